@@ -0,0 +1,87 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "omxcam.h"
+
+#define WIDTH 640
+#define HEIGHT 480
+
+int fd;
+
+int log_error (){
+  omxcam_perror ();
+  return 1;
+}
+
+void on_data (omxcam_buffer_t buffer){
+  //Append the buffer to the file
+  if (pwrite (fd, buffer.data, buffer.length, 0) == -1){
+    fprintf (stderr, "error: pwrite\n");
+  }
+}
+
+int main (){
+  omxcam_jpeg_settings_t settings;
+  
+  omxcam_jpeg_init (&settings);
+  settings.quality = 85;
+  
+  //A synthetic rgb image, the rows are not padded
+  uint8_t* pixels = malloc (WIDTH*HEIGHT*3);
+  if (!pixels){
+    fprintf (stderr, "error: malloc\n");
+    return 1;
+  }
+  
+  omxcam_image_t image;
+  image.format = OMXCAM_FORMAT_RGB888;
+  image.width = WIDTH;
+  image.height = HEIGHT;
+  image.planes[0] = pixels;
+  image.planes[1] = 0;
+  image.planes[2] = 0;
+  image.stride = 0;
+  
+  //The encoder is configured with the first image and reused with the others
+  int i;
+  for (i=0; i<5; i++){
+    int x;
+    int y;
+    for (y=0; y<HEIGHT; y++){
+      for (x=0; x<WIDTH; x++){
+        uint8_t* p = pixels + (y*WIDTH + x)*3;
+        p[0] = x*255/WIDTH;
+        p[1] = y*255/HEIGHT;
+        p[2] = i*60;
+      }
+    }
+    
+    char filename[32];
+    sprintf (filename, "image-%d.jpg", i);
+    printf ("encoding %s\n", filename);
+    
+    fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+    if (fd == -1){
+      fprintf (stderr, "error: open\n");
+      return 1;
+    }
+    
+    if (omxcam_jpeg_encode (&image, &settings, on_data)) return log_error ();
+    
+    //Close the file
+    if (close (fd)){
+      fprintf (stderr, "error: close\n");
+      return 1;
+    }
+  }
+  
+  if (omxcam_jpeg_encode_free ()) return log_error ();
+  
+  free (pixels);
+  
+  printf ("ok\n");
+  
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "omxcam.h"
+
+int log_error (){
+  omxcam_perror ();
+  return 1;
+}
+
+int save (char* filename, omxcam_still_settings_t* settings){
+  printf ("capturing %s\n", filename);
+  
+  int fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+  if (fd == -1){
+    fprintf (stderr, "error: open\n");
+    return 1;
+  }
+  
+  if (omxcam_still_start_npt (settings)) return log_error ();
+  omxcam_buffer_t buffer;
+  omxcam_bool end_of_image = OMXCAM_FALSE;
+  
+  while (!end_of_image){
+    //When read() is called, the current thread is locked until a slice of the
+    //image is ready or an error occurs
+    if (omxcam_still_read_npt (&buffer, &end_of_image)) return log_error ();
+    
+    //Append the slice to the file
+    if (pwrite (fd, buffer.data, buffer.length, 0) == -1){
+      fprintf (stderr, "error: pwrite\n");
+      if (omxcam_still_stop_npt ()) log_error ();
+      return 1;
+    }
+  }
+  
+  if (omxcam_still_stop_npt ()) return log_error ();
+  
+  //Close the file
+  if (close (fd)){
+    fprintf (stderr, "error: close\n");
+    return 1;
+  }
+  
+  return 0;
+}
+
+int main (){
+  omxcam_still_settings_t settings;
+  
+  //Capture a jpeg image, 2592x1944 by default
+  omxcam_still_init (&settings);
+  
+  if (save ("still.jpg", &settings)) return 1;
+  
+  printf ("ok\n");
+  
+  return 0;
+}
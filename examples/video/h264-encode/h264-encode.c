@@ -0,0 +1,98 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "omxcam.h"
+
+#define WIDTH 640
+#define HEIGHT 480
+#define FRAMERATE 30
+
+int fd;
+
+int log_error (){
+  omxcam_perror ();
+  return 1;
+}
+
+void on_data (omxcam_buffer_t buffer){
+  //Append the buffer to the file
+  if (pwrite (fd, buffer.data, buffer.length, 0) == -1){
+    fprintf (stderr, "error: pwrite\n");
+  }
+}
+
+int main (){
+  omxcam_encode_settings_t settings;
+  
+  //Encode 90 synthetic frames, 640x480 @30fps
+  //Play it with: ffplay -f h264 video.h264
+  omxcam_encode_init (&settings);
+  settings.width = WIDTH;
+  settings.height = HEIGHT;
+  settings.framerate = FRAMERATE;
+  settings.h264.bitrate = 2000000;
+  settings.on_data = on_data;
+  
+  uint8_t* y = malloc (WIDTH*HEIGHT);
+  uint8_t* u = malloc (WIDTH*HEIGHT/4);
+  uint8_t* v = malloc (WIDTH*HEIGHT/4);
+  if (!y || !u || !v){
+    fprintf (stderr, "error: malloc\n");
+    return 1;
+  }
+  
+  omxcam_yuv_frame_t frame;
+  frame.y = y;
+  frame.u = u;
+  frame.v = v;
+  frame.stride = 0;
+  
+  printf ("encoding video.h264\n");
+  
+  fd = open ("video.h264", O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+  if (fd == -1){
+    fprintf (stderr, "error: open\n");
+    return 1;
+  }
+  
+  if (omxcam_encode_start (&settings)) return log_error ();
+  
+  int i;
+  int row;
+  for (i=0; i<90; i++){
+    //A horizontal gradient that moves to the right
+    for (row=0; row<HEIGHT; row++){
+      int col;
+      for (col=0; col<WIDTH; col++){
+        y[row*WIDTH + col] = (col + i*4)%256;
+      }
+    }
+    memset (u, 128 + i, WIDTH*HEIGHT/4);
+    memset (v, 128 - i, WIDTH*HEIGHT/4);
+    
+    //The buffer is copied, the frame can be reused after this call
+    if (omxcam_encode_frame (&frame, (int64_t)i*1000000/FRAMERATE)){
+      log_error ();
+      break;
+    }
+  }
+  
+  if (omxcam_encode_stop ()) return log_error ();
+  
+  free (y);
+  free (u);
+  free (v);
+  
+  //Close the file
+  if (close (fd)){
+    fprintf (stderr, "error: close\n");
+    return 1;
+  }
+  
+  printf ("ok\n");
+  
+  return 0;
+}
\ No newline at end of file
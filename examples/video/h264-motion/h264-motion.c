@@ -23,6 +23,23 @@ void on_motion (omxcam_buffer_t buffer){
   if (pwrite (fd_motion, buffer.data, buffer.length, 0) == -1){
     fprintf (stderr, "error: pwrite (motion)\n");
     if (omxcam_video_stop ()) log_error ();
+    return;
+  }
+  
+  omxcam_motion_field_t field;
+  omxcam_motion_summary_t summary;
+  omxcam_motion_threshold_t threshold = { 4, 0 };
+  
+  if (omxcam_motion_field (buffer, 640, 480, &field)){
+    log_error ();
+    return;
+  }
+  
+  omxcam_motion_summarize (&field, &threshold, &summary);
+  
+  if (summary.moving){
+    printf ("motion: %d macroblocks, box %dx%d at (%d, %d)\n", summary.moving,
+        summary.box.width, summary.box.height, summary.box.x, summary.box.y);
   }
 }
 
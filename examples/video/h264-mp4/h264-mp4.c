@@ -0,0 +1,53 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "omxcam.h"
+
+int fd;
+
+int log_error (){
+  omxcam_perror ();
+  return 1;
+}
+
+void on_data (omxcam_buffer_t buffer){
+  //Append the mp4 data to the file
+  if (pwrite (fd, buffer.data, buffer.length, 0) == -1){
+    fprintf (stderr, "error: pwrite\n");
+    if (omxcam_video_stop ()) log_error ();
+  }
+}
+
+int main (){
+  omxcam_video_settings_t settings;
+  
+  //Capture a video of ~5000ms, 1280x720 @30fps with a keyframe every second,
+  //each second is a fragment
+  omxcam_video_init (&settings);
+  settings.format = OMXCAM_FORMAT_H264_MP4;
+  settings.on_data = on_data;
+  settings.camera.width = 1280;
+  settings.camera.height = 720;
+  settings.h264.idr_period = 30;
+  
+  printf ("capturing video.mp4\n");
+  
+  fd = open ("video.mp4", O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+  if (fd == -1){
+    fprintf (stderr, "error: open\n");
+    return 1;
+  }
+  
+  if (omxcam_video_start (&settings, 5000)) return log_error ();
+  
+  //Close the file
+  if (close (fd)){
+    fprintf (stderr, "error: close\n");
+    return 1;
+  }
+  
+  printf ("ok\n");
+  
+  return 0;
+}
\ No newline at end of file
@@ -41,6 +41,9 @@ void on_data (omxcam_buffer_t buffer){
       //manually if you want to stop recording
       if (omxcam_video_update_saturation (100)) log_error ();
       if (omxcam_video_update_mirror (OMXCAM_MIRROR_HORIZONTAL)) log_error ();
+      //Halve the bitrate and start the new segment with an IDR frame
+      if (omxcam_video_update_h264_bitrate (8500000)) log_error ();
+      if (omxcam_video_request_h264_idr ()) log_error ();
     }
   }else{
     if (ms >= stop){
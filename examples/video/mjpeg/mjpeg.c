@@ -0,0 +1,60 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "omxcam.h"
+
+int fd;
+uint32_t frames = 0;
+
+int log_error (){
+  omxcam_perror ();
+  return 1;
+}
+
+void on_data (omxcam_buffer_t buffer){
+  //Each frame is a complete jpeg image, the last buffer of the image has the
+  //end of frame flag
+  if (buffer.flags & OMXCAM_BUFFER_END_OF_FRAME) frames++;
+  
+  //Append the buffer to the file
+  if (pwrite (fd, buffer.data, buffer.length, 0) == -1){
+    fprintf (stderr, "error: pwrite\n");
+    if (omxcam_video_stop ()) log_error ();
+  }
+}
+
+int main (){
+  omxcam_video_settings_t settings;
+  
+  //Capture a video of ~3000ms, 640x480 @15fps
+  //Play it with: ffplay -f mjpeg video.mjpeg
+  omxcam_video_init (&settings);
+  settings.format = OMXCAM_FORMAT_MJPEG;
+  settings.on_data = on_data;
+  settings.camera.width = 640;
+  settings.camera.height = 480;
+  settings.camera.framerate = 15;
+  settings.mjpeg.quality = 80;
+  
+  printf ("capturing video.mjpeg\n");
+  
+  fd = open ("video.mjpeg", O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+  if (fd == -1){
+    fprintf (stderr, "error: open\n");
+    return 1;
+  }
+  
+  if (omxcam_video_start (&settings, 3000)) return log_error ();
+  
+  //Close the file
+  if (close (fd)){
+    fprintf (stderr, "error: close\n");
+    return 1;
+  }
+  
+  printf ("frames: %d\n", frames);
+  printf ("ok\n");
+  
+  return 0;
+}
\ No newline at end of file
@@ -6,14 +6,17 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <pthread.h>
 #include <IL/OMX_Broadcom.h>
 
 #include "omxcam_version.h"
 
 #if __GNUC__ >= 4
 # define OMXCAM_EXTERN __attribute__ ((visibility ("default")))
+# define OMXCAM_ALIGNED(n) __attribute__ ((aligned (n)))
 #else
 # define OMXCAM_EXTERN //Empty
+# define OMXCAM_ALIGNED(n) //Empty
 #endif
 
 //Error definitions, expand if necessary
@@ -56,7 +59,14 @@ extern "C" {
   X (30, ERROR_LOCK, "cannot lock the thread")                                 \
   X (31, ERROR_UNLOCK, "cannot unlock the thread")                             \
   X (32, ERROR_NO_PTHREAD, "capture started in 'no pthread' mode")             \
-  X (33, ERROR_NOT_NO_PTHREAD, "capture started not in 'no pthread' mode")
+  X (33, ERROR_NOT_NO_PTHREAD, "capture started not in 'no pthread' mode")     \
+  X (34, ERROR_ASYNC, "asynchronous operation error")                          \
+  X (35, ERROR_STILL_ONLY, "action can be executed only in still mode")        \
+  X (36, ERROR_MEMORY, "not enough memory")                                    \
+  X (37, ERROR_DVR, "recorded video not available")                            \
+  X (38, ERROR_SEGMENTER, "cannot write the segments")                         \
+  X (39, ERROR_NETWORK, "network error")                                       \
+  X (40, ERROR_ENCODER_NOT_RUNNING, "encoder is not running")
 
 #define OMXCAM_ISO_MAP_LENGTH 10
 #define OMXCAM_ISO_MAP(X)                                                      \
@@ -157,6 +167,13 @@ extern "C" {
   X (H264_AVC_PROFILE_MAIN, OMX_VIDEO_AVCProfileMain)                          \
   X (H264_AVC_PROFILE_HIGH, OMX_VIDEO_AVCProfileHigh)
 
+#define OMXCAM_H264_INTRA_REFRESH_MAP_LENGTH 4
+#define OMXCAM_H264_INTRA_REFRESH_MAP(X)                                       \
+  X (H264_INTRA_REFRESH_CYCLIC, OMX_VIDEO_IntraRefreshCyclic)                  \
+  X (H264_INTRA_REFRESH_ADAPTIVE, OMX_VIDEO_IntraRefreshAdaptive)              \
+  X (H264_INTRA_REFRESH_BOTH, OMX_VIDEO_IntraRefreshBoth)                      \
+  X (H264_INTRA_REFRESH_CYCLIC_ROWS, OMX_VIDEO_IntraRefreshCyclicMrows)
+
 #define OMXCAM_SHUTTER_SPEED_AUTO 0
 #define OMXCAM_JPEG_THUMBNAIL_WIDTH_AUTO 0
 #define OMXCAM_JPEG_THUMBNAIL_HEIGHT_AUTO 0
@@ -166,6 +183,24 @@ extern "C" {
 //Handy way to sleep forever while recording a video
 #define OMXCAM_CAPTURE_FOREVER 0
 
+//Maximum size of the SPS and PPS of the h264 stream
+#define OMXCAM_H264_PARAMETER_SETS_SIZE 512
+
+//Maximum size of the SEI messages attached to a frame
+#define OMXCAM_H264_SEI_SIZE 4096
+
+//MPEG-TS packets are emitted in chunks of 7 packets, 1316 bytes, the maximum
+//number of packets that fit in an UDP datagram
+#define OMXCAM_TS_PACKET_SIZE 188
+#define OMXCAM_TS_CHUNK_PACKETS 7
+
+//Maximum number of RTP destinations and RTSP connections
+#define OMXCAM_RTP_MAX_CLIENTS 8
+#define OMXCAM_RTSP_MAX_CONNECTIONS 8
+
+//Bytes of the header of the raw bayer data that describe the image
+#define OMXCAM_RAW_INFO_LENGTH 256
+
 typedef enum {
   OMXCAM_FALSE,
   OMXCAM_TRUE
@@ -176,7 +211,10 @@ typedef enum {
   OMXCAM_FORMAT_RGBA8888,
   OMXCAM_FORMAT_YUV420,
   OMXCAM_FORMAT_JPEG,
-  OMXCAM_FORMAT_H264
+  OMXCAM_FORMAT_H264,
+  OMXCAM_FORMAT_H264_MP4,
+  OMXCAM_FORMAT_H264_TS,
+  OMXCAM_FORMAT_MJPEG
 } omxcam_format;
 
 #define OMXCAM_ENUM_FN(name, value)                                            \
@@ -218,6 +256,10 @@ typedef enum {
   OMXCAM_H264_AVC_PROFILE_MAP (OMXCAM_ENUM_FN)
 } omxcam_avc_profile;
 
+typedef enum {
+  OMXCAM_H264_INTRA_REFRESH_MAP (OMXCAM_ENUM_FN)
+} omxcam_intra_refresh_mode;
+
 #undef OMXCAM_ENUM_FN
 
 #define OMXCAM_ENUM_FN(errno, name, _)                                         \
@@ -229,11 +271,46 @@ typedef enum {
 
 #undef OMXCAM_ENUM_FN
 
+typedef enum {
+  OMXCAM_BUFFER_END_OF_FRAME = 0x01,
+  OMXCAM_BUFFER_END_OF_NAL = 0x02,
+  OMXCAM_BUFFER_KEYFRAME = 0x04,
+  OMXCAM_BUFFER_CODEC_CONFIG = 0x08,
+  OMXCAM_BUFFER_MOTION_VECTORS = 0x10,
+  OMXCAM_BUFFER_END_OF_STREAM = 0x20
+} omxcam_buffer_flag;
+
 typedef struct {
   uint8_t* data;
   uint32_t length;
+  //Bitmask of omxcam_buffer_flag values
+  uint32_t flags;
+  //Presentation time in microseconds, -1 if it's unknown
+  int64_t timestamp;
 } omxcam_buffer_t;
 
+typedef struct {
+  //Number of the frame since the video was started, starting at 0
+  uint32_t sequence;
+  //Presentation time in microseconds, -1 if it's unknown
+  int64_t timestamp;
+  omxcam_bool keyframe;
+  //Access unit, the parameter sets and the SEI NAL units are included
+  omxcam_buffer_t data;
+  //Motion vectors of the frame, empty if they are not available
+  omxcam_buffer_t motion;
+} omxcam_frame_t;
+
+typedef struct {
+  omxcam_errno error;
+  //Name of the OpenMAX IL call that failed, e.g.
+  //"OMX_SetConfig - OMX_IndexConfigCommonExposureValue", null if none failed
+  const char* omx_call;
+  OMX_ERRORTYPE omx_error;
+  //Name of the component, e.g. "OMX.broadcom.camera", null if not applicable
+  const char* component;
+} omxcam_error_details_t;
+
 typedef struct {
   omxcam_bool enabled;
   uint32_t u;
@@ -314,6 +391,10 @@ typedef struct {
   omxcam_bool raw_bayer;
 } omxcam_jpeg_settings_t;
 
+typedef struct {
+  uint32_t quality;
+} omxcam_mjpeg_settings_t;
+
 typedef struct {
   omxcam_bool enabled;
   uint32_t loss_rate;
@@ -325,17 +406,72 @@ typedef struct {
   uint32_t p;
 } omxcam_quantization_t;
 
+typedef struct {
+  omxcam_bool enabled;
+  uint32_t min;
+  uint32_t max;
+} omxcam_quantization_bounds_t;
+
+typedef struct {
+  omxcam_bool enabled;
+  uint32_t min_bitrate;
+  uint32_t max_bitrate;
+  uint32_t target_latency;
+  uint32_t reaction_time;
+} omxcam_rate_control_t;
+
+typedef struct {
+  omxcam_bool enabled;
+  omxcam_intra_refresh_mode mode;
+  //Macroblocks refreshed per frame, macroblock rows with the CYCLIC_ROWS mode
+  uint32_t macroblocks;
+} omxcam_intra_refresh_t;
+
 typedef struct {
   uint32_t bitrate;
   uint32_t idr_period;
   omxcam_bool sei;
   omxcam_eede_t eede;
   omxcam_quantization_t qp;
+  //Bounds of the quantization parameters chosen by the rate control
+  omxcam_quantization_bounds_t qp_bounds;
   omxcam_avc_profile profile;
   omxcam_bool inline_headers;
   omxcam_bool inline_motion_vectors;
+  omxcam_rate_control_t rate_control;
+  omxcam_intra_refresh_t intra_refresh;
+  //Each slice is emitted as soon as it's encoded instead of the whole frame
+  omxcam_bool low_latency;
+  //Macroblock rows per slice, 0 for one slice per frame
+  uint32_t slice_rows;
+  //Measures the delay of the buffers, see omxcam_video_get_latency()
+  omxcam_bool measure_latency;
 } omxcam_h264_settings_t;
 
+typedef struct {
+  //Number of frames that have been measured
+  uint32_t frames;
+  //Delays of the first and the last buffer of the last frame in microseconds
+  uint32_t first;
+  uint32_t last;
+  //Delays of the last buffer of all the frames
+  uint32_t min;
+  uint32_t max;
+  uint32_t mean;
+} omxcam_latency_t;
+
+typedef struct {
+  //Number of frames and keyframes
+  uint32_t frames;
+  uint32_t keyframes;
+  //Sizes in bytes of the last frame and of all the frames
+  uint32_t last;
+  uint32_t min;
+  uint32_t max;
+  uint32_t mean;
+  uint32_t deviation;
+} omxcam_frame_stats_t;
+
 #define OMXCAM_COMMON_SETTINGS                                                 \
   omxcam_camera_settings_t camera;                                             \
   omxcam_format format;                                                        \
@@ -353,10 +489,517 @@ typedef struct {
 typedef struct {
   OMXCAM_COMMON_SETTINGS
   omxcam_h264_settings_t h264;
+  omxcam_mjpeg_settings_t mjpeg;
+  //Called with each encoded frame and its motion vectors (h264 only)
+  void (*on_frame)(omxcam_frame_t frame);
 } omxcam_video_settings_t;
 
 #undef OMXCAM_COMMON_SETTINGS
 
+#define OMXCAM_ENCODE_MAX_BUFFERS 8
+
+typedef struct {
+  uint32_t width;
+  uint32_t height;
+  uint32_t framerate;
+  //Input buffers, a frame can be copied while the previous ones are encoded
+  uint32_t buffers;
+  omxcam_h264_settings_t h264;
+  void (*on_data)(omxcam_buffer_t buffer);
+} omxcam_encode_settings_t;
+
+typedef struct {
+  uint8_t* y;
+  uint8_t* u;
+  uint8_t* v;
+  //Bytes per row of the y plane, half for the u and v planes. 0 is the width
+  uint32_t stride;
+} omxcam_yuv_frame_t;
+
+typedef struct {
+  //OMXCAM_FORMAT_YUV420, OMXCAM_FORMAT_RGB888 or OMXCAM_FORMAT_RGBA8888
+  omxcam_format format;
+  uint32_t width;
+  uint32_t height;
+  //The y, u and v planes or only the pixels with the rgb formats
+  uint8_t* planes[3];
+  //Bytes per row of the first plane, half for the u and v planes. 0 if the
+  //rows are not padded
+  uint32_t stride;
+} omxcam_image_t;
+
+typedef struct {
+  //TIFF tag, e.g. 0x0132 (DateTime) or 0x9003 (DateTimeOriginal)
+  uint16_t tag;
+  char* value;
+} omxcam_exif_entry_t;
+
+typedef struct {
+  //Offset from the beginning of the edited jpeg, 0 if there's no thumbnail
+  uint32_t offset;
+  uint32_t length;
+  //Valid until the next image is fed
+  uint8_t* data;
+} omxcam_exif_thumbnail_t;
+
+typedef struct {
+  //Called with the edited jpeg
+  void (*on_data)(omxcam_buffer_t buffer);
+  //Called when the header of an image is received, before it's emitted. The
+  //entries, the segment and 'replace' can be updated here
+  void (*on_header)();
+  //ASCII tags of the exif of the encoder that are overwritten in place
+  omxcam_exif_entry_t* entries;
+  uint32_t valid_entries;
+  //Complete segment (marker, length and payload) inserted after the APPn
+  //segments of the encoder
+  uint8_t* segment;
+  uint32_t segment_length;
+  //Removes the exif of the encoder
+  omxcam_bool replace;
+  //Thumbnail of the current image
+  omxcam_exif_thumbnail_t thumbnail;
+  //Private fields
+  int state;
+  uint8_t* header;
+  uint32_t header_length;
+  uint32_t header_size;
+  uint32_t position;
+} omxcam_exif_editor_t;
+
+typedef enum {
+  OMXCAM_BAYER_RGGB,
+  OMXCAM_BAYER_GBRG,
+  OMXCAM_BAYER_BGGR,
+  OMXCAM_BAYER_GRBG
+} omxcam_bayer_order;
+
+typedef struct {
+  uint32_t width;
+  uint32_t height;
+  omxcam_bayer_order order;
+  //10-bit samples, 'width' per row
+  uint16_t* data;
+} omxcam_raw_image_t;
+
+typedef struct {
+  //Called when the raw image is complete, the data is valid until the next
+  //image
+  void (*on_raw)(omxcam_raw_image_t image);
+  //Private fields
+  int state;
+  uint32_t match;
+  uint8_t header[OMXCAM_RAW_INFO_LENGTH];
+  uint32_t header_length;
+  uint8_t* row;
+  uint32_t row_size;
+  uint32_t row_length;
+  uint32_t row_index;
+  uint32_t stride;
+  uint32_t size;
+  omxcam_raw_image_t image;
+} omxcam_raw_t;
+
+#define OMXCAM_BRACKET_MAX_SHOTS 8
+
+typedef struct {
+  //Microseconds, 0 is automatic
+  uint32_t shutter_speed;
+  //[-24, 24], 1/6 EV steps
+  int32_t exposure_compensation;
+} omxcam_bracket_shot_t;
+
+typedef struct {
+  //Settings of the pipeline, only the yuv420 format is supported
+  omxcam_still_settings_t still;
+  omxcam_bracket_shot_t shots[OMXCAM_BRACKET_MAX_SHOTS];
+  uint32_t valid_shots;
+  //Called with each slice of each shot, the last slice of a shot has the
+  //OMXCAM_BUFFER_END_OF_STREAM flag
+  void (*on_data)(uint32_t shot, omxcam_buffer_t buffer);
+} omxcam_bracket_settings_t;
+
+typedef struct {
+  //Called with each merged slice
+  void (*on_data)(omxcam_buffer_t buffer);
+  //Private fields
+  uint32_t frames;
+  uint32_t stride;
+  uint32_t slices;
+  uint32_t slice_length;
+  uint32_t frame_length;
+  uint32_t frame;
+  uint32_t offset;
+  uint8_t* store;
+  uint8_t* slice;
+  uint8_t* out;
+  uint32_t* weights;
+  uint32_t* reciprocal;
+} omxcam_hdr_t;
+
+typedef enum {
+  OMXCAM_NAL_SLICE = 1,
+  OMXCAM_NAL_SLICE_DPA = 2,
+  OMXCAM_NAL_SLICE_DPB = 3,
+  OMXCAM_NAL_SLICE_DPC = 4,
+  OMXCAM_NAL_IDR = 5,
+  OMXCAM_NAL_SEI = 6,
+  OMXCAM_NAL_SPS = 7,
+  OMXCAM_NAL_PPS = 8,
+  OMXCAM_NAL_AUD = 9,
+  OMXCAM_NAL_END_OF_SEQUENCE = 10,
+  OMXCAM_NAL_END_OF_STREAM = 11,
+  OMXCAM_NAL_FILLER = 12
+} omxcam_nal_type;
+
+typedef struct {
+  //NAL unit without the start code, data[0] is the header
+  uint8_t* data;
+  uint32_t length;
+  //nal_unit_type, one of omxcam_nal_type (0-31)
+  uint8_t type;
+  //nal_ref_idc, 0 if the NAL unit is not used as a reference
+  uint8_t ref_idc;
+  //first_mb_in_slice of the slices, 0 otherwise
+  uint32_t first_mb;
+} omxcam_nal_t;
+
+typedef struct {
+  //Private fields
+  uint8_t* current;
+  uint8_t* end;
+  int end_of_nal;
+  int at_nal;
+  int in_nal;
+  uint32_t zeros;
+  int carry_ready;
+  int carry_emitted;
+  uint8_t* carry;
+  uint32_t carry_length;
+  uint32_t carry_size;
+} omxcam_nal_parser_t;
+
+typedef struct {
+  //Called with the muxed data
+  void (*on_data)(omxcam_buffer_t buffer);
+  //A fragment is emitted at each IDR frame or when the size of its data
+  //reaches this limit
+  uint32_t max_fragment_size;
+  //Private fields
+  omxcam_nal_parser_t parser;
+  uint8_t sps[256];
+  uint32_t sps_length;
+  uint8_t pps[256];
+  uint32_t pps_length;
+  int header_written;
+  uint32_t sequence;
+  int64_t buffer_time;
+  int64_t origin;
+  int64_t last_time;
+  uint32_t last_duration;
+  int frame_open;
+  int frame_slice;
+  int frame_sync;
+  int64_t frame_time;
+  uint32_t frame_start;
+  uint8_t* mdat;
+  uint32_t mdat_length;
+  uint32_t mdat_size;
+  uint8_t* moof;
+  uint32_t moof_size;
+  uint32_t* sample_sizes;
+  int64_t* sample_times;
+  uint8_t* sample_sync;
+  uint32_t samples;
+  uint32_t samples_size;
+  int stopped;
+} omxcam_mp4_t;
+
+typedef struct {
+  //Called with the muxed data, a multiple of OMXCAM_TS_PACKET_SIZE bytes
+  void (*on_data)(omxcam_buffer_t buffer);
+  //Private fields
+  //The packets are written in place, the chunk is aligned for the socket and
+  //file writes. Use posix_memalign() if the struct is allocated in the heap
+  uint8_t chunk[OMXCAM_TS_PACKET_SIZE*OMXCAM_TS_CHUNK_PACKETS]
+      OMXCAM_ALIGNED (16);
+  uint32_t packets;
+  uint32_t payload_length;
+  int packet_start;
+  int packet_random_access;
+  int64_t packet_pcr;
+  uint8_t continuity[3];
+  int frame_open;
+  int tables_written;
+  int64_t last_time;
+  uint32_t last_duration;
+  uint8_t config[512];
+  uint32_t config_length;
+  int stopped;
+} omxcam_ts_t;
+
+typedef struct {
+  uint64_t position;
+  uint32_t length;
+  int64_t timestamp;
+  int keyframe;
+  //Length of the parameter sets stored in the ring before an IDR frame
+  uint32_t config_length;
+} omxcam_dvr_frame_t;
+
+typedef struct {
+  //Private fields
+  pthread_mutex_t mutex;
+  uint8_t* arena;
+  uint32_t size;
+  uint64_t head;
+  omxcam_dvr_frame_t* frames;
+  uint32_t capacity;
+  uint64_t first;
+  uint64_t next;
+  int frame_open;
+  int64_t last_timestamp;
+  uint8_t config[512];
+  uint32_t config_length;
+  int config_complete;
+  uint8_t* scratch;
+  int dumping;
+} omxcam_dvr_t;
+
+typedef struct {
+  //Path of the segments, a printf format with the number of the segment, e.g.
+  //"/tmp/video-%05d.ts"
+  const char* path;
+  //Path of the m3u8 playlist, NULL if not needed. The segments must be in the
+  //same directory
+  const char* playlist;
+  //Number of segments in the playlist, 0 to include all of them
+  uint32_t playlist_size;
+  //A new segment begins at the first IDR frame after this duration (ms) or
+  //size (bytes, 0 to disable)
+  uint32_t duration;
+  uint32_t max_size;
+  //Bytes reserved in the disk for each segment, 0 to disable
+  uint32_t preallocate;
+  //Size of the queue between the capture and the writer thread
+  uint32_t queue_size;
+  //Private fields
+  omxcam_ts_t ts;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint8_t* queue;
+  uint64_t queue_head;
+  uint64_t queue_tail;
+  int stopping;
+  int error;
+  int dropped;
+  uint64_t drop_position;
+  uint8_t config[512];
+  uint32_t config_length;
+  int config_open;
+  int frame_open;
+  int segment_open;
+  uint32_t segment;
+  uint32_t segment_size;
+  int64_t segment_start;
+  int64_t last_timestamp;
+  int64_t last_duration;
+  int fd;
+  uint32_t written;
+  uint32_t* durations;
+  uint32_t segments;
+  uint32_t segments_size;
+} omxcam_segmenter_t;
+
+typedef struct {
+  //Maximum size of the RTP packets (UDP payload)
+  uint32_t mtu;
+  //Dynamic payload type
+  uint8_t payload_type;
+  //Called by omxcam_rtp_feed() when a client has been added, from the thread
+  //that feeds the buffers, e.g. to request an IDR frame
+  void (*on_client)();
+  //Private fields
+  omxcam_nal_parser_t parser;
+  pthread_mutex_t mutex;
+  int fd;
+  uint16_t port;
+  uint32_t client_addresses[OMXCAM_RTP_MAX_CLIENTS];
+  uint16_t client_ports[OMXCAM_RTP_MAX_CLIENTS];
+  uint32_t clients;
+  uint16_t sequence;
+  uint32_t ssrc;
+  uint32_t timestamp;
+  uint32_t timestamp_offset;
+  int64_t last_time;
+  int frame_open;
+  int fast_start;
+  uint8_t sps[256];
+  uint32_t sps_length;
+  uint8_t pps[256];
+  uint32_t pps_length;
+  void* batch;
+} omxcam_rtp_t;
+
+typedef struct {
+  //Local address and port of the RTSP server
+  const char* address;
+  uint16_t port;
+  //Private fields
+  omxcam_rtp_t* rtp;
+  int fd;
+  int stop_fd;
+  pthread_t thread;
+  void* connections;
+} omxcam_rtsp_t;
+
+typedef struct {
+  //Same layout as the records of the motion vector buffers
+  int8_t x;
+  int8_t y;
+  uint16_t sad;
+} omxcam_motion_vector_t;
+
+typedef struct {
+  //'rows' rows of 'stride' vectors, the last vector of each row is not a
+  //macroblock
+  omxcam_motion_vector_t* vectors;
+  uint32_t cols;
+  uint32_t rows;
+  uint32_t stride;
+} omxcam_motion_field_t;
+
+typedef struct {
+  //A macroblock is moving if the length of its vector is at least 'magnitude'
+  //and its SAD is at least 'sad'
+  uint32_t magnitude;
+  uint32_t sad;
+} omxcam_motion_threshold_t;
+
+typedef struct {
+  //Region in macroblocks
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+} omxcam_motion_box_t;
+
+typedef struct {
+  int64_t x;
+  int64_t y;
+  //Sum of the squared lengths
+  uint64_t magnitude;
+  uint64_t sad;
+} omxcam_motion_sum_t;
+
+typedef struct {
+  //Number of moving macroblocks
+  uint32_t moving;
+  //Bounding box of the moving macroblocks, empty if there are none
+  omxcam_motion_box_t box;
+  //Mean vector of the moving macroblocks
+  float mean_x;
+  float mean_y;
+  //Mean SAD of all the macroblocks
+  float mean_sad;
+} omxcam_motion_summary_t;
+
+typedef enum {
+  OMXCAM_MOTION_START,
+  OMXCAM_MOTION_STOP
+} omxcam_motion_event_type;
+
+typedef struct {
+  omxcam_motion_event_type type;
+  //Bounding box of the motion, since the start of the event
+  omxcam_motion_box_t box;
+  //Fraction of the region of interest that is moving [0, 1], the maximum
+  //since the start of the event
+  float score;
+  //Timestamp of the motion vectors, -1 if it's unknown
+  int64_t timestamp;
+} omxcam_motion_event_t;
+
+typedef struct {
+  //Pixel coordinates
+  uint32_t x;
+  uint32_t y;
+} omxcam_motion_point_t;
+
+typedef struct {
+  omxcam_motion_threshold_t threshold;
+  //Minimum number of connected moving macroblocks
+  uint32_t min_blob;
+  //Consecutive frames with and without motion that start and stop an event
+  uint32_t start_frames;
+  uint32_t stop_frames;
+  void (*on_event)(omxcam_motion_event_t event);
+  //Private fields
+  uint32_t width;
+  uint32_t height;
+  uint32_t cols;
+  uint32_t rows;
+  uint8_t* roi;
+  uint32_t roi_size;
+  int roi_default;
+  uint8_t* mask;
+  uint32_t* stack;
+  int active;
+  uint32_t frames;
+  omxcam_motion_box_t box;
+  float score;
+} omxcam_motion_detector_t;
+
+typedef struct {
+  //Wait for the motion vectors after the end of each frame
+  omxcam_bool motion;
+  void (*on_frame)(omxcam_frame_t frame);
+  //Private fields
+  uint32_t sequence;
+  int64_t timestamp;
+  uint32_t flags;
+  int started;
+  int complete;
+  uint8_t* data;
+  uint32_t length;
+  uint32_t size;
+  uint8_t* spare;
+  uint32_t spare_size;
+  int stopped;
+} omxcam_framer_t;
+
+typedef struct {
+  uint8_t profile;
+  uint8_t constraints;
+  uint8_t level;
+  uint32_t id;
+  uint32_t chroma_format;
+  uint32_t bit_depth;
+  uint32_t width;
+  uint32_t height;
+  uint32_t max_frame_num;
+  omxcam_bool frame_mbs_only;
+  //VUI timing, 0 if not present. fps = time_scale/(2*num_units_in_tick)
+  uint32_t num_units_in_tick;
+  uint32_t time_scale;
+} omxcam_sps_t;
+
+typedef enum {
+  //The video is ready, 'on_data' is being called
+  OMXCAM_ASYNC_START,
+  //The video has been stopped or the image has been captured
+  OMXCAM_ASYNC_STOP
+} omxcam_async_event;
+
+typedef struct {
+  omxcam_async_event event;
+  //0 if the operation succeeded, -1 otherwise
+  int code;
+  //The last error of the worker thread
+  omxcam_errno error;
+} omxcam_async_result_t;
+
 /*
  * Returns the string name of the given error. Returns NULL if the error is not
  * valid.
@@ -369,10 +1012,21 @@ OMXCAM_EXTERN const char* omxcam_error_name (omxcam_errno error);
 OMXCAM_EXTERN const char* omxcam_strerror (omxcam_errno error);
 
 /*
- * Returns the last error, if any.
+ * Returns the last error of the current thread, if any. The error state is
+ * thread-local, so the errors produced by a function called from one thread
+ * (e.g. omxcam_video_update_*()) don't overwrite the errors produced by another
+ * thread. An error produced while capturing in the background thread is
+ * reported to the thread that called omxcam_video_start().
  */
 OMXCAM_EXTERN omxcam_errno omxcam_last_error ();
 
+/*
+ * Same as 'omxcam_last_error()' but also returns the OpenMAX IL call that
+ * failed, the OMX_ERRORTYPE it returned and the component that received it.
+ * 'omx_call' is null if the last error wasn't caused by an OpenMAX IL call.
+ */
+OMXCAM_EXTERN void omxcam_last_error_details (omxcam_error_details_t* details);
+
 /*
  * Prints to stderr the last error in this way:
  *
@@ -482,7 +1136,9 @@ OMXCAM_EXTERN int omxcam_video_update_on_data (
 
 /*
  * Updates the camera settings. Can be only executed while the camera is running
- * and it's in video mode.
+ * and it's in video mode. The values that are equal to the current ones are
+ * not sent to the camera. The iso, the exposure compensation and the metering
+ * are written with a single call, without reading the current values.
  */
 OMXCAM_EXTERN int omxcam_video_update_sharpness (int32_t sharpness);
 OMXCAM_EXTERN int omxcam_video_update_contrast (int32_t contrast);
@@ -505,6 +1161,96 @@ OMXCAM_EXTERN int omxcam_video_update_roi (omxcam_roi_t* roi);
 OMXCAM_EXTERN int omxcam_video_update_frame_stabilisation (
     omxcam_bool frame_stabilisation);
 
+/*
+ * Updates the h264 encoder settings. Can be only executed while the video is
+ * running and encoded with h264. The encoder is not restarted.
+ *
+ * - bitrate: Target bitrate in bits per second, applied to the next encoded
+ *   frame. Only takes effect when the quantization parameters are not fixed
+ *   ('h264.qp.enabled').
+ * - idr_period: Number of frames between IDR frames, up to 65535.
+ *
+ * The quantization bounds ('h264.qp_bounds') are encoder parameters, they can
+ * only be set when the video is started.
+ *
+ * 'omxcam_video_request_h264_idr()' forces the next frame to be an IDR frame.
+ */
+OMXCAM_EXTERN int omxcam_video_update_h264_bitrate (uint32_t bitrate);
+OMXCAM_EXTERN int omxcam_video_update_h264_idr_period (uint32_t idr_period);
+OMXCAM_EXTERN int omxcam_video_request_h264_idr ();
+
+/*
+ * The last SPS and PPS produced by the encoder are cached, either with
+ * 'h264.inline_headers' or only at the beginning of the stream.
+ *
+ * 'omxcam_video_get_h264_parameter_sets()' copies them to 'data' (Annex B,
+ * with the start codes), which must have OMXCAM_H264_PARAMETER_SETS_SIZE
+ * bytes. 'length' is 0 if they haven't been produced yet.
+ *
+ * 'omxcam_video_add_h264_consumer()' prepares the stream for a consumer that
+ * joins in the middle of it, e.g. a new viewer or file. 'on_data' is called
+ * from the current thread with a OMXCAM_BUFFER_CODEC_CONFIG buffer that
+ * contains the parameter sets and the next frame is requested to be an IDR
+ * frame, so the consumer can start decoding at the next buffer with the
+ * OMXCAM_BUFFER_KEYFRAME flag instead of waiting 'h264.idr_period' frames.
+ */
+OMXCAM_EXTERN int omxcam_video_get_h264_parameter_sets (
+    uint8_t* data,
+    uint32_t* length);
+OMXCAM_EXTERN int omxcam_video_add_h264_consumer (
+    void (*on_data)(omxcam_buffer_t buffer));
+
+/*
+ * Attaches a "user data unregistered" SEI message to the next frame, e.g. the
+ * wall-clock time, the GPS position or the sensor gains. 'uuid' (16 bytes)
+ * identifies the format of 'data'. The messages added before the same frame
+ * are sent in a single SEI NAL unit, with the emulation prevention bytes.
+ *
+ * The SEI NAL unit is emitted as an additional buffer just before the first
+ * buffer of the frame (after the parameter sets), so it's also included by the
+ * muxers. The frame is not copied. It isn't supported in "no pthread" mode.
+ */
+OMXCAM_EXTERN int omxcam_video_add_h264_sei (
+    uint8_t* uuid,
+    uint8_t* data,
+    uint32_t length);
+
+/*
+ * Reports the state of the consumer of the h264 data to the rate control
+ * ('h264.rate_control'). 'queued' is the number of bytes that are waiting to be
+ * sent or written and 'drain_rate' is the number of bytes per second that the
+ * consumer is able to process, 0 if it's unknown. It should be called
+ * periodically, e.g. after each write.
+ *
+ * The rate control adjusts the bitrate of the encoder every
+ * 'reaction_time' ms between 'min_bitrate' and 'max_bitrate' in order to keep
+ * the queued data below 'target_latency' ms. The bitrate is decreased as fast
+ * as needed and increased in steps of 12.5%. If the drain rate is unknown, it's
+ * estimated from the growth of the queue.
+ */
+OMXCAM_EXTERN int omxcam_video_report_consumer (
+    uint32_t queued,
+    uint32_t drain_rate);
+
+/*
+ * Returns the delay between the capture of the frames and the moment their
+ * buffers are passed to 'on_data' ('h264.measure_latency'). The timestamps of
+ * the buffers come from the clock of the GPU, so the offset between both clocks
+ * is estimated as the smallest delay that has been seen and the delays are
+ * relative to the fastest frame. The difference between 'first' and 'last' is
+ * exact, it's the time saved by 'h264.low_latency' when the frame is split in
+ * slices ('h264.slice_rows').
+ */
+OMXCAM_EXTERN int omxcam_video_get_latency (omxcam_latency_t* latency);
+
+/*
+ * Returns the statistics of the size of the h264 frames since the video was
+ * started, the codec config buffers are not included. The ratio between 'max'
+ * and 'mean' and the standard deviation show the bitrate spikes of the IDR
+ * frames, which are avoided with 'h264.intra_refresh'.
+ */
+OMXCAM_EXTERN int omxcam_video_get_frame_stats (omxcam_frame_stats_t* stats);
+
 /*
  * Starts the video capture in "no pthread" mode. After this call the video
  * data is ready to be read.
@@ -538,6 +1284,653 @@ int omxcam_video_read_npt (
     omxcam_buffer_t* buffer,
     omxcam_bool* is_motion_vector);
 
+/*
+ * Reads the buffers until a whole h264 frame is available and returns it with
+ * its motion vectors if 'h264.inline_motion_vectors' is enabled. The frame is
+ * valid until the next read. Don't mix it with 'omxcam_video_read_npt()'.
+ */
+OMXCAM_EXTERN int omxcam_video_read_frame_npt (omxcam_frame_t* frame);
+
+/*
+ * Starts the image capture in "no pthread" mode. After this call the image
+ * data is ready to be read.
+ */
+OMXCAM_EXTERN int omxcam_still_start_npt (omxcam_still_settings_t* settings);
+
+/*
+ * Stops the image capture in "no pthread" mode. It can be called before the
+ * whole image has been read, the remaining data is discarded.
+ */
+OMXCAM_EXTERN int omxcam_still_stop_npt ();
+
+/*
+ * Fills a buffer with a slice of the image (jpeg or raw pixels). This is a
+ * blocking function, that is, the current thread is blocked until the buffer is
+ * filled. If an error occurs, the capture is stopped automatically.
+ *
+ * 'end_of_image' (null is allowed) is set to true when the buffer contains the
+ * last slice of the image. Further calls return an empty buffer, so the capture
+ * must be stopped with 'omxcam_still_stop_npt()'.
+ */
+OMXCAM_EXTERN int omxcam_still_read_npt (
+    omxcam_buffer_t* buffer,
+    omxcam_bool* end_of_image);
+
+/*
+ * Asynchronous versions of 'omxcam_video_start()' and 'omxcam_still_start()'.
+ * They validate the settings and return immediately. The OpenMAX IL
+ * initialization, the capture and the deinitialization are executed in an
+ * internal worker thread, so the current thread is never blocked. The settings
+ * are copied, but the memory they point to (e.g. the exif tags) must be valid
+ * until the capture finishes.
+ *
+ * The completion of each operation is notified with an
+ * 'omxcam_async_result_t' that is passed to 'on_complete' (null is allowed),
+ * which is called from the worker thread, and that can also be read with
+ * 'omxcam_async_read()' when 'omxcam_async_fd()' becomes readable:
+ *
+ * - Video: OMXCAM_ASYNC_START when the video is ready (or failed to start) and
+ *   OMXCAM_ASYNC_STOP when it has been stopped.
+ * - Still: OMXCAM_ASYNC_STOP when the image has been captured.
+ */
+OMXCAM_EXTERN int omxcam_video_start_async (
+    omxcam_video_settings_t* settings,
+    void (*on_complete)(omxcam_async_result_t result));
+OMXCAM_EXTERN int omxcam_still_start_async (
+    omxcam_still_settings_t* settings,
+    void (*on_complete)(omxcam_async_result_t result));
+
+/*
+ * Stops the video started with 'omxcam_video_start_async()' without blocking
+ * the current thread. If the video is still being initialized, it is stopped
+ * as soon as it is ready. The completion is notified with OMXCAM_ASYNC_STOP.
+ */
+OMXCAM_EXTERN int omxcam_stop_async ();
+
+/*
+ * Returns a file descriptor that becomes readable when an asynchronous
+ * operation completes. Add it to your event loop (poll, epoll, libuv, etc.)
+ * and call 'omxcam_async_read()' when it's readable. Don't read from it or
+ * close it.
+ */
+OMXCAM_EXTERN int omxcam_async_fd ();
+
+/*
+ * Returns the result of the oldest completed asynchronous operation. This
+ * function never blocks, it returns -1 with the error OMXCAM_ERROR_ASYNC if
+ * there are no pending results.
+ */
+OMXCAM_EXTERN int omxcam_async_read (omxcam_async_result_t* result);
+
+/*
+ * Zero-copy iterator of the NAL units of an h264 Annex-B stream. Feed each
+ * 'omxcam_buffer_t' received from the camera and call
+ * 'omxcam_nal_parser_next()' until it returns 0:
+ *
+ * omxcam_nal_parser_t parser;
+ * omxcam_nal_t nal;
+ *
+ * omxcam_nal_parser_init (&parser);
+ * ...
+ * //on_data
+ * if (omxcam_nal_parser_feed (&parser, buffer)) ...
+ * while ((r = omxcam_nal_parser_next (&parser, &nal)) == 1){
+ *   if (nal.type == OMXCAM_NAL_IDR) ...
+ * }
+ * ...
+ * omxcam_nal_parser_free (&parser);
+ *
+ * 'nal.data' points to the NAL unit header, the start code is not included,
+ * and it's valid until the next call to 'omxcam_nal_parser_next()' or
+ * 'omxcam_nal_parser_feed()'. It usually points inside the buffer, but the NAL
+ * units split across buffers are copied into an internal buffer. The end of the
+ * last NAL unit of a buffer is known with the OMXCAM_BUFFER_END_OF_NAL and
+ * OMXCAM_BUFFER_END_OF_FRAME flags, otherwise it's delayed until the next start
+ * code is found. 'omxcam_nal_parser_flush()' returns it at the end of the
+ * stream.
+ *
+ * 'omxcam_nal_parser_next()' and 'omxcam_nal_parser_flush()' return 1 if a NAL
+ * unit is returned, 0 if there are no more NAL units and -1 on error.
+ */
+OMXCAM_EXTERN void omxcam_nal_parser_init (omxcam_nal_parser_t* parser);
+OMXCAM_EXTERN void omxcam_nal_parser_free (omxcam_nal_parser_t* parser);
+OMXCAM_EXTERN int omxcam_nal_parser_feed (
+    omxcam_nal_parser_t* parser,
+    omxcam_buffer_t buffer);
+OMXCAM_EXTERN int omxcam_nal_parser_next (
+    omxcam_nal_parser_t* parser,
+    omxcam_nal_t* nal);
+OMXCAM_EXTERN int omxcam_nal_parser_flush (
+    omxcam_nal_parser_t* parser,
+    omxcam_nal_t* nal);
+
+/*
+ * Returns the NAL unit found at the beginning of the given data (with or
+ * without start code) without copying it. Useful when a single NAL unit is
+ * stored in a buffer, e.g. a cached SPS.
+ */
+OMXCAM_EXTERN int omxcam_nal_view (
+    uint8_t* data,
+    uint32_t length,
+    omxcam_nal_t* nal);
+
+/*
+ * Parses a sequence parameter set NAL unit. The returned width and height are
+ * the cropped dimensions of the video.
+ */
+OMXCAM_EXTERN int omxcam_nal_parse_sps (omxcam_nal_t* nal, omxcam_sps_t* sps);
+
+/*
+ * Fragmented MP4 muxer of an h264 stream. The output can be played while it's
+ * being written, e.g. saved to a file or sent to the Media Source Extensions of
+ * a browser. Feed each 'omxcam_buffer_t' received from the camera, the muxed
+ * data is written to 'on_data':
+ *
+ * omxcam_mp4_t mp4;
+ *
+ * omxcam_mp4_init (&mp4, on_mp4_data);
+ * ...
+ * //on_data
+ * if (omxcam_mp4_feed (&mp4, buffer)) ...
+ * ...
+ * omxcam_mp4_flush (&mp4);
+ * omxcam_mp4_free (&mp4);
+ *
+ * The first data is the initialization segment (ftyp and moov), emitted with
+ * the OMXCAM_BUFFER_CODEC_CONFIG flag when the SPS, the PPS and the first IDR
+ * frame are received. Then, a fragment (moof and mdat) begins at each IDR frame
+ * or when 'max_fragment_size' is reached. The frames are buffered until the
+ * fragment is complete, so the memory used is bounded by the IDR period and
+ * 'max_fragment_size'. The durations of the samples are calculated from the
+ * timestamps of the buffers.
+ *
+ * The video can also be captured with the OMXCAM_FORMAT_H264_MP4 format, then
+ * 'on_data' receives the muxed data directly.
+ */
+OMXCAM_EXTERN void omxcam_mp4_init (
+    omxcam_mp4_t* mp4,
+    void (*on_data)(omxcam_buffer_t buffer));
+OMXCAM_EXTERN void omxcam_mp4_free (omxcam_mp4_t* mp4);
+OMXCAM_EXTERN int omxcam_mp4_feed (omxcam_mp4_t* mp4, omxcam_buffer_t buffer);
+OMXCAM_EXTERN int omxcam_mp4_flush (omxcam_mp4_t* mp4);
+
+/*
+ * MPEG-TS muxer of an h264 stream. Feed each 'omxcam_buffer_t' received from
+ * the camera, the 188-byte packets are written to 'on_data' in chunks of up to
+ * OMXCAM_TS_CHUNK_PACKETS packets, so each chunk can be sent in a single UDP
+ * datagram. A chunk is also emitted at the end of each frame to reduce the
+ * latency. The chunk is preallocated inside the struct, there are no memory
+ * allocations.
+ *
+ * The PAT and PMT are written before the first frame and before each IDR
+ * frame. Each frame is a PES packet that begins with an access unit delimiter
+ * and includes the PCR, derived from the timestamp of the buffers.
+ *
+ * The video can also be captured with the OMXCAM_FORMAT_H264_TS format, then
+ * 'on_data' receives the muxed data directly.
+ */
+OMXCAM_EXTERN void omxcam_ts_init (
+    omxcam_ts_t* ts,
+    void (*on_data)(omxcam_buffer_t buffer));
+OMXCAM_EXTERN int omxcam_ts_feed (omxcam_ts_t* ts, omxcam_buffer_t buffer);
+OMXCAM_EXTERN int omxcam_ts_flush (omxcam_ts_t* ts);
+
+/*
+ * Pre-event recorder. Keeps the last encoded frames of an h264 stream in a
+ * fixed-size ring, e.g. a security camera that needs the seconds before a
+ * trigger. Feed each 'omxcam_buffer_t' received from the camera:
+ *
+ * omxcam_dvr_t dvr;
+ *
+ * //8MB
+ * if (omxcam_dvr_init (&dvr, 8388608)) ...
+ * ...
+ * //on_data
+ * if (omxcam_dvr_feed (&dvr, buffer)) ...
+ * ...
+ * //From any thread
+ * if (omxcam_dvr_dump (&dvr, 10, on_clip)) ...
+ * ...
+ * omxcam_dvr_free (&dvr);
+ *
+ * All the memory is allocated by 'omxcam_dvr_init()', the oldest frames are
+ * overwritten when the ring is full. The frame index has an entry per KB of
+ * the ring, so with long GOPs at low bitrates the oldest frames can also be
+ * dropped from the index before the ring is full. 'omxcam_dvr_dump()' calls
+ * 'on_data' with the frames recorded since the given number of seconds ago,
+ * starting at the nearest preceding IDR frame and with the SPS and PPS that
+ * were in effect at that frame prepended, so the clip can be decoded. Each IDR
+ * frame stores a copy of the parameter sets in the ring. The buffers have the
+ * same flags and timestamps as the camera buffers, so they can be passed to
+ * the muxers. The lock is only held while
+ * copying the data, the recording is not stalled while 'on_data' is executed.
+ * If the frames are overwritten before they are dumped, it returns -1 with the
+ * error OMXCAM_ERROR_DVR.
+ */
+OMXCAM_EXTERN int omxcam_dvr_init (omxcam_dvr_t* dvr, uint32_t size);
+OMXCAM_EXTERN void omxcam_dvr_free (omxcam_dvr_t* dvr);
+OMXCAM_EXTERN int omxcam_dvr_feed (omxcam_dvr_t* dvr, omxcam_buffer_t buffer);
+OMXCAM_EXTERN int omxcam_dvr_dump (
+    omxcam_dvr_t* dvr,
+    uint32_t seconds,
+    void (*on_data)(omxcam_buffer_t buffer));
+
+/*
+ * Splits an h264 stream into MPEG-TS files that begin with an IDR frame and
+ * writes an HLS playlist (m3u8) as they are completed. Feed each
+ * 'omxcam_buffer_t' received from the camera:
+ *
+ * omxcam_segmenter_t segmenter;
+ *
+ * omxcam_segmenter_init (&segmenter);
+ * segmenter.path = "video-%05d.ts";
+ * segmenter.playlist = "video.m3u8";
+ * if (omxcam_segmenter_start (&segmenter)) ...
+ * ...
+ * //on_data
+ * if (omxcam_segmenter_feed (&segmenter, buffer)) ...
+ * ...
+ * omxcam_segmenter_stop (&segmenter);
+ *
+ * A new segment begins at the first IDR frame after 'duration' or 'max_size',
+ * so set 'h264.idr_period' to a divisor of the duration, e.g. 30 at 30fps.
+ * The files are written by a background thread, the data is copied to a queue
+ * of 'queue_size' bytes and the capture thread never waits for the disk. If
+ * the queue is full or the files cannot be written, 'omxcam_segmenter_feed()'
+ * returns -1 with the error OMXCAM_ERROR_SEGMENTER, the segment that is being
+ * written is deleted and it's not listed in the playlist.
+ */
+OMXCAM_EXTERN void omxcam_segmenter_init (omxcam_segmenter_t* segmenter);
+OMXCAM_EXTERN int omxcam_segmenter_start (omxcam_segmenter_t* segmenter);
+OMXCAM_EXTERN int omxcam_segmenter_feed (
+    omxcam_segmenter_t* segmenter,
+    omxcam_buffer_t buffer);
+OMXCAM_EXTERN int omxcam_segmenter_stop (omxcam_segmenter_t* segmenter);
+
+/*
+ * RTP packetiser of an h264 stream (RFC 6184, packetization-mode=1). The NAL
+ * units that fit in 'mtu' bytes are sent in a single packet, the others are
+ * fragmented with FU-A. Feed each 'omxcam_buffer_t' received from the camera,
+ * the packets are sent with UDP to the clients without copying the data, the
+ * packets of each buffer are sent with a single sendmmsg() call:
+ *
+ * omxcam_rtp_t rtp;
+ *
+ * if (omxcam_rtp_init (&rtp)) ...
+ * if (omxcam_rtp_add_client (&rtp, "127.0.0.1", 5000)) ...
+ * ...
+ * //on_data
+ * if (omxcam_rtp_feed (&rtp, buffer)) ...
+ * ...
+ * omxcam_rtp_free (&rtp);
+ *
+ * The clients can be added and removed from any thread. The last SPS and PPS
+ * are sent again before the next frame when a client is added and 'on_client'
+ * is called from the thread that feeds the buffers, so it can safely call
+ * 'omxcam_video_request_h264_idr()' from there. The capture
+ * thread never waits for the network, the packets are dropped if the socket
+ * buffer is full.
+ */
+OMXCAM_EXTERN int omxcam_rtp_init (omxcam_rtp_t* rtp);
+OMXCAM_EXTERN void omxcam_rtp_free (omxcam_rtp_t* rtp);
+OMXCAM_EXTERN int omxcam_rtp_add_client (
+    omxcam_rtp_t* rtp,
+    const char* address,
+    uint16_t port);
+OMXCAM_EXTERN int omxcam_rtp_remove_client (
+    omxcam_rtp_t* rtp,
+    const char* address,
+    uint16_t port);
+OMXCAM_EXTERN int omxcam_rtp_feed (omxcam_rtp_t* rtp, omxcam_buffer_t buffer);
+
+/*
+ * Minimal RTSP server for an 'omxcam_rtp_t'. It handles OPTIONS, DESCRIBE,
+ * SETUP (UDP unicast only), PLAY and TEARDOWN in a background thread. PLAY
+ * adds the client to the packetiser, which calls the 'on_client' function of
+ * the 'omxcam_rtp_t', TEARDOWN or closing the connection removes it. RTCP is
+ * not implemented, only the RTP port is announced. The stream is
+ * available at rtsp://<address>:<port>/. By default it listens on
+ * 127.0.0.1:8554.
+ *
+ * omxcam_rtsp_t rtsp;
+ *
+ * omxcam_rtsp_init (&rtsp);
+ * if (omxcam_rtsp_start (&rtsp, &rtp)) ...
+ * ...
+ * omxcam_rtsp_stop (&rtsp);
+ */
+OMXCAM_EXTERN void omxcam_rtsp_init (omxcam_rtsp_t* rtsp);
+OMXCAM_EXTERN int omxcam_rtsp_start (omxcam_rtsp_t* rtsp, omxcam_rtp_t* rtp);
+OMXCAM_EXTERN int omxcam_rtsp_stop (omxcam_rtsp_t* rtsp);
+
+/*
+ * Motion vectors of the h264 encoder ('h264.inline_motion_vectors'). Each
+ * buffer received by 'on_motion' contains a vector and the SAD of each
+ * macroblock (16x16 pixels) of the frame, plus an additional column.
+ *
+ * 'omxcam_motion_field()' wraps the buffer without copying it. 'width' and
+ * 'height' are the dimensions of the video.
+ *
+ * 'omxcam_motion_magnitude()' writes the squared lengths of the vectors to
+ * 'magnitudes' (cols*rows values).
+ *
+ * 'omxcam_motion_threshold()' writes 1 to 'mask' (cols*rows bytes) for each
+ * moving macroblock, 0 otherwise, and returns the number of moving
+ * macroblocks.
+ *
+ * 'omxcam_motion_sum()' sums the vectors of the macroblocks inside 'box'.
+ *
+ * 'omxcam_motion_summarize()' returns the number of moving macroblocks, their
+ * bounding box and their mean vector.
+ *
+ * The loops are branchless, a 1080p field (~8000 macroblocks) is processed in
+ * tens of microseconds. The magnitude and the threshold use NEON when the
+ * library is built with it (NEON=1 in the makefiles).
+ *
+ * void on_motion (omxcam_buffer_t buffer){
+ *   omxcam_motion_field_t field;
+ *   omxcam_motion_summary_t summary;
+ *   omxcam_motion_threshold_t threshold = { 4, 0 };
+ *
+ *   if (omxcam_motion_field (buffer, 1920, 1080, &field)) ...
+ *   omxcam_motion_summarize (&field, &threshold, &summary);
+ *   if (summary.moving > 10) ...
+ * }
+ */
+OMXCAM_EXTERN int omxcam_motion_field (
+    omxcam_buffer_t buffer,
+    uint32_t width,
+    uint32_t height,
+    omxcam_motion_field_t* field);
+OMXCAM_EXTERN void omxcam_motion_magnitude (
+    omxcam_motion_field_t* field,
+    uint16_t* magnitudes);
+OMXCAM_EXTERN uint32_t omxcam_motion_threshold (
+    omxcam_motion_field_t* field,
+    omxcam_motion_threshold_t* threshold,
+    uint8_t* mask);
+OMXCAM_EXTERN void omxcam_motion_sum (
+    omxcam_motion_field_t* field,
+    omxcam_motion_box_t* box,
+    omxcam_motion_sum_t* sum);
+OMXCAM_EXTERN void omxcam_motion_summarize (
+    omxcam_motion_field_t* field,
+    omxcam_motion_threshold_t* threshold,
+    omxcam_motion_summary_t* summary);
+
+/*
+ * Motion detector. Feed it with the buffers received by 'on_motion', it calls
+ * 'on_event' when the motion starts and stops.
+ *
+ * The moving macroblocks ('threshold') outside the region of interest are
+ * ignored. The moving macroblocks are grouped by connectivity and the groups
+ * smaller than 'min_blob' macroblocks are discarded as noise. An event starts
+ * after 'start_frames' consecutive frames with motion and stops after
+ * 'stop_frames' consecutive frames without motion.
+ *
+ * The region of interest is the whole frame by default.
+ * 'omxcam_motion_detector_set_roi()' sets it from a mask with a byte per
+ * macroblock (cols*rows, non-zero to include the macroblock) or resets it to
+ * the whole frame if 'mask' is null. 'omxcam_motion_detector_add_polygon()'
+ * adds the macroblocks whose center is inside the polygon (pixel coordinates),
+ * the first polygon replaces the whole frame.
+ *
+ * omxcam_motion_detector_t detector;
+ *
+ * if (omxcam_motion_detector_init (&detector, 1920, 1080)) ...
+ * detector.on_event = on_event;
+ * ...
+ * //on_motion
+ * if (omxcam_motion_detector_feed (&detector, buffer)) ...
+ * ...
+ * omxcam_motion_detector_free (&detector);
+ */
+OMXCAM_EXTERN int omxcam_motion_detector_init (
+    omxcam_motion_detector_t* detector,
+    uint32_t width,
+    uint32_t height);
+OMXCAM_EXTERN void omxcam_motion_detector_free (
+    omxcam_motion_detector_t* detector);
+OMXCAM_EXTERN void omxcam_motion_detector_set_roi (
+    omxcam_motion_detector_t* detector,
+    uint8_t* mask);
+OMXCAM_EXTERN int omxcam_motion_detector_add_polygon (
+    omxcam_motion_detector_t* detector,
+    omxcam_motion_point_t* points,
+    uint32_t length);
+OMXCAM_EXTERN int omxcam_motion_detector_feed (
+    omxcam_motion_detector_t* detector,
+    omxcam_buffer_t buffer);
+
+/*
+ * Encodes yuv420 frames supplied by the client with the h264 encoder, the
+ * camera is not used. The frames are copied to one of the 'buffers' input
+ * buffers and 'omxcam_encode_frame()' returns while the encoder is still busy,
+ * it only blocks when all the buffers are being encoded. The timestamp is in
+ * microseconds, -1 if unknown.
+ *
+ * 'omxcam_encode_start()' creates a thread that emits the encoded buffers with
+ * 'on_data'. 'omxcam_encode_stop()' sends the end of stream to the encoder and
+ * waits until all the pending frames have been emitted.
+ *
+ * In "no pthread" mode the buffers are read with 'omxcam_encode_read_npt()'.
+ * There's only one output buffer, so the buffers of each frame need to be read
+ * until OMXCAM_BUFFER_END_OF_FRAME before submitting more frames than input
+ * buffers. 'omxcam_encode_stop_npt()' discards the frames that haven't been
+ * read.
+ *
+ * The encoder can't be used while the camera is running. The h264 settings
+ * that depend on the capture (rate control, latency and frame statistics) are
+ * ignored.
+ */
+OMXCAM_EXTERN void omxcam_encode_init (omxcam_encode_settings_t* settings);
+OMXCAM_EXTERN int omxcam_encode_start (omxcam_encode_settings_t* settings);
+OMXCAM_EXTERN int omxcam_encode_start_npt (omxcam_encode_settings_t* settings);
+OMXCAM_EXTERN int omxcam_encode_frame (
+    omxcam_yuv_frame_t* frame,
+    int64_t timestamp);
+OMXCAM_EXTERN int omxcam_encode_read_npt (omxcam_buffer_t* buffer);
+OMXCAM_EXTERN int omxcam_encode_stop ();
+OMXCAM_EXTERN int omxcam_encode_stop_npt ();
+
+/*
+ * Sets the default jpeg settings, the same as 'omxcam_still_init()'.
+ */
+OMXCAM_EXTERN void omxcam_jpeg_init (omxcam_jpeg_settings_t* settings);
+
+/*
+ * Encodes an image from memory with the jpeg encoder of the GPU and emits the
+ * jpeg with 'on_data', the last buffer has the OMXCAM_BUFFER_END_OF_STREAM
+ * flag. It blocks until the whole image is encoded.
+ *
+ * The encoder is created with the first image and kept alive between calls, so
+ * consecutive images with the same format, dimensions and settings only pay
+ * the copy and the encoding. Changing any of them reconfigures the encoder.
+ * The exif tags are updated with each image. 'omxcam_jpeg_encode_free()'
+ * releases the encoder.
+ *
+ * It doesn't use the camera, so it can be used while a video is being
+ * captured, but it must be called from a single thread. 'jpeg.raw_bayer' and
+ * 'jpeg.thumbnail.preview' are not available.
+ */
+OMXCAM_EXTERN int omxcam_jpeg_encode (
+    omxcam_image_t* image,
+    omxcam_jpeg_settings_t* settings,
+    void (*on_data)(omxcam_buffer_t buffer));
+OMXCAM_EXTERN int omxcam_jpeg_encode_free ();
+
+/*
+ * Edits the metadata of a jpeg stream without decoding it. Feed each
+ * 'omxcam_buffer_t' of a still capture, a MJPEG video or
+ * 'omxcam_jpeg_encode()', the edited jpeg is written to 'on_data':
+ *
+ * omxcam_exif_editor_t editor;
+ *
+ * omxcam_exif_editor_init (&editor, on_jpeg_data);
+ * editor.entries = entries;
+ * editor.valid_entries = 1;
+ * ...
+ * //on_data
+ * if (omxcam_exif_editor_feed (&editor, buffer)) ...
+ * ...
+ * omxcam_exif_editor_free (&editor);
+ *
+ * Only the SOI and the APPn segments of each image are buffered. When the
+ * first marker that is not an APPn arrives, 'on_header' is called, the ASCII
+ * tags of IFD0, the Exif IFD and the GPS IFD that appear in 'entries' are
+ * overwritten (the values can't grow, longer values are truncated), 'segment'
+ * is inserted and the header is emitted. The rest of the image is passed
+ * through without copies. An image ends with a buffer with the
+ * OMXCAM_BUFFER_END_OF_FRAME or OMXCAM_BUFFER_END_OF_STREAM flag.
+ *
+ * New tags or IFDs (e.g. GPS coordinates) can't be added in place, use
+ * 'segment' with a complete APP1 exif segment and set 'replace' to remove the
+ * exif of the encoder.
+ *
+ * 'thumbnail' contains the position of the thumbnail generated by the encoder
+ * (IFD1) once the header is emitted, so it can be extracted or served without
+ * decoding the image.
+ */
+OMXCAM_EXTERN void omxcam_exif_editor_init (
+    omxcam_exif_editor_t* editor,
+    void (*on_data)(omxcam_buffer_t buffer));
+OMXCAM_EXTERN void omxcam_exif_editor_free (omxcam_exif_editor_t* editor);
+OMXCAM_EXTERN int omxcam_exif_editor_feed (
+    omxcam_exif_editor_t* editor,
+    omxcam_buffer_t buffer);
+
+/*
+ * Extracts the raw bayer data appended to a jpeg when 'jpeg.raw_bayer' is
+ * enabled. Feed each 'omxcam_buffer_t' of the still capture, the jpeg is not
+ * modified:
+ *
+ * omxcam_raw_t raw;
+ *
+ * omxcam_raw_init (&raw, on_raw);
+ * ...
+ * //on_data
+ * if (omxcam_raw_feed (&raw, buffer)) ...
+ * ...
+ * omxcam_raw_free (&raw);
+ *
+ * The raw block is found as it arrives: the "BRCM" header is validated and
+ * each row of 10-bit packed pixels is unpacked to 16 bits when it's received,
+ * so the image is ready when the capture ends. 'on_raw' receives the unpacked
+ * image without the padding. The image buffer is allocated with the first
+ * image and reused.
+ */
+OMXCAM_EXTERN void omxcam_raw_init (
+    omxcam_raw_t* raw,
+    void (*on_raw)(omxcam_raw_image_t image));
+OMXCAM_EXTERN void omxcam_raw_free (omxcam_raw_t* raw);
+OMXCAM_EXTERN int omxcam_raw_feed (omxcam_raw_t* raw, omxcam_buffer_t buffer);
+
+/*
+ * Unpacks a row of 10-bit packed pixels, 4 pixels in 5 bytes, to 16 bits. It's
+ * vectorized with NEON when the library is built with it (NEON=1 in the
+ * makefiles).
+ */
+OMXCAM_EXTERN void omxcam_raw_unpack (
+    uint8_t* src,
+    uint16_t* dst,
+    uint32_t width);
+
+/*
+ * Bilinear demosaic of a raw image into planar rgb. 'r', 'g' and 'b' must have
+ * room for width*height samples, the values have 10 bits.
+ */
+OMXCAM_EXTERN int omxcam_raw_demosaic (
+    omxcam_raw_image_t* image,
+    uint16_t* r,
+    uint16_t* g,
+    uint16_t* b);
+
+/*
+ * Sets the default bracketing settings: the still defaults with the yuv420
+ * format and 3 shots at -2, 0 and +2 EV.
+ */
+OMXCAM_EXTERN void omxcam_bracket_init (omxcam_bracket_settings_t* settings);
+
+/*
+ * Captures a burst of yuv420 stills with a different exposure each. The
+ * pipeline is built once: between shots only the exposure is reprogrammed with
+ * a single config call and the capture is triggered again, so the burst is
+ * much faster than a 'omxcam_still_start()' per shot. It blocks until all the
+ * shots are captured. The frames can be merged with 'omxcam_hdr_feed()'.
+ */
+OMXCAM_EXTERN int omxcam_bracket_start (omxcam_bracket_settings_t* settings);
+
+/*
+ * Exposure fusion of yuv420 frames, e.g. the shots of 'omxcam_bracket_start()'.
+ * Feed the frames one after the other, the merged frame is emitted in slices
+ * of 16 rows with the layout of 'omxcam_yuv_planes_slice()', the last one with
+ * the OMXCAM_BUFFER_END_OF_FRAME flag:
+ *
+ * omxcam_hdr_t hdr;
+ *
+ * if (omxcam_hdr_init (&hdr, 2592, 1944, 3, on_hdr_data)) ...
+ * ...
+ * //on_data of the bracketing
+ * if (omxcam_hdr_feed (&hdr, buffer)) ...
+ * ...
+ * omxcam_hdr_free (&hdr);
+ *
+ * Each pixel is the weighted mean of the exposures, the weight of each 2x2
+ * block is how well exposed it is in each frame (higher near mid-gray), so the
+ * shadows come from the long exposures and the highlights from the short ones
+ * and the result is already tone mapped to 8 bits. All the frames except the
+ * last one are stored, the last one is merged slice by slice as it arrives.
+ * 'omxcam_hdr_init()' allocates (frames - 1) full yuv420 frames, each of
+ * round(width, 32)*round(height, 16)*3/2 bytes (~7.6 MB at 2592x1944, so 3
+ * frames take ~15 MB), plus two slices and a few rows of weights. It fails
+ * with OMXCAM_ERROR_BAD_PARAMETER if the stored frames don't fit in 32 bits
+ * and with OMXCAM_ERROR_MEMORY if they can't be allocated. The weighted sums
+ * use NEON when the library is built with it (NEON=1 in the makefiles).
+ */
+OMXCAM_EXTERN int omxcam_hdr_init (
+    omxcam_hdr_t* hdr,
+    uint32_t width,
+    uint32_t height,
+    uint32_t frames,
+    void (*on_data)(omxcam_buffer_t buffer));
+OMXCAM_EXTERN void omxcam_hdr_free (omxcam_hdr_t* hdr);
+OMXCAM_EXTERN int omxcam_hdr_feed (omxcam_hdr_t* hdr, omxcam_buffer_t buffer);
+
+/*
+ * Groups the h264 buffers of each frame and pairs them with the motion
+ * vectors of the frame. 'on_frame' is called once per frame with the whole
+ * access unit (copied) and the motion vectors buffer (not copied). The motion
+ * vectors are valid until 'on_frame' returns, the access unit until the next
+ * frame is emitted. The codec config buffers are included in the next frame.
+ *
+ * The encoder emits the motion vectors after the last buffer of the frame. If
+ * 'motion' is true the frame is delayed until they arrive, otherwise it's
+ * emitted with an empty 'motion' buffer. A frame that is still waiting for its
+ * motion vectors when the next frame begins is emitted without them.
+ *
+ * The video capture does this internally when 'on_frame' is set in the
+ * settings and 'omxcam_video_read_frame_npt()' uses it in "no pthread" mode.
+ *
+ * omxcam_framer_t framer;
+ *
+ * omxcam_framer_init (&framer, OMXCAM_TRUE);
+ * framer.on_frame = on_frame;
+ * ...
+ * //on_data and on_motion
+ * if (omxcam_framer_feed (&framer, buffer)) ...
+ * ...
+ * omxcam_framer_flush (&framer);
+ * omxcam_framer_free (&framer);
+ */
+OMXCAM_EXTERN void omxcam_framer_init (
+    omxcam_framer_t* framer,
+    omxcam_bool motion);
+OMXCAM_EXTERN void omxcam_framer_free (omxcam_framer_t* framer);
+OMXCAM_EXTERN int omxcam_framer_feed (
+    omxcam_framer_t* framer,
+    omxcam_buffer_t buffer);
+OMXCAM_EXTERN void omxcam_framer_flush (omxcam_framer_t* framer);
+
 #ifdef __cplusplus
 }
 #endif
@@ -2,7 +2,7 @@
 #define OMXCAM_VERSION_H
 
 #define OMXCAM_VERSION_MAJOR 0
-#define OMXCAM_VERSION_MINOR 0
+#define OMXCAM_VERSION_MINOR 1
 #define OMXCAM_VERSION_PATCH 0
 
 #endif
\ No newline at end of file
@@ -0,0 +1,433 @@
+#include "omxcam.h"
+#include "internal.h"
+
+//Maximum number of results that can be pending to be read. Each capture
+//produces at most 2 results, the oldest ones are discarded if they are not read
+#define OMXCAM_ASYNC_QUEUE_LENGTH 4
+
+typedef struct {
+  int video;
+  omxcam_video_settings_t video_settings;
+  omxcam_still_settings_t still_settings;
+  void (*on_ready)();
+  void (*on_complete)(omxcam_async_result_t result);
+} omxcam__async_arg_t;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static int fd = -1;
+static int busy = 0;
+static int ready = 0;
+static int stop_requested = 0;
+static int stopper_created = 0;
+static int stop_code = 0;
+static omxcam_errno stop_error = OMXCAM_ERROR_NONE;
+static pthread_t worker;
+static pthread_t stopper;
+static omxcam__async_arg_t arg;
+static omxcam_async_result_t queue[OMXCAM_ASYNC_QUEUE_LENGTH];
+static uint32_t queue_head = 0;
+static uint32_t queue_length = 0;
+
+static int omxcam__async_open (){
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  //The file descriptor is created once and lives until the process exits
+  if (fd == -1){
+    fd = eventfd (0, EFD_NONBLOCK | EFD_SEMAPHORE | EFD_CLOEXEC);
+  }
+  int error = fd == -1;
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  if (error){
+    omxcam__error ("eventfd");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  return 0;
+}
+
+static void omxcam__async_emit (
+    void (*on_complete)(omxcam_async_result_t result),
+    omxcam_async_event event,
+    int code,
+    omxcam_errno error){
+  omxcam__trace ("asynchronous operation completed (%s, %d)",
+      event == OMXCAM_ASYNC_START ? "start" : "stop", code);
+  
+  omxcam_async_result_t result;
+  result.event = event;
+  result.code = code;
+  result.error = error;
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return;
+  }
+  
+  if (queue_length == OMXCAM_ASYNC_QUEUE_LENGTH){
+    //Discard the oldest result
+    queue_head = (queue_head + 1)%OMXCAM_ASYNC_QUEUE_LENGTH;
+    queue_length--;
+  }
+  queue[(queue_head + queue_length)%OMXCAM_ASYNC_QUEUE_LENGTH] = result;
+  queue_length++;
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    return;
+  }
+  
+  if (eventfd_write (fd, 1)){
+    omxcam__error ("eventfd_write");
+  }
+  
+  if (on_complete) on_complete (result);
+}
+
+static void* omxcam__async_stop_thread (void* thread_arg){
+  //The return value is not needed
+  
+  stop_code = omxcam_video_stop ();
+  stop_error = omxcam_last_error ();
+  
+  return (void*)0;
+}
+
+static int omxcam__async_stop (){
+  omxcam__trace ("creating stop thread");
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  //The flag is set before the thread exists, so the worker can't miss it
+  stopper_created = 1;
+  int error = pthread_create (&stopper, 0, omxcam__async_stop_thread, 0);
+  if (error) stopper_created = 0;
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  if (error){
+    omxcam__error ("pthread_create");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  return 0;
+}
+
+static void omxcam__async_on_ready (){
+  //Executed by the worker thread from inside omxcam_video_start()
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return;
+  }
+  
+  ready = 1;
+  int stop = stop_requested;
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    return;
+  }
+  
+  if (arg.on_ready) arg.on_ready ();
+  
+  omxcam__async_emit (arg.on_complete, OMXCAM_ASYNC_START, 0,
+      OMXCAM_ERROR_NONE);
+  
+  //omxcam_stop_async() was called while the video was being initialized
+  if (stop) omxcam__async_stop ();
+}
+
+static void* omxcam__async_worker (void* thread_arg){
+  //The return value is not needed
+  
+  void (*on_complete)(omxcam_async_result_t result) = arg.on_complete;
+  omxcam_async_event event = OMXCAM_ASYNC_STOP;
+  int code;
+  omxcam_errno error;
+  
+  if (arg.video){
+    code = omxcam_video_start (&arg.video_settings, OMXCAM_CAPTURE_FOREVER);
+    error = omxcam_last_error ();
+    
+    //The stop thread is joined before notifying the completion in order to
+    //include the result of omxcam_video_stop()
+    if (pthread_mutex_lock (&mutex)){
+      omxcam__error ("pthread_mutex_lock");
+      return (void*)0;
+    }
+    
+    int join = stopper_created;
+    
+    if (pthread_mutex_unlock (&mutex)){
+      omxcam__error ("pthread_mutex_unlock");
+      return (void*)0;
+    }
+    
+    if (join){
+      if (pthread_join (stopper, 0)){
+        omxcam__error ("pthread_join");
+        code = -1;
+        error = OMXCAM_ERROR_ASYNC;
+      }else if (!code && stop_code){
+        code = stop_code;
+        error = stop_error;
+      }
+    }
+    
+    //If the video was never ready, the start operation is the one that failed
+    if (!ready) event = OMXCAM_ASYNC_START;
+  }else{
+    code = omxcam_still_start (&arg.still_settings);
+    error = omxcam_last_error ();
+  }
+  
+  //Another capture can be started from 'on_complete'
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return (void*)0;
+  }
+  
+  busy = 0;
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    return (void*)0;
+  }
+  
+  omxcam__async_emit (on_complete, event, code, error);
+  
+  return (void*)0;
+}
+
+static int omxcam__async_acquire (){
+  if (omxcam__async_open ()) return -1;
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  int running = busy || omxcam__ctx.state.running;
+  if (!running){
+    busy = 1;
+    ready = 0;
+    stop_requested = 0;
+    stopper_created = 0;
+    stop_code = 0;
+    stop_error = OMXCAM_ERROR_NONE;
+  }
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  if (running){
+    omxcam__error ("camera is already running");
+    omxcam__set_last_error (OMXCAM_ERROR_CAMERA_RUNNING);
+    return -1;
+  }
+  
+  return 0;
+}
+
+static void omxcam__async_release (){
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return;
+  }
+  
+  busy = 0;
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+  }
+}
+
+static int omxcam__async_spawn (){
+  omxcam__trace ("creating worker thread");
+  
+  pthread_attr_t attr;
+  
+  //The worker is detached, it's never joined
+  if (pthread_attr_init (&attr)){
+    omxcam__error ("pthread_attr_init");
+    omxcam__async_release ();
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  if (pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED) ||
+      pthread_create (&worker, &attr, omxcam__async_worker, 0)){
+    omxcam__error ("pthread_create");
+    pthread_attr_destroy (&attr);
+    omxcam__async_release ();
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  if (pthread_attr_destroy (&attr)){
+    omxcam__error ("pthread_attr_destroy");
+  }
+  
+  return 0;
+}
+
+int omxcam_video_start_async (
+    omxcam_video_settings_t* settings,
+    void (*on_complete)(omxcam_async_result_t result)){
+  omxcam__trace ("starting video capture (async)");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__video_validate (settings)){
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  if (omxcam__async_acquire ()) return -1;
+  
+  arg.video = 1;
+  arg.video_settings = *settings;
+  arg.video_settings.on_ready = omxcam__async_on_ready;
+  arg.on_ready = settings->on_ready;
+  arg.on_complete = on_complete;
+  
+  return omxcam__async_spawn ();
+}
+
+int omxcam_still_start_async (
+    omxcam_still_settings_t* settings,
+    void (*on_complete)(omxcam_async_result_t result)){
+  omxcam__trace ("starting still capture (async)");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__still_validate (settings)){
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  if (omxcam__async_acquire ()) return -1;
+  
+  arg.video = 0;
+  arg.still_settings = *settings;
+  arg.on_ready = 0;
+  arg.on_complete = on_complete;
+  
+  return omxcam__async_spawn ();
+}
+
+int omxcam_stop_async (){
+  omxcam__trace ("stopping capture (async)");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  omxcam_errno error = OMXCAM_ERROR_NONE;
+  int stop = 0;
+  
+  if (!busy){
+    error = OMXCAM_ERROR_CAMERA_NOT_RUNNING;
+  }else if (!arg.video){
+    //The still capture finishes by itself
+    error = OMXCAM_ERROR_VIDEO_ONLY;
+  }else if (stop_requested){
+    error = OMXCAM_ERROR_CAMERA_STOPPING;
+  }else{
+    stop_requested = 1;
+    //If the video is not ready yet, it's stopped from 'on_ready'
+    stop = ready;
+  }
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  if (error){
+    omxcam__error (omxcam_strerror (error));
+    omxcam__set_last_error (error);
+    return -1;
+  }
+  
+  if (stop) return omxcam__async_stop ();
+  
+  return 0;
+}
+
+int omxcam_async_fd (){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__async_open ()) return -1;
+  
+  return fd;
+}
+
+int omxcam_async_read (omxcam_async_result_t* result){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  eventfd_t value;
+  
+  if (fd == -1 || eventfd_read (fd, &value)){
+    omxcam__error ("there are no pending results");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  int empty = !queue_length;
+  if (!empty){
+    *result = queue[queue_head];
+    queue_head = (queue_head + 1)%OMXCAM_ASYNC_QUEUE_LENGTH;
+    queue_length--;
+  }
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  if (empty){
+    //The result was discarded because the queue was full
+    omxcam__error ("there are no pending results");
+    omxcam__set_last_error (OMXCAM_ERROR_ASYNC);
+    return -1;
+  }
+  
+  return 0;
+}
@@ -0,0 +1,132 @@
+#include "omxcam.h"
+#include "internal.h"
+
+void omxcam_bracket_init (omxcam_bracket_settings_t* settings){
+  omxcam_still_init (&settings->still);
+  settings->still.format = OMXCAM_FORMAT_YUV420;
+  
+  //-2, 0 and +2 EV
+  memset (settings->shots, 0, sizeof (settings->shots));
+  settings->shots[0].exposure_compensation = -12;
+  settings->shots[1].exposure_compensation = 0;
+  settings->shots[2].exposure_compensation = 12;
+  settings->valid_shots = 3;
+  settings->on_data = 0;
+}
+
+static int omxcam__bracket_validate (omxcam_bracket_settings_t* settings){
+  uint32_t i;
+  
+  if (settings->still.format != OMXCAM_FORMAT_YUV420){
+    omxcam__error ("invalid 'still.format' value, only yuv420 is supported");
+    return -1;
+  }
+  if (!settings->valid_shots ||
+      settings->valid_shots > OMXCAM_BRACKET_MAX_SHOTS){
+    omxcam__error ("invalid 'valid_shots' value");
+    return -1;
+  }
+  for (i=0; i<settings->valid_shots; i++){
+    if (!omxcam__camera_is_valid_exposure_compensation (
+        settings->shots[i].exposure_compensation)){
+      omxcam__error ("invalid 'shots[%d].exposure_compensation' value", i);
+      return -1;
+    }
+  }
+  if (!settings->on_data){
+    omxcam__error ("'on_data' is required");
+    return -1;
+  }
+  
+  return omxcam__still_validate (&settings->still);
+}
+
+static int omxcam__bracket_shot (
+    omxcam_bracket_settings_t* settings,
+    uint32_t shot){
+  omxcam_buffer_t buffer;
+  int end_of_image = 0;
+  
+  while (!end_of_image){
+    if (omxcam__still_read (&buffer, &end_of_image)) return -1;
+    if (buffer.length) settings->on_data (shot, buffer);
+  }
+  
+  return 0;
+}
+
+static int omxcam__bracket_abort (omxcam_errno error){
+  //The pipeline is released so the next capture can start, the errors of the
+  //deinitialization are ignored
+  omxcam__still_omx_deinit ();
+  omxcam__deinit ();
+  
+  omxcam__set_last_error (error);
+  return omxcam__exit (-1);
+}
+
+int omxcam_bracket_start (omxcam_bracket_settings_t* settings){
+  omxcam__trace ("starting exposure bracketing");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__ctx.state.running){
+    omxcam__error ("camera is already running");
+    omxcam__set_last_error (OMXCAM_ERROR_CAMERA_RUNNING);
+    return -1;
+  }
+  
+  if (omxcam__bracket_validate (settings)){
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  //Other captures are rejected during the whole burst
+  omxcam__ctx.state.running = 1;
+  
+  //The first shot is configured with the pipeline
+  omxcam_still_settings_t still = settings->still;
+  still.camera.shutter_speed = settings->shots[0].shutter_speed;
+  still.camera.exposure_compensation =
+      settings->shots[0].exposure_compensation;
+  
+  if (omxcam__init ()) return omxcam__exit (-1);
+  if (omxcam__still_omx_init (&still)){
+    omxcam_errno error = omxcam_last_error ();
+    omxcam__deinit ();
+    omxcam__set_last_error (error);
+    return omxcam__exit (-1);
+  }
+  
+  uint32_t i;
+  
+  for (i=0; i<settings->valid_shots; i++){
+    omxcam__trace ("bracketing shot %d", i);
+    
+    if (i){
+      //The pipeline stays in Executing, only the exposure is reprogrammed and
+      //the capture is triggered again
+      if (omxcam__camera_capture_port_reset (72)){
+        return omxcam__bracket_abort (OMXCAM_ERROR_STILL);
+      }
+      still.camera.shutter_speed = settings->shots[i].shutter_speed;
+      still.camera.exposure_compensation =
+          settings->shots[i].exposure_compensation;
+      if (omxcam__camera_set_exposure_value (&still.camera)){
+        return omxcam__bracket_abort (OMXCAM_ERROR_STILL);
+      }
+      if (omxcam__camera_capture_port_set (72)){
+        return omxcam__bracket_abort (OMXCAM_ERROR_STILL);
+      }
+    }
+    
+    if (omxcam__bracket_shot (settings, i)){
+      return omxcam__bracket_abort (omxcam_last_error ());
+    }
+  }
+  
+  if (omxcam__still_omx_deinit ()) return omxcam__exit (-1);
+  if (omxcam__deinit ()) return omxcam__exit (-1);
+  
+  return omxcam__exit (0);
+}
@@ -1,6 +1,35 @@
 #include "omxcam.h"
 #include "internal.h"
 
+//Settings that have been applied to the camera component
+#define OMXCAM_APPLIED_SHARPNESS 0x0001
+#define OMXCAM_APPLIED_CONTRAST 0x0002
+#define OMXCAM_APPLIED_BRIGHTNESS 0x0004
+#define OMXCAM_APPLIED_SATURATION 0x0008
+#define OMXCAM_APPLIED_EXPOSURE 0x0010
+#define OMXCAM_APPLIED_EXPOSURE_VALUE 0x0020
+#define OMXCAM_APPLIED_MIRROR 0x0040
+#define OMXCAM_APPLIED_ROTATION 0x0080
+#define OMXCAM_APPLIED_COLOR_EFFECTS 0x0100
+#define OMXCAM_APPLIED_COLOR_DENOISE 0x0200
+#define OMXCAM_APPLIED_WHITE_BALANCE 0x0400
+#define OMXCAM_APPLIED_IMAGE_FILTER 0x0800
+#define OMXCAM_APPLIED_ROI 0x1000
+#define OMXCAM_APPLIED_DRC 0x2000
+#define OMXCAM_APPLIED_FRAME_STABILISATION 0x4000
+
+//Values applied to the camera component. The setters skip the calls when the
+//value hasn't changed. They are forgotten when a new component is configured
+//because it starts with its own defaults
+static omxcam_camera_settings_t omxcam__camera_applied;
+static uint32_t omxcam__camera_applied_mask;
+
+static int omxcam__camera_unchanged (uint32_t setting, int equal){
+  if (!(omxcam__camera_applied_mask & setting) || !equal) return 0;
+  omxcam__trace ("camera setting 0x%04X unchanged", setting);
+  return 1;
+}
+
 int omxcam__camera_load_drivers (uint32_t camera_id){
   /*
   This is a specific behaviour of the Broadcom's Raspberry Pi OpenMAX IL
@@ -25,8 +54,8 @@ int omxcam__camera_load_drivers (uint32_t camera_id){
   req_st.bEnable = OMX_TRUE;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigRequestCallback, &req_st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigRequestCallback: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigRequestCallback", error);
     return -1;
   }
   
@@ -36,8 +65,8 @@ int omxcam__camera_load_drivers (uint32_t camera_id){
   dev_st.nU32 = camera_id;
   if ((error = OMX_SetParameter (omxcam__ctx.camera.handle,
       OMX_IndexParamCameraDeviceNumber, &dev_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamCameraDeviceNumber: "
-        "%s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetParameter - OMX_IndexParamCameraDeviceNumber", error);
     return -1;
   }
   
@@ -88,8 +117,8 @@ static int omxcam__config_capture_port (uint32_t port, OMX_BOOL set){
   port_st.bEnabled = set;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigPortCapturing, &port_st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigPortCapturing: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigPortCapturing", error);
     return -1;
   }
   
@@ -241,6 +270,10 @@ int omxcam__camera_validate (omxcam_camera_settings_t* settings, int video){
 }
 
 int omxcam__camera_set_sharpness (int32_t sharpness){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_SHARPNESS,
+      omxcam__camera_applied.sharpness == sharpness)){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_SHARPNESSTYPE st;
   omxcam__omx_struct_init (st);
@@ -248,14 +281,20 @@ int omxcam__camera_set_sharpness (int32_t sharpness){
   st.nSharpness = sharpness;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigCommonSharpness, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonSharpness: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigCommonSharpness", error);
     return -1;
   }
+  omxcam__camera_applied.sharpness = sharpness;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_SHARPNESS;
   return 0;
 }
 
 int omxcam__camera_set_contrast (int32_t contrast){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_CONTRAST,
+      omxcam__camera_applied.contrast == contrast)){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_CONTRASTTYPE st;
   omxcam__omx_struct_init (st);
@@ -263,14 +302,20 @@ int omxcam__camera_set_contrast (int32_t contrast){
   st.nContrast = contrast;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigCommonContrast, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonContrast: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigCommonContrast", error);
     return -1;
   }
+  omxcam__camera_applied.contrast = contrast;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_CONTRAST;
   return 0;
 }
 
 int omxcam__camera_set_brightness (uint32_t brightness){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_BRIGHTNESS,
+      omxcam__camera_applied.brightness == brightness)){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_BRIGHTNESSTYPE st;
   omxcam__omx_struct_init (st);
@@ -278,14 +323,20 @@ int omxcam__camera_set_brightness (uint32_t brightness){
   st.nBrightness = brightness;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigCommonBrightness, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonBrightness: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigCommonBrightness", error);
     return -1;
   }
+  omxcam__camera_applied.brightness = brightness;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_BRIGHTNESS;
   return 0;
 }
 
 int omxcam__camera_set_saturation (int32_t saturation){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_SATURATION,
+      omxcam__camera_applied.saturation == saturation)){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_SATURATIONTYPE st;
   omxcam__omx_struct_init (st);
@@ -293,36 +344,53 @@ int omxcam__camera_set_saturation (int32_t saturation){
   st.nSaturation = saturation;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigCommonSaturation, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonSaturation: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigCommonSaturation", error);
     return -1;
   }
+  omxcam__camera_applied.saturation = saturation;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_SATURATION;
   return 0;
 }
 
-int omxcam__camera_set_iso (omxcam_iso iso){
+//Fills the exposure value fields of the applied settings from the component
+//if they are not known yet
+static int omxcam__camera_load_exposure_value (){
+  if (omxcam__camera_applied_mask & OMXCAM_APPLIED_EXPOSURE_VALUE) return 0;
+  
   OMX_ERRORTYPE error;
   OMX_CONFIG_EXPOSUREVALUETYPE st;
   omxcam__omx_struct_init (st);
   st.nPortIndex = OMX_ALL;
   if ((error = OMX_GetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigCommonExposureValue, &st))){
-    omxcam__error ("OMX_GetConfig - OMX_IndexConfigCommonExposureValue: "
-        "%s", omxcam__dump_OMX_ERRORTYPE (error));
-    return -1;
-  }
-  st.nSensitivity = iso;
-  st.bAutoSensitivity = !iso;
-  if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
-      OMX_IndexConfigCommonExposureValue, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonExposureValue: "
-        "%s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_GetConfig - OMX_IndexConfigCommonExposureValue", error);
     return -1;
   }
+  omxcam__camera_applied.metering = st.eMetering;
+  omxcam__camera_applied.exposure_compensation =
+      (st.xEVCompensation*6 + (st.xEVCompensation < 0 ? -32768 : 32768))/65536;
+  omxcam__camera_applied.shutter_speed =
+      st.bAutoShutterSpeed ? 0 : st.nShutterSpeedMsec;
+  omxcam__camera_applied.iso = st.bAutoSensitivity ? 0 : st.nSensitivity;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_EXPOSURE_VALUE;
+  
   return 0;
 }
 
+int omxcam__camera_set_iso (omxcam_iso iso){
+  if (omxcam__camera_load_exposure_value ()) return -1;
+  omxcam_camera_settings_t settings = omxcam__camera_applied;
+  settings.iso = iso;
+  return omxcam__camera_set_exposure_value (&settings);
+}
+
 int omxcam__camera_set_exposure (omxcam_exposure exposure){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_EXPOSURE,
+      omxcam__camera_applied.exposure == exposure)){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_EXPOSURECONTROLTYPE st;
   omxcam__omx_struct_init (st);
@@ -330,35 +398,27 @@ int omxcam__camera_set_exposure (omxcam_exposure exposure){
   st.eExposureControl = exposure;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigCommonExposure, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonExposure: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigCommonExposure", error);
     return -1;
   }
+  omxcam__camera_applied.exposure = exposure;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_EXPOSURE;
   return 0;
 }
 
 int omxcam__camera_set_exposure_compensation (int32_t exposure_compensation){
-  OMX_ERRORTYPE error;
-  OMX_CONFIG_EXPOSUREVALUETYPE st;
-  omxcam__omx_struct_init (st);
-  st.nPortIndex = OMX_ALL;
-  if ((error = OMX_GetConfig (omxcam__ctx.camera.handle,
-      OMX_IndexConfigCommonExposureValue, &st))){
-    omxcam__error ("OMX_GetConfig - OMX_IndexConfigCommonExposureValue: "
-        "%s", omxcam__dump_OMX_ERRORTYPE (error));
-    return -1;
-  }
-  st.xEVCompensation = (exposure_compensation << 16)/6;
-  if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
-      OMX_IndexConfigCommonExposureValue, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonExposureValue: "
-        "%s", omxcam__dump_OMX_ERRORTYPE (error));
-    return -1;
-  }
-  return 0;
+  if (omxcam__camera_load_exposure_value ()) return -1;
+  omxcam_camera_settings_t settings = omxcam__camera_applied;
+  settings.exposure_compensation = exposure_compensation;
+  return omxcam__camera_set_exposure_value (&settings);
 }
 
 int omxcam__camera_set_mirror (omxcam_mirror mirror, int video){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_MIRROR,
+      omxcam__camera_applied.mirror == mirror)){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_MIRRORTYPE st;
   omxcam__omx_struct_init (st);
@@ -366,14 +426,20 @@ int omxcam__camera_set_mirror (omxcam_mirror mirror, int video){
   st.eMirror = mirror;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigCommonMirror, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonMirror: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigCommonMirror", error);
     return -1;
   }
+  omxcam__camera_applied.mirror = mirror;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_MIRROR;
   return 0;
 }
 
 int omxcam__camera_set_rotation (omxcam_rotation rotation, int video){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_ROTATION,
+      omxcam__camera_applied.rotation == rotation)){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_ROTATIONTYPE st;
   omxcam__omx_struct_init (st);
@@ -381,15 +447,22 @@ int omxcam__camera_set_rotation (omxcam_rotation rotation, int video){
   st.nRotation = rotation;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigCommonRotate, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonRotate: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigCommonRotate", error);
     return -1;
   }
+  omxcam__camera_applied.rotation = rotation;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_ROTATION;
   return 0;
 }
 
 int omxcam__camera_set_color_effects (
     omxcam_color_effects_t* color_effects){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_COLOR_EFFECTS,
+      !memcmp (&omxcam__camera_applied.color_effects, color_effects,
+      sizeof (omxcam_color_effects_t)))){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_COLORENHANCEMENTTYPE st;
   omxcam__omx_struct_init (st);
@@ -399,49 +472,48 @@ int omxcam__camera_set_color_effects (
   st.nCustomizedV = color_effects->v;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigCommonColorEnhancement, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonColorEnhancement: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigCommonColorEnhancement", error);
     return -1;
   }
+  omxcam__camera_applied.color_effects = *color_effects;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_COLOR_EFFECTS;
   return 0;
 }
 
 int omxcam__camera_set_color_denoise (omxcam_bool color_denoise){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_COLOR_DENOISE,
+      omxcam__camera_applied.color_denoise == color_denoise)){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_BOOLEANTYPE st;
   omxcam__omx_struct_init (st);
   st.bEnabled = !!color_denoise;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigStillColourDenoiseEnable, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigStillColourDenoiseEnable: "
-        "%s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigStillColourDenoiseEnable", error);
     return -1;
   }
+  omxcam__camera_applied.color_denoise = color_denoise;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_COLOR_DENOISE;
   return 0;
 }
 
 int omxcam__camera_set_metering (omxcam_metering metering){
-  OMX_ERRORTYPE error;
-  OMX_CONFIG_EXPOSUREVALUETYPE st;
-  omxcam__omx_struct_init (st);
-  st.nPortIndex = OMX_ALL;
-  if ((error = OMX_GetConfig (omxcam__ctx.camera.handle,
-      OMX_IndexConfigCommonExposureValue, &st))){
-    omxcam__error ("OMX_GetConfig - OMX_IndexConfigCommonExposureValue: "
-        "%s", omxcam__dump_OMX_ERRORTYPE (error));
-    return -1;
-  }
-  st.eMetering = metering;
-  if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
-      OMX_IndexConfigCommonExposureValue, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonExposureValue: "
-        "%s", omxcam__dump_OMX_ERRORTYPE (error));
-    return -1;
-  }
-  return 0;
+  if (omxcam__camera_load_exposure_value ()) return -1;
+  omxcam_camera_settings_t settings = omxcam__camera_applied;
+  settings.metering = metering;
+  return omxcam__camera_set_exposure_value (&settings);
 }
 
 int omxcam__camera_set_white_balance (omxcam_white_balance_t* white_balance){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_WHITE_BALANCE,
+      !memcmp (&omxcam__camera_applied.white_balance, white_balance,
+      sizeof (omxcam_white_balance_t)))){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_WHITEBALCONTROLTYPE st;
   omxcam__omx_struct_init (st);
@@ -449,8 +521,8 @@ int omxcam__camera_set_white_balance (omxcam_white_balance_t* white_balance){
   st.eWhiteBalControl = white_balance->mode;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigCommonWhiteBalance, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonWhiteBalance: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigCommonWhiteBalance", error);
     return -1;
   }
   if (white_balance->mode == OMXCAM_WHITE_BALANCE_OFF){
@@ -460,15 +532,21 @@ int omxcam__camera_set_white_balance (omxcam_white_balance_t* white_balance){
     gain_st.xGainB = (white_balance->blue_gain << 16)/1000;
     if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
         OMX_IndexConfigCustomAwbGains, &gain_st))){
-      omxcam__error ("OMX_SetConfig - OMX_IndexConfigCustomAwbGains: %s",
-          omxcam__dump_OMX_ERRORTYPE (error));
+      omxcam__omx_error (&omxcam__ctx.camera,
+          "OMX_SetConfig - OMX_IndexConfigCustomAwbGains", error);
       return -1;
     }
   }
+  omxcam__camera_applied.white_balance = *white_balance;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_WHITE_BALANCE;
   return 0;
 }
 
 int omxcam__camera_set_image_filter (omxcam_image_filter image_filter){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_IMAGE_FILTER,
+      omxcam__camera_applied.image_filter == image_filter)){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_IMAGEFILTERTYPE st;
   omxcam__omx_struct_init (st);
@@ -476,14 +554,20 @@ int omxcam__camera_set_image_filter (omxcam_image_filter image_filter){
   st.eImageFilter = image_filter;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigCommonImageFilter, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonImageFilter: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigCommonImageFilter", error);
     return -1;
   }
+  omxcam__camera_applied.image_filter = image_filter;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_IMAGE_FILTER;
   return 0;
 }
 
 int omxcam__camera_set_roi (omxcam_roi_t* roi){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_ROI,
+      !memcmp (&omxcam__camera_applied.roi, roi, sizeof (omxcam_roi_t)))){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_INPUTCROPTYPE st;
   omxcam__omx_struct_init (st);
@@ -494,28 +578,41 @@ int omxcam__camera_set_roi (omxcam_roi_t* roi){
   st.xHeight = (roi->height << 16)/100;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigInputCropPercentages, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigInputCropPercentages: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigInputCropPercentages", error);
     return -1;
   }
+  omxcam__camera_applied.roi = *roi;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_ROI;
   return 0;
 }
 
 int omxcam__camera_set_drc (omxcam_drc drc){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_DRC,
+      omxcam__camera_applied.drc == drc)){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_DYNAMICRANGEEXPANSIONTYPE st;
   omxcam__omx_struct_init (st);
   st.eMode = drc;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigDynamicRangeExpansion, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigDynamicRangeExpansion: "
-        "%s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigDynamicRangeExpansion", error);
     return -1;
   }
+  omxcam__camera_applied.drc = drc;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_DRC;
   return 0;
 }
 
 int omxcam__camera_set_frame_stabilisation (omxcam_bool frame_stabilisation){
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_FRAME_STABILISATION,
+      omxcam__camera_applied.frame_stabilisation ==
+      frame_stabilisation)){
+    return 0;
+  }
   OMX_ERRORTYPE error;
   OMX_CONFIG_FRAMESTABTYPE st;
   omxcam__omx_struct_init (st);
@@ -523,10 +620,50 @@ int omxcam__camera_set_frame_stabilisation (omxcam_bool frame_stabilisation){
   st.bStab = !!frame_stabilisation;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigCommonFrameStabilisation, &st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonFrameStabilisation: "
-        "%s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigCommonFrameStabilisation", error);
+    return -1;
+  }
+  omxcam__camera_applied.frame_stabilisation = frame_stabilisation;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_FRAME_STABILISATION;
+  return 0;
+}
+
+int omxcam__camera_set_exposure_value (omxcam_camera_settings_t* settings){
+  //The 4 fields share the same index, they're written with a single call
+  //without reading the current values
+  if (omxcam__camera_unchanged (OMXCAM_APPLIED_EXPOSURE_VALUE,
+      omxcam__camera_applied.metering == settings->metering &&
+      omxcam__camera_applied.exposure_compensation ==
+          settings->exposure_compensation &&
+      omxcam__camera_applied.shutter_speed == settings->shutter_speed &&
+      omxcam__camera_applied.iso == settings->iso)){
+    return 0;
+  }
+  
+  OMX_ERRORTYPE error;
+  OMX_CONFIG_EXPOSUREVALUETYPE st;
+  omxcam__omx_struct_init (st);
+  st.nPortIndex = OMX_ALL;
+  st.eMetering = settings->metering;
+  st.xEVCompensation = (settings->exposure_compensation << 16)/6;
+  //Despite the name says it's in milliseconds, it's in microseconds
+  st.nShutterSpeedMsec = settings->shutter_speed;
+  st.bAutoShutterSpeed = !settings->shutter_speed;
+  st.nSensitivity = settings->iso;
+  st.bAutoSensitivity = !settings->iso;
+  if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
+      OMX_IndexConfigCommonExposureValue, &st))){
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigCommonExposureValue", error);
     return -1;
   }
+  omxcam__camera_applied.metering = settings->metering;
+  omxcam__camera_applied.exposure_compensation =
+      settings->exposure_compensation;
+  omxcam__camera_applied.shutter_speed = settings->shutter_speed;
+  omxcam__camera_applied.iso = settings->iso;
+  omxcam__camera_applied_mask |= OMXCAM_APPLIED_EXPOSURE_VALUE;
   return 0;
 }
 
@@ -535,6 +672,9 @@ int omxcam__camera_configure_omx (
     int video){
   omxcam__trace ("configuring '%s' settings", omxcam__ctx.camera.name);
   
+  //New component, nothing has been applied yet
+  omxcam__camera_applied_mask = 0;
+  
   if (omxcam__camera_set_sharpness (settings->sharpness)) return -1;
   if (omxcam__camera_set_contrast (settings->contrast)) return -1;
   if (omxcam__camera_set_brightness (settings->brightness)) return -1;
@@ -557,23 +697,7 @@ int omxcam__camera_configure_omx (
     return -1;
   }
   
-  OMX_ERRORTYPE error;
-  OMX_CONFIG_EXPOSUREVALUETYPE exposure_st;
-  omxcam__omx_struct_init (exposure_st);
-  exposure_st.nPortIndex = OMX_ALL;
-  exposure_st.eMetering = settings->metering;
-  exposure_st.xEVCompensation = (settings->exposure_compensation << 16)/6;
-  //Despite the name says it's in milliseconds, it's in microseconds
-  exposure_st.nShutterSpeedMsec = settings->shutter_speed;
-  exposure_st.bAutoShutterSpeed = !settings->shutter_speed;
-  exposure_st.nSensitivity = settings->iso;
-  exposure_st.bAutoSensitivity = !settings->iso;
-  if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
-      OMX_IndexConfigCommonExposureValue, &exposure_st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigCommonExposureValue: "
-        "%s", omxcam__dump_OMX_ERRORTYPE (error));
-    return -1;
-  }
+  if (omxcam__camera_set_exposure_value (settings)) return -1;
   
   return 0;
 }
@@ -97,6 +97,22 @@ OMX_ERRORTYPE fill_buffer_done (
   return OMX_ErrorNone;
 }
 
+OMX_ERRORTYPE empty_buffer_done (
+    OMX_HANDLETYPE comp,
+    OMX_PTR app_data,
+    OMX_BUFFERHEADERTYPE* buffer){
+  omxcam__component_t* component = (omxcam__component_t*)app_data;
+  
+  omxcam__trace ("event: EmptyBufferDone");
+  
+  //Only the encoders have input buffers, the other ports are tunneled
+  if (!omxcam__jpeg_encode_buffer_done (component, buffer)){
+    omxcam__encode_buffer_done (buffer);
+  }
+  
+  return OMX_ErrorNone;
+}
+
 int omxcam__component_port_enable (
     omxcam__component_t* component,
     uint32_t port){
@@ -106,7 +122,7 @@ int omxcam__component_port_enable (
   
   if ((error = OMX_SendCommand (component->handle, OMX_CommandPortEnable,
       port, 0))){
-    omxcam__error ("OMX_SendCommand: %s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (component, "OMX_SendCommand", error);
     return -1;
   }
   
@@ -122,7 +138,7 @@ int omxcam__component_port_disable (
   
   if ((error = OMX_SendCommand (component->handle, OMX_CommandPortDisable,
       port, 0))){
-    omxcam__error ("OMX_SendCommand: %s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (component, "OMX_SendCommand", error);
     return -1;
   }
   
@@ -138,11 +154,12 @@ int omxcam__component_init (omxcam__component_t* component){
   
   OMX_CALLBACKTYPE callbacks;
   callbacks.EventHandler = event_handler;
+  callbacks.EmptyBufferDone = empty_buffer_done;
   callbacks.FillBufferDone = fill_buffer_done;
   
   if ((error = OMX_GetHandle (&component->handle, component->name, component,
       &callbacks))){
-    omxcam__error ("OMX_GetHandle: %s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (component, "OMX_GetHandle", error);
     return -1;
   }
   
@@ -160,9 +177,10 @@ int omxcam__component_init (omxcam__component_t* component){
   for (i=0; i<4; i++){
     if ((error = OMX_GetParameter (component->handle, component_types[i],
         &ports_st))){
+      omxcam__set_omx_error (component, "OMX_GetParameter", error);
       omxcam__error ("OMX_GetParameter - %s: %s",
-          omxcam__dump_OMX_ERRORTYPE (error),
-          omxcam__dump_OMX_INDEXTYPE (component_types[i]));
+          omxcam__dump_OMX_INDEXTYPE (component_types[i]),
+          omxcam__dump_OMX_ERRORTYPE (error));
       return -1;
     }
     
@@ -187,7 +205,7 @@ int omxcam__component_deinit (omxcam__component_t* component){
   if (omxcam__event_destroy (component)) return -1;
 
   if ((error = OMX_FreeHandle (component->handle))){
-    omxcam__error ("OMX_FreeHandle: %s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (component, "OMX_FreeHandle", error);
     return -1;
   }
   
@@ -204,7 +222,7 @@ int omxcam__component_change_state (
   
   if ((error = OMX_SendCommand (component->handle, OMX_CommandStateSet, state,
       0))){
-    omxcam__error ("OMX_SendCommand: %s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (component, "OMX_SendCommand", error);
     return -1;
   }
   
@@ -221,15 +239,14 @@ int omxcam__buffer_alloc (omxcam__component_t* component, uint32_t port){
   def_st.nPortIndex = port;
   if ((error = OMX_GetParameter (component->handle,
       OMX_IndexParamPortDefinition, &def_st))){
-    omxcam__error ("OMX_GetParameter - OMX_IndexParamPortDefinition: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (component,
+        "OMX_GetParameter - OMX_IndexParamPortDefinition", error);
     return -1;
   }
   
   if ((error = OMX_AllocateBuffer (component->handle,
       &omxcam__ctx.output_buffer, port, 0, def_st.nBufferSize))){
-    omxcam__error ("OMX_AllocateBuffer: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (component, "OMX_AllocateBuffer", error);
     return -1;
   }
   
@@ -243,13 +260,56 @@ int omxcam__buffer_free (omxcam__component_t* component, uint32_t port){
   
   if ((error = OMX_FreeBuffer (component->handle, port,
       omxcam__ctx.output_buffer))){
-    omxcam__error ("OMX_FreeBuffer: %s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (component, "OMX_FreeBuffer", error);
     return -1;
   }
   
   return 0;
 }
 
+void omxcam__buffer_wrap (omxcam_buffer_t* buffer){
+  omxcam__buffer_wrap_header (omxcam__ctx.output_buffer, buffer);
+}
+
+void omxcam__buffer_wrap_header (
+    OMX_BUFFERHEADERTYPE* header,
+    omxcam_buffer_t* buffer){
+  OMX_U32 flags = header->nFlags;
+  
+  buffer->data = header->pBuffer;
+  buffer->length = header->nFilledLen;
+  buffer->flags = 0;
+  
+#ifdef OMX_SKIP64BIT
+  buffer->timestamp = ((int64_t)header->nTimeStamp.nHighPart << 32) |
+      header->nTimeStamp.nLowPart;
+#else
+  buffer->timestamp = header->nTimeStamp;
+#endif
+  
+  if (flags & OMX_BUFFERFLAG_TIME_UNKNOWN) buffer->timestamp = -1;
+  
+  //The end of a frame is also the end of a NAL unit
+  if (flags & OMX_BUFFERFLAG_ENDOFFRAME){
+    buffer->flags |= OMXCAM_BUFFER_END_OF_FRAME | OMXCAM_BUFFER_END_OF_NAL;
+  }
+  if (flags & OMX_BUFFERFLAG_ENDOFNAL){
+    buffer->flags |= OMXCAM_BUFFER_END_OF_NAL;
+  }
+  if (flags & OMX_BUFFERFLAG_SYNCFRAME){
+    buffer->flags |= OMXCAM_BUFFER_KEYFRAME;
+  }
+  if (flags & OMX_BUFFERFLAG_CODECCONFIG){
+    buffer->flags |= OMXCAM_BUFFER_CODEC_CONFIG;
+  }
+  if (flags & OMX_BUFFERFLAG_CODECSIDEINFO){
+    buffer->flags |= OMXCAM_BUFFER_MOTION_VECTORS;
+  }
+  if (flags & OMX_BUFFERFLAG_EOS){
+    buffer->flags |= OMXCAM_BUFFER_END_OF_STREAM;
+  }
+}
+
 int omxcam__exit (int code){
   omxcam__ctx.state.running = 0;
   omxcam__ctx.state.joined = 0;
@@ -284,7 +344,7 @@ int omxcam__init (){
   OMX_ERRORTYPE error;
   
   if ((error = OMX_Init ())){
-    omxcam__error ("OMX_Init: %s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (0, "OMX_Init", error);
     omxcam__set_last_error (OMXCAM_ERROR_INIT);
     return -1;
   }
@@ -296,7 +356,7 @@ int omxcam__deinit (){
   OMX_ERRORTYPE error;
   
   if ((error = OMX_Deinit ())){
-    omxcam__error ("OMX_Deinit: %s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (0, "OMX_Deinit", error);
     omxcam__set_last_error (OMXCAM_ERROR_DEINIT);
     return -1;
   }
@@ -0,0 +1,303 @@
+#include "omxcam.h"
+#include "internal.h"
+
+//Values of the mask, the macroblocks are marked when they are visited
+#define OMXCAM_DETECTOR_MOVING 1
+#define OMXCAM_DETECTOR_VISITED 2
+
+static void omxcam__detector_emit (
+    omxcam_motion_detector_t* detector,
+    omxcam_motion_event_type type,
+    int64_t timestamp){
+  omxcam__trace ("motion %s", type == OMXCAM_MOTION_START ? "start" : "stop");
+  
+  if (!detector->on_event) return;
+  
+  omxcam_motion_event_t event;
+  event.type = type;
+  event.box = detector->box;
+  event.score = detector->score;
+  event.timestamp = timestamp;
+  detector->on_event (event);
+}
+
+static void omxcam__detector_union (
+    omxcam_motion_box_t* box,
+    omxcam_motion_box_t* other){
+  if (!other->width) return;
+  if (!box->width){
+    *box = *other;
+    return;
+  }
+  
+  uint32_t x1 = box->x < other->x ? box->x : other->x;
+  uint32_t y1 = box->y < other->y ? box->y : other->y;
+  uint32_t x2 = box->x + box->width > other->x + other->width
+      ? box->x + box->width
+      : other->x + other->width;
+  uint32_t y2 = box->y + box->height > other->y + other->height
+      ? box->y + box->height
+      : other->y + other->height;
+  
+  box->x = x1;
+  box->y = y1;
+  box->width = x2 - x1;
+  box->height = y2 - y1;
+}
+
+static uint32_t omxcam__detector_blob (
+    omxcam_motion_detector_t* detector,
+    uint32_t start,
+    omxcam_motion_box_t* box){
+  //Flood fill with 4-connectivity, returns the size of the blob
+  uint8_t* mask = detector->mask;
+  uint32_t* stack = detector->stack;
+  uint32_t cols = detector->cols;
+  uint32_t rows = detector->rows;
+  uint32_t top = 0;
+  uint32_t size = 0;
+  uint32_t x1 = cols;
+  uint32_t y1 = rows;
+  uint32_t x2 = 0;
+  uint32_t y2 = 0;
+  
+  //Each macroblock is pushed once, the stack has cols*rows entries
+  mask[start] = OMXCAM_DETECTOR_VISITED;
+  stack[top++] = start;
+  
+  while (top){
+    uint32_t i = stack[--top];
+    uint32_t x = i%cols;
+    uint32_t y = i/cols;
+    
+    size++;
+    if (x < x1) x1 = x;
+    if (x > x2) x2 = x;
+    if (y < y1) y1 = y;
+    if (y > y2) y2 = y;
+    
+    if (x > 0 && mask[i - 1] == OMXCAM_DETECTOR_MOVING){
+      mask[i - 1] = OMXCAM_DETECTOR_VISITED;
+      stack[top++] = i - 1;
+    }
+    if (x + 1 < cols && mask[i + 1] == OMXCAM_DETECTOR_MOVING){
+      mask[i + 1] = OMXCAM_DETECTOR_VISITED;
+      stack[top++] = i + 1;
+    }
+    if (y > 0 && mask[i - cols] == OMXCAM_DETECTOR_MOVING){
+      mask[i - cols] = OMXCAM_DETECTOR_VISITED;
+      stack[top++] = i - cols;
+    }
+    if (y + 1 < rows && mask[i + cols] == OMXCAM_DETECTOR_MOVING){
+      mask[i + cols] = OMXCAM_DETECTOR_VISITED;
+      stack[top++] = i + cols;
+    }
+  }
+  
+  box->x = x1;
+  box->y = y1;
+  box->width = x2 - x1 + 1;
+  box->height = y2 - y1 + 1;
+  
+  return size;
+}
+
+int omxcam_motion_detector_init (
+    omxcam_motion_detector_t* detector,
+    uint32_t width,
+    uint32_t height){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  memset (detector, 0, sizeof (omxcam_motion_detector_t));
+  
+  if (!width || !height){
+    omxcam__error ("invalid size");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  detector->threshold.magnitude = 4;
+  detector->threshold.sad = 0;
+  detector->min_blob = 4;
+  detector->start_frames = 3;
+  detector->stop_frames = 30;
+  detector->width = width;
+  detector->height = height;
+  detector->cols = (width + OMXCAM_MOTION_MACROBLOCK_SIZE - 1)/
+      OMXCAM_MOTION_MACROBLOCK_SIZE;
+  detector->rows = (height + OMXCAM_MOTION_MACROBLOCK_SIZE - 1)/
+      OMXCAM_MOTION_MACROBLOCK_SIZE;
+  
+  uint32_t size = detector->cols*detector->rows;
+  detector->roi = malloc (size);
+  detector->mask = malloc (size);
+  detector->stack = malloc (size*sizeof (uint32_t));
+  
+  if (!detector->roi || !detector->mask || !detector->stack){
+    omxcam__error ("malloc");
+    free (detector->roi);
+    free (detector->mask);
+    free (detector->stack);
+    omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+    return -1;
+  }
+  
+  omxcam_motion_detector_set_roi (detector, 0);
+  
+  return 0;
+}
+
+void omxcam_motion_detector_free (omxcam_motion_detector_t* detector){
+  free (detector->roi);
+  free (detector->mask);
+  free (detector->stack);
+  memset (detector, 0, sizeof (omxcam_motion_detector_t));
+}
+
+void omxcam_motion_detector_set_roi (
+    omxcam_motion_detector_t* detector,
+    uint8_t* mask){
+  uint32_t size = detector->cols*detector->rows;
+  uint32_t i;
+  
+  detector->roi_default = !mask;
+  detector->roi_size = 0;
+  
+  for (i=0; i<size; i++){
+    detector->roi[i] = !mask || mask[i];
+    detector->roi_size += detector->roi[i];
+  }
+}
+
+int omxcam_motion_detector_add_polygon (
+    omxcam_motion_detector_t* detector,
+    omxcam_motion_point_t* points,
+    uint32_t length){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (!points || length < 3){
+    omxcam__error ("invalid polygon");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  if (detector->roi_default){
+    memset (detector->roi, 0, detector->cols*detector->rows);
+    detector->roi_default = 0;
+    detector->roi_size = 0;
+  }
+  
+  uint32_t row;
+  uint32_t col;
+  uint32_t i;
+  uint32_t j;
+  
+  //Even-odd rule with the center of each macroblock
+  for (row=0; row<detector->rows; row++){
+    float y = (row + 0.5f)*OMXCAM_MOTION_MACROBLOCK_SIZE;
+    
+    for (col=0; col<detector->cols; col++){
+      float x = (col + 0.5f)*OMXCAM_MOTION_MACROBLOCK_SIZE;
+      int inside = 0;
+      
+      for (i=0, j=length - 1; i<length; j=i++){
+        float xi = points[i].x;
+        float yi = points[i].y;
+        float xj = points[j].x;
+        float yj = points[j].y;
+        
+        if ((yi > y) != (yj > y) && x < (xj - xi)*(y - yi)/(yj - yi) + xi){
+          inside = !inside;
+        }
+      }
+      
+      uint8_t* roi = &detector->roi[row*detector->cols + col];
+      if (inside && !*roi){
+        *roi = 1;
+        detector->roi_size++;
+      }
+    }
+  }
+  
+  return 0;
+}
+
+int omxcam_motion_detector_feed (
+    omxcam_motion_detector_t* detector,
+    omxcam_buffer_t buffer){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  omxcam_motion_field_t field;
+  uint32_t size = detector->cols*detector->rows;
+  uint32_t i;
+  
+  if (omxcam_motion_field (buffer, detector->width, detector->height, &field)){
+    return -1;
+  }
+  
+  omxcam_motion_threshold (&field, &detector->threshold, detector->mask);
+  
+  for (i=0; i<size; i++){
+    detector->mask[i] &= detector->roi[i];
+  }
+  
+  //The blobs smaller than 'min_blob' are noise
+  omxcam_motion_box_t box;
+  uint32_t moving = 0;
+  memset (&box, 0, sizeof (box));
+  
+  for (i=0; i<size; i++){
+    if (detector->mask[i] != OMXCAM_DETECTOR_MOVING) continue;
+    
+    omxcam_motion_box_t blob_box;
+    uint32_t blob = omxcam__detector_blob (detector, i, &blob_box);
+    
+    if (blob >= detector->min_blob){
+      moving += blob;
+      omxcam__detector_union (&box, &blob_box);
+    }
+  }
+  
+  float score = detector->roi_size ? (float)moving/detector->roi_size : 0;
+  
+  //Hysteresis, 'frames' counts the consecutive frames that contradict the
+  //current state
+  if (!detector->active){
+    if (!moving){
+      detector->frames = 0;
+      return 0;
+    }
+    
+    if (!detector->frames){
+      memset (&detector->box, 0, sizeof (omxcam_motion_box_t));
+      detector->score = 0;
+    }
+    
+    omxcam__detector_union (&detector->box, &box);
+    if (score > detector->score) detector->score = score;
+    
+    if (++detector->frames >= detector->start_frames){
+      detector->active = 1;
+      detector->frames = 0;
+      omxcam__detector_emit (detector, OMXCAM_MOTION_START, buffer.timestamp);
+    }
+    
+    return 0;
+  }
+  
+  omxcam__detector_union (&detector->box, &box);
+  if (score > detector->score) detector->score = score;
+  
+  if (moving){
+    detector->frames = 0;
+    return 0;
+  }
+  
+  if (++detector->frames >= detector->stop_frames){
+    detector->active = 0;
+    detector->frames = 0;
+    omxcam__detector_emit (detector, OMXCAM_MOTION_STOP, buffer.timestamp);
+  }
+  
+  return 0;
+}
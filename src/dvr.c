@@ -0,0 +1,350 @@
+#include "omxcam.h"
+#include "internal.h"
+
+//The data is dumped in pieces of this size, the lock is only held while each
+//piece is copied
+#define OMXCAM_DVR_SCRATCH_SIZE 65536
+
+//Bytes of the ring per entry of the frame index. The frames are usually
+//bigger, but long GOPs at low bitrates can fill the index before the ring,
+//then the oldest frames are dropped from the index and can't be dumped
+#define OMXCAM_DVR_BYTES_PER_FRAME 1024
+
+static void omxcam__dvr_read (
+    omxcam_dvr_t* dvr,
+    uint8_t* data,
+    uint64_t position,
+    uint32_t length){
+  uint32_t offset = position%dvr->size;
+  uint32_t n = dvr->size - offset;
+  
+  if (n >= length){
+    memcpy (data, dvr->arena + offset, length);
+  }else{
+    memcpy (data, dvr->arena + offset, n);
+    memcpy (data + n, dvr->arena, length - n);
+  }
+}
+
+static void omxcam__dvr_write (
+    omxcam_dvr_t* dvr,
+    uint8_t* data,
+    uint32_t length){
+  uint32_t offset = dvr->head%dvr->size;
+  uint32_t n = dvr->size - offset;
+  
+  if (n >= length){
+    memcpy (dvr->arena + offset, data, length);
+  }else{
+    memcpy (dvr->arena + offset, data, n);
+    memcpy (dvr->arena, data + n, length - n);
+  }
+  
+  dvr->head += length;
+}
+
+//Evicts the frames that are going to be overwritten by the next bytes. The
+//parameter sets of an IDR frame are stored just before it
+static void omxcam__dvr_evict (omxcam_dvr_t* dvr, uint32_t length){
+  uint64_t head = dvr->head + length;
+  
+  while (dvr->first < dvr->next){
+    omxcam_dvr_frame_t* frame = &dvr->frames[dvr->first%dvr->capacity];
+    if (head - (frame->position - frame->config_length) <= dvr->size) break;
+    dvr->first++;
+  }
+}
+
+static void omxcam__dvr_append (omxcam_dvr_t* dvr, omxcam_buffer_t* buffer){
+  omxcam_dvr_frame_t* frame;
+  
+  if (!dvr->frame_open){
+    //The index is full
+    if (dvr->next - dvr->first == dvr->capacity) dvr->first++;
+    
+    //The frames without timestamp have the time of the previous frame
+    if (buffer->timestamp != -1) dvr->last_timestamp = buffer->timestamp;
+    
+    frame = &dvr->frames[dvr->next%dvr->capacity];
+    frame->config_length = 0;
+    frame->length = 0;
+    frame->timestamp = dvr->last_timestamp;
+    frame->keyframe = !!(buffer->flags & OMXCAM_BUFFER_KEYFRAME);
+    dvr->frame_open = 1;
+    
+    //The parameter sets in effect are saved with the IDR frame, the clips
+    //that start at it are prepended with them
+    if (frame->keyframe && dvr->config_length < dvr->size){
+      omxcam__dvr_evict (dvr, dvr->config_length);
+      omxcam__dvr_write (dvr, dvr->config, dvr->config_length);
+      frame->config_length = dvr->config_length;
+    }
+    
+    frame->position = dvr->head;
+  }
+  
+  frame = &dvr->frames[dvr->next%dvr->capacity];
+  
+  if (frame->config_length + frame->length + buffer->length >= dvr->size){
+    //The frame doesn't fit in the ring, it's discarded and the rest of its
+    //buffers are ignored
+    if (frame->length < dvr->size){
+      omxcam__error ("frame too big for the ring");
+      frame->length = dvr->size;
+    }
+    dvr->frame_open = !(buffer->flags & OMXCAM_BUFFER_END_OF_FRAME);
+    return;
+  }
+  
+  omxcam__dvr_evict (dvr, buffer->length);
+  omxcam__dvr_write (dvr, buffer->data, buffer->length);
+  frame->length += buffer->length;
+  
+  if (buffer->flags & OMXCAM_BUFFER_END_OF_FRAME){
+    dvr->frame_open = 0;
+    dvr->next++;
+  }
+}
+
+static int omxcam__dvr_lock (omxcam_dvr_t* dvr){
+  if (pthread_mutex_lock (&dvr->mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    omxcam__set_last_error (OMXCAM_ERROR_DVR);
+    return -1;
+  }
+  return 0;
+}
+
+static int omxcam__dvr_unlock (omxcam_dvr_t* dvr){
+  if (pthread_mutex_unlock (&dvr->mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    omxcam__set_last_error (OMXCAM_ERROR_DVR);
+    return -1;
+  }
+  return 0;
+}
+
+int omxcam_dvr_init (omxcam_dvr_t* dvr, uint32_t size){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  memset (dvr, 0, sizeof (omxcam_dvr_t));
+  
+  if (!size){
+    omxcam__error ("invalid size");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  dvr->size = size;
+  dvr->capacity = size/OMXCAM_DVR_BYTES_PER_FRAME + 64;
+  dvr->last_timestamp = -1;
+  dvr->arena = malloc (size);
+  dvr->frames = malloc (dvr->capacity*sizeof (omxcam_dvr_frame_t));
+  dvr->scratch = malloc (OMXCAM_DVR_SCRATCH_SIZE);
+  
+  if (!dvr->arena || !dvr->frames || !dvr->scratch){
+    omxcam__error ("malloc");
+    free (dvr->arena);
+    free (dvr->frames);
+    free (dvr->scratch);
+    omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+    return -1;
+  }
+  
+  if (pthread_mutex_init (&dvr->mutex, 0)){
+    omxcam__error ("pthread_mutex_init");
+    free (dvr->arena);
+    free (dvr->frames);
+    free (dvr->scratch);
+    omxcam__set_last_error (OMXCAM_ERROR_DVR);
+    return -1;
+  }
+  
+  return 0;
+}
+
+void omxcam_dvr_free (omxcam_dvr_t* dvr){
+  if (pthread_mutex_destroy (&dvr->mutex)){
+    omxcam__error ("pthread_mutex_destroy");
+  }
+  free (dvr->arena);
+  free (dvr->frames);
+  free (dvr->scratch);
+  memset (dvr, 0, sizeof (omxcam_dvr_t));
+}
+
+int omxcam_dvr_feed (omxcam_dvr_t* dvr, omxcam_buffer_t buffer){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  //The motion vectors are not part of the h264 stream
+  if (buffer.flags & OMXCAM_BUFFER_MOTION_VECTORS) return 0;
+  
+  if (omxcam__dvr_lock (dvr)) return -1;
+  
+  int error = 0;
+  
+  if (buffer.flags & OMXCAM_BUFFER_CODEC_CONFIG){
+    //The parameter sets are kept apart until the next IDR frame, which stores
+    //a copy of them. A new group of parameter sets replaces the previous one
+    if (dvr->config_complete){
+      dvr->config_complete = 0;
+      dvr->config_length = 0;
+    }
+    if (dvr->config_length + buffer.length > sizeof (dvr->config)){
+      omxcam__error ("parameter sets too big");
+      error = 1;
+    }else{
+      memcpy (dvr->config + dvr->config_length, buffer.data, buffer.length);
+      dvr->config_length += buffer.length;
+    }
+  }else{
+    dvr->config_complete = 1;
+    omxcam__dvr_append (dvr, &buffer);
+  }
+  
+  if (omxcam__dvr_unlock (dvr)) return -1;
+  
+  if (error){
+    omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+    return -1;
+  }
+  
+  return 0;
+}
+
+static void omxcam__dvr_emit (
+    void (*on_data)(omxcam_buffer_t buffer),
+    uint8_t* data,
+    uint32_t length,
+    uint32_t flags,
+    int64_t timestamp){
+  omxcam_buffer_t buffer;
+  buffer.data = data;
+  buffer.length = length;
+  buffer.flags = flags;
+  buffer.timestamp = timestamp;
+  on_data (buffer);
+}
+
+static int omxcam__dvr_dump_frames (
+    omxcam_dvr_t* dvr,
+    uint64_t start,
+    uint64_t end,
+    void (*on_data)(omxcam_buffer_t buffer)){
+  uint64_t i;
+  
+  for (i=start; i<end; i++){
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    omxcam_dvr_frame_t frame;
+    
+    do {
+      if (omxcam__dvr_lock (dvr)) return -1;
+      
+      //The frame can be overwritten while the previous pieces are emitted
+      int overwritten = i < dvr->first;
+      frame = dvr->frames[i%dvr->capacity];
+      
+      if (!overwritten){
+        length = frame.length - offset;
+        if (length > OMXCAM_DVR_SCRATCH_SIZE) length = OMXCAM_DVR_SCRATCH_SIZE;
+        omxcam__dvr_read (dvr, dvr->scratch, frame.position + offset, length);
+      }
+      
+      if (omxcam__dvr_unlock (dvr)) return -1;
+      
+      if (overwritten){
+        omxcam__error ("frame overwritten while dumping");
+        omxcam__set_last_error (OMXCAM_ERROR_DVR);
+        return -1;
+      }
+      
+      offset += length;
+      
+      uint32_t flags = frame.keyframe ? OMXCAM_BUFFER_KEYFRAME : 0;
+      if (offset == frame.length){
+        flags |= OMXCAM_BUFFER_END_OF_FRAME | OMXCAM_BUFFER_END_OF_NAL;
+      }
+      
+      omxcam__dvr_emit (on_data, dvr->scratch, length, flags,
+          frame.timestamp);
+    } while (offset < frame.length);
+  }
+  
+  return 0;
+}
+
+int omxcam_dvr_dump (
+    omxcam_dvr_t* dvr,
+    uint32_t seconds,
+    void (*on_data)(omxcam_buffer_t buffer)){
+  omxcam__trace ("dumping the last %d seconds", seconds);
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  uint8_t config[sizeof (dvr->config)];
+  uint32_t config_length = 0;
+  uint64_t start = 0;
+  uint64_t end = 0;
+  int found = 0;
+  int busy;
+  
+  if (omxcam__dvr_lock (dvr)) return -1;
+  
+  //The scratch buffer is shared
+  busy = dvr->dumping;
+  
+  if (!busy && dvr->first < dvr->next){
+    //Search the nearest IDR frame before the requested time, or the oldest
+    //one if the ring doesn't contain the requested seconds
+    int64_t time = dvr->frames[(dvr->next - 1)%dvr->capacity].timestamp -
+        (int64_t)seconds*1000000;
+    uint64_t i = dvr->next;
+    
+    while (i-- > dvr->first){
+      omxcam_dvr_frame_t* frame = &dvr->frames[i%dvr->capacity];
+      if (!frame->keyframe) continue;
+      start = i;
+      found = 1;
+      if (frame->timestamp <= time) break;
+    }
+    
+    //The frames recorded after this call are not included, the parameter sets
+    //are the ones in effect at the first frame
+    end = dvr->next;
+    if (found){
+      omxcam_dvr_frame_t* frame = &dvr->frames[start%dvr->capacity];
+      config_length = frame->config_length;
+      omxcam__dvr_read (dvr, config, frame->position - config_length,
+          config_length);
+    }
+    dvr->dumping = found;
+  }
+  
+  if (omxcam__dvr_unlock (dvr)) return -1;
+  
+  if (busy){
+    omxcam__error ("already dumping");
+    omxcam__set_last_error (OMXCAM_ERROR_DVR);
+    return -1;
+  }
+  
+  if (!found){
+    omxcam__error ("there are no IDR frames");
+    omxcam__set_last_error (OMXCAM_ERROR_DVR);
+    return -1;
+  }
+  
+  if (config_length){
+    omxcam__dvr_emit (on_data, config, config_length,
+        OMXCAM_BUFFER_CODEC_CONFIG | OMXCAM_BUFFER_END_OF_NAL, -1);
+  }
+  
+  int error = omxcam__dvr_dump_frames (dvr, start, end, on_data);
+  
+  if (omxcam__dvr_lock (dvr)) return -1;
+  dvr->dumping = 0;
+  if (omxcam__dvr_unlock (dvr)) return -1;
+  
+  return error;
+}
@@ -0,0 +1,684 @@
+#include "omxcam.h"
+#include "internal.h"
+
+//Input buffers that are not being encoded, returned by EmptyBufferDone
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static OMX_BUFFERHEADERTYPE* buffers[OMXCAM_ENCODE_MAX_BUFFERS];
+static OMX_BUFFERHEADERTYPE* free_buffers[OMXCAM_ENCODE_MAX_BUFFERS];
+static uint32_t buffers_count;
+static uint32_t free_count;
+
+static int started = 0;
+static int no_pthread;
+static int bg_error;
+static int aborted;
+static omxcam_error_details_t bg_error_details;
+static pthread_t bg_thread;
+static void (*on_data)(omxcam_buffer_t buffer);
+static uint32_t width;
+static uint32_t height;
+static omxcam_yuv_planes_t planes;
+
+void omxcam__encode_buffer_done (OMX_BUFFERHEADERTYPE* buffer){
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return;
+  }
+  
+  free_buffers[free_count++] = buffer;
+  
+  if (pthread_cond_signal (&cond)){
+    omxcam__error ("pthread_cond_signal");
+  }
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+  }
+}
+
+static void omxcam__encode_handle_error (){
+  omxcam__trace ("error while encoding");
+  
+  omxcam_error_details_t details;
+  omxcam_last_error_details (&details);
+  details.error = OMXCAM_ERROR_CAPTURE;
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return;
+  }
+  
+  //The threads that are waiting for an input buffer need to fail too, the
+  //encoder doesn't consume them anymore
+  bg_error = -1;
+  bg_error_details = details;
+  
+  if (pthread_cond_broadcast (&cond)){
+    omxcam__error ("pthread_cond_broadcast");
+  }
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+  }
+}
+
+static OMX_BUFFERHEADERTYPE* omxcam__encode_take_buffer (){
+  OMX_BUFFERHEADERTYPE* buffer = 0;
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return 0;
+  }
+  
+  //Spurious wakeup guard
+  while (!free_count && !bg_error){
+    if (pthread_cond_wait (&cond, &mutex)){
+      omxcam__error ("pthread_cond_wait");
+      omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+      pthread_mutex_unlock (&mutex);
+      return 0;
+    }
+  }
+  
+  if (bg_error){
+    omxcam__set_last_error_details (&bg_error_details);
+  }else{
+    buffer = free_buffers[--free_count];
+  }
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return 0;
+  }
+  
+  return buffer;
+}
+
+static void omxcam__encode_copy_plane (
+    uint8_t* dst,
+    uint32_t dst_stride,
+    uint8_t* src,
+    uint32_t src_stride,
+    uint32_t row_length,
+    uint32_t rows){
+  if (dst_stride == src_stride){
+    memcpy (dst, src, src_stride*rows);
+    return;
+  }
+  
+  uint32_t row;
+  for (row=0; row<rows; row++){
+    memcpy (dst, src, row_length);
+    dst += dst_stride;
+    src += src_stride;
+  }
+}
+
+static void* omxcam__encode_output (void* thread_arg){
+  //The return value is not needed
+  
+  OMX_ERRORTYPE error;
+  omxcam_buffer_t buffer;
+  
+  do{
+    if ((error = OMX_FillThisBuffer (omxcam__ctx.video_encode.handle,
+        omxcam__ctx.output_buffer))){
+      omxcam__omx_error (&omxcam__ctx.video_encode, "OMX_FillThisBuffer",
+          error);
+      omxcam__encode_handle_error ();
+      return (void*)0;
+    }
+    
+    //Wait until it's filled
+    if (omxcam__event_wait (&omxcam__ctx.video_encode,
+        OMXCAM_EVENT_FILL_BUFFER_DONE, 0, 0)){
+      omxcam__encode_handle_error ();
+      return (void*)0;
+    }
+    
+    if (aborted) break;
+    
+    omxcam__buffer_wrap (&buffer);
+    
+    //The buffers are filled even if there's no callback
+    if (on_data && buffer.length) on_data (buffer);
+  }while (!(buffer.flags & OMXCAM_BUFFER_END_OF_STREAM));
+  
+  omxcam__trace ("exit thread");
+  
+  return (void*)0;
+}
+
+static int omxcam__encode_change_state (omxcam__state state){
+  if (omxcam__component_change_state (&omxcam__ctx.video_encode, state)){
+    return -1;
+  }
+  if (omxcam__event_wait (&omxcam__ctx.video_encode, OMXCAM_EVENT_STATE_SET,
+      0, 0)){
+    return -1;
+  }
+  
+  return 0;
+}
+
+static int omxcam__encode_alloc_buffers (uint32_t size){
+  OMX_ERRORTYPE error;
+  uint32_t i;
+  
+  free_count = 0;
+  
+  for (i=0; i<buffers_count; i++){
+    if ((error = OMX_AllocateBuffer (omxcam__ctx.video_encode.handle,
+        &buffers[i], 200, 0, size))){
+      omxcam__omx_error (&omxcam__ctx.video_encode, "OMX_AllocateBuffer",
+          error);
+      buffers_count = i;
+      return -1;
+    }
+    free_buffers[free_count++] = buffers[i];
+  }
+  
+  return 0;
+}
+
+static int omxcam__encode_free_buffers (){
+  OMX_ERRORTYPE error;
+  uint32_t i;
+  
+  for (i=0; i<buffers_count; i++){
+    if ((error = OMX_FreeBuffer (omxcam__ctx.video_encode.handle, 200,
+        buffers[i]))){
+      omxcam__omx_error (&omxcam__ctx.video_encode, "OMX_FreeBuffer", error);
+      return -1;
+    }
+  }
+  
+  buffers_count = 0;
+  free_count = 0;
+  
+  return 0;
+}
+
+static int omxcam__encode_omx_init (omxcam_encode_settings_t* settings){
+  omxcam__trace ("initializing encoder");
+  
+  OMX_ERRORTYPE error;
+  
+  //The camera is not used, it doesn't need to be checked
+  omxcam__ctx.video_encode.name = OMXCAM_VIDEO_ENCODE_NAME;
+  
+  bcm_host_init ();
+  
+  if ((error = OMX_Init ())){
+    omxcam__omx_error (0, "OMX_Init", error);
+    omxcam__set_last_error (OMXCAM_ERROR_INIT);
+    return -1;
+  }
+  
+  if (omxcam__component_init (&omxcam__ctx.video_encode)){
+    omxcam__set_last_error (OMXCAM_ERROR_INIT_VIDEO_ENCODER);
+    return -1;
+  }
+  
+  omxcam__trace ("%dx%d @%dfps", settings->width, settings->height,
+      settings->framerate);
+  
+  width = settings->width;
+  height = settings->height;
+  omxcam_yuv_planes (width, height, &planes);
+  
+  //Configure the input port definition, the frames are copied to the buffers
+  //with the same layout as the yuv frames of the camera
+  omxcam__trace ("configuring '%s' port definition",
+      omxcam__ctx.video_encode.name);
+  
+  OMX_PARAM_PORTDEFINITIONTYPE port_st;
+  omxcam__omx_struct_init (port_st);
+  port_st.nPortIndex = 200;
+  if ((error = OMX_GetParameter (omxcam__ctx.video_encode.handle,
+      OMX_IndexParamPortDefinition, &port_st))){
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_GetParameter - OMX_IndexParamPortDefinition", error);
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  port_st.format.video.nFrameWidth = width;
+  port_st.format.video.nFrameHeight = height;
+  port_st.format.video.nStride = omxcam_round (width, 32);
+  port_st.format.video.nSliceHeight = omxcam_round (height, 16);
+  port_st.format.video.xFramerate = settings->framerate << 16;
+  port_st.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+  port_st.format.video.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
+  port_st.nBufferCountActual = settings->buffers;
+  if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
+      OMX_IndexParamPortDefinition, &port_st))){
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_SetParameter - OMX_IndexParamPortDefinition", error);
+    omxcam__set_last_error (error == OMX_ErrorBadParameter
+        ? OMXCAM_ERROR_BAD_PARAMETER
+        : OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  //The size of the buffers is updated by the component
+  if ((error = OMX_GetParameter (omxcam__ctx.video_encode.handle,
+      OMX_IndexParamPortDefinition, &port_st))){
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_GetParameter - OMX_IndexParamPortDefinition", error);
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  //The component can increase the number of buffers up to its minimum
+  if (port_st.nBufferCountActual > OMXCAM_ENCODE_MAX_BUFFERS){
+    omxcam__error ("too many input buffers: %d", port_st.nBufferCountActual);
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  uint32_t buffer_size = port_st.nBufferSize;
+  buffers_count = port_st.nBufferCountActual;
+  
+  //Configure the output port definition
+  omxcam__omx_struct_init (port_st);
+  port_st.nPortIndex = 201;
+  if ((error = OMX_GetParameter (omxcam__ctx.video_encode.handle,
+      OMX_IndexParamPortDefinition, &port_st))){
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_GetParameter - OMX_IndexParamPortDefinition", error);
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  port_st.format.video.nFrameWidth = width;
+  port_st.format.video.nFrameHeight = height;
+  port_st.format.video.xFramerate = settings->framerate << 16;
+  port_st.format.video.nStride = omxcam_round (width, 32);
+  //Despite being configured later, these two fields need to be set now
+  port_st.format.video.nBitrate = settings->h264.qp.enabled
+      ? 0
+      : settings->h264.bitrate;
+  port_st.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
+  if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
+      OMX_IndexParamPortDefinition, &port_st))){
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_SetParameter - OMX_IndexParamPortDefinition", error);
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  if (omxcam__h264_configure_omx (&settings->h264)){
+    omxcam__set_last_error (OMXCAM_ERROR_H264);
+    return -1;
+  }
+  
+  //Change to Idle
+  if (omxcam__encode_change_state (OMXCAM_STATE_IDLE)){
+    omxcam__set_last_error (OMXCAM_ERROR_IDLE);
+    return -1;
+  }
+  
+  //Enable the ports
+  if (omxcam__component_port_enable (&omxcam__ctx.video_encode, 200)){
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  if (omxcam__encode_alloc_buffers (buffer_size)){
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  if (omxcam__event_wait (&omxcam__ctx.video_encode, OMXCAM_EVENT_PORT_ENABLE,
+      0, 0)){
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  if (omxcam__component_port_enable (&omxcam__ctx.video_encode, 201)){
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  if (omxcam__buffer_alloc (&omxcam__ctx.video_encode, 201)){
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  if (omxcam__event_wait (&omxcam__ctx.video_encode, OMXCAM_EVENT_PORT_ENABLE,
+      0, 0)){
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  //Change to Executing
+  if (omxcam__encode_change_state (OMXCAM_STATE_EXECUTING)){
+    omxcam__set_last_error (OMXCAM_ERROR_EXECUTING);
+    return -1;
+  }
+  
+  return 0;
+}
+
+static int omxcam__encode_omx_deinit (){
+  omxcam__trace ("deinitializing encoder");
+  
+  //Change to Idle, the component returns all the buffers
+  if (omxcam__encode_change_state (OMXCAM_STATE_IDLE)){
+    omxcam__set_last_error (OMXCAM_ERROR_IDLE);
+    return -1;
+  }
+  
+  //Disable the ports
+  if (omxcam__component_port_disable (&omxcam__ctx.video_encode, 200)){
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  if (omxcam__encode_free_buffers ()){
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  if (omxcam__event_wait (&omxcam__ctx.video_encode,
+      OMXCAM_EVENT_PORT_DISABLE, 0, 0)){
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  if (omxcam__component_port_disable (&omxcam__ctx.video_encode, 201)){
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  if (omxcam__buffer_free (&omxcam__ctx.video_encode, 201)){
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  if (omxcam__event_wait (&omxcam__ctx.video_encode,
+      OMXCAM_EVENT_PORT_DISABLE, 0, 0)){
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  //Change to Loaded
+  if (omxcam__encode_change_state (OMXCAM_STATE_LOADED)){
+    omxcam__set_last_error (OMXCAM_ERROR_LOADED);
+    return -1;
+  }
+  
+  if (omxcam__component_deinit (&omxcam__ctx.video_encode)){
+    omxcam__set_last_error (OMXCAM_ERROR_DEINIT_VIDEO_ENCODER);
+    return -1;
+  }
+  
+  if (omxcam__deinit ()) return -1;
+  
+  return 0;
+}
+
+static int omxcam__encode_exit (int code){
+  started = 0;
+  return no_pthread ? omxcam__exit_npt (code) : omxcam__exit (code);
+}
+
+static int omxcam__encode_check (int npt){
+  if (!started){
+    omxcam__error ("encoder is not running");
+    omxcam__set_last_error (OMXCAM_ERROR_ENCODER_NOT_RUNNING);
+    return -1;
+  }
+  
+  if (npt && !no_pthread){
+    omxcam__error ("encoder hasn't been started in 'no pthread' mode");
+    omxcam__set_last_error (OMXCAM_ERROR_NOT_NO_PTHREAD);
+    return -1;
+  }
+  
+  if (!npt && no_pthread){
+    omxcam__error ("encoder has been started in 'no pthread' mode");
+    omxcam__set_last_error (OMXCAM_ERROR_NO_PTHREAD);
+    return -1;
+  }
+  
+  return 0;
+}
+
+void omxcam_encode_init (omxcam_encode_settings_t* settings){
+  omxcam__h264_init (&settings->h264);
+  settings->width = OMXCAM_VIDEO_MAX_WIDTH;
+  settings->height = OMXCAM_VIDEO_MAX_HEIGHT;
+  settings->framerate = 30;
+  settings->buffers = 3;
+  settings->on_data = 0;
+}
+
+static int omxcam__encode_validate (omxcam_encode_settings_t* settings){
+  if (settings->width < OMXCAM_MIN_WIDTH ||
+      settings->width > OMXCAM_VIDEO_MAX_WIDTH || (settings->width & 1)){
+    omxcam__error ("invalid 'width' value");
+    return -1;
+  }
+  if (settings->height < OMXCAM_MIN_HEIGHT ||
+      settings->height > OMXCAM_VIDEO_MAX_HEIGHT || (settings->height & 1)){
+    omxcam__error ("invalid 'height' value");
+    return -1;
+  }
+  if (!settings->framerate){
+    omxcam__error ("invalid 'framerate' value");
+    return -1;
+  }
+  if (settings->buffers < 1 || settings->buffers > OMXCAM_ENCODE_MAX_BUFFERS){
+    omxcam__error ("invalid 'buffers' value");
+    return -1;
+  }
+  if (omxcam__h264_validate (&settings->h264)) return -1;
+  return 0;
+}
+
+static int omxcam__encode_start (omxcam_encode_settings_t* settings, int npt){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  //The encoder is shared with the video capture
+  if (omxcam__ctx.state.running){
+    omxcam__error ("camera is already running");
+    omxcam__set_last_error (OMXCAM_ERROR_CAMERA_RUNNING);
+    return -1;
+  }
+  
+  if (omxcam__encode_validate (settings)){
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  omxcam__ctx.no_pthread = npt;
+  omxcam__ctx.state.running = 1;
+  omxcam__ctx.video = 0;
+  omxcam__ctx.h264 = 0;
+  omxcam__ctx.on_stop = 0;
+  
+  started = 1;
+  no_pthread = npt;
+  bg_error = 0;
+  aborted = 0;
+  on_data = settings->on_data;
+  
+  if (omxcam__encode_omx_init (settings)) return omxcam__encode_exit (-1);
+  
+  if (!npt){
+    omxcam__trace ("creating background thread");
+    
+    if (pthread_create (&bg_thread, 0, omxcam__encode_output, 0)){
+      omxcam__error ("pthread_create");
+      omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+      omxcam__encode_omx_deinit ();
+      return omxcam__encode_exit (-1);
+    }
+  }
+  
+  omxcam__ctx.state.ready = 1;
+  
+  return 0;
+}
+
+int omxcam_encode_start (omxcam_encode_settings_t* settings){
+  omxcam__trace ("starting encoder");
+  return omxcam__encode_start (settings, 0);
+}
+
+int omxcam_encode_start_npt (omxcam_encode_settings_t* settings){
+  omxcam__trace ("starting encoder (no pthread)");
+  return omxcam__encode_start (settings, 1);
+}
+
+int omxcam_encode_frame (omxcam_yuv_frame_t* frame, int64_t timestamp){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (!started){
+    omxcam__error ("encoder is not running");
+    omxcam__set_last_error (OMXCAM_ERROR_ENCODER_NOT_RUNNING);
+    return -1;
+  }
+  
+  //Blocks until the encoder returns an input buffer, the other buffers are
+  //still being encoded
+  OMX_BUFFERHEADERTYPE* buffer = omxcam__encode_take_buffer ();
+  if (!buffer) return -1;
+  
+  uint32_t stride = frame->stride ? frame->stride : width;
+  uint32_t dst_stride = omxcam_round (width, 32);
+  
+  omxcam__encode_copy_plane (buffer->pBuffer + planes.offset_y, dst_stride,
+      frame->y, stride, width, height);
+  omxcam__encode_copy_plane (buffer->pBuffer + planes.offset_u,
+      dst_stride >> 1, frame->u, stride >> 1, width >> 1, height >> 1);
+  omxcam__encode_copy_plane (buffer->pBuffer + planes.offset_v,
+      dst_stride >> 1, frame->v, stride >> 1, width >> 1, height >> 1);
+  
+  buffer->nOffset = 0;
+  buffer->nFilledLen = planes.offset_v + planes.length_v;
+  buffer->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
+  
+  if (timestamp == -1){
+    buffer->nFlags |= OMX_BUFFERFLAG_TIME_UNKNOWN;
+    timestamp = 0;
+  }
+  
+#ifdef OMX_SKIP64BIT
+  buffer->nTimeStamp.nLowPart = timestamp;
+  buffer->nTimeStamp.nHighPart = timestamp >> 32;
+#else
+  buffer->nTimeStamp = timestamp;
+#endif
+  
+  OMX_ERRORTYPE error;
+  
+  if ((error = OMX_EmptyThisBuffer (omxcam__ctx.video_encode.handle,
+      buffer))){
+    omxcam__omx_error (&omxcam__ctx.video_encode, "OMX_EmptyThisBuffer",
+        error);
+    omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
+    omxcam__encode_buffer_done (buffer);
+    return -1;
+  }
+  
+  return 0;
+}
+
+int omxcam_encode_read_npt (omxcam_buffer_t* buffer){
+  omxcam__trace ("reading buffer (no pthread)");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__encode_check (1)) return -1;
+  
+  OMX_ERRORTYPE error;
+  
+  if ((error = OMX_FillThisBuffer (omxcam__ctx.video_encode.handle,
+      omxcam__ctx.output_buffer))){
+    omxcam__omx_error (&omxcam__ctx.video_encode, "OMX_FillThisBuffer",
+        error);
+    omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
+    return -1;
+  }
+  
+  //Wait until it's filled
+  if (omxcam__event_wait (&omxcam__ctx.video_encode,
+      OMXCAM_EVENT_FILL_BUFFER_DONE, 0, 0)){
+    omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
+    return -1;
+  }
+  
+  omxcam__buffer_wrap (buffer);
+  
+  return 0;
+}
+
+int omxcam_encode_stop (){
+  omxcam__trace ("stopping encoder");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__encode_check (0)) return -1;
+  
+  if (omxcam__ctx.state.stopping){
+    omxcam__error ("encoder is already being stopped");
+    omxcam__set_last_error (OMXCAM_ERROR_CAMERA_STOPPING);
+    return -1;
+  }
+  
+  omxcam__ctx.state.stopping = 1;
+  omxcam__ctx.state.ready = 0;
+  
+  //An empty buffer with the end of stream flag, the encoder emits the pending
+  //frames and then the output thread finishes
+  OMX_BUFFERHEADERTYPE* buffer = omxcam__encode_take_buffer ();
+  int error = buffer ? 0 : -1;
+  
+  if (buffer){
+    OMX_ERRORTYPE omx_error;
+    
+    buffer->nOffset = 0;
+    buffer->nFilledLen = 0;
+    buffer->nFlags = OMX_BUFFERFLAG_EOS | OMX_BUFFERFLAG_TIME_UNKNOWN;
+    
+    if ((omx_error = OMX_EmptyThisBuffer (omxcam__ctx.video_encode.handle,
+        buffer))){
+      omxcam__omx_error (&omxcam__ctx.video_encode, "OMX_EmptyThisBuffer",
+          omx_error);
+      omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
+      error = -1;
+    }
+  }
+  
+  if (error){
+    //The end of stream won't arrive, the output thread is woken up manually.
+    //If it has already finished due to an error the event is ignored
+    aborted = 1;
+    if (omxcam__event_wake (&omxcam__ctx.video_encode,
+        OMXCAM_EVENT_FILL_BUFFER_DONE, OMX_ErrorNone)){
+      omxcam__error ("cannot wake the output thread");
+    }
+  }
+  
+  if (pthread_join (bg_thread, 0)){
+    omxcam__error ("pthread_join");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return omxcam__encode_exit (-1);
+  }
+  
+  //The details of the first error are reported
+  if (error){
+    omxcam_error_details_t details;
+    omxcam_last_error_details (&details);
+    omxcam__encode_omx_deinit ();
+    omxcam__set_last_error_details (&details);
+    return omxcam__encode_exit (-1);
+  }
+  
+  return omxcam__encode_exit (omxcam__encode_omx_deinit ());
+}
+
+int omxcam_encode_stop_npt (){
+  omxcam__trace ("stopping encoder (no pthread)");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__encode_check (1)) return -1;
+  
+  //The frames that haven't been read are discarded
+  return omxcam__encode_exit (omxcam__encode_omx_deinit ());
+}
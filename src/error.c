@@ -1,7 +1,14 @@
 #include "omxcam.h"
 #include "internal.h"
 
-static omxcam_errno last_error = OMXCAM_ERROR_NONE;
+//Each thread has its own error state
+static __thread omxcam_error_details_t last_error = {
+  OMXCAM_ERROR_NONE, 0, OMX_ErrorNone, 0
+};
+
+//The OpenMAX IL details saved by omxcam__set_omx_error() that are not yet
+//attached to an error. The error is set afterwards by the caller
+static __thread int omx_error_pending = 0;
 
 void omxcam__error_ (
     const char* fmt,
@@ -44,14 +51,43 @@ const char* omxcam_strerror (omxcam_errno error){
 #undef OMXCAM_STRERROR_FN
 
 omxcam_errno omxcam_last_error (){
-  return last_error;
+  return last_error.error;
+}
+
+void omxcam_last_error_details (omxcam_error_details_t* details){
+  *details = last_error;
 }
 
 void omxcam__set_last_error (omxcam_errno error){
-  last_error = error;
+  //The details belong to the error set right after the failed call. A new
+  //error without them, or the reset, must not report the details of an older
+  //failure
+  if (!omx_error_pending || error == OMXCAM_ERROR_NONE){
+    last_error.omx_call = 0;
+    last_error.omx_error = OMX_ErrorNone;
+    last_error.component = 0;
+  }
+  
+  last_error.error = error;
+  omx_error_pending = 0;
+}
+
+void omxcam__set_omx_error (
+    omxcam__component_t* component,
+    const char* call,
+    OMX_ERRORTYPE error){
+  last_error.omx_call = call;
+  last_error.omx_error = error;
+  last_error.component = component ? component->name : 0;
+  omx_error_pending = 1;
+}
+
+void omxcam__set_last_error_details (omxcam_error_details_t* details){
+  last_error = *details;
+  omx_error_pending = 0;
 }
 
 void omxcam_perror (){
-  fprintf (stderr, "omxcam: %s: %s\n", omxcam_error_name (last_error),
-      omxcam_strerror (last_error));
+  fprintf (stderr, "omxcam: %s: %s\n", omxcam_error_name (last_error.error),
+      omxcam_strerror (last_error.error));
 }
\ No newline at end of file
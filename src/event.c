@@ -95,6 +95,8 @@ int omxcam__event_wait (
   
   if (flags & OMXCAM_EVENT_ERROR){
     //omxcam__error() was called from the EventHandler
+    omxcam__set_omx_error (component, "OMX_EventError",
+        component->event.omx_error);
     if (omx_error){
       *omx_error = component->event.omx_error;
     }
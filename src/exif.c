@@ -0,0 +1,384 @@
+#include "omxcam.h"
+#include "internal.h"
+
+//States of the editor
+#define OMXCAM_EXIF_HEADER 0
+#define OMXCAM_EXIF_BODY 1
+
+//Exif identifier of the APP1 segment, followed by the TIFF header
+#define OMXCAM_EXIF_ID_LENGTH 6
+
+//TIFF tags
+#define OMXCAM_EXIF_TAG_EXIF_IFD 0x8769
+#define OMXCAM_EXIF_TAG_GPS_IFD 0x8825
+#define OMXCAM_EXIF_TAG_THUMBNAIL_OFFSET 0x0201
+#define OMXCAM_EXIF_TAG_THUMBNAIL_LENGTH 0x0202
+#define OMXCAM_EXIF_TYPE_ASCII 2
+
+static uint8_t exif_id[] = { 'E', 'x', 'i', 'f', 0, 0 };
+
+//The TIFF data of the APP1 segment, the offsets are relative to its beginning
+typedef struct {
+  uint8_t* data;
+  uint32_t length;
+  int big_endian;
+} omxcam__tiff_t;
+
+static uint16_t omxcam__tiff_u16 (omxcam__tiff_t* tiff, uint32_t offset){
+  uint8_t* p = tiff->data + offset;
+  return tiff->big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static uint32_t omxcam__tiff_u32 (omxcam__tiff_t* tiff, uint32_t offset){
+  uint8_t* p = tiff->data + offset;
+  return tiff->big_endian
+      ? ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+      : ((uint32_t)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+static int omxcam__tiff_contains (
+    omxcam__tiff_t* tiff,
+    uint32_t offset,
+    uint32_t length){
+  return offset <= tiff->length && length <= tiff->length - offset;
+}
+
+static void omxcam__exif_patch_entry (
+    omxcam_exif_editor_t* editor,
+    omxcam__tiff_t* tiff,
+    uint32_t entry){
+  uint16_t tag = omxcam__tiff_u16 (tiff, entry);
+  uint32_t count = omxcam__tiff_u32 (tiff, entry + 4);
+  uint32_t i;
+  
+  if (omxcam__tiff_u16 (tiff, entry + 2) != OMXCAM_EXIF_TYPE_ASCII || !count){
+    return;
+  }
+  
+  for (i=0; i<editor->valid_entries; i++){
+    if (editor->entries[i].tag != tag) continue;
+    
+    //The values of up to 4 bytes are stored in the entry
+    uint32_t offset = count <= 4
+        ? entry + 8
+        : omxcam__tiff_u32 (tiff, entry + 8);
+    if (!omxcam__tiff_contains (tiff, offset, count)) return;
+    
+    //The value is overwritten in place, it can't grow
+    uint32_t length = strlen (editor->entries[i].value);
+    if (length > count - 1){
+      omxcam__trace ("exif tag %04X truncated to %d bytes", tag, count - 1);
+      length = count - 1;
+    }
+    
+    memcpy (tiff->data + offset, editor->entries[i].value, length);
+    memset (tiff->data + offset + length, 0, count - length);
+    return;
+  }
+}
+
+static uint32_t omxcam__exif_patch_ifd (
+    omxcam_exif_editor_t* editor,
+    omxcam__tiff_t* tiff,
+    uint32_t ifd,
+    int sub_ifds){
+  if (!omxcam__tiff_contains (tiff, ifd, 2)) return 0;
+  
+  uint16_t entries = omxcam__tiff_u16 (tiff, ifd);
+  if (!omxcam__tiff_contains (tiff, ifd + 2, entries*12 + 4)) return 0;
+  
+  uint32_t entry = ifd + 2;
+  uint16_t i;
+  
+  for (i=0; i<entries; i++, entry += 12){
+    uint16_t tag = omxcam__tiff_u16 (tiff, entry);
+    
+    //The Exif and GPS IFDs are only linked from IFD0
+    if (sub_ifds && (tag == OMXCAM_EXIF_TAG_EXIF_IFD ||
+        tag == OMXCAM_EXIF_TAG_GPS_IFD)){
+      omxcam__exif_patch_ifd (editor, tiff, omxcam__tiff_u32 (tiff, entry + 8),
+          0);
+      continue;
+    }
+    
+    omxcam__exif_patch_entry (editor, tiff, entry);
+  }
+  
+  //Offset of the next IFD
+  return omxcam__tiff_u32 (tiff, entry);
+}
+
+static void omxcam__exif_find_thumbnail (
+    omxcam_exif_editor_t* editor,
+    omxcam__tiff_t* tiff,
+    uint32_t ifd){
+  if (!ifd || !omxcam__tiff_contains (tiff, ifd, 2)) return;
+  
+  uint16_t entries = omxcam__tiff_u16 (tiff, ifd);
+  if (!omxcam__tiff_contains (tiff, ifd + 2, entries*12)) return;
+  
+  uint32_t entry = ifd + 2;
+  uint32_t offset = 0;
+  uint32_t length = 0;
+  uint16_t i;
+  
+  for (i=0; i<entries; i++, entry += 12){
+    uint16_t tag = omxcam__tiff_u16 (tiff, entry);
+    if (tag == OMXCAM_EXIF_TAG_THUMBNAIL_OFFSET){
+      offset = omxcam__tiff_u32 (tiff, entry + 8);
+    }else if (tag == OMXCAM_EXIF_TAG_THUMBNAIL_LENGTH){
+      length = omxcam__tiff_u32 (tiff, entry + 8);
+    }
+  }
+  
+  if (!length || !omxcam__tiff_contains (tiff, offset, length)) return;
+  
+  //The APP1 segment is not moved, so the offset in the header is also the
+  //offset in the edited jpeg
+  editor->thumbnail.data = tiff->data + offset;
+  editor->thumbnail.offset = tiff->data + offset - editor->header;
+  editor->thumbnail.length = length;
+}
+
+static void omxcam__exif_edit (
+    omxcam_exif_editor_t* editor,
+    uint32_t app1,
+    uint32_t app1_length){
+  omxcam__tiff_t tiff;
+  tiff.data = editor->header + app1 + 4 + OMXCAM_EXIF_ID_LENGTH;
+  tiff.length = app1_length - 4 - OMXCAM_EXIF_ID_LENGTH;
+  
+  if (tiff.length < 8) return;
+  
+  if (tiff.data[0] == 'M' && tiff.data[1] == 'M'){
+    tiff.big_endian = 1;
+  }else if (tiff.data[0] == 'I' && tiff.data[1] == 'I'){
+    tiff.big_endian = 0;
+  }else{
+    omxcam__trace ("invalid TIFF header");
+    return;
+  }
+  
+  uint32_t ifd1 = omxcam__exif_patch_ifd (editor, &tiff,
+      omxcam__tiff_u32 (&tiff, 4), 1);
+  
+  if (!editor->replace) omxcam__exif_find_thumbnail (editor, &tiff, ifd1);
+}
+
+static int omxcam__exif_header_reserve (
+    omxcam_exif_editor_t* editor,
+    uint32_t length){
+  if (length <= editor->header_size) return 0;
+  
+  //The APPn segments are up to 64KB, the buffer is reused between images
+  uint32_t size = editor->header_size ? editor->header_size : 65536;
+  while (size < length) size *= 2;
+  
+  uint8_t* header = realloc (editor->header, size);
+  if (!header){
+    omxcam__error ("realloc");
+    omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+    return -1;
+  }
+  
+  editor->header = header;
+  editor->header_size = size;
+  
+  return 0;
+}
+
+//Returns the length of the header needed to make the next decision, or 0 if
+//the APPn segments have ended at 'position'
+static uint32_t omxcam__exif_header_want (omxcam_exif_editor_t* editor){
+  uint8_t* header = editor->header;
+  uint32_t position = editor->position;
+  
+  //SOI
+  if (!position) return 2;
+  
+  //Marker
+  if (editor->header_length < position + 2) return position + 2;
+  if (header[position] != 0xFF || (header[position + 1] & 0xF0) != 0xE0){
+    return 0;
+  }
+  
+  //Length of the segment, includes the length itself
+  if (editor->header_length < position + 4) return position + 4;
+  uint32_t length = (header[position + 2] << 8) | header[position + 3];
+  if (length < 2) return 0;
+  
+  return position + 2 + length;
+}
+
+static void omxcam__exif_emit (
+    omxcam_exif_editor_t* editor,
+    omxcam_buffer_t* pieces,
+    uint32_t count,
+    omxcam_buffer_t buffer){
+  uint32_t last = count;
+  uint32_t i;
+  
+  //The flags of the buffer go with the last piece
+  for (i=0; i<count; i++){
+    if (pieces[i].length) last = i;
+  }
+  if (last == count){
+    last = count - 1;
+  }
+  
+  for (i=0; i<count; i++){
+    if (!pieces[i].length && (i != last || !buffer.flags)) continue;
+    pieces[i].timestamp = buffer.timestamp;
+    pieces[i].flags = i == last ? buffer.flags : 0;
+    if (editor->on_data) editor->on_data (pieces[i]);
+  }
+}
+
+static void omxcam__exif_piece (
+    omxcam_buffer_t* piece,
+    uint8_t* data,
+    uint32_t length){
+  piece->data = data;
+  piece->length = length;
+}
+
+static void omxcam__exif_header_end (
+    omxcam_exif_editor_t* editor,
+    omxcam_buffer_t buffer,
+    uint32_t consumed){
+  uint8_t* header = editor->header;
+  uint32_t end = editor->position;
+  uint32_t app1 = 0;
+  uint32_t app1_length = 0;
+  uint32_t p = 2;
+  
+  editor->state = OMXCAM_EXIF_BODY;
+  
+  //Find the exif of the encoder
+  while (p < end){
+    uint32_t length = 2 + ((header[p + 2] << 8) | header[p + 3]);
+    if (header[p + 1] == 0xE1 && length >= 4 + OMXCAM_EXIF_ID_LENGTH &&
+        !memcmp (header + p + 4, exif_id, OMXCAM_EXIF_ID_LENGTH)){
+      app1 = p;
+      app1_length = length;
+      break;
+    }
+    p += length;
+  }
+  
+  //The entries and the segment can be set now
+  if (editor->on_header) editor->on_header ();
+  
+  if (app1_length) omxcam__exif_edit (editor, app1, app1_length);
+  
+  //Header, without the exif if it's replaced, the segment, the beginning of
+  //the next segment and the rest of the buffer
+  omxcam_buffer_t pieces[5];
+  int replace = editor->replace && app1_length;
+  
+  if (replace){
+    omxcam__exif_piece (&pieces[0], header, app1);
+    omxcam__exif_piece (&pieces[1], header + app1 + app1_length,
+        end - app1 - app1_length);
+  }else{
+    omxcam__exif_piece (&pieces[0], header, end);
+    omxcam__exif_piece (&pieces[1], 0, 0);
+  }
+  omxcam__exif_piece (&pieces[2], editor->segment, editor->segment_length);
+  omxcam__exif_piece (&pieces[3], header + end, editor->header_length - end);
+  omxcam__exif_piece (&pieces[4], buffer.data + consumed,
+      buffer.length - consumed);
+  
+  omxcam__exif_emit (editor, pieces, 5, buffer);
+}
+
+void omxcam_exif_editor_init (
+    omxcam_exif_editor_t* editor,
+    void (*on_data)(omxcam_buffer_t buffer)){
+  memset (editor, 0, sizeof (omxcam_exif_editor_t));
+  editor->on_data = on_data;
+  editor->state = OMXCAM_EXIF_HEADER;
+}
+
+void omxcam_exif_editor_free (omxcam_exif_editor_t* editor){
+  free (editor->header);
+  editor->header = 0;
+  editor->header_size = 0;
+  editor->header_length = 0;
+}
+
+int omxcam_exif_editor_feed (
+    omxcam_exif_editor_t* editor,
+    omxcam_buffer_t buffer){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  int end_of_image = buffer.flags &
+      (OMXCAM_BUFFER_END_OF_FRAME | OMXCAM_BUFFER_END_OF_STREAM);
+  
+  if (editor->state == OMXCAM_EXIF_BODY){
+    //The rest of the image is not modified
+    if (editor->on_data) editor->on_data (buffer);
+  }else{
+    if (!editor->position && !editor->header_length){
+      //New image
+      memset (&editor->thumbnail, 0, sizeof (omxcam_exif_thumbnail_t));
+    }
+    
+    //Only the bytes needed to parse the APPn segments are copied
+    uint32_t consumed = 0;
+    uint32_t want;
+    int jpeg = 1;
+    
+    while ((want = omxcam__exif_header_want (editor))){
+      if (editor->header_length < want){
+        uint32_t length = want - editor->header_length;
+        if (length > buffer.length - consumed){
+          length = buffer.length - consumed;
+        }
+        if (omxcam__exif_header_reserve (editor, want)) return -1;
+        memcpy (editor->header + editor->header_length, buffer.data + consumed,
+            length);
+        editor->header_length += length;
+        consumed += length;
+        if (editor->header_length < want) break;
+      }
+      
+      if (!editor->position){
+        if (editor->header[0] != 0xFF || editor->header[1] != 0xD8){
+          jpeg = 0;
+          break;
+        }
+        editor->position = 2;
+      }else if (omxcam__exif_header_want (editor) == want){
+        //A whole APPn segment
+        editor->position = want;
+      }
+    }
+    
+    if (!jpeg){
+      //Not a jpeg, it's emitted as is
+      omxcam__trace ("SOI marker not found");
+      omxcam_buffer_t pieces[2];
+      omxcam__exif_piece (&pieces[0], editor->header, editor->header_length);
+      omxcam__exif_piece (&pieces[1], buffer.data + consumed,
+          buffer.length - consumed);
+      omxcam__exif_emit (editor, pieces, 2, buffer);
+      editor->state = OMXCAM_EXIF_BODY;
+    }else if (!want){
+      omxcam__exif_header_end (editor, buffer, consumed);
+    }else if (end_of_image){
+      //The image ended inside the header
+      omxcam_buffer_t piece;
+      omxcam__exif_piece (&piece, editor->header, editor->header_length);
+      omxcam__exif_emit (editor, &piece, 1, buffer);
+    }
+  }
+  
+  if (end_of_image){
+    editor->state = OMXCAM_EXIF_HEADER;
+    editor->position = 0;
+    editor->header_length = 0;
+  }
+  
+  return 0;
+}
@@ -0,0 +1,135 @@
+#include "omxcam.h"
+#include "internal.h"
+
+static void omxcam__framer_emit (
+    omxcam_framer_t* framer,
+    omxcam_buffer_t* motion){
+  omxcam_frame_t frame;
+  
+  frame.sequence = framer->sequence++;
+  frame.timestamp = framer->timestamp;
+  frame.keyframe = (framer->flags & OMXCAM_BUFFER_KEYFRAME)
+      ? OMXCAM_TRUE
+      : OMXCAM_FALSE;
+  frame.data.data = framer->data;
+  frame.data.length = framer->length;
+  frame.data.flags = framer->flags | OMXCAM_BUFFER_END_OF_FRAME |
+      OMXCAM_BUFFER_END_OF_NAL;
+  frame.data.timestamp = framer->timestamp;
+  
+  if (motion){
+    frame.motion = *motion;
+  }else{
+    memset (&frame.motion, 0, sizeof (omxcam_buffer_t));
+    frame.motion.timestamp = -1;
+  }
+  
+  //The buffers are swapped, the next frame can begin before the previous one
+  //is consumed (the motion vectors don't arrive in "no pthread" mode)
+  uint8_t* data = framer->data;
+  uint32_t size = framer->size;
+  framer->data = framer->spare;
+  framer->size = framer->spare_size;
+  framer->spare = data;
+  framer->spare_size = size;
+  
+  framer->length = 0;
+  framer->flags = 0;
+  framer->started = 0;
+  framer->complete = 0;
+  
+  if (framer->on_frame) framer->on_frame (frame);
+}
+
+static int omxcam__framer_append (
+    omxcam_framer_t* framer,
+    omxcam_buffer_t* buffer){
+  uint32_t length = framer->length + buffer->length;
+  
+  if (length > framer->size){
+    uint32_t size = framer->size ? framer->size : 65536;
+    while (size < length) size *= 2;
+    
+    uint8_t* data = realloc (framer->data, size);
+    if (!data){
+      omxcam__error ("realloc");
+      omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+      return -1;
+    }
+    
+    framer->data = data;
+    framer->size = size;
+  }
+  
+  memcpy (framer->data + framer->length, buffer->data, buffer->length);
+  framer->length = length;
+  
+  return 0;
+}
+
+void omxcam_framer_init (omxcam_framer_t* framer, omxcam_bool motion){
+  memset (framer, 0, sizeof (omxcam_framer_t));
+  framer->motion = motion;
+  framer->timestamp = -1;
+}
+
+void omxcam_framer_free (omxcam_framer_t* framer){
+  free (framer->data);
+  free (framer->spare);
+  framer->data = 0;
+  framer->spare = 0;
+  framer->length = 0;
+  framer->size = 0;
+  framer->spare_size = 0;
+}
+
+int omxcam_framer_feed (omxcam_framer_t* framer, omxcam_buffer_t buffer){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (buffer.flags & OMXCAM_BUFFER_MOTION_VECTORS){
+    if (!framer->complete){
+      omxcam__trace ("motion vectors without frame");
+      return 0;
+    }
+    omxcam__framer_emit (framer, &buffer);
+    return 0;
+  }
+  
+  //The motion vectors of the previous frame didn't arrive
+  if (framer->complete){
+    omxcam__framer_emit (framer, 0);
+    
+    //The capture was stopped from 'on_frame', the buffer has been freed
+    if (framer->stopped) return 0;
+  }
+  
+  if (omxcam__framer_append (framer, &buffer)) return -1;
+  
+  //The codec config buffers also have the end of frame flag, they are part of
+  //the next frame
+  if (buffer.flags & OMXCAM_BUFFER_CODEC_CONFIG) return 0;
+  
+  if (!framer->started){
+    framer->started = 1;
+    framer->timestamp = buffer.timestamp;
+  }
+  framer->flags |= buffer.flags & OMXCAM_BUFFER_KEYFRAME;
+  
+  if (!(buffer.flags & OMXCAM_BUFFER_END_OF_FRAME)) return 0;
+  
+  if (framer->motion){
+    framer->complete = 1;
+  }else{
+    omxcam__framer_emit (framer, 0);
+  }
+  
+  return 0;
+}
+
+void omxcam_framer_flush (omxcam_framer_t* framer){
+  //An incomplete frame is discarded
+  if (framer->complete) omxcam__framer_emit (framer, 0);
+  framer->length = 0;
+  framer->flags = 0;
+  framer->started = 0;
+}
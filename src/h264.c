@@ -13,9 +13,19 @@ void omxcam__h264_init (omxcam_h264_settings_t* settings){
   settings->qp.enabled = OMXCAM_FALSE;
   settings->qp.i = OMXCAM_H264_QP_OFF;
   settings->qp.p = OMXCAM_H264_QP_OFF;
+  settings->qp_bounds.enabled = OMXCAM_FALSE;
+  settings->qp_bounds.min = 10;
+  settings->qp_bounds.max = 40;
   settings->profile = OMXCAM_H264_AVC_PROFILE_HIGH;
   settings->inline_headers = OMXCAM_FALSE;
   settings->inline_motion_vectors = OMXCAM_FALSE;
+  omxcam__rate_control_init (&settings->rate_control);
+  settings->intra_refresh.enabled = OMXCAM_FALSE;
+  settings->intra_refresh.mode = OMXCAM_H264_INTRA_REFRESH_CYCLIC;
+  settings->intra_refresh.macroblocks = 0;
+  settings->low_latency = OMXCAM_FALSE;
+  settings->slice_rows = 0;
+  settings->measure_latency = OMXCAM_FALSE;
 }
 
 int omxcam__h264_validate (omxcam_h264_settings_t* settings){
@@ -23,6 +33,10 @@ int omxcam__h264_validate (omxcam_h264_settings_t* settings){
     omxcam__error ("invalid 'h264.bitrate' value");
     return -1;
   }
+  if (!omxcam__h264_is_valid_idr_period (settings->idr_period)){
+    omxcam__error ("invalid 'h264.idr_period' value");
+    return -1;
+  }
   if (!omxcam__h264_is_valid_eede_loss_rate (settings->eede.loss_rate)){
     omxcam__error ("invalid 'h264.eede.loss_rate' value");
     return -1;
@@ -35,10 +49,43 @@ int omxcam__h264_validate (omxcam_h264_settings_t* settings){
     omxcam__error ("invalid 'h264.eede.p' value");
     return -1;
   }
+  if (settings->qp_bounds.enabled){
+    if (!omxcam__h264_is_valid_quantization (settings->qp_bounds.min)){
+      omxcam__error ("invalid 'h264.qp_bounds.min' value");
+      return -1;
+    }
+    if (!omxcam__h264_is_valid_quantization (settings->qp_bounds.max) ||
+        settings->qp_bounds.max < settings->qp_bounds.min){
+      omxcam__error ("invalid 'h264.qp_bounds.max' value");
+      return -1;
+    }
+    if (settings->qp.enabled){
+      //The bounds are only used by the rate control
+      omxcam__error ("'h264.qp_bounds' cannot be used with 'h264.qp'");
+      return -1;
+    }
+  }
   if (!omxcam__h264_is_valid_avc_profile (settings->profile)){
     omxcam__error ("invalid 'h264.profile' value");
     return -1;
   }
+  if (omxcam__rate_control_validate (&settings->rate_control)) return -1;
+  if (settings->rate_control.enabled && settings->qp.enabled){
+    //The bitrate is ignored when the quantization parameters are fixed
+    omxcam__error ("'h264.rate_control' cannot be used with 'h264.qp'");
+    return -1;
+  }
+  if (settings->intra_refresh.enabled){
+    if (!omxcam__h264_is_valid_intra_refresh_mode (
+        settings->intra_refresh.mode)){
+      omxcam__error ("invalid 'h264.intra_refresh.mode' value");
+      return -1;
+    }
+    if (!settings->intra_refresh.macroblocks){
+      omxcam__error ("invalid 'h264.intra_refresh.macroblocks' value");
+      return -1;
+    }
+  }
   return 0;
 }
 
@@ -54,6 +101,11 @@ int omxcam__h264_is_valid_quantization (uint32_t qp){
   return qp <= 51;
 }
 
+int omxcam__h264_is_valid_idr_period (uint32_t idr_period){
+  //More than 30 minutes at 30fps
+  return idr_period <= 65535;
+}
+
 int omxcam__h264_configure_omx (omxcam_h264_settings_t* settings){
   omxcam__trace ("configuring '%s' settings", omxcam__ctx.video_encode.name);
   
@@ -68,8 +120,8 @@ int omxcam__h264_configure_omx (omxcam_h264_settings_t* settings){
     bitrate_st.nPortIndex = 201;
     if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
         OMX_IndexParamVideoBitrate, &bitrate_st))){
-      omxcam__error ("OMX_SetParameter - OMX_IndexParamVideoBitrate: %s",
-          omxcam__dump_OMX_ERRORTYPE (error));
+      omxcam__omx_error (&omxcam__ctx.video_encode,
+          "OMX_SetParameter - OMX_IndexParamVideoBitrate", error);
       return -1;
     }
   }else{
@@ -82,12 +134,18 @@ int omxcam__h264_configure_omx (omxcam_h264_settings_t* settings){
     quantization_st.nQpP = settings->qp.p;
     if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
         OMX_IndexParamVideoQuantization, &quantization_st))){
-      omxcam__error ("OMX_SetParameter - OMX_IndexParamVideoQuantization: %s",
-          omxcam__dump_OMX_ERRORTYPE (error));
+      omxcam__omx_error (&omxcam__ctx.video_encode,
+          "OMX_SetParameter - OMX_IndexParamVideoQuantization", error);
       return -1;
     }
   }
   
+  //Quantization bounds of the rate control
+  if (settings->qp_bounds.enabled && omxcam__h264_set_qp_bounds (
+      settings->qp_bounds.min, settings->qp_bounds.max)){
+    return -1;
+  }
+  
   //Codec
   OMX_VIDEO_PARAM_PORTFORMATTYPE format_st;
   omxcam__omx_struct_init (format_st);
@@ -96,28 +154,13 @@ int omxcam__h264_configure_omx (omxcam_h264_settings_t* settings){
   format_st.eCompressionFormat = OMX_VIDEO_CodingAVC;
   if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
       OMX_IndexParamVideoPortFormat, &format_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamVideoPortFormat: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_SetParameter - OMX_IndexParamVideoPortFormat", error);
     return -1;
   }
   
   //IDR period
-  OMX_VIDEO_CONFIG_AVCINTRAPERIOD idr_st;
-  omxcam__omx_struct_init (idr_st);
-  idr_st.nPortIndex = 201;
-  if ((error = OMX_GetConfig (omxcam__ctx.video_encode.handle,
-      OMX_IndexConfigVideoAVCIntraPeriod, &idr_st))){
-    omxcam__error ("OMX_GetConfig - OMX_IndexConfigVideoAVCIntraPeriod: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
-    return -1;
-  }
-  idr_st.nIDRPeriod = settings->idr_period;
-  if ((error = OMX_SetConfig (omxcam__ctx.video_encode.handle,
-      OMX_IndexConfigVideoAVCIntraPeriod, &idr_st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigVideoAVCIntraPeriod: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
-    return -1;
-  }
+  if (omxcam__h264_set_idr_period (settings->idr_period)) return -1;
   
   //SEI
   OMX_PARAM_BRCMVIDEOAVCSEIENABLETYPE sei_st;
@@ -126,8 +169,8 @@ int omxcam__h264_configure_omx (omxcam_h264_settings_t* settings){
   sei_st.bEnable = !!settings->sei;
   if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
       OMX_IndexParamBrcmVideoAVCSEIEnable, &sei_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamBrcmVideoAVCSEIEnable: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_SetParameter - OMX_IndexParamBrcmVideoAVCSEIEnable", error);
     return -1;
   }
   
@@ -138,8 +181,8 @@ int omxcam__h264_configure_omx (omxcam_h264_settings_t* settings){
   eede_st.enable = !!settings->eede.enabled;
   if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
       OMX_IndexParamBrcmEEDEEnable, &eede_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamBrcmEEDEEnable: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_SetParameter - OMX_IndexParamBrcmEEDEEnable", error);
     return -1;
   }
   
@@ -149,8 +192,8 @@ int omxcam__h264_configure_omx (omxcam_h264_settings_t* settings){
   eede_loss_rate_st.loss_rate = settings->eede.loss_rate;
   if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
       OMX_IndexParamBrcmEEDELossRate, &eede_loss_rate_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamBrcmEEDELossRate: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_SetParameter - OMX_IndexParamBrcmEEDELossRate", error);
     return -1;
   }
   
@@ -160,15 +203,15 @@ int omxcam__h264_configure_omx (omxcam_h264_settings_t* settings){
   avc_profile_st.nPortIndex = 201;
   if ((error = OMX_GetParameter (omxcam__ctx.video_encode.handle,
       OMX_IndexParamVideoAvc, &avc_profile_st))){
-    omxcam__error ("OMX_GetParameter - OMX_IndexParamVideoAvc: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_GetParameter - OMX_IndexParamVideoAvc", error);
     return -1;
   }
   avc_profile_st.eProfile = settings->profile;
   if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
       OMX_IndexParamVideoAvc, &avc_profile_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamVideoAvc: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_SetParameter - OMX_IndexParamVideoAvc", error);
     return -1;
   }
   
@@ -179,9 +222,8 @@ int omxcam__h264_configure_omx (omxcam_h264_settings_t* settings){
   headers_st.bEnabled = !!settings->inline_headers;
   if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
       OMX_IndexParamBrcmVideoAVCInlineHeaderEnable, &headers_st))){
-    omxcam__error ("OMX_SetParameter - "
-        "OMX_IndexParamBrcmVideoAVCInlineHeaderEnable: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.video_encode, "OMX_SetParameter - "
+        "OMX_IndexParamBrcmVideoAVCInlineHeaderEnable", error);
     return -1;
   }
   
@@ -192,12 +234,141 @@ int omxcam__h264_configure_omx (omxcam_h264_settings_t* settings){
   motion_st.bEnabled = !!settings->inline_motion_vectors;
   if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
       OMX_IndexParamBrcmVideoAVCInlineVectorsEnable, &motion_st))){
-    omxcam__error ("OMX_SetParameter - "
-        "OMX_IndexParamBrcmVideoAVCInlineVectorsEnable: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.video_encode, "OMX_SetParameter - "
+        "OMX_IndexParamBrcmVideoAVCInlineVectorsEnable", error);
     return -1;
   }
   
+  //Intra refresh, the macroblocks are refreshed gradually in the P frames
+  //instead of sending big IDR frames
+  if (settings->intra_refresh.enabled){
+    OMX_VIDEO_PARAM_INTRAREFRESHTYPE refresh_st;
+    omxcam__omx_struct_init (refresh_st);
+    refresh_st.nPortIndex = 201;
+    if ((error = OMX_GetParameter (omxcam__ctx.video_encode.handle,
+        OMX_IndexParamVideoIntraRefresh, &refresh_st))){
+      omxcam__omx_error (&omxcam__ctx.video_encode,
+          "OMX_GetParameter - OMX_IndexParamVideoIntraRefresh", error);
+      return -1;
+    }
+    refresh_st.eRefreshMode = settings->intra_refresh.mode;
+    if (settings->intra_refresh.mode != OMXCAM_H264_INTRA_REFRESH_ADAPTIVE){
+      refresh_st.nCirMBs = settings->intra_refresh.macroblocks;
+    }
+    if (settings->intra_refresh.mode == OMXCAM_H264_INTRA_REFRESH_ADAPTIVE ||
+        settings->intra_refresh.mode == OMXCAM_H264_INTRA_REFRESH_BOTH){
+      refresh_st.nAirMBs = settings->intra_refresh.macroblocks;
+    }
+    if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
+        OMX_IndexParamVideoIntraRefresh, &refresh_st))){
+      omxcam__omx_error (&omxcam__ctx.video_encode,
+          "OMX_SetParameter - OMX_IndexParamVideoIntraRefresh", error);
+      return -1;
+    }
+  }
+  
+  //Slices, they are emitted in different buffers
+  if (settings->slice_rows){
+    OMX_PARAM_U32TYPE slice_st;
+    omxcam__omx_struct_init (slice_st);
+    slice_st.nPortIndex = 201;
+    slice_st.nU32 = settings->slice_rows;
+    if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
+        OMX_IndexConfigBrcmVideoEncoderMBRowsPerSlice, &slice_st))){
+      omxcam__omx_error (&omxcam__ctx.video_encode, "OMX_SetParameter - "
+          "OMX_IndexConfigBrcmVideoEncoderMBRowsPerSlice", error);
+      return -1;
+    }
+  }
+  
+  //Low latency, the output buffers are returned as soon as each slice is
+  //encoded
+  if (settings->low_latency){
+    OMX_CONFIG_PORTBOOLEANTYPE latency_st;
+    omxcam__omx_struct_init (latency_st);
+    latency_st.nPortIndex = 201;
+    latency_st.bEnabled = OMX_TRUE;
+    if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
+        OMX_IndexConfigBrcmVideoH264LowLatency, &latency_st))){
+      omxcam__omx_error (&omxcam__ctx.video_encode, "OMX_SetParameter - "
+          "OMX_IndexConfigBrcmVideoH264LowLatency", error);
+      return -1;
+    }
+  }
+  
+  return 0;
+}
+
+int omxcam__h264_set_bitrate (uint32_t bitrate){
+  OMX_ERRORTYPE error;
+  OMX_VIDEO_CONFIG_BITRATETYPE st;
+  omxcam__omx_struct_init (st);
+  st.nPortIndex = 201;
+  st.nEncodeBitrate = bitrate;
+  if ((error = OMX_SetConfig (omxcam__ctx.video_encode.handle,
+      OMX_IndexConfigVideoBitrate, &st))){
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_SetConfig - OMX_IndexConfigVideoBitrate", error);
+    return -1;
+  }
+  return 0;
+}
+
+int omxcam__h264_set_qp_bounds (uint32_t min, uint32_t max){
+  OMX_ERRORTYPE error;
+  OMX_PARAM_U32TYPE st;
+  omxcam__omx_struct_init (st);
+  st.nPortIndex = 201;
+  st.nU32 = min;
+  if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
+      OMX_IndexParamBrcmVideoEncodeMinQuant, &st))){
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_SetParameter - OMX_IndexParamBrcmVideoEncodeMinQuant", error);
+    return -1;
+  }
+  st.nU32 = max;
+  if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
+      OMX_IndexParamBrcmVideoEncodeMaxQuant, &st))){
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_SetParameter - OMX_IndexParamBrcmVideoEncodeMaxQuant", error);
+    return -1;
+  }
+  return 0;
+}
+
+int omxcam__h264_set_idr_period (uint32_t idr_period){
+  OMX_ERRORTYPE error;
+  OMX_VIDEO_CONFIG_AVCINTRAPERIOD st;
+  omxcam__omx_struct_init (st);
+  st.nPortIndex = 201;
+  if ((error = OMX_GetConfig (omxcam__ctx.video_encode.handle,
+      OMX_IndexConfigVideoAVCIntraPeriod, &st))){
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_GetConfig - OMX_IndexConfigVideoAVCIntraPeriod", error);
+    return -1;
+  }
+  st.nIDRPeriod = idr_period;
+  if ((error = OMX_SetConfig (omxcam__ctx.video_encode.handle,
+      OMX_IndexConfigVideoAVCIntraPeriod, &st))){
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_SetConfig - OMX_IndexConfigVideoAVCIntraPeriod", error);
+    return -1;
+  }
+  return 0;
+}
+
+int omxcam__h264_request_idr (){
+  OMX_ERRORTYPE error;
+  OMX_CONFIG_PORTBOOLEANTYPE st;
+  omxcam__omx_struct_init (st);
+  st.nPortIndex = 201;
+  st.bEnabled = OMX_TRUE;
+  if ((error = OMX_SetConfig (omxcam__ctx.video_encode.handle,
+      OMX_IndexConfigBrcmVideoRequestIFrame, &st))){
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_SetConfig - OMX_IndexConfigBrcmVideoRequestIFrame", error);
+    return -1;
+  }
   return 0;
 }
 
@@ -213,6 +384,7 @@ int omxcam__h264_configure_omx (omxcam_h264_settings_t* settings){
   case value: return 1;
 
 OMXCAM_FN (OMXCAM_CASE_FN, avc_profile, H264_AVC_PROFILE)
+OMXCAM_FN (OMXCAM_CASE_FN, intra_refresh_mode, H264_INTRA_REFRESH)
 
 #undef OMXCAM_CASE_FN
 #undef OMXCAM_FN
\ No newline at end of file
@@ -0,0 +1,274 @@
+#include "omxcam.h"
+#include "internal.h"
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+//Rows of a slice, the same as the camera slices
+#define OMXCAM_HDR_SLICE_HEIGHT 16
+
+//The weights are 1-128, the normalized weights are 16-bit fixed point
+#define OMXCAM_HDR_MAX_WEIGHT 128
+
+int omxcam_hdr_init (
+    omxcam_hdr_t* hdr,
+    uint32_t width,
+    uint32_t height,
+    uint32_t frames,
+    void (*on_data)(omxcam_buffer_t buffer)){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  memset (hdr, 0, sizeof (omxcam_hdr_t));
+  
+  if (!width || !height || !frames || frames > OMXCAM_BRACKET_MAX_SHOTS){
+    omxcam__error ("invalid hdr dimensions or number of frames");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  //The sizes are computed with 64 bits and the offsets into the stored frames
+  //must fit in 32 bits, the dimensions that don't are rejected
+  uint64_t stride = ((uint64_t)width + 31) & ~(uint64_t)31;
+  uint64_t slices = ((uint64_t)height + 15)/OMXCAM_HDR_SLICE_HEIGHT;
+  uint64_t slice_length = (stride*OMXCAM_HDR_SLICE_HEIGHT*3) >> 1;
+  uint64_t weights_length = sizeof (uint32_t)*
+      ((stride >> 1)*frames*3 + stride*2 + (stride >> 1));
+  
+  if (slice_length*2 > UINT32_MAX || slice_length > UINT32_MAX/slices ||
+      slice_length*slices*(frames - 1) > UINT32_MAX ||
+      slice_length*slices*(frames - 1) > SIZE_MAX ||
+      weights_length > SIZE_MAX){
+    omxcam__error ("hdr frames too big");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  hdr->on_data = on_data;
+  hdr->frames = frames;
+  hdr->stride = stride;
+  hdr->slices = slices;
+  hdr->slice_length = slice_length;
+  hdr->frame_length = slice_length*slices;
+  
+  //Only the first exposures are kept, the last one is merged as it arrives
+  hdr->store = malloc (hdr->frame_length*(frames - 1));
+  hdr->slice = malloc (hdr->slice_length*2);
+  hdr->weights = malloc (weights_length);
+  hdr->reciprocal = malloc (sizeof (uint32_t)*
+      (OMXCAM_BRACKET_MAX_SHOTS*OMXCAM_HDR_MAX_WEIGHT + 1));
+  
+  if ((frames > 1 && !hdr->store) || !hdr->slice || !hdr->weights ||
+      !hdr->reciprocal){
+    omxcam__error ("malloc");
+    omxcam_hdr_free (hdr);
+    omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+    return -1;
+  }
+  
+  hdr->out = hdr->slice + hdr->slice_length;
+  
+  uint32_t i;
+  hdr->reciprocal[0] = 0;
+  for (i=1; i<=OMXCAM_BRACKET_MAX_SHOTS*OMXCAM_HDR_MAX_WEIGHT; i++){
+    hdr->reciprocal[i] = (65536 + (i >> 1))/i;
+  }
+  
+  return 0;
+}
+
+void omxcam_hdr_free (omxcam_hdr_t* hdr){
+  free (hdr->store);
+  free (hdr->slice);
+  free (hdr->weights);
+  free (hdr->reciprocal);
+  hdr->store = 0;
+  hdr->slice = 0;
+  hdr->weights = 0;
+  hdr->reciprocal = 0;
+}
+
+//acc[x] += w[x]*p[x], 8 pixels per iteration with NEON
+static void omxcam__hdr_accumulate (
+    uint32_t* acc,
+    uint32_t* w,
+    uint8_t* p,
+    uint32_t n){
+  uint32_t x = 0;
+  
+#ifdef __ARM_NEON
+  for (; x + 8 <= n; x += 8){
+    uint16x8_t p16 = vmovl_u8 (vld1_u8 (p + x));
+    vst1q_u32 (acc + x, vmlaq_u32 (vld1q_u32 (acc + x), vld1q_u32 (w + x),
+        vmovl_u16 (vget_low_u16 (p16))));
+    vst1q_u32 (acc + x + 4, vmlaq_u32 (vld1q_u32 (acc + x + 4),
+        vld1q_u32 (w + x + 4), vmovl_u16 (vget_high_u16 (p16))));
+  }
+#endif
+  
+  for (; x<n; x++) acc[x] += w[x]*p[x];
+}
+
+//out[x] = min(acc[x] >> 16, 255), the narrowing saturates with NEON
+static void omxcam__hdr_store (uint8_t* out, uint32_t* acc, uint32_t n){
+  uint32_t x = 0;
+  
+#ifdef __ARM_NEON
+  for (; x + 8 <= n; x += 8){
+    uint16x8_t value = vcombine_u16 (vshrn_n_u32 (vld1q_u32 (acc + x), 16),
+        vshrn_n_u32 (vld1q_u32 (acc + x + 4), 16));
+    vst1_u8 (out + x, vqmovn_u16 (value));
+  }
+#endif
+  
+  for (; x<n; x++){
+    uint32_t value = acc[x] >> 16;
+    out[x] = value > 255 ? 255 : value;
+  }
+}
+
+//Merges a slice of each exposure. The weight of each 2x2 block (a chroma
+//sample) is how well exposed it is, higher near mid-gray, and the weights are
+//normalized so the merged slice keeps the range of the inputs. The weighted
+//sums of the pixels use NEON when the library is built with it
+static void omxcam__hdr_merge (omxcam_hdr_t* hdr, uint8_t** slices){
+  uint32_t stride = hdr->stride;
+  uint32_t half = stride >> 1;
+  uint32_t frames = hdr->frames;
+  uint32_t* weights = hdr->weights;
+  uint32_t* sum = weights + half*frames;
+  uint32_t* wide = sum + half;
+  uint32_t* acc = wide + stride*frames;
+  uint32_t* acc_u = acc + stride;
+  uint32_t* acc_v = acc_u + half;
+  uint32_t offset_u = stride*OMXCAM_HDR_SLICE_HEIGHT;
+  uint32_t offset_v = offset_u + half*(OMXCAM_HDR_SLICE_HEIGHT >> 1);
+  uint32_t f;
+  uint32_t x;
+  uint32_t y;
+  uint32_t r;
+  
+  for (y=0; y<(OMXCAM_HDR_SLICE_HEIGHT >> 1); y++){
+    memset (sum, 0, sizeof (uint32_t)*half);
+    
+    //Weights of the blocks
+    for (f=0; f<frames; f++){
+      uint8_t* row0 = slices[f] + (y << 1)*stride;
+      uint8_t* row1 = row0 + stride;
+      uint32_t* w = weights + f*half;
+      for (x=0; x<half; x++){
+        int32_t d = ((row0[x << 1] + row0[(x << 1) + 1] + row1[x << 1] +
+            row1[(x << 1) + 1]) >> 2) - 128;
+        w[x] = OMXCAM_HDR_MAX_WEIGHT - abs (d) + (d < 0);
+        sum[x] += w[x];
+      }
+    }
+    
+    //Normalized to 1.0 = 65536
+    for (x=0; x<half; x++){
+      sum[x] = hdr->reciprocal[sum[x]];
+    }
+    for (f=0; f<frames; f++){
+      uint32_t* w = weights + f*half;
+      uint32_t* w2 = wide + f*stride;
+      for (x=0; x<half; x++){
+        w[x] *= sum[x];
+        w2[x << 1] = w[x];
+        w2[(x << 1) + 1] = w[x];
+      }
+    }
+    
+    //Luma
+    for (r=y << 1; r<=(y << 1) + 1; r++){
+      for (x=0; x<stride; x++) acc[x] = 32768;
+      for (f=0; f<frames; f++){
+        omxcam__hdr_accumulate (acc, wide + f*stride, slices[f] + r*stride,
+            stride);
+      }
+      omxcam__hdr_store (hdr->out + r*stride, acc, stride);
+    }
+    
+    //Chroma
+    for (x=0; x<half; x++){
+      acc_u[x] = 32768;
+      acc_v[x] = 32768;
+    }
+    for (f=0; f<frames; f++){
+      uint8_t* u = slices[f] + offset_u + y*half;
+      uint8_t* v = slices[f] + offset_v + y*half;
+      uint32_t* w = weights + f*half;
+      omxcam__hdr_accumulate (acc_u, w, u, half);
+      omxcam__hdr_accumulate (acc_v, w, v, half);
+    }
+    omxcam__hdr_store (hdr->out + offset_u + y*half, acc_u, half);
+    omxcam__hdr_store (hdr->out + offset_v + y*half, acc_v, half);
+  }
+}
+
+static void omxcam__hdr_emit (
+    omxcam_hdr_t* hdr,
+    uint8_t* last,
+    omxcam_buffer_t* buffer){
+  uint8_t* slices[OMXCAM_BRACKET_MAX_SHOTS];
+  uint32_t index = hdr->offset/hdr->slice_length;
+  uint32_t f;
+  
+  for (f=0; f<hdr->frames - 1; f++){
+    slices[f] = hdr->store + f*hdr->frame_length + index*hdr->slice_length;
+  }
+  slices[hdr->frames - 1] = last;
+  
+  omxcam__hdr_merge (hdr, slices);
+  
+  omxcam_buffer_t out;
+  out.data = hdr->out;
+  out.length = hdr->slice_length;
+  out.timestamp = buffer->timestamp;
+  out.flags = index == hdr->slices - 1 ? OMXCAM_BUFFER_END_OF_FRAME : 0;
+  if (hdr->on_data) hdr->on_data (out);
+}
+
+int omxcam_hdr_feed (omxcam_hdr_t* hdr, omxcam_buffer_t buffer){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  uint8_t* data = buffer.data;
+  uint32_t length = buffer.length;
+  
+  while (length){
+    uint32_t n = hdr->frame_length - hdr->offset;
+    if (n > length) n = length;
+    
+    if (hdr->frame < hdr->frames - 1){
+      memcpy (hdr->store + hdr->frame*hdr->frame_length + hdr->offset, data,
+          n);
+      hdr->offset += n;
+    }else{
+      uint32_t pending = hdr->offset%hdr->slice_length;
+      
+      if (!pending && n >= hdr->slice_length){
+        //Whole slice inside the buffer, merged without copying it
+        n = hdr->slice_length;
+        omxcam__hdr_emit (hdr, data, &buffer);
+      }else{
+        if (n > hdr->slice_length - pending){
+          n = hdr->slice_length - pending;
+        }
+        memcpy (hdr->slice + pending, data, n);
+        if (pending + n == hdr->slice_length){
+          omxcam__hdr_emit (hdr, hdr->slice, &buffer);
+        }
+      }
+      hdr->offset += n;
+    }
+    
+    data += n;
+    length -= n;
+    
+    if (hdr->offset == hdr->frame_length){
+      hdr->offset = 0;
+      if (++hdr->frame == hdr->frames) hdr->frame = 0;
+    }
+  }
+  
+  return 0;
+}
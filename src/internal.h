@@ -2,12 +2,23 @@
 #define OMXCAM_INTERNAL_H
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
 #include <time.h>
 #include <pthread.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include <bcm_host.h>
@@ -30,6 +41,7 @@
 #define OMXCAM_MIN_GPU_MEM 128 //MB
 #define OMXCAM_VIDEO_MAX_WIDTH 1920
 #define OMXCAM_VIDEO_MAX_HEIGHT 1080
+#define OMXCAM_MOTION_MACROBLOCK_SIZE 16
 #define OMXCAM_STILL_MAX_WIDTH 2592
 #define OMXCAM_STILL_MAX_HEIGHT 1944
 #define OMXCAM_MIN_WIDTH 16
@@ -42,6 +54,17 @@
 #define omxcam__error(message, ...) //Empty
 #endif
 
+/*
+ * Same as omxcam__error() but used when an OpenMAX IL call fails. The call, the
+ * returned error and the component are also saved in the thread-local error
+ * details, see omxcam_last_error_details().
+ */
+#define omxcam__omx_error(component, call, error)                              \
+  do {                                                                         \
+    omxcam__set_omx_error (component, call, error);                            \
+    omxcam__error ("%s: %s", call, omxcam__dump_OMX_ERRORTYPE (error));        \
+  } while (0)
+
 #define OMXCAM_STR(x) #x
 #define OMXCAM_STR_VALUE(x) OMXCAM_STR(x)
 
@@ -107,8 +130,11 @@ typedef struct {
   void (*on_stop)();
   int video;
   int inline_motion_vectors;
+  int rate_control;
+  int measure_latency;
   int no_pthread;
   int use_encoder;
+  int h264;
   struct {
     int running;
     int joined;
@@ -125,6 +151,33 @@ omxcam__context_t omxcam__ctx;
  */
 const char* omxcam__strbool (omxcam_bool value);
 
+/*
+ * Writes a big-endian integer and returns the pointer to the next byte. Used
+ * by the muxers.
+ */
+uint8_t* omxcam__put_u16 (uint8_t* p, uint16_t value);
+uint8_t* omxcam__put_u32 (uint8_t* p, uint32_t value);
+uint8_t* omxcam__put_u64 (uint8_t* p, uint64_t value);
+
+/*
+ * Functions of the RTP packetiser used by the RTSP server. The addresses are
+ * in network byte order.
+ */
+int omxcam__rtp_parameter_sets (
+    omxcam_rtp_t* rtp,
+    uint8_t* sps,
+    uint32_t* sps_length,
+    uint8_t* pps,
+    uint32_t* pps_length);
+int omxcam__rtp_add_client (
+    omxcam_rtp_t* rtp,
+    uint32_t address,
+    uint16_t port);
+int omxcam__rtp_remove_client (
+    omxcam_rtp_t* rtp,
+    uint32_t address,
+    uint16_t port);
+
 /*
  * Prints an error message to the stdout along with the file, line and function
  * name from where this function is called. It is printed if the cflag
@@ -138,10 +191,27 @@ void omxcam__error_ (
     ...);
 
 /*
- * Sets the last error.
+ * Sets the last error of the current thread. OMXCAM_ERROR_NONE also clears the
+ * OpenMAX IL error details.
  */
 void omxcam__set_last_error (omxcam_errno error);
 
+/*
+ * Saves the OpenMAX IL call that failed, its returned error and the component
+ * (null is allowed) in the error details of the current thread. Use the
+ * omxcam__omx_error() macro instead.
+ */
+void omxcam__set_omx_error (
+    omxcam__component_t* component,
+    const char* call,
+    OMX_ERRORTYPE error);
+
+/*
+ * Replaces the error details of the current thread. Used to move the error
+ * details from the background thread to the thread that started the capture.
+ */
+void omxcam__set_last_error_details (omxcam_error_details_t* details);
+
 /*
  * OpenMAX IL event handlers.
  */
@@ -152,6 +222,10 @@ OMX_ERRORTYPE event_handler (
     OMX_U32 data1,
     OMX_U32 data2,
     OMX_PTR event_data);
+OMX_ERRORTYPE empty_buffer_done (
+    OMX_HANDLETYPE comp,
+    OMX_PTR app_data,
+    OMX_BUFFERHEADERTYPE* buffer);
 OMX_ERRORTYPE fill_buffer_done (
     OMX_HANDLETYPE comp,
     OMX_PTR app_data,
@@ -276,6 +350,18 @@ int omxcam__component_change_state (
 int omxcam__buffer_alloc (omxcam__component_t* component, uint32_t port);
 int omxcam__buffer_free (omxcam__component_t* component, uint32_t port);
 
+/*
+ * Fills an 'omxcam_buffer_t' with the data and flags of the output buffer.
+ */
+void omxcam__buffer_wrap (omxcam_buffer_t* buffer);
+
+/*
+ * Same as 'omxcam__buffer_wrap()' but with any OpenMAX buffer.
+ */
+void omxcam__buffer_wrap_header (
+    OMX_BUFFERHEADERTYPE* header,
+    omxcam_buffer_t* buffer);
+
 /*
  * Initializes and deinitializes OpenMAX IL. They must be the first and last
  * api calls.
@@ -343,6 +429,20 @@ int omxcam__camera_set_image_filter (omxcam_image_filter image_filter);
 int omxcam__camera_set_roi (omxcam_roi_t* roi);
 int omxcam__camera_set_frame_stabilisation (omxcam_bool frame_stabilisation);
 
+/*
+ * Sets the metering, the exposure compensation, the shutter speed and the iso
+ * with a single OMX_IndexConfigCommonExposureValue call.
+ */
+int omxcam__camera_set_exposure_value (omxcam_camera_settings_t* settings);
+
+/*
+ * Still pipeline, also used by the exposure bracketing. 'omxcam__still_read()'
+ * sets 'end_of_image' when the last slice of the image is read.
+ */
+int omxcam__still_omx_init (omxcam_still_settings_t* settings);
+int omxcam__still_omx_deinit ();
+int omxcam__still_read (omxcam_buffer_t* buffer, int* end_of_image);
+
 /*
  * Validates the settings.
  */
@@ -351,6 +451,7 @@ int omxcam__video_validate (omxcam_video_settings_t* settings);
 int omxcam__camera_validate (omxcam_camera_settings_t* settings, int video);
 int omxcam__jpeg_validate (omxcam_jpeg_settings_t* settings);
 int omxcam__h264_validate (omxcam_h264_settings_t* settings);
+int omxcam__mjpeg_validate (omxcam_mjpeg_settings_t* settings);
 
 /*
  * Validates each camera setting. Returns 1 if it's valid, 0 otherwise.
@@ -395,12 +496,25 @@ void omxcam__jpeg_init (omxcam_jpeg_settings_t* settings);
 /*
  * Adds an exif tag to the jpeg metadata.
  */
-int omxcam__jpeg_add_tag (char* key, char* value);
+int omxcam__jpeg_add_tag (
+    omxcam__component_t* component,
+    char* key,
+    char* value);
+
+/*
+ * Adds the date and the user exif tags to the jpeg metadata. They are
+ * configs, so they can be updated while the component is executing.
+ */
+int omxcam__jpeg_add_tags (
+    omxcam__component_t* component,
+    omxcam_jpeg_settings_t* settings);
 
 /*
- * Configures the OpenMAX IL image_encode component with the jpeg settings.
+ * Configures an OpenMAX IL image_encode component with the jpeg settings.
  */
-int omxcam__jpeg_configure_omx (omxcam_jpeg_settings_t* settings);
+int omxcam__jpeg_configure_omx (
+    omxcam__component_t* component,
+    omxcam_jpeg_settings_t* settings);
 
 /*
  * Validates each jpeg setting. Returns 1 if it's valid, 0 otherwise.
@@ -408,6 +522,16 @@ int omxcam__jpeg_configure_omx (omxcam_jpeg_settings_t* settings);
 int omxcam__jpeg_is_valid_quality (uint32_t quality);
 int omxcam__jpeg_is_valid_thumbnail (uint32_t dimension);
 
+/*
+ * Sets the default settings for the mjpeg encoder.
+ */
+void omxcam__mjpeg_init (omxcam_mjpeg_settings_t* settings);
+
+/*
+ * Configures the OpenMAX IL video_encode component with the mjpeg settings.
+ */
+int omxcam__mjpeg_configure_omx (omxcam_mjpeg_settings_t* settings);
+
 /*
  * Sets the default settings for the h264 encoder.
  */
@@ -418,6 +542,80 @@ void omxcam__h264_init (omxcam_h264_settings_t* settings);
  */
 int omxcam__h264_configure_omx (omxcam_h264_settings_t* settings);
 
+/*
+ * Sets the h264 encoder settings that can be modified while the video_encode
+ * component is in the Executing state.
+ */
+int omxcam__h264_set_bitrate (uint32_t bitrate);
+int omxcam__h264_set_qp_bounds (uint32_t min, uint32_t max);
+int omxcam__h264_set_idr_period (uint32_t idr_period);
+int omxcam__h264_request_idr ();
+
+/*
+ * Sets the default settings for the h264 rate control and validates them.
+ */
+void omxcam__rate_control_init (omxcam_rate_control_t* settings);
+int omxcam__rate_control_validate (omxcam_rate_control_t* settings);
+
+/*
+ * Resets the rate control state before the video is started and updates it
+ * with the length of each h264 buffer. The bitrate is changed from the thread
+ * that fills the buffers.
+ */
+void omxcam__rate_control_start (
+    omxcam_rate_control_t* settings,
+    uint32_t bitrate);
+void omxcam__rate_control_update (uint32_t length);
+
+/*
+ * Delay between the timestamp of each h264 frame and its buffers. It's reset
+ * before the video is started and updated with each h264 buffer from the thread
+ * that fills the buffers.
+ */
+void omxcam__latency_start ();
+void omxcam__latency_update (omxcam_buffer_t* buffer);
+
+/*
+ * Returns an input buffer of the encoder to the free list, called from the
+ * EmptyBufferDone handler.
+ */
+void omxcam__encode_buffer_done (OMX_BUFFERHEADERTYPE* buffer);
+
+/*
+ * Same for the input buffer of the jpeg encoder. Returns 1 if the component is
+ * the jpeg encoder, 0 otherwise.
+ */
+int omxcam__jpeg_encode_buffer_done (
+    omxcam__component_t* component,
+    OMX_BUFFERHEADERTYPE* buffer);
+
+/*
+ * Statistics of the size of the h264 frames. They are reset before the video is
+ * started and updated with each h264 buffer from the thread that fills the
+ * buffers.
+ */
+void omxcam__frame_stats_start ();
+void omxcam__frame_stats_update (omxcam_buffer_t* buffer);
+
+/*
+ * Cache of the last SPS and PPS of the h264 stream. It's reset before the video
+ * is started and updated with each h264 buffer from the thread that fills the
+ * buffers.
+ */
+void omxcam__parameter_sets_reset ();
+void omxcam__parameter_sets_update (omxcam_buffer_t* buffer);
+int omxcam__parameter_sets_get (uint8_t* data, uint32_t* length);
+
+/*
+ * SEI messages (user data unregistered) of the next frame. They are added from
+ * any thread and taken by the thread that fills the buffers at the beginning of
+ * each frame. 'omxcam__sei_take()' returns 1 and fills 'sei' with the escaped
+ * SEI NAL unit if there are messages.
+ */
+void omxcam__sei_reset ();
+int omxcam__sei_add (uint8_t* uuid, uint8_t* data, uint32_t length);
+int omxcam__sei_take (omxcam_buffer_t* frame, omxcam_buffer_t* sei);
+
 /*
  * Returns the string name of the given h246 setting.
  */
@@ -429,6 +627,8 @@ const char* omxcam__h264_str_avc_profile (omxcam_avc_profile profile);
 int omxcam__h264_is_valid_bitrate (uint32_t bitrate);
 int omxcam__h264_is_valid_eede_loss_rate (uint32_t loss_rate);
 int omxcam__h264_is_valid_quantization (uint32_t qp);
+int omxcam__h264_is_valid_idr_period (uint32_t idr_period);
 int omxcam__h264_is_valid_avc_profile (omxcam_avc_profile profile);
+int omxcam__h264_is_valid_intra_refresh_mode (omxcam_intra_refresh_mode mode);
 
 #endif
\ No newline at end of file
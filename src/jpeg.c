@@ -40,7 +40,10 @@ int omxcam__jpeg_is_valid_thumbnail (uint32_t dimension){
   return dimension <= 1024;
 }
 
-int omxcam__jpeg_add_tag (char* key, char* value){
+int omxcam__jpeg_add_tag (
+    omxcam__component_t* component,
+    char* key,
+    char* value){
   int key_length = strlen (key);
   int value_length = strlen (value);
   
@@ -64,18 +67,55 @@ int omxcam__jpeg_add_tag (char* key, char* value){
   
   OMX_ERRORTYPE error;
   
-  if ((error = OMX_SetConfig (omxcam__ctx.image_encode.handle,
-      OMX_IndexConfigMetadataItem, &item))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigMetadataItem: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+  if ((error = OMX_SetConfig (component->handle, OMX_IndexConfigMetadataItem,
+      &item))){
+    omxcam__omx_error (component, "OMX_SetConfig - OMX_IndexConfigMetadataItem",
+        error);
     return -1;
   }
   
   return 0;
 }
 
-int omxcam__jpeg_configure_omx (omxcam_jpeg_settings_t* settings){
-  omxcam__trace ("configuring '%s' settings", omxcam__ctx.image_encode.name);
+int omxcam__jpeg_add_tags (
+    omxcam__component_t* component,
+    omxcam_jpeg_settings_t* settings){
+  //EXIF tags
+  //See firmware/documentation/ilcomponents/image_decode.html for valid keys
+  //See http://www.media.mit.edu/pia/Research/deepview/exif.html#IFD0Tags
+  //for valid keys and their description
+  char timestamp[20];
+  time_t now;
+  struct tm ts;
+  time (&now);
+  ts = *localtime (&now);
+  strftime (timestamp, sizeof (timestamp), "%Y:%m:%d %H:%M:%S", &ts);
+  
+  if (omxcam__jpeg_add_tag (component, "EXIF.DateTimeOriginal", timestamp)){
+    return -1;
+  }
+  if (omxcam__jpeg_add_tag (component, "EXIF.DateTimeDigitized", timestamp)){
+    return -1;
+  }
+  if (omxcam__jpeg_add_tag (component, "IFD0.DateTime", timestamp)){
+    return -1;
+  }
+  
+  uint32_t i;
+  for (i=0; i<settings->exif.valid_tags; i++){
+    if (omxcam__jpeg_add_tag (component, settings->exif.tags[i].key,
+        settings->exif.tags[i].value)){
+      return -1;
+    }
+  }
+  
+  return 0;
+}
+
+int omxcam__jpeg_configure_omx (
+    omxcam__component_t* component,
+    omxcam_jpeg_settings_t* settings){
+  omxcam__trace ("configuring '%s' settings", component->name);
 
   OMX_ERRORTYPE error;
   
@@ -84,10 +124,10 @@ int omxcam__jpeg_configure_omx (omxcam_jpeg_settings_t* settings){
   omxcam__omx_struct_init (quality_st);
   quality_st.nPortIndex = 341;
   quality_st.nQFactor = settings->quality;
-  if ((error = OMX_SetParameter (omxcam__ctx.image_encode.handle,
+  if ((error = OMX_SetParameter (component->handle,
       OMX_IndexParamQFactor, &quality_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamQFactor: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (component,
+        "OMX_SetParameter - OMX_IndexParamQFactor", error);
     return -1;
   }
   
@@ -95,10 +135,10 @@ int omxcam__jpeg_configure_omx (omxcam_jpeg_settings_t* settings){
   OMX_CONFIG_BOOLEANTYPE exif_st;
   omxcam__omx_struct_init (exif_st);
   exif_st.bEnabled = !settings->exif.enabled;
-  if ((error = OMX_SetParameter (omxcam__ctx.image_encode.handle,
+  if ((error = OMX_SetParameter (component->handle,
       OMX_IndexParamBrcmDisableEXIF, &exif_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamBrcmDisableEXIF: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (component,
+        "OMX_SetParameter - OMX_IndexParamBrcmDisableEXIF", error);
     return -1;
   }
   
@@ -116,8 +156,8 @@ int omxcam__jpeg_configure_omx (omxcam_jpeg_settings_t* settings){
     memcpy (raw.uri_st.contentURI, dummy, 5);
     if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
         OMX_IndexConfigCaptureRawImageURI, &raw))){
-      omxcam__error ("OMX_SetConfig - OMX_IndexConfigCaptureRawImageURI: %s",
-          omxcam__dump_OMX_ERRORTYPE (error));
+      omxcam__omx_error (&omxcam__ctx.camera,
+          "OMX_SetConfig - OMX_IndexConfigCaptureRawImageURI", error);
       return -1;
     }
   }
@@ -127,37 +167,16 @@ int omxcam__jpeg_configure_omx (omxcam_jpeg_settings_t* settings){
   omxcam__omx_struct_init (ijg_st);
   ijg_st.nPortIndex = 341;
   ijg_st.bEnabled = settings->ijg;
-  if ((error = OMX_SetParameter (omxcam__ctx.image_encode.handle,
+  if ((error = OMX_SetParameter (component->handle,
       OMX_IndexParamBrcmEnableIJGTableScaling, &ijg_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamBrcmEnableIJGTableScaling: "
-        "%s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (component,
+        "OMX_SetParameter - OMX_IndexParamBrcmEnableIJGTableScaling", error);
     return -1;
   }
   
   if (!settings->exif.enabled) return 0;
   
-  //EXIF tags
-  //See firmware/documentation/ilcomponents/image_decode.html for valid keys
-  //See http://www.media.mit.edu/pia/Research/deepview/exif.html#IFD0Tags
-  //for valid keys and their description
-  char timestamp[20];
-  time_t now;
-  struct tm ts;
-  time (&now);
-  ts = *localtime (&now);
-  strftime (timestamp, sizeof (timestamp), "%Y:%m:%d %H:%M:%S", &ts);
-  
-  if (omxcam__jpeg_add_tag ("EXIF.DateTimeOriginal", timestamp)) return -1;
-  if (omxcam__jpeg_add_tag ("EXIF.DateTimeDigitized", timestamp)) return -1;
-  if (omxcam__jpeg_add_tag ("IFD0.DateTime", timestamp)) return -1;
-  
-  uint32_t i;
-  for (i=0; i<settings->exif.valid_tags; i++){
-    if (omxcam__jpeg_add_tag (settings->exif.tags[i].key,
-        settings->exif.tags[i].value)){
-      return -1;
-    }
-  }
+  if (omxcam__jpeg_add_tags (component, settings)) return -1;
   
   //Thumbnail
   OMX_PARAM_BRCMTHUMBNAILTYPE thumbnail_st;
@@ -166,10 +185,10 @@ int omxcam__jpeg_configure_omx (omxcam_jpeg_settings_t* settings){
   thumbnail_st.bUsePreview = settings->thumbnail.preview;
   thumbnail_st.nWidth = settings->thumbnail.width;
   thumbnail_st.nHeight = settings->thumbnail.height;
-  if ((error = OMX_SetParameter (omxcam__ctx.image_encode.handle,
+  if ((error = OMX_SetParameter (component->handle,
       OMX_IndexParamBrcmThumbnail, &thumbnail_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamBrcmThumbnail: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (component,
+        "OMX_SetParameter - OMX_IndexParamBrcmThumbnail", error);
     return -1;
   }
 
@@ -0,0 +1,505 @@
+#include "omxcam.h"
+#include "internal.h"
+
+//The component is kept between calls and it's only reconfigured when the
+//dimensions, the format or the jpeg settings change. It's not shared with the
+//still capture, both can be used at the same time
+static omxcam__component_t encoder;
+static int loaded = 0;
+static int configured = 0;
+static OMX_BUFFERHEADERTYPE* input_buffer;
+static OMX_BUFFERHEADERTYPE* output_buffer;
+static omxcam_format format;
+static uint32_t width;
+static uint32_t height;
+static uint32_t stride;
+static uint32_t slice_height;
+static omxcam_jpeg_settings_t configured_settings;
+
+//The input buffer is returned by EmptyBufferDone
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int input_free;
+
+int omxcam__jpeg_encode_buffer_done (
+    omxcam__component_t* component,
+    OMX_BUFFERHEADERTYPE* buffer){
+  if (component != &encoder) return 0;
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return 1;
+  }
+  
+  input_free = 1;
+  
+  if (pthread_cond_signal (&cond)){
+    omxcam__error ("pthread_cond_signal");
+  }
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+  }
+  
+  return 1;
+}
+
+static int omxcam__jpeg_encode_wait_input (){
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return -1;
+  }
+  
+  //Spurious wakeup guard
+  while (!input_free){
+    if (pthread_cond_wait (&cond, &mutex)){
+      omxcam__error ("pthread_cond_wait");
+      pthread_mutex_unlock (&mutex);
+      return -1;
+    }
+  }
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    return -1;
+  }
+  
+  return 0;
+}
+
+static uint32_t omxcam__jpeg_encode_bpp (omxcam_format image_format){
+  switch (image_format){
+    case OMXCAM_FORMAT_RGB888:
+      return 3;
+    case OMXCAM_FORMAT_RGBA8888:
+      return 4;
+    default:
+      return 1;
+  }
+}
+
+static int omxcam__jpeg_encode_change_state (omxcam__state state){
+  if (omxcam__component_change_state (&encoder, state)) return -1;
+  if (omxcam__event_wait (&encoder, OMXCAM_EVENT_STATE_SET, 0, 0)) return -1;
+  return 0;
+}
+
+static int omxcam__jpeg_encode_validate (
+    omxcam_image_t* image,
+    omxcam_jpeg_settings_t* settings){
+  if (image->format != OMXCAM_FORMAT_YUV420 &&
+      image->format != OMXCAM_FORMAT_RGB888 &&
+      image->format != OMXCAM_FORMAT_RGBA8888){
+    omxcam__error ("invalid 'format' value");
+    omxcam__set_last_error (OMXCAM_ERROR_FORMAT);
+    return -1;
+  }
+  if (image->width < OMXCAM_MIN_WIDTH ||
+      image->width > OMXCAM_STILL_MAX_WIDTH ||
+      image->height < OMXCAM_MIN_HEIGHT ||
+      image->height > OMXCAM_STILL_MAX_HEIGHT){
+    omxcam__error ("invalid image dimensions");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  if (!image->planes[0] || (image->format == OMXCAM_FORMAT_YUV420 &&
+      (!image->planes[1] || !image->planes[2] || (image->width & 1) ||
+      (image->height & 1)))){
+    omxcam__error ("invalid image planes");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  if (omxcam__jpeg_validate (settings)){
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  //There's no camera, the raw data and the preview frame don't exist
+  if (settings->raw_bayer ||
+      (settings->thumbnail.enabled && settings->thumbnail.preview)){
+    omxcam__error ("'jpeg.raw_bayer' and 'jpeg.thumbnail.preview' need the "
+        "camera");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  return 0;
+}
+
+static int omxcam__jpeg_encode_configure (
+    omxcam_image_t* image,
+    omxcam_jpeg_settings_t* settings){
+  omxcam__trace ("configuring '%s' port definition (%dx%d)", encoder.name,
+      image->width, image->height);
+  
+  OMX_COLOR_FORMATTYPE color_format;
+  OMX_ERRORTYPE error;
+  
+  switch (image->format){
+    case OMXCAM_FORMAT_RGB888:
+      color_format = OMX_COLOR_Format24bitRGB888;
+      break;
+    case OMXCAM_FORMAT_RGBA8888:
+      color_format = OMX_COLOR_Format32bitABGR8888;
+      break;
+    default:
+      color_format = OMX_COLOR_FormatYUV420PackedPlanar;
+      break;
+  }
+  
+  format = image->format;
+  width = image->width;
+  height = image->height;
+  //Same layout as the frames of the camera
+  stride = omxcam_round (width, 32)*omxcam__jpeg_encode_bpp (format);
+  slice_height = omxcam_round (height, 16);
+  
+  OMX_PARAM_PORTDEFINITIONTYPE port_st;
+  omxcam__omx_struct_init (port_st);
+  port_st.nPortIndex = 340;
+  if ((error = OMX_GetParameter (encoder.handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    omxcam__omx_error (&encoder,
+        "OMX_GetParameter - OMX_IndexParamPortDefinition", error);
+    return -1;
+  }
+  
+  port_st.format.image.nFrameWidth = width;
+  port_st.format.image.nFrameHeight = height;
+  port_st.format.image.nStride = stride;
+  port_st.format.image.nSliceHeight = slice_height;
+  port_st.format.image.eCompressionFormat = OMX_IMAGE_CodingUnused;
+  port_st.format.image.eColorFormat = color_format;
+  if ((error = OMX_SetParameter (encoder.handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    omxcam__omx_error (&encoder,
+        "OMX_SetParameter - OMX_IndexParamPortDefinition", error);
+    return -1;
+  }
+  
+  //The size of the buffer is updated by the component
+  if ((error = OMX_GetParameter (encoder.handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    omxcam__omx_error (&encoder,
+        "OMX_GetParameter - OMX_IndexParamPortDefinition", error);
+    return -1;
+  }
+  
+  uint32_t input_size = port_st.nBufferSize;
+  
+  omxcam__omx_struct_init (port_st);
+  port_st.nPortIndex = 341;
+  if ((error = OMX_GetParameter (encoder.handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    omxcam__omx_error (&encoder,
+        "OMX_GetParameter - OMX_IndexParamPortDefinition", error);
+    return -1;
+  }
+  
+  port_st.format.image.nFrameWidth = width;
+  port_st.format.image.nFrameHeight = height;
+  port_st.format.image.eCompressionFormat = OMX_IMAGE_CodingJPEG;
+  port_st.format.image.eColorFormat = OMX_COLOR_FormatUnused;
+  if ((error = OMX_SetParameter (encoder.handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    omxcam__omx_error (&encoder,
+        "OMX_SetParameter - OMX_IndexParamPortDefinition", error);
+    return -1;
+  }
+  
+  if ((error = OMX_GetParameter (encoder.handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    omxcam__omx_error (&encoder,
+        "OMX_GetParameter - OMX_IndexParamPortDefinition", error);
+    return -1;
+  }
+  
+  if (omxcam__jpeg_configure_omx (&encoder, settings)){
+    omxcam__set_last_error (OMXCAM_ERROR_JPEG);
+    return -1;
+  }
+  
+  //Change to Idle
+  if (omxcam__jpeg_encode_change_state (OMXCAM_STATE_IDLE)){
+    omxcam__set_last_error (OMXCAM_ERROR_IDLE);
+    return -1;
+  }
+  
+  //Enable the ports
+  if (omxcam__component_port_enable (&encoder, 340)) return -1;
+  if ((error = OMX_AllocateBuffer (encoder.handle, &input_buffer, 340, 0,
+      input_size))){
+    omxcam__omx_error (&encoder, "OMX_AllocateBuffer", error);
+    return -1;
+  }
+  if (omxcam__event_wait (&encoder, OMXCAM_EVENT_PORT_ENABLE, 0, 0)) return -1;
+  if (omxcam__component_port_enable (&encoder, 341)) return -1;
+  if ((error = OMX_AllocateBuffer (encoder.handle, &output_buffer, 341, 0,
+      port_st.nBufferSize))){
+    omxcam__omx_error (&encoder, "OMX_AllocateBuffer", error);
+    return -1;
+  }
+  if (omxcam__event_wait (&encoder, OMXCAM_EVENT_PORT_ENABLE, 0, 0)) return -1;
+  
+  //Change to Executing
+  if (omxcam__jpeg_encode_change_state (OMXCAM_STATE_EXECUTING)){
+    omxcam__set_last_error (OMXCAM_ERROR_EXECUTING);
+    return -1;
+  }
+  
+  configured = 1;
+  configured_settings = *settings;
+  input_free = 1;
+  
+  return 0;
+}
+
+static int omxcam__jpeg_encode_unconfigure (){
+  omxcam__trace ("unconfiguring '%s'", encoder.name);
+  
+  OMX_ERRORTYPE error;
+  
+  configured = 0;
+  
+  //Change to Idle
+  if (omxcam__jpeg_encode_change_state (OMXCAM_STATE_IDLE)){
+    omxcam__set_last_error (OMXCAM_ERROR_IDLE);
+    return -1;
+  }
+  
+  //Disable the ports
+  if (omxcam__component_port_disable (&encoder, 340)) return -1;
+  if ((error = OMX_FreeBuffer (encoder.handle, 340, input_buffer))){
+    omxcam__omx_error (&encoder, "OMX_FreeBuffer", error);
+    return -1;
+  }
+  if (omxcam__event_wait (&encoder, OMXCAM_EVENT_PORT_DISABLE, 0, 0)){
+    return -1;
+  }
+  if (omxcam__component_port_disable (&encoder, 341)) return -1;
+  if ((error = OMX_FreeBuffer (encoder.handle, 341, output_buffer))){
+    omxcam__omx_error (&encoder, "OMX_FreeBuffer", error);
+    return -1;
+  }
+  if (omxcam__event_wait (&encoder, OMXCAM_EVENT_PORT_DISABLE, 0, 0)){
+    return -1;
+  }
+  
+  //Change to Loaded
+  if (omxcam__jpeg_encode_change_state (OMXCAM_STATE_LOADED)){
+    omxcam__set_last_error (OMXCAM_ERROR_LOADED);
+    return -1;
+  }
+  
+  return 0;
+}
+
+static int omxcam__jpeg_encode_load (){
+  omxcam__trace ("loading jpeg encoder");
+  
+  OMX_ERRORTYPE error;
+  
+  encoder.name = OMXCAM_IMAGE_ENCODE_NAME;
+  
+  //The camera is not used, it doesn't need to be checked
+  bcm_host_init ();
+  
+  if ((error = OMX_Init ())){
+    omxcam__omx_error (0, "OMX_Init", error);
+    omxcam__set_last_error (OMXCAM_ERROR_INIT);
+    return -1;
+  }
+  
+  if (omxcam__component_init (&encoder)){
+    omxcam__set_last_error (OMXCAM_ERROR_INIT_IMAGE_ENCODER);
+    OMX_Deinit ();
+    return -1;
+  }
+  
+  loaded = 1;
+  
+  return 0;
+}
+
+static int omxcam__jpeg_encode_release (){
+  OMX_ERRORTYPE error;
+  int r = 0;
+  
+  if (configured && omxcam__jpeg_encode_unconfigure ()) r = -1;
+  
+  if (omxcam__component_deinit (&encoder)){
+    omxcam__set_last_error (OMXCAM_ERROR_DEINIT_IMAGE_ENCODER);
+    r = -1;
+  }
+  
+  loaded = 0;
+  configured = 0;
+  
+  //bcm_host_deinit() is not called, the camera could be capturing video
+  if ((error = OMX_Deinit ())){
+    omxcam__omx_error (0, "OMX_Deinit", error);
+    omxcam__set_last_error (OMXCAM_ERROR_DEINIT);
+    r = -1;
+  }
+  
+  return r;
+}
+
+static int omxcam__jpeg_encode_changed (
+    omxcam_image_t* image,
+    omxcam_jpeg_settings_t* settings){
+  //The exif tags are configs, they are set again with each image
+  return image->format != format || image->width != width ||
+      image->height != height ||
+      settings->quality != configured_settings.quality ||
+      settings->exif.enabled != configured_settings.exif.enabled ||
+      settings->ijg != configured_settings.ijg ||
+      settings->thumbnail.enabled != configured_settings.thumbnail.enabled ||
+      settings->thumbnail.width != configured_settings.thumbnail.width ||
+      settings->thumbnail.height != configured_settings.thumbnail.height;
+}
+
+static void omxcam__jpeg_encode_copy (
+    uint8_t* dst,
+    uint32_t dst_stride,
+    uint8_t* src,
+    uint32_t src_stride,
+    uint32_t row_length,
+    uint32_t rows){
+  if (dst_stride == src_stride){
+    memcpy (dst, src, src_stride*rows);
+    return;
+  }
+  
+  uint32_t row;
+  for (row=0; row<rows; row++){
+    memcpy (dst, src, row_length);
+    dst += dst_stride;
+    src += src_stride;
+  }
+}
+
+static uint32_t omxcam__jpeg_encode_fill (omxcam_image_t* image){
+  uint32_t row_length = width*omxcam__jpeg_encode_bpp (format);
+  uint32_t src_stride = image->stride ? image->stride : row_length;
+  uint8_t* data = input_buffer->pBuffer;
+  
+  if (format != OMXCAM_FORMAT_YUV420){
+    omxcam__jpeg_encode_copy (data, stride, image->planes[0], src_stride,
+        row_length, height);
+    return stride*slice_height;
+  }
+  
+  omxcam_yuv_planes_t planes;
+  omxcam_yuv_planes (width, height, &planes);
+  
+  omxcam__jpeg_encode_copy (data + planes.offset_y, stride, image->planes[0],
+      src_stride, width, height);
+  omxcam__jpeg_encode_copy (data + planes.offset_u, stride >> 1,
+      image->planes[1], src_stride >> 1, width >> 1, height >> 1);
+  omxcam__jpeg_encode_copy (data + planes.offset_v, stride >> 1,
+      image->planes[2], src_stride >> 1, width >> 1, height >> 1);
+  
+  return planes.offset_v + planes.length_v;
+}
+
+static int omxcam__jpeg_encode (
+    omxcam_image_t* image,
+    omxcam_jpeg_settings_t* settings,
+    void (*on_data)(omxcam_buffer_t buffer)){
+  OMX_ERRORTYPE error;
+  
+  if (!loaded && omxcam__jpeg_encode_load ()) return -1;
+  
+  if (configured && omxcam__jpeg_encode_changed (image, settings) &&
+      omxcam__jpeg_encode_unconfigure ()){
+    return -1;
+  }
+  
+  if (!configured){
+    if (omxcam__jpeg_encode_configure (image, settings)) return -1;
+  }else if (settings->exif.enabled &&
+      omxcam__jpeg_add_tags (&encoder, settings)){
+    return -1;
+  }
+  
+  //The whole image fits in the input buffer
+  input_buffer->nOffset = 0;
+  input_buffer->nFilledLen = omxcam__jpeg_encode_fill (image);
+  input_buffer->nFlags = OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_EOS;
+  input_free = 0;
+  
+  if ((error = OMX_EmptyThisBuffer (encoder.handle, input_buffer))){
+    omxcam__omx_error (&encoder, "OMX_EmptyThisBuffer", error);
+    return -1;
+  }
+  
+  omxcam_buffer_t buffer;
+  uint32_t current_events;
+  
+  do{
+    if ((error = OMX_FillThisBuffer (encoder.handle, output_buffer))){
+      omxcam__omx_error (&encoder, "OMX_FillThisBuffer", error);
+      return -1;
+    }
+    
+    //Wait until it's filled
+    if (omxcam__event_wait (&encoder, OMXCAM_EVENT_FILL_BUFFER_DONE,
+        &current_events, 0)){
+      return -1;
+    }
+    
+    //The end of the image is also notified with an OMX_EventBufferFlag
+    if ((current_events & OMXCAM_EVENT_BUFFER_FLAG) &&
+        omxcam__event_wait (&encoder, OMXCAM_EVENT_BUFFER_FLAG, 0, 0)){
+      return -1;
+    }
+    
+    omxcam__buffer_wrap_header (output_buffer, &buffer);
+    if (buffer.length && on_data) on_data (buffer);
+  }while (!(buffer.flags & OMXCAM_BUFFER_END_OF_STREAM));
+  
+  //The input buffer can be reused when the encoder returns it
+  if (omxcam__jpeg_encode_wait_input ()) return -1;
+  
+  return 0;
+}
+
+void omxcam_jpeg_init (omxcam_jpeg_settings_t* settings){
+  omxcam__jpeg_init (settings);
+}
+
+int omxcam_jpeg_encode (
+    omxcam_image_t* image,
+    omxcam_jpeg_settings_t* settings,
+    void (*on_data)(omxcam_buffer_t buffer)){
+  omxcam__trace ("encoding jpeg image");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__jpeg_encode_validate (image, settings)) return -1;
+  
+  if (omxcam__jpeg_encode (image, settings, on_data)){
+    if (omxcam_last_error () == OMXCAM_ERROR_NONE){
+      omxcam__set_last_error (OMXCAM_ERROR_JPEG);
+    }
+    
+    //The state of the component is unknown, it's released and loaded again
+    //with the next image. The error of the encoding is reported
+    omxcam_error_details_t details;
+    omxcam_last_error_details (&details);
+    if (loaded) omxcam__jpeg_encode_release ();
+    omxcam__set_last_error_details (&details);
+    
+    return -1;
+  }
+  
+  return 0;
+}
+
+int omxcam_jpeg_encode_free (){
+  omxcam__trace ("releasing jpeg encoder");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (!loaded) return 0;
+  
+  return omxcam__jpeg_encode_release ();
+}
@@ -0,0 +1,105 @@
+#include "omxcam.h"
+#include "internal.h"
+
+//Read by the consumer, updated at the end of each frame
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static omxcam_latency_t stats;
+static uint64_t sum;
+
+//Only used from the thread that fills the buffers
+static int64_t offset;
+static int offset_valid;
+static int64_t frame_first;
+static int frame_open;
+
+static int64_t omxcam__latency_now (){
+  //Monotonic clock, the wall clock jumps when it's adjusted by NTP
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec*1000000 + now.tv_nsec/1000;
+}
+
+void omxcam__latency_start (){
+  offset_valid = 0;
+  frame_open = 0;
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return;
+  }
+  memset (&stats, 0, sizeof (omxcam_latency_t));
+  sum = 0;
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+  }
+}
+
+void omxcam__latency_update (omxcam_buffer_t* buffer){
+  if ((buffer->flags & OMXCAM_BUFFER_CODEC_CONFIG) || buffer->timestamp == -1){
+    return;
+  }
+  
+  int64_t now = omxcam__latency_now ();
+  
+  if (!frame_open){
+    frame_open = 1;
+    frame_first = now;
+    
+    //The timestamps come from the clock of the GPU, the offset between both
+    //clocks is the smallest delay that has been seen
+    int64_t delay = now - buffer->timestamp;
+    if (!offset_valid || delay < offset){
+      offset = delay;
+      offset_valid = 1;
+    }
+  }
+  
+  if (!(buffer->flags & OMXCAM_BUFFER_END_OF_FRAME)) return;
+  frame_open = 0;
+  
+  uint32_t first = frame_first - buffer->timestamp - offset;
+  uint32_t last = now - buffer->timestamp - offset;
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return;
+  }
+  
+  if (!stats.frames || last < stats.min) stats.min = last;
+  if (last > stats.max) stats.max = last;
+  stats.first = first;
+  stats.last = last;
+  stats.frames++;
+  sum += last;
+  stats.mean = sum/stats.frames;
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+  }
+}
+
+int omxcam_video_get_latency (omxcam_latency_t* latency){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (!omxcam__ctx.state.ready || !omxcam__ctx.measure_latency){
+    omxcam__error ("latency is not being measured");
+    omxcam__set_last_error (OMXCAM_ERROR_CAMERA_UPDATE);
+    return -1;
+  }
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  *latency = stats;
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  return 0;
+}
@@ -0,0 +1,35 @@
+#include "omxcam.h"
+#include "internal.h"
+
+void omxcam__mjpeg_init (omxcam_mjpeg_settings_t* settings){
+  settings->quality = 75;
+}
+
+int omxcam__mjpeg_validate (omxcam_mjpeg_settings_t* settings){
+  if (!omxcam__jpeg_is_valid_quality (settings->quality)){
+    omxcam__error ("invalid 'mjpeg.quality' value");
+    return -1;
+  }
+  return 0;
+}
+
+int omxcam__mjpeg_configure_omx (omxcam_mjpeg_settings_t* settings){
+  omxcam__trace ("configuring '%s' settings", omxcam__ctx.video_encode.name);
+  
+  OMX_ERRORTYPE error;
+  
+  //Quality, the bitrate of the port is 0 so each frame is encoded with the
+  //same quality
+  OMX_IMAGE_PARAM_QFACTORTYPE quality_st;
+  omxcam__omx_struct_init (quality_st);
+  quality_st.nPortIndex = 201;
+  quality_st.nQFactor = settings->quality;
+  if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
+      OMX_IndexParamQFactor, &quality_st))){
+    omxcam__omx_error (&omxcam__ctx.video_encode,
+        "OMX_SetParameter - OMX_IndexParamQFactor", error);
+    return -1;
+  }
+  
+  return 0;
+}
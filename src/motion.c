@@ -0,0 +1,254 @@
+#include "omxcam.h"
+#include "internal.h"
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+//The loops of this file are executed for each macroblock of each frame. The
+//magnitude and the threshold use NEON when the library is built with it (e.g.
+//-mfpu=neon on the Raspberry Pi 2), 8 macroblocks per iteration
+
+static omxcam_motion_vector_t* omxcam__motion_row (
+    omxcam_motion_field_t* field,
+    uint32_t row){
+  return field->vectors + row*field->stride;
+}
+
+static void omxcam__motion_clip (
+    omxcam_motion_field_t* field,
+    omxcam_motion_box_t* box,
+    omxcam_motion_box_t* clipped){
+  clipped->x = box->x < field->cols ? box->x : field->cols;
+  clipped->y = box->y < field->rows ? box->y : field->rows;
+  clipped->width = field->cols - clipped->x;
+  if (box->width < clipped->width) clipped->width = box->width;
+  clipped->height = field->rows - clipped->y;
+  if (box->height < clipped->height) clipped->height = box->height;
+}
+
+int omxcam_motion_field (
+    omxcam_buffer_t buffer,
+    uint32_t width,
+    uint32_t height,
+    omxcam_motion_field_t* field){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  uint32_t cols = (width + OMXCAM_MOTION_MACROBLOCK_SIZE - 1)/
+      OMXCAM_MOTION_MACROBLOCK_SIZE;
+  uint32_t rows = (height + OMXCAM_MOTION_MACROBLOCK_SIZE - 1)/
+      OMXCAM_MOTION_MACROBLOCK_SIZE;
+  uint32_t stride = cols + 1;
+  
+  if (!cols || !rows ||
+      buffer.length < stride*rows*sizeof (omxcam_motion_vector_t) ||
+      ((uintptr_t)buffer.data & 1)){
+    omxcam__error ("invalid motion vectors buffer");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  field->vectors = (omxcam_motion_vector_t*)buffer.data;
+  field->cols = cols;
+  field->rows = rows;
+  field->stride = stride;
+  
+  return 0;
+}
+
+void omxcam_motion_magnitude (
+    omxcam_motion_field_t* field,
+    uint16_t* magnitudes){
+  uint32_t cols = field->cols;
+  uint32_t row;
+  uint32_t col;
+  
+  for (row=0; row<field->rows; row++){
+    omxcam_motion_vector_t* v = omxcam__motion_row (field, row);
+    uint16_t* m = magnitudes + row*cols;
+    col = 0;
+    
+#ifdef __ARM_NEON
+    //Deinterleaved x, y and the 2 bytes of the SAD, x*x + y*y <= 32768
+    for (; col + 8 <= cols; col += 8){
+      int8x8x4_t in = vld4_s8 ((int8_t*)(v + col));
+      uint16x8_t x = vreinterpretq_u16_s16 (vmull_s8 (in.val[0], in.val[0]));
+      uint16x8_t y = vreinterpretq_u16_s16 (vmull_s8 (in.val[1], in.val[1]));
+      vst1q_u16 (m + col, vaddq_u16 (x, y));
+    }
+#endif
+    
+    for (; col<cols; col++){
+      int32_t x = v[col].x;
+      int32_t y = v[col].y;
+      m[col] = x*x + y*y;
+    }
+  }
+}
+
+uint32_t omxcam_motion_threshold (
+    omxcam_motion_field_t* field,
+    omxcam_motion_threshold_t* threshold,
+    uint8_t* mask){
+  uint32_t magnitude = threshold->magnitude*threshold->magnitude;
+  uint32_t sad = threshold->sad;
+  //The stores to the mask can alias the field, the bounds are kept in locals
+  uint32_t cols = field->cols;
+  uint32_t moving = 0;
+  uint32_t row;
+  uint32_t col;
+  
+#ifdef __ARM_NEON
+  //The comparisons are 16-bit, greater thresholds use the scalar loop
+  int neon = magnitude <= 0xFFFF && sad <= 0xFFFF;
+  uint16x8_t magnitude_min = vdupq_n_u16 (magnitude);
+  uint16x8_t sad_min = vdupq_n_u16 (sad);
+  uint8x8_t one = vdup_n_u8 (1);
+#endif
+  
+  for (row=0; row<field->rows; row++){
+    omxcam_motion_vector_t* v = omxcam__motion_row (field, row);
+    uint8_t* m = mask + row*cols;
+    col = 0;
+    
+#ifdef __ARM_NEON
+    //Moving macroblocks of the row, at most 8 per lane
+    uint16x8_t count = vdupq_n_u16 (0);
+    
+    for (; neon && col + 8 <= cols; col += 8){
+      uint8x8x4_t in = vld4_u8 ((uint8_t*)(v + col));
+      int8x8_t vx = vreinterpret_s8_u8 (in.val[0]);
+      int8x8_t vy = vreinterpret_s8_u8 (in.val[1]);
+      uint16x8_t length = vaddq_u16 (
+          vreinterpretq_u16_s16 (vmull_s8 (vx, vx)),
+          vreinterpretq_u16_s16 (vmull_s8 (vy, vy)));
+      uint16x8_t block_sad = vorrq_u16 (vmovl_u8 (in.val[2]),
+          vshll_n_u8 (in.val[3], 8));
+      uint16x8_t moves = vandq_u16 (vcgeq_u16 (length, magnitude_min),
+          vcgeq_u16 (block_sad, sad_min));
+      uint8x8_t value = vand_u8 (vmovn_u16 (moves), one);
+      vst1_u8 (m + col, value);
+      count = vaddw_u8 (count, value);
+    }
+    
+    uint64x2_t total = vpaddlq_u32 (vpaddlq_u16 (count));
+    moving += vgetq_lane_u64 (total, 0) + vgetq_lane_u64 (total, 1);
+#endif
+    
+    for (; col<cols; col++){
+      int32_t x = v[col].x;
+      int32_t y = v[col].y;
+      uint8_t value = ((uint32_t)(x*x + y*y) >= magnitude) &
+          (v[col].sad >= sad);
+      m[col] = value;
+      moving += value;
+    }
+  }
+  
+  return moving;
+}
+
+void omxcam_motion_sum (
+    omxcam_motion_field_t* field,
+    omxcam_motion_box_t* box,
+    omxcam_motion_sum_t* sum){
+  omxcam_motion_box_t clipped;
+  uint32_t row;
+  uint32_t col;
+  
+  omxcam__motion_clip (field, box, &clipped);
+  memset (sum, 0, sizeof (omxcam_motion_sum_t));
+  
+  for (row=clipped.y; row<clipped.y + clipped.height; row++){
+    omxcam_motion_vector_t* v = omxcam__motion_row (field, row) + clipped.x;
+    //32-bit sums per row, a row has less than 2^16 macroblocks
+    int32_t x = 0;
+    int32_t y = 0;
+    uint32_t magnitude = 0;
+    uint32_t sad = 0;
+    
+    for (col=0; col<clipped.width; col++){
+      int32_t vx = v[col].x;
+      int32_t vy = v[col].y;
+      x += vx;
+      y += vy;
+      magnitude += vx*vx + vy*vy;
+      sad += v[col].sad;
+    }
+    
+    sum->x += x;
+    sum->y += y;
+    sum->magnitude += magnitude;
+    sum->sad += sad;
+  }
+}
+
+void omxcam_motion_summarize (
+    omxcam_motion_field_t* field,
+    omxcam_motion_threshold_t* threshold,
+    omxcam_motion_summary_t* summary){
+  uint32_t magnitude = threshold->magnitude*threshold->magnitude;
+  uint32_t sad = threshold->sad;
+  uint32_t cols = field->cols;
+  uint32_t min_col = cols;
+  uint32_t max_col = 0;
+  uint32_t min_row = field->rows;
+  uint32_t max_row = 0;
+  uint32_t moving = 0;
+  int64_t sum_x = 0;
+  int64_t sum_y = 0;
+  uint64_t sum_sad = 0;
+  uint32_t row;
+  uint32_t col;
+  
+  for (row=0; row<field->rows; row++){
+    omxcam_motion_vector_t* v = omxcam__motion_row (field, row);
+    uint32_t row_moving = 0;
+    int32_t row_x = 0;
+    int32_t row_y = 0;
+    uint32_t row_sad = 0;
+    uint32_t row_first = cols;
+    uint32_t row_end = 0;
+    
+    for (col=0; col<cols; col++){
+      int32_t x = v[col].x;
+      int32_t y = v[col].y;
+      uint32_t value = ((uint32_t)(x*x + y*y) >= magnitude) &
+          (v[col].sad >= sad);
+      uint32_t first = value ? col : cols;
+      //Columns after the last moving macroblock, 0 if there's none
+      uint32_t end = value*(col + 1);
+      row_moving += value;
+      row_x += x*(int32_t)value;
+      row_y += y*(int32_t)value;
+      row_sad += v[col].sad;
+      row_first = first < row_first ? first : row_first;
+      row_end = end > row_end ? end : row_end;
+    }
+    
+    if (row_moving){
+      if (row < min_row) min_row = row;
+      max_row = row;
+      if (row_first < min_col) min_col = row_first;
+      if (row_end - 1 > max_col) max_col = row_end - 1;
+    }
+    
+    moving += row_moving;
+    sum_x += row_x;
+    sum_y += row_y;
+    sum_sad += row_sad;
+  }
+  
+  memset (summary, 0, sizeof (omxcam_motion_summary_t));
+  summary->moving = moving;
+  summary->mean_sad = (float)sum_sad/(cols*field->rows);
+  
+  if (!moving) return;
+  
+  summary->box.x = min_col;
+  summary->box.y = min_row;
+  summary->box.width = max_col - min_col + 1;
+  summary->box.height = max_row - min_row + 1;
+  summary->mean_x = (float)sum_x/moving;
+  summary->mean_y = (float)sum_y/moving;
+}
@@ -0,0 +1,624 @@
+#include "omxcam.h"
+#include "internal.h"
+
+//Default maximum length of the data of a fragment
+#define OMXCAM_MP4_MAX_FRAGMENT_SIZE 4194304
+
+//Timescale of the track, same as the MPEG-TS clock
+#define OMXCAM_MP4_TIMESCALE 90000
+
+//Duration of a sample when it cannot be calculated, 30fps
+#define OMXCAM_MP4_DEFAULT_DURATION 3000
+
+//Size of the moof box without the trun entries
+#define OMXCAM_MP4_MOOF_SIZE 88
+
+//Flags of the samples: depends_on = 2 (sync), depends_on = 1 + non sync
+#define OMXCAM_MP4_SYNC_SAMPLE 0x02000000
+#define OMXCAM_MP4_NON_SYNC_SAMPLE 0x01010000
+
+static uint32_t matrix[] = {
+  0x00010000, 0, 0,
+  0, 0x00010000, 0,
+  0, 0, 0x40000000
+};
+
+static uint8_t* omxcam__mp4_box (uint8_t* p, const char* type){
+  //The size is written when the box ends
+  p = omxcam__put_u32 (p, 0);
+  memcpy (p, type, 4);
+  return p + 4;
+}
+
+static uint8_t* omxcam__mp4_full_box (
+    uint8_t* p,
+    const char* type,
+    uint8_t version,
+    uint32_t flags){
+  p = omxcam__mp4_box (p, type);
+  return omxcam__put_u32 (p, (uint32_t)version << 24 | flags);
+}
+
+static void omxcam__mp4_box_end (uint8_t* box, uint8_t* p){
+  omxcam__put_u32 (box, p - box);
+}
+
+static uint8_t* omxcam__mp4_zeros (uint8_t* p, uint32_t length){
+  memset (p, 0, length);
+  return p + length;
+}
+
+static uint8_t* omxcam__mp4_matrix (uint8_t* p){
+  uint32_t i;
+  for (i=0; i<9; i++){
+    p = omxcam__put_u32 (p, matrix[i]);
+  }
+  return p;
+}
+
+static void omxcam__mp4_emit (
+    omxcam_mp4_t* mp4,
+    uint8_t* data,
+    uint32_t length,
+    uint32_t flags,
+    int64_t timestamp){
+  omxcam_buffer_t buffer;
+  buffer.data = data;
+  buffer.length = length;
+  buffer.flags = flags;
+  buffer.timestamp = timestamp;
+  if (mp4->on_data) mp4->on_data (buffer);
+}
+
+static uint8_t* omxcam__mp4_write_avcc (
+    omxcam_mp4_t* mp4,
+    omxcam_sps_t* sps,
+    uint8_t* p){
+  uint8_t* avcc = p;
+  p = omxcam__mp4_box (p, "avcC");
+  
+  *p++ = 1;
+  //profile, constraints and level as they appear in the SPS
+  *p++ = mp4->sps[1];
+  *p++ = mp4->sps[2];
+  *p++ = mp4->sps[3];
+  //The length of the NAL units is stored in 4 bytes
+  *p++ = 0xFC | 3;
+  *p++ = 0xE0 | 1;
+  p = omxcam__put_u16 (p, mp4->sps_length);
+  memcpy (p, mp4->sps, mp4->sps_length);
+  p += mp4->sps_length;
+  *p++ = 1;
+  p = omxcam__put_u16 (p, mp4->pps_length);
+  memcpy (p, mp4->pps, mp4->pps_length);
+  p += mp4->pps_length;
+  
+  if (sps->profile == 100 || sps->profile == 110 || sps->profile == 122 ||
+      sps->profile == 144){
+    *p++ = 0xFC | sps->chroma_format;
+    *p++ = 0xF8 | (sps->bit_depth - 8);
+    *p++ = 0xF8 | (sps->bit_depth - 8);
+    *p++ = 0;
+  }
+  
+  omxcam__mp4_box_end (avcc, p);
+  return p;
+}
+
+static uint8_t* omxcam__mp4_write_stbl (
+    omxcam_mp4_t* mp4,
+    omxcam_sps_t* sps,
+    uint8_t* p){
+  uint8_t* stbl = p;
+  p = omxcam__mp4_box (p, "stbl");
+  
+  uint8_t* stsd = p;
+  p = omxcam__mp4_full_box (p, "stsd", 0, 0);
+  p = omxcam__put_u32 (p, 1);
+  
+  uint8_t* avc1 = p;
+  p = omxcam__mp4_box (p, "avc1");
+  p = omxcam__mp4_zeros (p, 6);
+  //data_reference_index
+  p = omxcam__put_u16 (p, 1);
+  p = omxcam__mp4_zeros (p, 16);
+  p = omxcam__put_u16 (p, sps->width);
+  p = omxcam__put_u16 (p, sps->height);
+  //72 dpi
+  p = omxcam__put_u32 (p, 0x00480000);
+  p = omxcam__put_u32 (p, 0x00480000);
+  p = omxcam__put_u32 (p, 0);
+  //frame_count
+  p = omxcam__put_u16 (p, 1);
+  //compressorname
+  p = omxcam__mp4_zeros (p, 32);
+  p = omxcam__put_u16 (p, 0x0018);
+  p = omxcam__put_u16 (p, 0xFFFF);
+  p = omxcam__mp4_write_avcc (mp4, sps, p);
+  omxcam__mp4_box_end (avc1, p);
+  omxcam__mp4_box_end (stsd, p);
+  
+  //The samples are described in the fragments
+  uint8_t* box = p;
+  p = omxcam__mp4_full_box (p, "stts", 0, 0);
+  p = omxcam__put_u32 (p, 0);
+  omxcam__mp4_box_end (box, p);
+  
+  box = p;
+  p = omxcam__mp4_full_box (p, "stsc", 0, 0);
+  p = omxcam__put_u32 (p, 0);
+  omxcam__mp4_box_end (box, p);
+  
+  box = p;
+  p = omxcam__mp4_full_box (p, "stsz", 0, 0);
+  p = omxcam__put_u32 (p, 0);
+  p = omxcam__put_u32 (p, 0);
+  omxcam__mp4_box_end (box, p);
+  
+  box = p;
+  p = omxcam__mp4_full_box (p, "stco", 0, 0);
+  p = omxcam__put_u32 (p, 0);
+  omxcam__mp4_box_end (box, p);
+  
+  omxcam__mp4_box_end (stbl, p);
+  return p;
+}
+
+static uint8_t* omxcam__mp4_write_minf (
+    omxcam_mp4_t* mp4,
+    omxcam_sps_t* sps,
+    uint8_t* p){
+  uint8_t* minf = p;
+  p = omxcam__mp4_box (p, "minf");
+  
+  uint8_t* box = p;
+  p = omxcam__mp4_full_box (p, "vmhd", 0, 1);
+  p = omxcam__mp4_zeros (p, 8);
+  omxcam__mp4_box_end (box, p);
+  
+  uint8_t* dinf = p;
+  p = omxcam__mp4_box (p, "dinf");
+  uint8_t* dref = p;
+  p = omxcam__mp4_full_box (p, "dref", 0, 0);
+  p = omxcam__put_u32 (p, 1);
+  //The data is in the same file
+  box = p;
+  p = omxcam__mp4_full_box (p, "url ", 0, 1);
+  omxcam__mp4_box_end (box, p);
+  omxcam__mp4_box_end (dref, p);
+  omxcam__mp4_box_end (dinf, p);
+  
+  p = omxcam__mp4_write_stbl (mp4, sps, p);
+  
+  omxcam__mp4_box_end (minf, p);
+  return p;
+}
+
+static uint8_t* omxcam__mp4_write_trak (
+    omxcam_mp4_t* mp4,
+    omxcam_sps_t* sps,
+    uint8_t* p){
+  uint8_t* trak = p;
+  p = omxcam__mp4_box (p, "trak");
+  
+  //Enabled and in movie
+  uint8_t* box = p;
+  p = omxcam__mp4_full_box (p, "tkhd", 0, 3);
+  p = omxcam__mp4_zeros (p, 8);
+  //track_ID
+  p = omxcam__put_u32 (p, 1);
+  p = omxcam__mp4_zeros (p, 24);
+  p = omxcam__mp4_matrix (p);
+  p = omxcam__put_u32 (p, sps->width << 16);
+  p = omxcam__put_u32 (p, sps->height << 16);
+  omxcam__mp4_box_end (box, p);
+  
+  uint8_t* mdia = p;
+  p = omxcam__mp4_box (p, "mdia");
+  
+  box = p;
+  p = omxcam__mp4_full_box (p, "mdhd", 0, 0);
+  p = omxcam__mp4_zeros (p, 8);
+  p = omxcam__put_u32 (p, OMXCAM_MP4_TIMESCALE);
+  p = omxcam__put_u32 (p, 0);
+  //Undetermined language, "und"
+  p = omxcam__put_u16 (p, 0x55C4);
+  p = omxcam__put_u16 (p, 0);
+  omxcam__mp4_box_end (box, p);
+  
+  box = p;
+  p = omxcam__mp4_full_box (p, "hdlr", 0, 0);
+  p = omxcam__put_u32 (p, 0);
+  memcpy (p, "vide", 4);
+  p = omxcam__mp4_zeros (p + 4, 12);
+  memcpy (p, "VideoHandler", 13);
+  p += 13;
+  omxcam__mp4_box_end (box, p);
+  
+  p = omxcam__mp4_write_minf (mp4, sps, p);
+  
+  omxcam__mp4_box_end (mdia, p);
+  omxcam__mp4_box_end (trak, p);
+  return p;
+}
+
+static int omxcam__mp4_write_init (omxcam_mp4_t* mp4){
+  omxcam__trace ("writing mp4 initialization segment");
+  
+  omxcam_nal_t nal;
+  omxcam_sps_t sps;
+  
+  if (omxcam_nal_view (mp4->sps, mp4->sps_length, &nal) ||
+      omxcam_nal_parse_sps (&nal, &sps)){
+    omxcam__error ("invalid SPS");
+    return -1;
+  }
+  
+  //ftyp and moov are less than 1KB plus the parameter sets
+  uint8_t data[2048];
+  uint8_t* p = data;
+  
+  uint8_t* box = p;
+  p = omxcam__mp4_box (p, "ftyp");
+  memcpy (p, "iso5", 4);
+  p = omxcam__put_u32 (p + 4, 512);
+  memcpy (p, "iso5iso6avc1mp41", 16);
+  p += 16;
+  omxcam__mp4_box_end (box, p);
+  
+  uint8_t* moov = p;
+  p = omxcam__mp4_box (p, "moov");
+  
+  box = p;
+  p = omxcam__mp4_full_box (p, "mvhd", 0, 0);
+  p = omxcam__mp4_zeros (p, 8);
+  p = omxcam__put_u32 (p, 1000);
+  p = omxcam__put_u32 (p, 0);
+  //rate and volume
+  p = omxcam__put_u32 (p, 0x00010000);
+  p = omxcam__put_u16 (p, 0x0100);
+  p = omxcam__mp4_zeros (p, 10);
+  p = omxcam__mp4_matrix (p);
+  p = omxcam__mp4_zeros (p, 24);
+  //next_track_ID
+  p = omxcam__put_u32 (p, 2);
+  omxcam__mp4_box_end (box, p);
+  
+  p = omxcam__mp4_write_trak (mp4, &sps, p);
+  
+  uint8_t* mvex = p;
+  p = omxcam__mp4_box (p, "mvex");
+  box = p;
+  p = omxcam__mp4_full_box (p, "trex", 0, 0);
+  //track_ID and default_sample_description_index
+  p = omxcam__put_u32 (p, 1);
+  p = omxcam__put_u32 (p, 1);
+  p = omxcam__mp4_zeros (p, 12);
+  omxcam__mp4_box_end (box, p);
+  omxcam__mp4_box_end (mvex, p);
+  
+  omxcam__mp4_box_end (moov, p);
+  
+  omxcam__mp4_emit (mp4, data, p - data, OMXCAM_BUFFER_CODEC_CONFIG, -1);
+  
+  return 0;
+}
+
+static int omxcam__mp4_write_fragment (
+    omxcam_mp4_t* mp4,
+    uint32_t length,
+    int64_t next_time){
+  uint32_t samples = mp4->samples;
+  uint32_t size = OMXCAM_MP4_MOOF_SIZE + 12*samples;
+  
+  //moof plus the header of the mdat
+  if (size + 8 > mp4->moof_size){
+    uint8_t* moof = realloc (mp4->moof, size + 8);
+    if (!moof){
+      omxcam__error ("realloc");
+      omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+      return -1;
+    }
+    mp4->moof = moof;
+    mp4->moof_size = size + 8;
+  }
+  
+  uint8_t* p = mp4->moof;
+  p = omxcam__mp4_box (p, "moof");
+  
+  uint8_t* box = p;
+  p = omxcam__mp4_full_box (p, "mfhd", 0, 0);
+  p = omxcam__put_u32 (p, ++mp4->sequence);
+  omxcam__mp4_box_end (box, p);
+  
+  uint8_t* traf = p;
+  p = omxcam__mp4_box (p, "traf");
+  
+  //default-base-is-moof
+  box = p;
+  p = omxcam__mp4_full_box (p, "tfhd", 0, 0x020000);
+  p = omxcam__put_u32 (p, 1);
+  omxcam__mp4_box_end (box, p);
+  
+  box = p;
+  p = omxcam__mp4_full_box (p, "tfdt", 1, 0);
+  p = omxcam__put_u64 (p, mp4->sample_times[0]);
+  omxcam__mp4_box_end (box, p);
+  
+  //data-offset, sample-duration, sample-size and sample-flags
+  box = p;
+  p = omxcam__mp4_full_box (p, "trun", 0, 0x000701);
+  p = omxcam__put_u32 (p, samples);
+  p = omxcam__put_u32 (p, size + 8);
+  
+  uint32_t i;
+  for (i=0; i<samples; i++){
+    int64_t next = i + 1 < samples ? mp4->sample_times[i + 1] : next_time;
+    p = omxcam__put_u32 (p, next - mp4->sample_times[i]);
+    p = omxcam__put_u32 (p, mp4->sample_sizes[i]);
+    p = omxcam__put_u32 (p, mp4->sample_sync[i]
+        ? OMXCAM_MP4_SYNC_SAMPLE
+        : OMXCAM_MP4_NON_SYNC_SAMPLE);
+  }
+  
+  omxcam__mp4_box_end (box, p);
+  omxcam__mp4_box_end (traf, p);
+  omxcam__mp4_box_end (mp4->moof, p);
+  
+  p = omxcam__put_u32 (p, length + 8);
+  memcpy (p, "mdat", 4);
+  
+  int64_t timestamp = mp4->origin == -1
+      ? -1
+      : mp4->origin + mp4->sample_times[0]*100/9;
+  
+  omxcam__mp4_emit (mp4, mp4->moof, size + 8,
+      mp4->sample_sync[0] ? OMXCAM_BUFFER_KEYFRAME : 0, timestamp);
+  omxcam__mp4_emit (mp4, mp4->mdat, length, OMXCAM_BUFFER_END_OF_FRAME,
+      timestamp);
+  
+  //Keep the data of the frame that is not finished yet
+  memmove (mp4->mdat, mp4->mdat + length, mp4->mdat_length - length);
+  mp4->mdat_length -= length;
+  mp4->frame_start -= length;
+  mp4->samples = 0;
+  
+  return 0;
+}
+
+static int omxcam__mp4_add_sample (omxcam_mp4_t* mp4, int64_t time){
+  if (mp4->samples == mp4->samples_size){
+    uint32_t size = mp4->samples_size ? mp4->samples_size*2 : 64;
+    void* p;
+    
+    if (!(p = realloc (mp4->sample_sizes, size*sizeof (uint32_t)))){
+      goto error;
+    }
+    mp4->sample_sizes = p;
+    if (!(p = realloc (mp4->sample_times, size*sizeof (int64_t)))){
+      goto error;
+    }
+    mp4->sample_times = p;
+    if (!(p = realloc (mp4->sample_sync, size))){
+      goto error;
+    }
+    mp4->sample_sync = p;
+    
+    mp4->samples_size = size;
+  }
+  
+  mp4->sample_sizes[mp4->samples] = mp4->mdat_length - mp4->frame_start;
+  mp4->sample_times[mp4->samples] = time;
+  mp4->sample_sync[mp4->samples] = mp4->frame_sync;
+  mp4->samples++;
+  
+  return 0;
+  
+error:
+  omxcam__error ("realloc");
+  omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+  return -1;
+}
+
+static int omxcam__mp4_close_frame (omxcam_mp4_t* mp4){
+  if (!mp4->frame_open) return 0;
+  mp4->frame_open = 0;
+  
+  if (!mp4->header_written){
+    //The stream begins with the first IDR frame after the parameter sets
+    if (!mp4->frame_sync || !mp4->sps_length || !mp4->pps_length){
+      mp4->mdat_length = mp4->frame_start;
+      return 0;
+    }
+    if (omxcam__mp4_write_init (mp4)) return -1;
+    mp4->header_written = 1;
+  }
+  
+  //Decoding time in the track timescale. The timestamps start at 0 and they
+  //are extrapolated from the previous frame when they are unknown
+  int64_t time = mp4->last_time == -1
+      ? 0
+      : mp4->last_time + mp4->last_duration;
+  
+  if (mp4->frame_time != -1){
+    if (mp4->origin == -1) mp4->origin = mp4->frame_time - time*100/9;
+    time = ((mp4->frame_time - mp4->origin)*9 + 50)/100;
+  }
+  
+  if (mp4->last_time != -1){
+    //The decoding times must be increasing
+    if (time <= mp4->last_time) time = mp4->last_time + 1;
+    mp4->last_duration = time - mp4->last_time;
+  }
+  mp4->last_time = time;
+  
+  //The previous samples are written when a keyframe begins or they reach the
+  //size limit. The duration of the last one is known now
+  if (mp4->samples && (mp4->frame_sync ||
+      mp4->frame_start >= mp4->max_fragment_size)){
+    if (omxcam__mp4_write_fragment (mp4, mp4->frame_start, time)) return -1;
+  }
+  
+  return omxcam__mp4_add_sample (mp4, time);
+}
+
+static int omxcam__mp4_append (omxcam_mp4_t* mp4, omxcam_nal_t* nal){
+  //Annex-B to AVCC, the start code is replaced with the length
+  uint32_t length = mp4->mdat_length + 4 + nal->length;
+  
+  if (length > mp4->mdat_size){
+    uint32_t size = mp4->mdat_size ? mp4->mdat_size : 65536;
+    while (size < length) size *= 2;
+    
+    uint8_t* mdat = realloc (mp4->mdat, size);
+    if (!mdat){
+      omxcam__error ("realloc");
+      omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+      return -1;
+    }
+    
+    mp4->mdat = mdat;
+    mp4->mdat_size = size;
+  }
+  
+  uint8_t* p = omxcam__put_u32 (mp4->mdat + mp4->mdat_length, nal->length);
+  memcpy (p, nal->data, nal->length);
+  mp4->mdat_length = length;
+  
+  return 0;
+}
+
+static int omxcam__mp4_save (
+    uint8_t* data,
+    uint32_t* length,
+    omxcam_nal_t* nal){
+  //Without the parameter set the initialization segment can't be written
+  if (nal->length > 256){
+    omxcam__error ("parameter set too big (%d bytes)", nal->length);
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  memcpy (data, nal->data, nal->length);
+  *length = nal->length;
+  return 0;
+}
+
+static int omxcam__mp4_nal (omxcam_mp4_t* mp4, omxcam_nal_t* nal){
+  int slice = nal->type >= OMXCAM_NAL_SLICE && nal->type <= OMXCAM_NAL_IDR;
+  
+  switch (nal->type){
+    case OMXCAM_NAL_SPS:
+    case OMXCAM_NAL_PPS:
+    case OMXCAM_NAL_AUD:
+      //They begin a new access unit, they are not stored in the samples. The
+      //parameter sets of the initialization segment are the first ones
+      if (omxcam__mp4_close_frame (mp4)) return -1;
+      if (mp4->header_written || mp4->stopped) return 0;
+      if (nal->type == OMXCAM_NAL_SPS){
+        return omxcam__mp4_save (mp4->sps, &mp4->sps_length, nal);
+      }
+      if (nal->type == OMXCAM_NAL_PPS){
+        return omxcam__mp4_save (mp4->pps, &mp4->pps_length, nal);
+      }
+      return 0;
+    case OMXCAM_NAL_FILLER:
+      return 0;
+    case OMXCAM_NAL_SEI:
+      if (mp4->frame_slice && omxcam__mp4_close_frame (mp4)) return -1;
+      break;
+    default:
+      //The first slice of the next frame
+      if (slice && mp4->frame_slice && !nal->first_mb &&
+          omxcam__mp4_close_frame (mp4)){
+        return -1;
+      }
+  }
+  
+  //The capture was stopped from 'on_data' while the previous frame was being
+  //written, the NAL unit points to a buffer that has been freed
+  if (mp4->stopped) return 0;
+  
+  if (!mp4->frame_open){
+    mp4->frame_open = 1;
+    mp4->frame_slice = 0;
+    mp4->frame_sync = 0;
+    mp4->frame_time = mp4->buffer_time;
+    mp4->frame_start = mp4->mdat_length;
+  }
+  
+  if (slice) mp4->frame_slice = 1;
+  if (nal->type == OMXCAM_NAL_IDR) mp4->frame_sync = 1;
+  
+  return omxcam__mp4_append (mp4, nal);
+}
+
+void omxcam_mp4_init (
+    omxcam_mp4_t* mp4,
+    void (*on_data)(omxcam_buffer_t buffer)){
+  memset (mp4, 0, sizeof (omxcam_mp4_t));
+  omxcam_nal_parser_init (&mp4->parser);
+  mp4->on_data = on_data;
+  mp4->max_fragment_size = OMXCAM_MP4_MAX_FRAGMENT_SIZE;
+  mp4->buffer_time = -1;
+  mp4->origin = -1;
+  mp4->last_time = -1;
+  mp4->last_duration = OMXCAM_MP4_DEFAULT_DURATION;
+}
+
+void omxcam_mp4_free (omxcam_mp4_t* mp4){
+  omxcam_nal_parser_free (&mp4->parser);
+  free (mp4->mdat);
+  free (mp4->moof);
+  free (mp4->sample_sizes);
+  free (mp4->sample_times);
+  free (mp4->sample_sync);
+  omxcam_mp4_init (mp4, mp4->on_data);
+}
+
+int omxcam_mp4_feed (omxcam_mp4_t* mp4, omxcam_buffer_t buffer){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  //The motion vectors are not part of the h264 stream
+  if (buffer.flags & OMXCAM_BUFFER_MOTION_VECTORS) return 0;
+  
+  mp4->buffer_time = buffer.timestamp;
+  
+  if (omxcam_nal_parser_feed (&mp4->parser, buffer)) return -1;
+  
+  omxcam_nal_t nal;
+  int r;
+  
+  while ((r = omxcam_nal_parser_next (&mp4->parser, &nal)) == 1){
+    if (omxcam__mp4_nal (mp4, &nal)) return -1;
+    if (mp4->stopped) return 0;
+  }
+  if (r == -1) return -1;
+  
+  if (buffer.flags & OMXCAM_BUFFER_END_OF_FRAME){
+    return omxcam__mp4_close_frame (mp4);
+  }
+  
+  return 0;
+}
+
+int omxcam_mp4_flush (omxcam_mp4_t* mp4){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  omxcam_nal_t nal;
+  int r;
+  
+  //The pending NAL units of a stopped capture point to a freed buffer, only
+  //the data already copied is written
+  while (!mp4->stopped &&
+      (r = omxcam_nal_parser_flush (&mp4->parser, &nal)) == 1){
+    if (omxcam__mp4_nal (mp4, &nal)) return -1;
+  }
+  if (!mp4->stopped && r == -1) return -1;
+  
+  if (omxcam__mp4_close_frame (mp4)) return -1;
+  if (!mp4->samples) return 0;
+  
+  //The last sample has the same duration as the previous one
+  return omxcam__mp4_write_fragment (mp4, mp4->mdat_length,
+      mp4->last_time + mp4->last_duration);
+}
@@ -0,0 +1,535 @@
+#include "omxcam.h"
+#include "internal.h"
+
+//Maximum length of a NAL unit split across buffers
+#define OMXCAM_NAL_MAX_CARRY 8388608
+
+//Maximum length of an unescaped SPS. The biggest ones, with scaling matrices,
+//are a few hundred bytes
+#define OMXCAM_NAL_MAX_SPS 1024
+
+//Bytes of a slice header that are unescaped to read first_mb_in_slice
+#define OMXCAM_NAL_SLICE_HEADER 16
+
+typedef struct {
+  uint8_t* data;
+  uint32_t length;
+  uint32_t bit;
+  int overflow;
+} omxcam__bits_t;
+
+static uint32_t omxcam__bits_read (omxcam__bits_t* bits, uint32_t n){
+  uint32_t value = 0;
+  
+  while (n--){
+    if (bits->bit >= bits->length*8){
+      bits->overflow = 1;
+      return 0;
+    }
+    value = (value << 1) |
+        ((bits->data[bits->bit >> 3] >> (7 - (bits->bit & 7))) & 1);
+    bits->bit++;
+  }
+  
+  return value;
+}
+
+static uint32_t omxcam__bits_read_ue (omxcam__bits_t* bits){
+  //Exp-Golomb code: n leading zeros, a one and n bits
+  uint32_t zeros = 0;
+  
+  while (!omxcam__bits_read (bits, 1)){
+    if (bits->overflow || ++zeros > 31){
+      bits->overflow = 1;
+      return 0;
+    }
+  }
+  
+  return ((1u << zeros) - 1) + omxcam__bits_read (bits, zeros);
+}
+
+static int32_t omxcam__bits_read_se (omxcam__bits_t* bits){
+  uint32_t value = omxcam__bits_read_ue (bits);
+  return value & 1 ? (int32_t)((value + 1) >> 1) : -(int32_t)(value >> 1);
+}
+
+static uint32_t omxcam__nal_unescape (
+    uint8_t* src,
+    uint32_t length,
+    uint8_t* dst,
+    uint32_t size){
+  //Removes the emulation prevention bytes (00 00 03)
+  uint32_t i;
+  uint32_t j = 0;
+  uint32_t zeros = 0;
+  
+  for (i=0; i<length && j<size; i++){
+    if (zeros >= 2 && src[i] == 3){
+      zeros = 0;
+      continue;
+    }
+    zeros = src[i] ? 0 : zeros + 1;
+    dst[j++] = src[i];
+  }
+  
+  return j;
+}
+
+static uint8_t* omxcam__nal_find_start_code (uint8_t* p, uint8_t* end){
+  //Returns a pointer to the next "00 00 01" or 'end' if it's not found. The
+  //bytes are checked one by one until the pointer is aligned, then 4 bytes are
+  //checked at a time and the words without a zero byte are skipped. Every start
+  //code begins with a zero byte, so only the positions of a word with a zero
+  //byte need to be checked
+  if (end - p < 3) return end;
+  
+  while (((uintptr_t)p & 3) && p + 3 <= end){
+    if (!p[0] && !p[1] && p[2] == 1) return p;
+    p++;
+  }
+  
+  uint32_t word;
+  
+  for (; p + 6 <= end; p += 4){
+    memcpy (&word, p, 4);
+    if (!((word - 0x01010101) & ~word & 0x80808080)) continue;
+    if (!p[0] && !p[1] && p[2] == 1) return p;
+    if (!p[1] && !p[2] && p[3] == 1) return p + 1;
+    if (!p[2] && !p[3] && p[4] == 1) return p + 2;
+    if (!p[3] && !p[4] && p[5] == 1) return p + 3;
+  }
+  
+  for (; p + 3 <= end; p++){
+    if (!p[0] && !p[1] && p[2] == 1) return p;
+  }
+  
+  return end;
+}
+
+static int omxcam__nal_fill (uint8_t* data, uint32_t length, omxcam_nal_t* nal){
+  //The trailing zeros belong to the next start code (zero_byte) or are padding
+  //(trailing_zero_8bits)
+  while (length && !data[length - 1]) length--;
+  if (!length) return 0;
+  
+  nal->data = data;
+  nal->length = length;
+  nal->type = data[0] & 0x1F;
+  nal->ref_idc = (data[0] >> 5) & 3;
+  nal->first_mb = 0;
+  
+  if (length > 1 && (nal->type == OMXCAM_NAL_SLICE ||
+      nal->type == OMXCAM_NAL_SLICE_DPA || nal->type == OMXCAM_NAL_IDR)){
+    uint8_t header[OMXCAM_NAL_SLICE_HEADER];
+    omxcam__bits_t bits;
+    bits.data = header;
+    bits.length = omxcam__nal_unescape (data + 1, length - 1, header,
+        sizeof (header));
+    bits.bit = 0;
+    bits.overflow = 0;
+    nal->first_mb = omxcam__bits_read_ue (&bits);
+  }
+  
+  return 1;
+}
+
+static int omxcam__nal_append (
+    omxcam_nal_parser_t* parser,
+    uint8_t* data,
+    uint32_t length){
+  if (!length) return 0;
+  
+  if (parser->carry_length + length > parser->carry_size){
+    uint32_t size = parser->carry_size ? parser->carry_size : 65536;
+    while (size < parser->carry_length + length) size *= 2;
+    
+    if (size > OMXCAM_NAL_MAX_CARRY){
+      omxcam__error ("NAL unit too big");
+      omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+      return -1;
+    }
+    
+    uint8_t* carry = realloc (parser->carry, size);
+    if (!carry){
+      omxcam__error ("realloc");
+      omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+      return -1;
+    }
+    
+    parser->carry = carry;
+    parser->carry_size = size;
+  }
+  
+  memcpy (parser->carry + parser->carry_length, data, length);
+  parser->carry_length += length;
+  
+  return 0;
+}
+
+void omxcam_nal_parser_init (omxcam_nal_parser_t* parser){
+  memset (parser, 0, sizeof (omxcam_nal_parser_t));
+}
+
+void omxcam_nal_parser_free (omxcam_nal_parser_t* parser){
+  free (parser->carry);
+  omxcam_nal_parser_init (parser);
+}
+
+int omxcam_nal_parser_feed (
+    omxcam_nal_parser_t* parser,
+    omxcam_buffer_t buffer){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (parser->carry_emitted){
+    parser->carry_emitted = 0;
+    parser->carry_length = 0;
+  }
+  
+  parser->current = buffer.data;
+  parser->end = buffer.data + buffer.length;
+  parser->end_of_nal = !!(buffer.flags & OMXCAM_BUFFER_END_OF_NAL);
+  parser->at_nal = 0;
+  
+  if (!parser->in_nal){
+    //The start code of the next NAL unit can be split between the buffers
+    if (parser->zeros >= 2 && buffer.length >= 1 && buffer.data[0] == 1){
+      parser->current += 1;
+      parser->at_nal = 1;
+    }else if (parser->zeros && buffer.length >= 2 && !buffer.data[0] &&
+        buffer.data[1] == 1){
+      parser->current += 2;
+      parser->at_nal = 1;
+    }
+    if (parser->at_nal) parser->zeros = 0;
+    return 0;
+  }
+  
+  //The previous buffer ended in the middle of a NAL unit. The start code that
+  //ends it can also be split between the two buffers
+  uint8_t* carry_end = parser->carry + parser->carry_length;
+  uint8_t* start_code;
+  
+  if (parser->carry_length >= 2 && buffer.length >= 1 && !carry_end[-2] &&
+      !carry_end[-1] && buffer.data[0] == 1){
+    start_code = parser->current + 1;
+  }else if (parser->carry_length >= 1 && buffer.length >= 2 &&
+      !carry_end[-1] && !buffer.data[0] && buffer.data[1] == 1){
+    start_code = parser->current + 2;
+  }else{
+    start_code = omxcam__nal_find_start_code (parser->current, parser->end);
+    if (start_code == parser->end){
+      //The whole buffer belongs to the NAL unit
+      if (omxcam__nal_append (parser, parser->current, buffer.length)){
+        return -1;
+      }
+      parser->current = parser->end;
+      if (parser->end_of_nal){
+        parser->in_nal = 0;
+        parser->carry_ready = 1;
+      }
+      return 0;
+    }
+    if (omxcam__nal_append (parser, parser->current,
+        start_code - parser->current)){
+      return -1;
+    }
+    start_code += 3;
+  }
+  
+  //The trailing zeros of the carry are removed when it's returned
+  parser->in_nal = 0;
+  parser->carry_ready = 1;
+  parser->current = start_code;
+  parser->at_nal = 1;
+  
+  return 0;
+}
+
+int omxcam_nal_parser_next (
+    omxcam_nal_parser_t* parser,
+    omxcam_nal_t* nal){
+  //Critical section, this function needs to be as fast as possible
+  
+  if (parser->carry_emitted){
+    parser->carry_emitted = 0;
+    parser->carry_length = 0;
+  }
+  
+  if (parser->carry_ready){
+    parser->carry_ready = 0;
+    parser->carry_emitted = 1;
+    if (omxcam__nal_fill (parser->carry, parser->carry_length, nal)) return 1;
+  }
+  
+  while (parser->current < parser->end){
+    uint8_t* start_code;
+    
+    if (!parser->at_nal){
+      //Skip the data before the first start code
+      start_code = omxcam__nal_find_start_code (parser->current, parser->end);
+      if (start_code == parser->end){
+        //Count the trailing zeros, they can be the beginning of a start code
+        int zeros = 0;
+        while (zeros < 2 && parser->end - zeros > parser->current &&
+            !parser->end[-1 - zeros]){
+          zeros++;
+        }
+        if (parser->end - zeros == parser->current){
+          zeros += parser->zeros;
+        }
+        parser->zeros = zeros;
+        parser->current = parser->end;
+        return 0;
+      }
+      parser->current = start_code + 3;
+      parser->at_nal = 1;
+      parser->zeros = 0;
+    }
+    
+    uint8_t* start = parser->current;
+    start_code = omxcam__nal_find_start_code (start, parser->end);
+    
+    if (start_code != parser->end){
+      parser->current = start_code + 3;
+      if (omxcam__nal_fill (start, start_code - start, nal)) return 1;
+      continue;
+    }
+    
+    //Last NAL unit of the buffer
+    parser->current = parser->end;
+    parser->at_nal = 0;
+    
+    if (parser->end_of_nal){
+      return omxcam__nal_fill (start, parser->end - start, nal);
+    }
+    
+    //It continues in the next buffer
+    if (omxcam__nal_append (parser, start, parser->end - start)) return -1;
+    parser->in_nal = 1;
+    return 0;
+  }
+  
+  //The buffer ended just after a start code
+  if (parser->at_nal && !parser->end_of_nal){
+    parser->at_nal = 0;
+    parser->in_nal = 1;
+  }
+  
+  return 0;
+}
+
+int omxcam_nal_parser_flush (
+    omxcam_nal_parser_t* parser,
+    omxcam_nal_t* nal){
+  int r = omxcam_nal_parser_next (parser, nal);
+  if (r) return r;
+  
+  if (!parser->in_nal) return 0;
+  
+  parser->in_nal = 0;
+  parser->carry_emitted = 1;
+  
+  return omxcam__nal_fill (parser->carry, parser->carry_length, nal);
+}
+
+int omxcam_nal_view (uint8_t* data, uint32_t length, omxcam_nal_t* nal){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  uint8_t* end = data + length;
+  uint8_t* p = data;
+  
+  //Skip the start code
+  while (p < end && !*p) p++;
+  if (p - data >= 2 && p < end && *p == 1) data = p + 1;
+  
+  //A second start code ends the NAL unit
+  end = omxcam__nal_find_start_code (data, end);
+  
+  if (!omxcam__nal_fill (data, end - data, nal)){
+    omxcam__error ("empty NAL unit");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  return 0;
+}
+
+static void omxcam__nal_skip_scaling_list (omxcam__bits_t* bits, int size){
+  int32_t last = 8;
+  int32_t next = 8;
+  int i;
+  
+  for (i=0; i<size; i++){
+    if (next){
+      next = (last + omxcam__bits_read_se (bits) + 256)%256;
+    }
+    last = next ? next : last;
+  }
+}
+
+int omxcam_nal_parse_sps (omxcam_nal_t* nal, omxcam_sps_t* sps){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (nal->type != OMXCAM_NAL_SPS || nal->length < 4){
+    omxcam__error ("the NAL unit is not an SPS");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  uint8_t rbsp[OMXCAM_NAL_MAX_SPS];
+  omxcam__bits_t bits;
+  bits.data = rbsp;
+  bits.length = omxcam__nal_unescape (nal->data + 1, nal->length - 1, rbsp,
+      sizeof (rbsp));
+  bits.bit = 0;
+  bits.overflow = 0;
+  
+  memset (sps, 0, sizeof (omxcam_sps_t));
+  
+  sps->profile = omxcam__bits_read (&bits, 8);
+  sps->constraints = omxcam__bits_read (&bits, 8);
+  sps->level = omxcam__bits_read (&bits, 8);
+  sps->id = omxcam__bits_read_ue (&bits);
+  sps->chroma_format = 1;
+  sps->bit_depth = 8;
+  
+  int separate_colour_plane = 0;
+  
+  switch (sps->profile){
+    case 100: case 110: case 122: case 244: case 44: case 83: case 86:
+    case 118: case 128: case 138: case 139: case 134: case 135:
+      sps->chroma_format = omxcam__bits_read_ue (&bits);
+      if (sps->chroma_format == 3){
+        separate_colour_plane = omxcam__bits_read (&bits, 1);
+      }
+      sps->bit_depth = omxcam__bits_read_ue (&bits) + 8;
+      //bit_depth_chroma_minus8, qpprime_y_zero_transform_bypass_flag
+      omxcam__bits_read_ue (&bits);
+      omxcam__bits_read (&bits, 1);
+      if (omxcam__bits_read (&bits, 1)){
+        //seq_scaling_matrix_present_flag
+        int lists = sps->chroma_format == 3 ? 12 : 8;
+        int i;
+        for (i=0; i<lists; i++){
+          if (omxcam__bits_read (&bits, 1)){
+            omxcam__nal_skip_scaling_list (&bits, i < 6 ? 16 : 64);
+          }
+        }
+      }
+      break;
+  }
+  
+  //log2_max_frame_num_minus4, [0, 12]
+  uint32_t log2_max_frame_num = omxcam__bits_read_ue (&bits);
+  if (log2_max_frame_num > 12){
+    omxcam__error ("invalid SPS log2_max_frame_num_minus4");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  sps->max_frame_num = 1 << (log2_max_frame_num + 4);
+  
+  uint32_t poc_type = omxcam__bits_read_ue (&bits);
+  if (poc_type == 0){
+    //log2_max_pic_order_cnt_lsb_minus4
+    omxcam__bits_read_ue (&bits);
+  }else if (poc_type == 1){
+    //delta_pic_order_always_zero_flag, offset_for_non_ref_pic,
+    //offset_for_top_to_bottom_field, offset_for_ref_frame[]
+    omxcam__bits_read (&bits, 1);
+    omxcam__bits_read_se (&bits);
+    omxcam__bits_read_se (&bits);
+    uint32_t cycle = omxcam__bits_read_ue (&bits);
+    while (cycle-- && !bits.overflow) omxcam__bits_read_se (&bits);
+  }
+  
+  //max_num_ref_frames, gaps_in_frame_num_value_allowed_flag
+  omxcam__bits_read_ue (&bits);
+  omxcam__bits_read (&bits, 1);
+  
+  uint32_t width_mbs = omxcam__bits_read_ue (&bits) + 1;
+  uint32_t height_map_units = omxcam__bits_read_ue (&bits) + 1;
+  sps->frame_mbs_only = omxcam__bits_read (&bits, 1);
+  
+  //The dimensions in pixels must fit in 32 bits
+  if (width_mbs > UINT32_MAX/16 || height_map_units > UINT32_MAX/32){
+    omxcam__error ("invalid SPS dimensions");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  if (!sps->frame_mbs_only){
+    //mb_adaptive_frame_field_flag
+    omxcam__bits_read (&bits, 1);
+  }
+  
+  //direct_8x8_inference_flag
+  omxcam__bits_read (&bits, 1);
+  
+  sps->width = width_mbs*16;
+  sps->height = (2 - sps->frame_mbs_only)*height_map_units*16;
+  
+  if (omxcam__bits_read (&bits, 1)){
+    //frame_cropping_flag
+    uint32_t left = omxcam__bits_read_ue (&bits);
+    uint32_t right = omxcam__bits_read_ue (&bits);
+    uint32_t top = omxcam__bits_read_ue (&bits);
+    uint32_t bottom = omxcam__bits_read_ue (&bits);
+    
+    uint32_t crop_x = 1;
+    uint32_t crop_y = 2 - sps->frame_mbs_only;
+    
+    if (sps->chroma_format && !separate_colour_plane){
+      //SubWidthC and SubHeightC
+      crop_x = sps->chroma_format == 3 ? 1 : 2;
+      crop_y *= sps->chroma_format == 1 ? 2 : 1;
+    }
+    
+    //The offsets are up to 2^32 - 2 each, the sums can't overflow 64 bits
+    uint64_t crop_width = ((uint64_t)left + right)*crop_x;
+    uint64_t crop_height = ((uint64_t)top + bottom)*crop_y;
+    
+    if (crop_width >= sps->width || crop_height >= sps->height){
+      omxcam__error ("invalid SPS cropping");
+      omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+      return -1;
+    }
+    
+    sps->width -= crop_width;
+    sps->height -= crop_height;
+  }
+  
+  if (omxcam__bits_read (&bits, 1)){
+    //vui_parameters_present_flag
+    if (omxcam__bits_read (&bits, 1)){
+      //aspect_ratio_info_present_flag, Extended_SAR
+      if (omxcam__bits_read (&bits, 8) == 255) omxcam__bits_read (&bits, 32);
+    }
+    if (omxcam__bits_read (&bits, 1)){
+      //overscan_info_present_flag
+      omxcam__bits_read (&bits, 1);
+    }
+    if (omxcam__bits_read (&bits, 1)){
+      //video_signal_type_present_flag
+      omxcam__bits_read (&bits, 4);
+      if (omxcam__bits_read (&bits, 1)) omxcam__bits_read (&bits, 24);
+    }
+    if (omxcam__bits_read (&bits, 1)){
+      //chroma_loc_info_present_flag
+      omxcam__bits_read_ue (&bits);
+      omxcam__bits_read_ue (&bits);
+    }
+    if (omxcam__bits_read (&bits, 1)){
+      //timing_info_present_flag
+      sps->num_units_in_tick = omxcam__bits_read (&bits, 32);
+      sps->time_scale = omxcam__bits_read (&bits, 32);
+    }
+  }
+  
+  if (bits.overflow){
+    omxcam__error ("truncated SPS");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "omxcam.h"
+#include "internal.h"
+
+//Last complete group of parameter sets, read by the consumers
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t sets[OMXCAM_H264_PARAMETER_SETS_SIZE];
+static uint32_t sets_length;
+
+//Only used from the thread that fills the buffers
+static uint8_t pending[OMXCAM_H264_PARAMETER_SETS_SIZE];
+static uint32_t pending_length;
+static int collecting;
+static int overflow;
+
+void omxcam__parameter_sets_reset (){
+  pending_length = 0;
+  collecting = 0;
+  overflow = 0;
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return;
+  }
+  sets_length = 0;
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+  }
+}
+
+void omxcam__parameter_sets_update (omxcam_buffer_t* buffer){
+  //Critical section, only the codec config buffers are copied
+  
+  if (buffer->flags & OMXCAM_BUFFER_CODEC_CONFIG){
+    //The SPS and the PPS are usually in different buffers. A group replaces the
+    //previous one when it's complete
+    if (!collecting){
+      collecting = 1;
+      pending_length = 0;
+      overflow = 0;
+    }
+    if (pending_length + buffer->length > sizeof (pending)){
+      overflow = 1;
+    }else{
+      memcpy (pending + pending_length, buffer->data, buffer->length);
+      pending_length += buffer->length;
+    }
+    return;
+  }
+  
+  if (!collecting) return;
+  collecting = 0;
+  
+  if (overflow){
+    omxcam__error ("parameter sets too big");
+    return;
+  }
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return;
+  }
+  memcpy (sets, pending, pending_length);
+  sets_length = pending_length;
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+  }
+}
+
+int omxcam__parameter_sets_get (uint8_t* data, uint32_t* length){
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  memcpy (data, sets, sets_length);
+  *length = sets_length;
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  return 0;
+}
@@ -0,0 +1,162 @@
+#include "omxcam.h"
+#include "internal.h"
+
+//Reported by the consumer, shared with the capture thread
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static int reported;
+static uint32_t queued;
+static uint32_t drain_rate;
+
+//Only used from the thread that fills the buffers
+static omxcam_rate_control_t settings;
+static uint32_t bitrate;
+static uint64_t window_start;
+static uint64_t window_bytes;
+static uint32_t window_queued;
+
+static uint64_t omxcam__rate_control_now (){
+  //Monotonic clock, the wall clock can be stepped while the video runs
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec*1000 + now.tv_nsec/1000000;
+}
+
+void omxcam__rate_control_init (omxcam_rate_control_t* settings){
+  settings->enabled = OMXCAM_FALSE;
+  settings->min_bitrate = 1000000;
+  settings->max_bitrate = 25000000;
+  settings->target_latency = 200;
+  settings->reaction_time = 500;
+}
+
+int omxcam__rate_control_validate (omxcam_rate_control_t* settings){
+  if (!settings->enabled) return 0;
+  if (!omxcam__h264_is_valid_bitrate (settings->min_bitrate)){
+    omxcam__error ("invalid 'h264.rate_control.min_bitrate' value");
+    return -1;
+  }
+  if (!omxcam__h264_is_valid_bitrate (settings->max_bitrate) ||
+      settings->max_bitrate < settings->min_bitrate){
+    omxcam__error ("invalid 'h264.rate_control.max_bitrate' value");
+    return -1;
+  }
+  if (!settings->reaction_time){
+    omxcam__error ("invalid 'h264.rate_control.reaction_time' value");
+    return -1;
+  }
+  return 0;
+}
+
+void omxcam__rate_control_start (
+    omxcam_rate_control_t* rate_control_settings,
+    uint32_t initial_bitrate){
+  settings = *rate_control_settings;
+  bitrate = initial_bitrate;
+  if (bitrate < settings.min_bitrate) bitrate = settings.min_bitrate;
+  if (bitrate > settings.max_bitrate) bitrate = settings.max_bitrate;
+  window_start = omxcam__rate_control_now ();
+  window_bytes = 0;
+  window_queued = 0;
+  reported = 0;
+  queued = 0;
+  drain_rate = 0;
+}
+
+void omxcam__rate_control_update (uint32_t length){
+  window_bytes += length;
+  
+  uint64_t now = omxcam__rate_control_now ();
+  uint64_t elapsed = now - window_start;
+  if (elapsed < settings.reaction_time) return;
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return;
+  }
+  
+  int current_reported = reported;
+  int64_t current_queued = queued;
+  int64_t current_drain_rate = drain_rate;
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    return;
+  }
+  
+  //Nothing to control against until the consumer reports its state
+  if (!current_reported){
+    window_start = now;
+    window_bytes = 0;
+    return;
+  }
+  
+  //Bytes per second that the consumer is able to drain. If it's not reported,
+  //it's what has been produced minus the growth of the queue
+  int64_t capacity = current_drain_rate;
+  if (!capacity){
+    int64_t drained = (int64_t)window_bytes - (current_queued - window_queued);
+    if (drained < 0) drained = 0;
+    capacity = drained*1000/elapsed;
+  }
+  
+  //The bytes above the target latency need to be drained during the next
+  //period, so the bitrate is lowered by that amount
+  int64_t excess = current_queued - capacity*settings.target_latency/1000;
+  int64_t next = capacity*8 - excess*8*1000/settings.reaction_time;
+  
+  //The capacity cannot be known when the consumer keeps up with the encoder
+  //and only reports the queue, so the bitrate is slowly increased to probe it
+  if (excess <= 0 && !current_drain_rate){
+    next = bitrate + bitrate/8;
+  }
+  
+  //Decrease immediately, increase slowly to avoid oscillations
+  if (next > bitrate + bitrate/8) next = bitrate + bitrate/8;
+  if (next < settings.min_bitrate) next = settings.min_bitrate;
+  if (next > settings.max_bitrate) next = settings.max_bitrate;
+  
+  //Ignore small variations
+  uint32_t delta = next > bitrate ? next - bitrate : bitrate - next;
+  if (delta > bitrate/32){
+    omxcam__trace ("rate control: %d -> %d bps (queued: %lld bytes)",
+        bitrate, (uint32_t)next, (long long)current_queued);
+    
+    //If the bitrate cannot be updated, the video is not stopped, the next
+    //period will try it again
+    if (!omxcam__h264_set_bitrate ((uint32_t)next)){
+      bitrate = (uint32_t)next;
+    }
+  }
+  
+  window_start = now;
+  window_bytes = 0;
+  window_queued = (uint32_t)current_queued;
+}
+
+int omxcam_video_report_consumer (uint32_t queued_bytes, uint32_t drain){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (!omxcam__ctx.state.ready || !omxcam__ctx.rate_control){
+    omxcam__error ("rate control is not running");
+    omxcam__set_last_error (OMXCAM_ERROR_CAMERA_UPDATE);
+    return -1;
+  }
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  reported = 1;
+  queued = queued_bytes;
+  drain_rate = drain;
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  return 0;
+}
@@ -0,0 +1,345 @@
+#include "omxcam.h"
+#include "internal.h"
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+//States of the parser
+#define OMXCAM_RAW_SEARCH 0
+#define OMXCAM_RAW_HEADER 1
+#define OMXCAM_RAW_ROWS 2
+#define OMXCAM_RAW_DONE 3
+
+//The raw block begins with "BRCM" and a 32KB header, followed by the rows of
+//10-bit packed pixels
+#define OMXCAM_RAW_HEADER_LENGTH 32768
+
+//Offset of the image description inside the header
+#define OMXCAM_RAW_INFO_OFFSET 176
+
+static uint8_t magic[] = { 'B', 'R', 'C', 'M' };
+
+static uint16_t omxcam__raw_u16 (uint8_t* p){
+  return p[0] | (p[1] << 8);
+}
+
+void omxcam_raw_unpack (uint8_t* src, uint16_t* dst, uint32_t width){
+  uint32_t x = 0;
+  
+#ifdef __ARM_NEON
+  //8 pixels from 10 bytes per iteration, the 16-byte load never reads past
+  //the packed row
+  static const uint8_t high_index[] = { 0, 1, 2, 3, 5, 6, 7, 8 };
+  static const uint8_t low_index[] = { 4, 4, 4, 4, 9, 9, 9, 9 };
+  static const int8_t low_shift[] = { 0, -2, -4, -6, 0, -2, -4, -6 };
+  uint8x8_t high_table = vld1_u8 (high_index);
+  uint8x8_t low_table = vld1_u8 (low_index);
+  int8x8_t shift = vld1_s8 (low_shift);
+  uint8x8_t mask = vdup_n_u8 (3);
+  uint32_t packed = (width >> 2)*5;
+  
+  for (; (x >> 2)*5 + 16 <= packed; x += 8, src += 10){
+    uint8x16_t in = vld1q_u8 (src);
+    uint8x8x2_t table = {{ vget_low_u8 (in), vget_high_u8 (in) }};
+    uint8x8_t high = vtbl2_u8 (table, high_table);
+    uint8x8_t low = vand_u8 (vshl_u8 (vtbl2_u8 (table, low_table), shift),
+        mask);
+    vst1q_u16 (dst + x, vorrq_u16 (vshll_n_u8 (high, 2), vmovl_u8 (low)));
+  }
+#endif
+  
+  //4 pixels from 5 bytes, the fifth byte has the 2 low bits of each pixel
+  for (; x + 4 <= width; x += 4, src += 5){
+    dst[x] = (src[0] << 2) | (src[4] & 3);
+    dst[x + 1] = (src[1] << 2) | ((src[4] >> 2) & 3);
+    dst[x + 2] = (src[2] << 2) | ((src[4] >> 4) & 3);
+    dst[x + 3] = (src[3] << 2) | (src[4] >> 6);
+  }
+  
+  for (; x<width; x++){
+    dst[x] = (src[x & 3] << 2) | ((src[4] >> ((x & 3) << 1)) & 3);
+  }
+}
+
+//Value of the pixel (x, y) of each color. 'up' and 'down' are the adjacent
+//rows and 'left' and 'right' the adjacent columns, mirrored at the borders so
+//the parity of the bayer pattern is preserved
+static inline void omxcam__raw_bilinear (
+    uint16_t* up,
+    uint16_t* row,
+    uint16_t* down,
+    uint32_t left,
+    uint32_t x,
+    uint32_t right,
+    int red_row,
+    int red_column,
+    uint16_t* r,
+    uint16_t* g,
+    uint16_t* b){
+  uint16_t cross = (up[x] + down[x] + row[left] + row[right] + 2) >> 2;
+  uint16_t diagonal = (up[left] + up[right] + down[left] + down[right] + 2)
+      >> 2;
+  uint16_t horizontal = (row[left] + row[right] + 1) >> 1;
+  uint16_t vertical = (up[x] + down[x] + 1) >> 1;
+  
+  if (red_row == red_column){
+    *g = cross;
+    if (red_row){
+      *r = row[x];
+      *b = diagonal;
+    }else{
+      *r = diagonal;
+      *b = row[x];
+    }
+  }else{
+    *g = row[x];
+    if (red_row){
+      *r = horizontal;
+      *b = vertical;
+    }else{
+      *r = vertical;
+      *b = horizontal;
+    }
+  }
+}
+
+int omxcam_raw_demosaic (
+    omxcam_raw_image_t* image,
+    uint16_t* r,
+    uint16_t* g,
+    uint16_t* b){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  uint32_t width = image->width;
+  uint32_t height = image->height;
+  
+  if (width < 2 || height < 2){
+    omxcam__error ("invalid raw image dimensions: %dx%d", width, height);
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  //Position of the red pixel in the 2x2 pattern
+  uint32_t red_x = image->order == OMXCAM_BAYER_GRBG ||
+      image->order == OMXCAM_BAYER_BGGR;
+  uint32_t red_y = image->order == OMXCAM_BAYER_GBRG ||
+      image->order == OMXCAM_BAYER_BGGR;
+  uint32_t x;
+  uint32_t y;
+  
+  for (y=0; y<height; y++){
+    uint16_t* row = image->data + y*width;
+    uint16_t* up = image->data + (y ? y - 1 : 1)*width;
+    uint16_t* down = image->data +
+        (y < height - 1 ? y + 1 : height - 2)*width;
+    int red_row = (y & 1) == red_y;
+    uint32_t i = y*width;
+    
+    omxcam__raw_bilinear (up, row, down, 1, 0, 1, red_row, red_x == 0,
+        r + i, g + i, b + i);
+    
+    for (x=1; x<width - 1; x++){
+      omxcam__raw_bilinear (up, row, down, x - 1, x, x + 1, red_row,
+          (x & 1) == red_x, r + i + x, g + i + x, b + i + x);
+    }
+    
+    omxcam__raw_bilinear (up, row, down, x - 1, x, x - 1, red_row,
+        (x & 1) == red_x, r + i + x, g + i + x, b + i + x);
+  }
+  
+  return 0;
+}
+
+void omxcam_raw_init (
+    omxcam_raw_t* raw,
+    void (*on_raw)(omxcam_raw_image_t image)){
+  memset (raw, 0, sizeof (omxcam_raw_t));
+  raw->on_raw = on_raw;
+  raw->state = OMXCAM_RAW_SEARCH;
+}
+
+void omxcam_raw_free (omxcam_raw_t* raw){
+  free (raw->image.data);
+  free (raw->row);
+  raw->image.data = 0;
+  raw->row = 0;
+  raw->size = 0;
+  raw->row_size = 0;
+}
+
+static int omxcam__raw_begin (omxcam_raw_t* raw){
+  uint8_t* info = raw->header + OMXCAM_RAW_INFO_OFFSET;
+  uint32_t width = omxcam__raw_u16 (info + 32);
+  uint32_t height = omxcam__raw_u16 (info + 34);
+  uint8_t order = info[68];
+  
+  //The magic can also appear inside the jpeg
+  if (info[0] < '0' || info[0] > 'z' || width < 16 || width > 8192 ||
+      height < 16 || height > 8192 || order > OMXCAM_BAYER_GRBG){
+    return 1;
+  }
+  
+  omxcam__trace ("raw image found: %.32s %dx%d", info, width, height);
+  
+  raw->stride = omxcam_round ((width*5) >> 2, 32);
+  
+  if (width*height > raw->size){
+    free (raw->image.data);
+    raw->size = 0;
+    raw->image.data = malloc (width*height*sizeof (uint16_t));
+    if (!raw->image.data){
+      omxcam__error ("malloc");
+      omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+      return -1;
+    }
+    raw->size = width*height;
+  }
+  
+  if (raw->stride > raw->row_size){
+    free (raw->row);
+    raw->row_size = 0;
+    raw->row = malloc (raw->stride);
+    if (!raw->row){
+      omxcam__error ("malloc");
+      omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+      return -1;
+    }
+    raw->row_size = raw->stride;
+  }
+  
+  raw->image.width = width;
+  raw->image.height = height;
+  raw->image.order = order;
+  raw->row_length = 0;
+  raw->row_index = 0;
+  
+  return 0;
+}
+
+static int omxcam__raw_process (
+    omxcam_raw_t* raw,
+    uint8_t* data,
+    uint32_t length){
+  uint32_t packed = (raw->image.width*5 + 3) >> 2;
+  uint32_t consumed = 0;
+  uint32_t n;
+  
+  while (consumed < length){
+    switch (raw->state){
+      case OMXCAM_RAW_SEARCH:
+        //The magic can be split between buffers
+        while (consumed < length && raw->match < 4){
+          if (data[consumed++] == magic[raw->match]){
+            raw->match++;
+          }else{
+            raw->match = data[consumed - 1] == magic[0];
+          }
+        }
+        if (raw->match == 4){
+          memcpy (raw->header, magic, 4);
+          raw->header_length = 4;
+          raw->state = OMXCAM_RAW_HEADER;
+        }
+        break;
+      
+      case OMXCAM_RAW_HEADER:
+        n = length - consumed;
+        if (raw->header_length < OMXCAM_RAW_INFO_LENGTH){
+          if (n > OMXCAM_RAW_INFO_LENGTH - raw->header_length){
+            n = OMXCAM_RAW_INFO_LENGTH - raw->header_length;
+          }
+          memcpy (raw->header + raw->header_length, data + consumed, n);
+          raw->header_length += n;
+          consumed += n;
+          
+          if (raw->header_length < OMXCAM_RAW_INFO_LENGTH) break;
+          
+          int error = omxcam__raw_begin (raw);
+          if (error == -1) return -1;
+          if (error){
+            //False positive, the magic is searched again after its first byte
+            uint8_t header[OMXCAM_RAW_INFO_LENGTH];
+            memcpy (header, raw->header, OMXCAM_RAW_INFO_LENGTH);
+            raw->state = OMXCAM_RAW_SEARCH;
+            raw->match = 0;
+            if (omxcam__raw_process (raw, header + 1,
+                OMXCAM_RAW_INFO_LENGTH - 1)){
+              return -1;
+            }
+            //The rest of the data is processed with the new state
+            return omxcam__raw_process (raw, data + consumed,
+                length - consumed);
+          }
+          packed = (raw->image.width*5 + 3) >> 2;
+          break;
+        }
+        
+        //The rest of the header is skipped
+        if (n > OMXCAM_RAW_HEADER_LENGTH - raw->header_length){
+          n = OMXCAM_RAW_HEADER_LENGTH - raw->header_length;
+        }
+        raw->header_length += n;
+        consumed += n;
+        if (raw->header_length == OMXCAM_RAW_HEADER_LENGTH){
+          raw->state = OMXCAM_RAW_ROWS;
+        }
+        break;
+      
+      case OMXCAM_RAW_ROWS:
+        n = length - consumed;
+        if (!raw->row_length && n >= raw->stride){
+          //Whole row inside the buffer, unpacked without copying it
+          omxcam_raw_unpack (data + consumed,
+              raw->image.data + raw->row_index*raw->image.width,
+              raw->image.width);
+          consumed += raw->stride;
+        }else{
+          if (n > raw->stride - raw->row_length){
+            n = raw->stride - raw->row_length;
+          }
+          //The padding of the row is not needed
+          if (raw->row_length < packed){
+            memcpy (raw->row + raw->row_length, data + consumed,
+                n < packed - raw->row_length ? n : packed - raw->row_length);
+          }
+          raw->row_length += n;
+          consumed += n;
+          if (raw->row_length < raw->stride) break;
+          
+          omxcam_raw_unpack (raw->row,
+              raw->image.data + raw->row_index*raw->image.width,
+              raw->image.width);
+          raw->row_length = 0;
+        }
+        
+        //The padding rows are ignored
+        if (++raw->row_index == raw->image.height){
+          raw->state = OMXCAM_RAW_DONE;
+          if (raw->on_raw) raw->on_raw (raw->image);
+        }
+        break;
+      
+      default:
+        consumed = length;
+    }
+  }
+  
+  return 0;
+}
+
+int omxcam_raw_feed (omxcam_raw_t* raw, omxcam_buffer_t buffer){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__raw_process (raw, buffer.data, buffer.length)) return -1;
+  
+  if (buffer.flags & OMXCAM_BUFFER_END_OF_STREAM){
+    if (raw->state != OMXCAM_RAW_DONE){
+      omxcam__trace ("end of stream without a complete raw image");
+    }
+    raw->state = OMXCAM_RAW_SEARCH;
+    raw->match = 0;
+  }
+  
+  return 0;
+}
@@ -0,0 +1,502 @@
+//sendmmsg()
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "omxcam.h"
+#include "internal.h"
+
+#define OMXCAM_RTP_HEADER_SIZE 12
+
+//FU indicator and FU header
+#define OMXCAM_RTP_FU_SIZE 2
+#define OMXCAM_RTP_FU_A 28
+
+#define OMXCAM_RTP_DEFAULT_MTU 1400
+#define OMXCAM_RTP_DEFAULT_PAYLOAD_TYPE 96
+
+//Minimum size of the packets, smaller MTUs are rejected
+#define OMXCAM_RTP_MIN_MTU 64
+
+//Packets sent per sendmmsg() call. A 1080p IDR frame is ~100 packets with the
+//default MTU
+#define OMXCAM_RTP_BATCH_PACKETS 128
+
+//Duration of a frame when it cannot be calculated, 30fps
+#define OMXCAM_RTP_DEFAULT_DURATION 3000
+
+typedef struct {
+  uint8_t headers[OMXCAM_RTP_BATCH_PACKETS]
+      [OMXCAM_RTP_HEADER_SIZE + OMXCAM_RTP_FU_SIZE];
+  //The first iovec points to the header, the second one to the payload, which
+  //is never copied
+  struct iovec iovecs[OMXCAM_RTP_BATCH_PACKETS][2];
+  uint32_t packets;
+  struct sockaddr_in addresses[OMXCAM_RTP_MAX_CLIENTS];
+  struct mmsghdr messages[OMXCAM_RTP_BATCH_PACKETS*OMXCAM_RTP_MAX_CLIENTS];
+} omxcam__rtp_batch_t;
+
+static int omxcam__rtp_lock (omxcam_rtp_t* rtp){
+  if (pthread_mutex_lock (&rtp->mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    omxcam__set_last_error (OMXCAM_ERROR_NETWORK);
+    return -1;
+  }
+  return 0;
+}
+
+static int omxcam__rtp_unlock (omxcam_rtp_t* rtp){
+  if (pthread_mutex_unlock (&rtp->mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    omxcam__set_last_error (OMXCAM_ERROR_NETWORK);
+    return -1;
+  }
+  return 0;
+}
+
+static uint32_t omxcam__rtp_random (){
+  uint32_t value = 0;
+  int fd = open ("/dev/urandom", O_RDONLY);
+  
+  if (fd != -1){
+    if (read (fd, &value, sizeof (value)) != sizeof (value)) value = 0;
+    close (fd);
+  }
+  
+  //Fallback, the values only need to be different between sessions
+  if (!value) value = (uint32_t)time (0) ^ (uint32_t)getpid () << 16;
+  
+  return value;
+}
+
+static int omxcam__rtp_send (omxcam_rtp_t* rtp){
+  omxcam__rtp_batch_t* batch = rtp->batch;
+  uint32_t clients;
+  uint32_t i;
+  uint32_t j;
+  
+  if (!batch->packets) return 0;
+  
+  //The clients are copied, the lock is not held while sending
+  if (omxcam__rtp_lock (rtp)) return -1;
+  clients = rtp->clients;
+  for (i=0; i<clients; i++){
+    struct sockaddr_in* address = &batch->addresses[i];
+    memset (address, 0, sizeof (struct sockaddr_in));
+    address->sin_family = AF_INET;
+    address->sin_addr.s_addr = rtp->client_addresses[i];
+    address->sin_port = htons (rtp->client_ports[i]);
+  }
+  if (omxcam__rtp_unlock (rtp)) return -1;
+  
+  uint32_t messages = 0;
+  
+  for (i=0; i<clients; i++){
+    for (j=0; j<batch->packets; j++){
+      struct msghdr* message = &batch->messages[messages++].msg_hdr;
+      memset (message, 0, sizeof (struct msghdr));
+      message->msg_name = &batch->addresses[i];
+      message->msg_namelen = sizeof (struct sockaddr_in);
+      message->msg_iov = batch->iovecs[j];
+      message->msg_iovlen = 2;
+    }
+  }
+  
+  batch->packets = 0;
+  
+  uint32_t sent = 0;
+  
+  while (sent < messages){
+    int n = sendmmsg (rtp->fd, batch->messages + sent, messages - sent, 0);
+    if (n == -1){
+      if (errno == EINTR) continue;
+      //The socket buffer is full or the client is unreachable, the rest of the
+      //packets are dropped
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED){
+        omxcam__error ("sendmmsg: %s", strerror (errno));
+      }
+      break;
+    }
+    sent += n;
+  }
+  
+  return 0;
+}
+
+static uint8_t* omxcam__rtp_packet (
+    omxcam_rtp_t* rtp,
+    uint8_t* payload,
+    uint32_t length,
+    uint32_t header_size){
+  omxcam__rtp_batch_t* batch = rtp->batch;
+  uint8_t* header = batch->headers[batch->packets];
+  
+  header[0] = 0x80;
+  header[1] = rtp->payload_type & 0x7F;
+  omxcam__put_u16 (header + 2, rtp->sequence++);
+  omxcam__put_u32 (header + 4, rtp->timestamp);
+  omxcam__put_u32 (header + 8, rtp->ssrc);
+  
+  batch->iovecs[batch->packets][0].iov_base = header;
+  batch->iovecs[batch->packets][0].iov_len = header_size;
+  batch->iovecs[batch->packets][1].iov_base = payload;
+  batch->iovecs[batch->packets][1].iov_len = length;
+  batch->packets++;
+  
+  return header;
+}
+
+static int omxcam__rtp_packetize (
+    omxcam_rtp_t* rtp,
+    omxcam_nal_t* nal,
+    int marker){
+  omxcam__rtp_batch_t* batch = rtp->batch;
+  uint32_t max = rtp->mtu - OMXCAM_RTP_HEADER_SIZE;
+  uint8_t* header;
+  
+  if (nal->length <= max){
+    //Single NAL unit packet
+    if (batch->packets == OMXCAM_RTP_BATCH_PACKETS &&
+        omxcam__rtp_send (rtp)) return -1;
+    header = omxcam__rtp_packet (rtp, nal->data, nal->length,
+        OMXCAM_RTP_HEADER_SIZE);
+    if (marker) header[1] |= 0x80;
+    return 0;
+  }
+  
+  //FU-A, the NAL unit header is replaced by the FU indicator and header
+  uint8_t* data = nal->data + 1;
+  uint32_t length = nal->length - 1;
+  int start = 1;
+  
+  max -= OMXCAM_RTP_FU_SIZE;
+  
+  while (length){
+    uint32_t n = length < max ? length : max;
+    int end = n == length;
+    
+    if (batch->packets == OMXCAM_RTP_BATCH_PACKETS &&
+        omxcam__rtp_send (rtp)) return -1;
+    header = omxcam__rtp_packet (rtp, data, n,
+        OMXCAM_RTP_HEADER_SIZE + OMXCAM_RTP_FU_SIZE);
+    if (marker && end) header[1] |= 0x80;
+    header[OMXCAM_RTP_HEADER_SIZE] = (nal->data[0] & 0xE0) | OMXCAM_RTP_FU_A;
+    header[OMXCAM_RTP_HEADER_SIZE + 1] = (start ? 0x80 : 0) |
+        (end ? 0x40 : 0) | (nal->data[0] & 0x1F);
+    
+    data += n;
+    length -= n;
+    start = 0;
+  }
+  
+  return 0;
+}
+
+static void omxcam__rtp_save_parameter_set (
+    omxcam_rtp_t* rtp,
+    omxcam_nal_t* nal){
+  uint8_t* set;
+  uint32_t* length;
+  
+  if (nal->type == OMXCAM_NAL_SPS){
+    set = rtp->sps;
+    length = &rtp->sps_length;
+  }else{
+    set = rtp->pps;
+    length = &rtp->pps_length;
+  }
+  
+  if (nal->length > sizeof (rtp->sps)) return;
+  
+  //The SDP of the RTSP server is generated from the current parameter sets
+  if (omxcam__rtp_lock (rtp)) return;
+  memcpy (set, nal->data, nal->length);
+  *length = nal->length;
+  omxcam__rtp_unlock (rtp);
+}
+
+static void omxcam__rtp_begin_frame (
+    omxcam_rtp_t* rtp,
+    omxcam_buffer_t* buffer){
+  //The time is extrapolated from the previous frame when it's unknown
+  int64_t time;
+  
+  if (buffer->timestamp == -1){
+    time = rtp->last_time == -1
+        ? 0
+        : rtp->last_time + OMXCAM_RTP_DEFAULT_DURATION;
+  }else{
+    time = buffer->timestamp*9/100;
+  }
+  rtp->last_time = time;
+  rtp->timestamp = rtp->timestamp_offset + (uint32_t)time;
+  rtp->frame_open = 1;
+}
+
+static int omxcam__rtp_fast_start (omxcam_rtp_t* rtp){
+  //The parameter sets are only written by the thread that calls feed(), they
+  //can be sent without copying them
+  int fast_start;
+  
+  if (omxcam__rtp_lock (rtp)) return -1;
+  fast_start = rtp->fast_start;
+  rtp->fast_start = 0;
+  if (omxcam__rtp_unlock (rtp)) return -1;
+  
+  if (!fast_start) return 0;
+  
+  //Executed by the thread that owns the encoder, not by the RTSP server
+  if (rtp->on_client) rtp->on_client ();
+  
+  if (!rtp->sps_length || !rtp->pps_length) return 0;
+  
+  omxcam_nal_t nal;
+  nal.data = rtp->sps;
+  nal.length = rtp->sps_length;
+  if (omxcam__rtp_packetize (rtp, &nal, 0)) return -1;
+  nal.data = rtp->pps;
+  nal.length = rtp->pps_length;
+  return omxcam__rtp_packetize (rtp, &nal, 0);
+}
+
+static int omxcam__rtp_parse_address (
+    const char* address,
+    uint16_t port,
+    uint32_t* value){
+  struct in_addr in;
+  
+  if (!address || !port || !inet_aton (address, &in)){
+    omxcam__error ("invalid address");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  *value = in.s_addr;
+  return 0;
+}
+
+int omxcam__rtp_parameter_sets (
+    omxcam_rtp_t* rtp,
+    uint8_t* sps,
+    uint32_t* sps_length,
+    uint8_t* pps,
+    uint32_t* pps_length){
+  if (omxcam__rtp_lock (rtp)) return -1;
+  memcpy (sps, rtp->sps, rtp->sps_length);
+  *sps_length = rtp->sps_length;
+  memcpy (pps, rtp->pps, rtp->pps_length);
+  *pps_length = rtp->pps_length;
+  return omxcam__rtp_unlock (rtp);
+}
+
+int omxcam__rtp_add_client (
+    omxcam_rtp_t* rtp,
+    uint32_t address,
+    uint16_t port){
+  uint32_t i;
+  int error = 0;
+  
+  if (omxcam__rtp_lock (rtp)) return -1;
+  
+  for (i=0; i<rtp->clients; i++){
+    if (rtp->client_addresses[i] == address && rtp->client_ports[i] == port){
+      break;
+    }
+  }
+  
+  if (i == rtp->clients){
+    if (rtp->clients == OMXCAM_RTP_MAX_CLIENTS){
+      error = 1;
+    }else{
+      rtp->client_addresses[i] = address;
+      rtp->client_ports[i] = port;
+      rtp->clients++;
+      //The new client cannot decode the stream without the parameter sets
+      rtp->fast_start = 1;
+    }
+  }
+  
+  if (omxcam__rtp_unlock (rtp)) return -1;
+  
+  if (error){
+    omxcam__error ("too many clients");
+    omxcam__set_last_error (OMXCAM_ERROR_NETWORK);
+    return -1;
+  }
+  
+  return 0;
+}
+
+int omxcam__rtp_remove_client (
+    omxcam_rtp_t* rtp,
+    uint32_t address,
+    uint16_t port){
+  uint32_t i;
+  
+  if (omxcam__rtp_lock (rtp)) return -1;
+  
+  for (i=0; i<rtp->clients; i++){
+    if (rtp->client_addresses[i] == address && rtp->client_ports[i] == port){
+      rtp->clients--;
+      rtp->client_addresses[i] = rtp->client_addresses[rtp->clients];
+      rtp->client_ports[i] = rtp->client_ports[rtp->clients];
+      break;
+    }
+  }
+  
+  return omxcam__rtp_unlock (rtp);
+}
+
+int omxcam_rtp_init (omxcam_rtp_t* rtp){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  memset (rtp, 0, sizeof (omxcam_rtp_t));
+  rtp->mtu = OMXCAM_RTP_DEFAULT_MTU;
+  rtp->payload_type = OMXCAM_RTP_DEFAULT_PAYLOAD_TYPE;
+  rtp->last_time = -1;
+  rtp->fd = -1;
+  
+  //RFC 3550, the sequence number and the timestamp start at random values
+  rtp->sequence = omxcam__rtp_random ();
+  rtp->ssrc = omxcam__rtp_random ();
+  rtp->timestamp_offset = omxcam__rtp_random ();
+  
+  rtp->batch = malloc (sizeof (omxcam__rtp_batch_t));
+  if (!rtp->batch){
+    omxcam__error ("malloc");
+    omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+    return -1;
+  }
+  ((omxcam__rtp_batch_t*)rtp->batch)->packets = 0;
+  
+  //The capture thread never blocks on the network
+  rtp->fd = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (rtp->fd == -1){
+    omxcam__error ("socket: %s", strerror (errno));
+    free (rtp->batch);
+    omxcam__set_last_error (OMXCAM_ERROR_NETWORK);
+    return -1;
+  }
+  
+  //Bind to an ephemeral port, it's the server_port announced by RTSP
+  struct sockaddr_in address;
+  socklen_t length = sizeof (address);
+  memset (&address, 0, sizeof (address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl (INADDR_ANY);
+  
+  if (bind (rtp->fd, (struct sockaddr*)&address, sizeof (address)) ||
+      getsockname (rtp->fd, (struct sockaddr*)&address, &length)){
+    omxcam__error ("bind: %s", strerror (errno));
+    close (rtp->fd);
+    free (rtp->batch);
+    omxcam__set_last_error (OMXCAM_ERROR_NETWORK);
+    return -1;
+  }
+  rtp->port = ntohs (address.sin_port);
+  
+  if (pthread_mutex_init (&rtp->mutex, 0)){
+    omxcam__error ("pthread_mutex_init");
+    close (rtp->fd);
+    free (rtp->batch);
+    omxcam__set_last_error (OMXCAM_ERROR_NETWORK);
+    return -1;
+  }
+  
+  omxcam_nal_parser_init (&rtp->parser);
+  
+  return 0;
+}
+
+void omxcam_rtp_free (omxcam_rtp_t* rtp){
+  if (pthread_mutex_destroy (&rtp->mutex)){
+    omxcam__error ("pthread_mutex_destroy");
+  }
+  if (rtp->fd != -1 && close (rtp->fd)){
+    omxcam__error ("close: %s", strerror (errno));
+  }
+  omxcam_nal_parser_free (&rtp->parser);
+  free (rtp->batch);
+  memset (rtp, 0, sizeof (omxcam_rtp_t));
+  rtp->fd = -1;
+}
+
+int omxcam_rtp_add_client (
+    omxcam_rtp_t* rtp,
+    const char* address,
+    uint16_t port){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  uint32_t value;
+  if (omxcam__rtp_parse_address (address, port, &value)) return -1;
+  
+  return omxcam__rtp_add_client (rtp, value, port);
+}
+
+int omxcam_rtp_remove_client (
+    omxcam_rtp_t* rtp,
+    const char* address,
+    uint16_t port){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  uint32_t value;
+  if (omxcam__rtp_parse_address (address, port, &value)) return -1;
+  
+  return omxcam__rtp_remove_client (rtp, value, port);
+}
+
+int omxcam_rtp_feed (omxcam_rtp_t* rtp, omxcam_buffer_t buffer){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  //The motion vectors are not part of the h264 stream
+  if (buffer.flags & OMXCAM_BUFFER_MOTION_VECTORS) return 0;
+  
+  if (rtp->mtu < OMXCAM_RTP_MIN_MTU){
+    omxcam__error ("invalid mtu");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  //The parameter sets are sent with the timestamp of the next frame
+  if (!rtp->frame_open && !(buffer.flags & OMXCAM_BUFFER_CODEC_CONFIG)){
+    omxcam__rtp_begin_frame (rtp, &buffer);
+    if (omxcam__rtp_fast_start (rtp)) return -1;
+  }
+  
+  int end_of_frame = !!(buffer.flags & OMXCAM_BUFFER_END_OF_FRAME);
+  omxcam_nal_t nal;
+  int r;
+  
+  if (omxcam_nal_parser_feed (&rtp->parser, buffer)){
+    omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+    return -1;
+  }
+  
+  while ((r = omxcam_nal_parser_next (&rtp->parser, &nal)) == 1){
+    if (nal.type == OMXCAM_NAL_SPS || nal.type == OMXCAM_NAL_PPS){
+      omxcam__rtp_save_parameter_set (rtp, &nal);
+    }
+    
+    //The marker bit is set in the last packet of the access unit
+    int last = rtp->parser.current == rtp->parser.end;
+    if (omxcam__rtp_packetize (rtp, &nal, end_of_frame && last)) return -1;
+    
+    //The NAL units split across buffers point to the parser's internal buffer,
+    //which can be reused by the next call, they are sent right away
+    if (nal.data < buffer.data || nal.data >= buffer.data + buffer.length){
+      if (omxcam__rtp_send (rtp)) return -1;
+    }
+  }
+  
+  if (r == -1){
+    omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+    return -1;
+  }
+  
+  //The buffer is returned to the camera after this call
+  if (omxcam__rtp_send (rtp)) return -1;
+  
+  if (end_of_frame) rtp->frame_open = 0;
+  
+  return 0;
+}
@@ -0,0 +1,533 @@
+#include "omxcam.h"
+#include "internal.h"
+
+#define OMXCAM_RTSP_DEFAULT_ADDRESS "127.0.0.1"
+#define OMXCAM_RTSP_DEFAULT_PORT 8554
+
+//Maximum size of a request, the connection is closed if it's bigger
+#define OMXCAM_RTSP_REQUEST_SIZE 4096
+#define OMXCAM_RTSP_RESPONSE_SIZE 4096
+
+#define OMXCAM_RTSP_PUBLIC "OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, " \
+    "GET_PARAMETER"
+
+typedef struct {
+  int fd;
+  //Address of the client in network byte order
+  uint32_t address;
+  //RTP port of the client, 0 before SETUP
+  uint16_t client_port;
+  int playing;
+  uint32_t session;
+  char request[OMXCAM_RTSP_REQUEST_SIZE];
+  uint32_t length;
+} omxcam__rtsp_connection_t;
+
+static char base64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static char* omxcam__rtsp_base64 (char* p, uint8_t* data, uint32_t length){
+  uint32_t i;
+  
+  for (i=0; i<length; i+=3){
+    uint32_t value = data[i] << 16;
+    if (i + 1 < length) value |= data[i + 1] << 8;
+    if (i + 2 < length) value |= data[i + 2];
+    
+    *p++ = base64[(value >> 18) & 0x3F];
+    *p++ = base64[(value >> 12) & 0x3F];
+    *p++ = i + 1 < length ? base64[(value >> 6) & 0x3F] : '=';
+    *p++ = i + 2 < length ? base64[value & 0x3F] : '=';
+  }
+  
+  *p = 0;
+  return p;
+}
+
+static const char* omxcam__rtsp_header (
+    const char* request,
+    const char* name,
+    char* value,
+    uint32_t size){
+  //Returns the value of the header or 0 if it's not present
+  uint32_t length = strlen (name);
+  const char* line = strstr (request, "\r\n");
+  
+  while (line && line[2] != '\r'){
+    line += 2;
+    if (!strncasecmp (line, name, length) && line[length] == ':'){
+      const char* start = line + length + 1;
+      while (*start == ' ') start++;
+      const char* end = strstr (start, "\r\n");
+      uint32_t n = end - start;
+      if (n >= size) n = size - 1;
+      memcpy (value, start, n);
+      value[n] = 0;
+      return value;
+    }
+    line = strstr (line, "\r\n");
+  }
+  
+  return 0;
+}
+
+static int omxcam__rtsp_write (int fd, char* data, uint32_t length){
+  while (length){
+    ssize_t n = write (fd, data, length);
+    if (n == -1){
+      if (errno == EINTR) continue;
+      omxcam__error ("write: %s", strerror (errno));
+      return -1;
+    }
+    data += n;
+    length -= n;
+  }
+  return 0;
+}
+
+static int omxcam__rtsp_reply (
+    omxcam__rtsp_connection_t* connection,
+    const char* cseq,
+    const char* status,
+    const char* headers,
+    const char* body){
+  char response[OMXCAM_RTSP_RESPONSE_SIZE];
+  int length;
+  
+  if (body){
+    length = snprintf (response, sizeof (response),
+        "RTSP/1.0 %s\r\nCSeq: %s\r\n%sContent-Length: %d\r\n\r\n%s",
+        status, cseq, headers, (int)strlen (body), body);
+  }else{
+    length = snprintf (response, sizeof (response),
+        "RTSP/1.0 %s\r\nCSeq: %s\r\n%s\r\n", status, cseq, headers);
+  }
+  
+  if (length >= (int)sizeof (response)) return -1;
+  
+  return omxcam__rtsp_write (connection->fd, response, length);
+}
+
+static int omxcam__rtsp_describe (
+    omxcam_rtsp_t* rtsp,
+    omxcam__rtsp_connection_t* connection,
+    const char* cseq){
+  uint8_t sps[sizeof (rtsp->rtp->sps)];
+  uint8_t pps[sizeof (rtsp->rtp->pps)];
+  uint32_t sps_length;
+  uint32_t pps_length;
+  char host[INET_ADDRSTRLEN];
+  char fmtp[1024];
+  char headers[256];
+  char sdp[2048];
+  struct sockaddr_in address;
+  socklen_t length = sizeof (address);
+  
+  if (omxcam__rtp_parameter_sets (rtsp->rtp, sps, &sps_length, pps,
+      &pps_length)) return -1;
+  
+  if (getsockname (connection->fd, (struct sockaddr*)&address, &length)){
+    omxcam__error ("getsockname: %s", strerror (errno));
+    return -1;
+  }
+  inet_ntop (AF_INET, &address.sin_addr, host, sizeof (host));
+  
+  //The parameter sets are only known after the first IDR frame, the clients
+  //can also get them from the stream
+  char* p = fmtp + sprintf (fmtp, "packetization-mode=1");
+  if (sps_length >= 4 && pps_length){
+    p += sprintf (p, ";profile-level-id=%02X%02X%02X;sprop-parameter-sets=",
+        sps[1], sps[2], sps[3]);
+    p = omxcam__rtsp_base64 (p, sps, sps_length);
+    *p++ = ',';
+    omxcam__rtsp_base64 (p, pps, pps_length);
+  }
+  
+  snprintf (sdp, sizeof (sdp),
+      "v=0\r\n"
+      "o=- %u 0 IN IP4 %s\r\n"
+      "s=omxcam\r\n"
+      "c=IN IP4 0.0.0.0\r\n"
+      "t=0 0\r\n"
+      "a=control:*\r\n"
+      "m=video 0 RTP/AVP %u\r\n"
+      "a=rtpmap:%u H264/90000\r\n"
+      "a=fmtp:%u %s\r\n"
+      "a=control:track0\r\n",
+      rtsp->rtp->ssrc, host, rtsp->rtp->payload_type,
+      rtsp->rtp->payload_type, rtsp->rtp->payload_type, fmtp);
+  
+  snprintf (headers, sizeof (headers),
+      "Content-Type: application/sdp\r\nContent-Base: rtsp://%s:%u/\r\n",
+      host, rtsp->port);
+  
+  return omxcam__rtsp_reply (connection, cseq, "200 OK", headers, sdp);
+}
+
+static int omxcam__rtsp_setup (
+    omxcam_rtsp_t* rtsp,
+    omxcam__rtsp_connection_t* connection,
+    const char* request,
+    const char* cseq){
+  char transport[256];
+  char headers[512];
+  
+  //Only UDP unicast, the interleaved TCP transport is not supported
+  if (!omxcam__rtsp_header (request, "Transport", transport,
+      sizeof (transport)) || strstr (transport, "RTP/AVP/TCP") ||
+      strstr (transport, "multicast") || !strstr (transport, "client_port=")){
+    return omxcam__rtsp_reply (connection, cseq, "461 Unsupported Transport",
+        "", 0);
+  }
+  
+  unsigned long port = strtoul (strstr (transport, "client_port=") + 12, 0,
+      10);
+  if (!port || port > 65535){
+    return omxcam__rtsp_reply (connection, cseq, "461 Unsupported Transport",
+        "", 0);
+  }
+  
+  //A new SETUP in the same session replaces the destination
+  if (connection->playing){
+    if (omxcam__rtp_remove_client (rtsp->rtp, connection->address,
+        connection->client_port)) return -1;
+    connection->playing = 0;
+  }
+  
+  connection->client_port = port;
+  
+  //There's no RTCP socket, only the RTP port is announced
+  snprintf (headers, sizeof (headers),
+      "Transport: RTP/AVP;unicast;client_port=%u-%u;server_port=%u;"
+      "ssrc=%08X\r\nSession: %08X\r\n",
+      connection->client_port, connection->client_port + 1, rtsp->rtp->port,
+      rtsp->rtp->ssrc, connection->session);
+  
+  return omxcam__rtsp_reply (connection, cseq, "200 OK", headers, 0);
+}
+
+static int omxcam__rtsp_play (
+    omxcam_rtsp_t* rtsp,
+    omxcam__rtsp_connection_t* connection,
+    const char* cseq){
+  char headers[64];
+  
+  if (!connection->client_port){
+    return omxcam__rtsp_reply (connection, cseq,
+        "455 Method Not Valid in This State", "", 0);
+  }
+  
+  if (!connection->playing){
+    if (omxcam__rtp_add_client (rtsp->rtp, connection->address,
+        connection->client_port)){
+      return omxcam__rtsp_reply (connection, cseq, "453 Not Enough Bandwidth",
+          "", 0);
+    }
+    //The packetiser sends the parameter sets before the next frame and calls
+    //'on_client' from the capture thread, which can request an IDR frame
+    connection->playing = 1;
+  }
+  
+  snprintf (headers, sizeof (headers), "Session: %08X\r\nRange: npt=0.000-\r\n",
+      connection->session);
+  
+  return omxcam__rtsp_reply (connection, cseq, "200 OK", headers, 0);
+}
+
+static int omxcam__rtsp_teardown (
+    omxcam_rtsp_t* rtsp,
+    omxcam__rtsp_connection_t* connection,
+    const char* cseq){
+  char headers[32];
+  
+  if (connection->playing){
+    if (omxcam__rtp_remove_client (rtsp->rtp, connection->address,
+        connection->client_port)) return -1;
+    connection->playing = 0;
+  }
+  connection->client_port = 0;
+  
+  snprintf (headers, sizeof (headers), "Session: %08X\r\n",
+      connection->session);
+  
+  return omxcam__rtsp_reply (connection, cseq, "200 OK", headers, 0);
+}
+
+static int omxcam__rtsp_request (
+    omxcam_rtsp_t* rtsp,
+    omxcam__rtsp_connection_t* connection,
+    const char* request){
+  char cseq[16];
+  
+  if (!omxcam__rtsp_header (request, "CSeq", cseq, sizeof (cseq))){
+    strcpy (cseq, "0");
+  }
+  
+  omxcam__trace ("RTSP request: %.*s", (int)strcspn (request, "\r"), request);
+  
+  if (!strncmp (request, "OPTIONS ", 8)){
+    return omxcam__rtsp_reply (connection, cseq, "200 OK",
+        "Public: " OMXCAM_RTSP_PUBLIC "\r\n", 0);
+  }
+  if (!strncmp (request, "DESCRIBE ", 9)){
+    return omxcam__rtsp_describe (rtsp, connection, cseq);
+  }
+  if (!strncmp (request, "SETUP ", 6)){
+    return omxcam__rtsp_setup (rtsp, connection, request, cseq);
+  }
+  if (!strncmp (request, "PLAY ", 5)){
+    return omxcam__rtsp_play (rtsp, connection, cseq);
+  }
+  if (!strncmp (request, "TEARDOWN ", 9)){
+    return omxcam__rtsp_teardown (rtsp, connection, cseq);
+  }
+  if (!strncmp (request, "GET_PARAMETER ", 14)){
+    //Keep-alive
+    return omxcam__rtsp_reply (connection, cseq, "200 OK", "", 0);
+  }
+  
+  return omxcam__rtsp_reply (connection, cseq, "501 Not Implemented", "", 0);
+}
+
+static void omxcam__rtsp_close (
+    omxcam_rtsp_t* rtsp,
+    omxcam__rtsp_connection_t* connection){
+  if (connection->playing){
+    omxcam__rtp_remove_client (rtsp->rtp, connection->address,
+        connection->client_port);
+  }
+  if (close (connection->fd)){
+    omxcam__error ("close: %s", strerror (errno));
+  }
+  connection->fd = -1;
+  connection->playing = 0;
+  connection->client_port = 0;
+  connection->length = 0;
+}
+
+static int omxcam__rtsp_read (
+    omxcam_rtsp_t* rtsp,
+    omxcam__rtsp_connection_t* connection){
+  //Returns -1 if the connection must be closed
+  ssize_t n = read (connection->fd, connection->request + connection->length,
+      OMXCAM_RTSP_REQUEST_SIZE - 1 - connection->length);
+  
+  if (n == -1 && errno == EINTR) return 0;
+  if (n <= 0) return -1;
+  
+  connection->length += n;
+  connection->request[connection->length] = 0;
+  
+  //The requests are processed in order, the clients can pipeline them. The
+  //requests don't have a body
+  char* end;
+  while ((end = strstr (connection->request, "\r\n\r\n"))){
+    end += 4;
+    end[-2] = 0;
+    if (omxcam__rtsp_request (rtsp, connection, connection->request)) return -1;
+    connection->length -= end - connection->request;
+    memmove (connection->request, end, connection->length + 1);
+  }
+  
+  if (connection->length == OMXCAM_RTSP_REQUEST_SIZE - 1){
+    omxcam__error ("RTSP request too big");
+    return -1;
+  }
+  
+  return 0;
+}
+
+static void omxcam__rtsp_accept (omxcam_rtsp_t* rtsp){
+  omxcam__rtsp_connection_t* connections = rtsp->connections;
+  struct sockaddr_in address;
+  socklen_t length = sizeof (address);
+  int i;
+  
+  int fd = accept (rtsp->fd, (struct sockaddr*)&address, &length);
+  if (fd == -1){
+    omxcam__error ("accept: %s", strerror (errno));
+    return;
+  }
+  
+  for (i=0; i<OMXCAM_RTSP_MAX_CONNECTIONS; i++){
+    if (connections[i].fd == -1) break;
+  }
+  
+  if (i == OMXCAM_RTSP_MAX_CONNECTIONS){
+    omxcam__error ("too many RTSP connections");
+    close (fd);
+    return;
+  }
+  
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
+  
+  connections[i].fd = fd;
+  connections[i].address = address.sin_addr.s_addr;
+  connections[i].session = rtsp->rtp->ssrc ^ (uint32_t)(fd << 16 | i);
+  connections[i].length = 0;
+}
+
+static void* omxcam__rtsp_thread (void* arg){
+  omxcam_rtsp_t* rtsp = (omxcam_rtsp_t*)arg;
+  omxcam__rtsp_connection_t* connections = rtsp->connections;
+  struct pollfd fds[2 + OMXCAM_RTSP_MAX_CONNECTIONS];
+  int indexes[OMXCAM_RTSP_MAX_CONNECTIONS];
+  int i;
+  
+  for (;;){
+    int n = 0;
+    
+    fds[n].fd = rtsp->stop_fd;
+    fds[n++].events = POLLIN;
+    fds[n].fd = rtsp->fd;
+    fds[n++].events = POLLIN;
+    
+    for (i=0; i<OMXCAM_RTSP_MAX_CONNECTIONS; i++){
+      if (connections[i].fd == -1) continue;
+      indexes[n - 2] = i;
+      fds[n].fd = connections[i].fd;
+      fds[n++].events = POLLIN;
+    }
+    
+    if (poll (fds, n, -1) == -1){
+      if (errno == EINTR) continue;
+      omxcam__error ("poll: %s", strerror (errno));
+      break;
+    }
+    
+    if (fds[0].revents) break;
+    
+    for (i=2; i<n; i++){
+      if (!fds[i].revents) continue;
+      omxcam__rtsp_connection_t* connection = &connections[indexes[i - 2]];
+      if (omxcam__rtsp_read (rtsp, connection)){
+        omxcam__rtsp_close (rtsp, connection);
+      }
+    }
+    
+    if (fds[1].revents) omxcam__rtsp_accept (rtsp);
+  }
+  
+  for (i=0; i<OMXCAM_RTSP_MAX_CONNECTIONS; i++){
+    if (connections[i].fd != -1) omxcam__rtsp_close (rtsp, &connections[i]);
+  }
+  
+  return (void*)0;
+}
+
+void omxcam_rtsp_init (omxcam_rtsp_t* rtsp){
+  memset (rtsp, 0, sizeof (omxcam_rtsp_t));
+  rtsp->address = OMXCAM_RTSP_DEFAULT_ADDRESS;
+  rtsp->port = OMXCAM_RTSP_DEFAULT_PORT;
+  rtsp->fd = -1;
+  rtsp->stop_fd = -1;
+}
+
+int omxcam_rtsp_start (omxcam_rtsp_t* rtsp, omxcam_rtp_t* rtp){
+  omxcam__trace ("starting the RTSP server on %s:%d", rtsp->address,
+      rtsp->port);
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  struct sockaddr_in address;
+  int i;
+  
+  memset (&address, 0, sizeof (address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons (rtsp->port);
+  
+  if (!rtp || !rtsp->address || !inet_aton (rtsp->address, &address.sin_addr)){
+    omxcam__error ("invalid address");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  rtsp->rtp = rtp;
+  rtsp->connections = malloc (OMXCAM_RTSP_MAX_CONNECTIONS*
+      sizeof (omxcam__rtsp_connection_t));
+  if (!rtsp->connections){
+    omxcam__error ("malloc");
+    omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+    return -1;
+  }
+  
+  omxcam__rtsp_connection_t* connections = rtsp->connections;
+  for (i=0; i<OMXCAM_RTSP_MAX_CONNECTIONS; i++){
+    connections[i].fd = -1;
+    connections[i].playing = 0;
+    connections[i].client_port = 0;
+  }
+  
+  int reuse = 1;
+  
+  rtsp->fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (rtsp->fd == -1 ||
+      setsockopt (rtsp->fd, SOL_SOCKET, SO_REUSEADDR, &reuse,
+          sizeof (reuse)) ||
+      bind (rtsp->fd, (struct sockaddr*)&address, sizeof (address)) ||
+      listen (rtsp->fd, OMXCAM_RTSP_MAX_CONNECTIONS)){
+    omxcam__error ("cannot listen: %s", strerror (errno));
+    if (rtsp->fd != -1) close (rtsp->fd);
+    rtsp->fd = -1;
+    free (rtsp->connections);
+    omxcam__set_last_error (OMXCAM_ERROR_NETWORK);
+    return -1;
+  }
+  
+  rtsp->stop_fd = eventfd (0, EFD_CLOEXEC);
+  if (rtsp->stop_fd == -1){
+    omxcam__error ("eventfd: %s", strerror (errno));
+    close (rtsp->fd);
+    rtsp->fd = -1;
+    free (rtsp->connections);
+    omxcam__set_last_error (OMXCAM_ERROR_NETWORK);
+    return -1;
+  }
+  
+  if (pthread_create (&rtsp->thread, 0, omxcam__rtsp_thread, rtsp)){
+    omxcam__error ("pthread_create");
+    close (rtsp->fd);
+    close (rtsp->stop_fd);
+    rtsp->fd = -1;
+    rtsp->stop_fd = -1;
+    free (rtsp->connections);
+    omxcam__set_last_error (OMXCAM_ERROR_NETWORK);
+    return -1;
+  }
+  
+  return 0;
+}
+
+int omxcam_rtsp_stop (omxcam_rtsp_t* rtsp){
+  omxcam__trace ("stopping the RTSP server");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (rtsp->fd == -1) return 0;
+  
+  int error = 0;
+  
+  if (eventfd_write (rtsp->stop_fd, 1)){
+    omxcam__error ("eventfd_write: %s", strerror (errno));
+    error = 1;
+  }else if (pthread_join (rtsp->thread, 0)){
+    omxcam__error ("pthread_join");
+    error = 1;
+  }
+  
+  //The clients are removed from the packetiser by the thread
+  close (rtsp->fd);
+  close (rtsp->stop_fd);
+  rtsp->fd = -1;
+  rtsp->stop_fd = -1;
+  
+  if (!error) free (rtsp->connections);
+  rtsp->connections = 0;
+  
+  if (error){
+    omxcam__set_last_error (OMXCAM_ERROR_NETWORK);
+    return -1;
+  }
+  
+  return 0;
+}
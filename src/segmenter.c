@@ -0,0 +1,642 @@
+#include "omxcam.h"
+#include "internal.h"
+
+//Records of the queue, an 8-byte header (type and value) plus the data
+#define OMXCAM_SEGMENTER_OPEN 1
+#define OMXCAM_SEGMENTER_DATA 2
+#define OMXCAM_SEGMENTER_CLOSE 3
+#define OMXCAM_SEGMENTER_HEADER 8
+
+#define OMXCAM_SEGMENTER_PATH_LENGTH 256
+
+static void omxcam__segmenter_queue_write (
+    omxcam_segmenter_t* segmenter,
+    uint8_t* data,
+    uint32_t length){
+  uint32_t offset = segmenter->queue_head%segmenter->queue_size;
+  uint32_t n = segmenter->queue_size - offset;
+  
+  if (n >= length){
+    memcpy (segmenter->queue + offset, data, length);
+  }else{
+    memcpy (segmenter->queue + offset, data, n);
+    memcpy (segmenter->queue, data + n, length - n);
+  }
+  
+  segmenter->queue_head += length;
+}
+
+static void omxcam__segmenter_queue_read (
+    omxcam_segmenter_t* segmenter,
+    uint64_t position,
+    uint8_t* data,
+    uint32_t length){
+  uint32_t offset = position%segmenter->queue_size;
+  uint32_t n = segmenter->queue_size - offset;
+  
+  if (n >= length){
+    memcpy (data, segmenter->queue + offset, length);
+  }else{
+    memcpy (data, segmenter->queue + offset, n);
+    memcpy (data + n, segmenter->queue, length - n);
+  }
+}
+
+static void omxcam__segmenter_fail (omxcam_segmenter_t* segmenter){
+  //Executed with the lock held
+  if (!segmenter->error){
+    segmenter->error = 1;
+    omxcam__error ("segmenter failed");
+  }
+}
+
+static int omxcam__segmenter_push (
+    omxcam_segmenter_t* segmenter,
+    uint32_t type,
+    uint32_t value,
+    uint8_t* data,
+    uint32_t length,
+    int wait){
+  if (pthread_mutex_lock (&segmenter->mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return -1;
+  }
+  
+  uint32_t needed = OMXCAM_SEGMENTER_HEADER + length;
+  int full;
+  
+  while ((full = segmenter->queue_size -
+      (segmenter->queue_head - segmenter->queue_tail) < needed) && wait &&
+      needed <= segmenter->queue_size){
+    pthread_cond_wait (&segmenter->cond, &segmenter->mutex);
+  }
+  
+  if (full){
+    //The capture thread never waits for the disk, the data is lost. The
+    //writer discards the segment that should have contained it
+    omxcam__error ("queue full");
+    if (!segmenter->dropped){
+      segmenter->dropped = 1;
+      segmenter->drop_position = segmenter->queue_head;
+    }
+    omxcam__segmenter_fail (segmenter);
+  }else{
+    uint8_t header[OMXCAM_SEGMENTER_HEADER];
+    omxcam__put_u32 (omxcam__put_u32 (header, type), value);
+    omxcam__segmenter_queue_write (segmenter, header, sizeof (header));
+    if (length) omxcam__segmenter_queue_write (segmenter, data, length);
+    pthread_cond_broadcast (&segmenter->cond);
+  }
+  
+  if (pthread_mutex_unlock (&segmenter->mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    return -1;
+  }
+  
+  return full ? -1 : 0;
+}
+
+static void omxcam__segmenter_on_ts (omxcam_buffer_t buffer){
+  //The data is always the chunk of the muxer that is embedded in the segmenter
+  omxcam_segmenter_t* segmenter = (omxcam_segmenter_t*)(buffer.data -
+      offsetof (omxcam_segmenter_t, ts.chunk));
+  
+  segmenter->segment_size += buffer.length;
+  omxcam__segmenter_push (segmenter, OMXCAM_SEGMENTER_DATA, buffer.length,
+      buffer.data, buffer.length, 0);
+}
+
+static int omxcam__segmenter_write_playlist (
+    omxcam_segmenter_t* segmenter,
+    int end){
+  char path[OMXCAM_SEGMENTER_PATH_LENGTH];
+  char tmp[OMXCAM_SEGMENTER_PATH_LENGTH];
+  uint32_t first = 0;
+  uint32_t target = 0;
+  uint32_t i;
+  
+  if (segmenter->playlist_size &&
+      segmenter->segments > segmenter->playlist_size){
+    first = segmenter->segments - segmenter->playlist_size;
+  }
+  for (i=first; i<segmenter->segments; i++){
+    if (segmenter->durations[i] > target) target = segmenter->durations[i];
+  }
+  
+  //The playlist is replaced atomically, the readers never see a partial file
+  snprintf (tmp, sizeof (tmp), "%s.tmp", segmenter->playlist);
+  FILE* file = fopen (tmp, "w");
+  if (!file){
+    omxcam__error ("fopen");
+    return -1;
+  }
+  
+  fprintf (file, "#EXTM3U\n#EXT-X-VERSION:3\n");
+  fprintf (file, "#EXT-X-TARGETDURATION:%d\n", (target + 999)/1000);
+  fprintf (file, "#EXT-X-MEDIA-SEQUENCE:%d\n", first);
+  if (!segmenter->playlist_size){
+    fprintf (file, "#EXT-X-PLAYLIST-TYPE:EVENT\n");
+  }
+  
+  for (i=first; i<segmenter->segments; i++){
+    snprintf (path, sizeof (path), segmenter->path, i);
+    char* name = strrchr (path, '/');
+    fprintf (file, "#EXTINF:%d.%03d,\n%s\n", segmenter->durations[i]/1000,
+        segmenter->durations[i]%1000, name ? name + 1 : path);
+  }
+  
+  if (end) fprintf (file, "#EXT-X-ENDLIST\n");
+  
+  if (fclose (file)){
+    omxcam__error ("fclose");
+    return -1;
+  }
+  
+  if (rename (tmp, segmenter->playlist)){
+    omxcam__error ("rename");
+    return -1;
+  }
+  
+  return 0;
+}
+
+static int omxcam__segmenter_open (
+    omxcam_segmenter_t* segmenter,
+    uint32_t segment){
+  char path[OMXCAM_SEGMENTER_PATH_LENGTH];
+  snprintf (path, sizeof (path), segmenter->path, segment);
+  
+  omxcam__trace ("opening segment '%s'", path);
+  
+  segmenter->fd = open (path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (segmenter->fd == -1){
+    omxcam__error ("open");
+    return -1;
+  }
+  segmenter->written = 0;
+  
+  //Reserve the blocks of the whole segment to avoid the fragmentation and the
+  //allocations while writing. It's not critical if it fails
+  if (segmenter->preallocate &&
+      posix_fallocate (segmenter->fd, 0, segmenter->preallocate)){
+    omxcam__error ("posix_fallocate");
+  }
+  
+  return 0;
+}
+
+static int omxcam__segmenter_write (
+    omxcam_segmenter_t* segmenter,
+    uint64_t position,
+    uint32_t length){
+  //The data is written directly from the queue, the capture thread doesn't
+  //overwrite it until the tail is moved
+  while (length){
+    uint32_t offset = position%segmenter->queue_size;
+    uint32_t n = segmenter->queue_size - offset;
+    if (n > length) n = length;
+    
+    ssize_t r = write (segmenter->fd, segmenter->queue + offset, n);
+    if (r == -1){
+      omxcam__error ("write");
+      return -1;
+    }
+    
+    position += r;
+    length -= r;
+    segmenter->written += r;
+  }
+  
+  return 0;
+}
+
+static void omxcam__segmenter_discard (
+    omxcam_segmenter_t* segmenter,
+    uint32_t segment){
+  //The segment is incomplete, it's removed and never listed in the playlist
+  char path[OMXCAM_SEGMENTER_PATH_LENGTH];
+  snprintf (path, sizeof (path), segmenter->path, segment);
+  
+  omxcam__trace ("discarding segment '%s'", path);
+  
+  if (close (segmenter->fd)){
+    omxcam__error ("close");
+  }
+  segmenter->fd = -1;
+  
+  if (unlink (path)){
+    omxcam__error ("unlink");
+  }
+}
+
+static int omxcam__segmenter_close (
+    omxcam_segmenter_t* segmenter,
+    uint32_t duration){
+  int error = 0;
+  
+  //Release the preallocated blocks that have not been used
+  if (segmenter->preallocate && ftruncate (segmenter->fd,
+      segmenter->written)){
+    omxcam__error ("ftruncate");
+    error = -1;
+  }
+  if (close (segmenter->fd)){
+    omxcam__error ("close");
+    error = -1;
+  }
+  segmenter->fd = -1;
+  
+  if (segmenter->segments == segmenter->segments_size){
+    uint32_t size = segmenter->segments_size ? segmenter->segments_size*2 : 64;
+    uint32_t* durations = realloc (segmenter->durations,
+        size*sizeof (uint32_t));
+    if (!durations){
+      omxcam__error ("realloc");
+      return -1;
+    }
+    segmenter->durations = durations;
+    segmenter->segments_size = size;
+  }
+  segmenter->durations[segmenter->segments++] = duration;
+  
+  if (segmenter->playlist &&
+      omxcam__segmenter_write_playlist (segmenter, 0)){
+    error = -1;
+  }
+  
+  return error;
+}
+
+static void* omxcam__segmenter_thread (void* arg){
+  //The return value is not needed
+  
+  omxcam_segmenter_t* segmenter = (omxcam_segmenter_t*)arg;
+  uint8_t header[OMXCAM_SEGMENTER_HEADER];
+  uint32_t segment = 0;
+  int failed = 0;
+  
+  while (1){
+    if (pthread_mutex_lock (&segmenter->mutex)){
+      omxcam__error ("pthread_mutex_lock");
+      return (void*)0;
+    }
+    
+    while (segmenter->queue_head == segmenter->queue_tail &&
+        !segmenter->stopping){
+      pthread_cond_wait (&segmenter->cond, &segmenter->mutex);
+    }
+    
+    int empty = segmenter->queue_head == segmenter->queue_tail;
+    uint64_t position = segmenter->queue_tail;
+    
+    //The records queued after the lost data are not written
+    int dropped = segmenter->dropped &&
+        position >= segmenter->drop_position;
+    
+    if (!empty){
+      omxcam__segmenter_queue_read (segmenter, position, header,
+          sizeof (header));
+    }
+    
+    if (pthread_mutex_unlock (&segmenter->mutex)){
+      omxcam__error ("pthread_mutex_unlock");
+      return (void*)0;
+    }
+    
+    if (!failed && dropped){
+      failed = 1;
+      if (segmenter->fd != -1) omxcam__segmenter_discard (segmenter, segment);
+    }
+    
+    if (empty) break;
+    
+    uint32_t type = (uint32_t)header[0] << 24 | header[1] << 16 |
+        header[2] << 8 | header[3];
+    uint32_t value = (uint32_t)header[4] << 24 | header[5] << 16 |
+        header[6] << 8 | header[7];
+    uint32_t length = type == OMXCAM_SEGMENTER_DATA ? value : 0;
+    int error = 0;
+    
+    //After an error the queue is drained without writing
+    if (!failed){
+      switch (type){
+        case OMXCAM_SEGMENTER_OPEN:
+          segment = value;
+          error = omxcam__segmenter_open (segmenter, value);
+          break;
+        case OMXCAM_SEGMENTER_DATA:
+          error = omxcam__segmenter_write (segmenter,
+              position + OMXCAM_SEGMENTER_HEADER, length);
+          break;
+        case OMXCAM_SEGMENTER_CLOSE:
+          error = omxcam__segmenter_close (segmenter, value);
+          break;
+      }
+    }
+    
+    if (pthread_mutex_lock (&segmenter->mutex)){
+      omxcam__error ("pthread_mutex_lock");
+      return (void*)0;
+    }
+    
+    segmenter->queue_tail += OMXCAM_SEGMENTER_HEADER + length;
+    if (error){
+      failed = 1;
+      omxcam__segmenter_fail (segmenter);
+    }
+    
+    if (error && segmenter->fd != -1){
+      omxcam__segmenter_discard (segmenter, segment);
+    }
+    pthread_cond_broadcast (&segmenter->cond);
+    
+    if (pthread_mutex_unlock (&segmenter->mutex)){
+      omxcam__error ("pthread_mutex_unlock");
+      return (void*)0;
+    }
+  }
+  
+  if (segmenter->fd != -1 && close (segmenter->fd)){
+    omxcam__error ("close");
+  }
+  
+  if (!failed && segmenter->playlist &&
+      omxcam__segmenter_write_playlist (segmenter, 1)){
+    if (!pthread_mutex_lock (&segmenter->mutex)){
+      omxcam__segmenter_fail (segmenter);
+      pthread_mutex_unlock (&segmenter->mutex);
+    }
+  }
+  
+  return (void*)0;
+}
+
+static int omxcam__segmenter_failed (omxcam_segmenter_t* segmenter){
+  if (pthread_mutex_lock (&segmenter->mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return 1;
+  }
+  
+  int error = segmenter->error;
+  
+  if (pthread_mutex_unlock (&segmenter->mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    return 1;
+  }
+  
+  return error;
+}
+
+static uint32_t omxcam__segmenter_duration (
+    omxcam_segmenter_t* segmenter,
+    int64_t time){
+  return (time - segmenter->segment_start)/1000;
+}
+
+static int omxcam__segmenter_save_config (
+    omxcam_segmenter_t* segmenter,
+    omxcam_buffer_t* buffer){
+  //The SPS and the PPS are usually in different buffers, a group replaces the
+  //previous one
+  if (!segmenter->config_open) segmenter->config_length = 0;
+  
+  if (segmenter->config_length + buffer->length >
+      sizeof (segmenter->config)){
+    omxcam__error ("parameter sets too big");
+    omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+    return -1;
+  }
+  
+  memcpy (segmenter->config + segmenter->config_length, buffer->data,
+      buffer->length);
+  segmenter->config_length += buffer->length;
+  
+  return 0;
+}
+
+static int omxcam__segmenter_parameter_sets (omxcam_segmenter_t* segmenter){
+  omxcam_buffer_t buffer;
+  
+  if (!segmenter->config_length) return 0;
+  
+  buffer.data = segmenter->config;
+  buffer.length = segmenter->config_length;
+  buffer.flags = OMXCAM_BUFFER_CODEC_CONFIG | OMXCAM_BUFFER_END_OF_NAL;
+  buffer.timestamp = -1;
+  
+  return omxcam_ts_feed (&segmenter->ts, buffer);
+}
+
+void omxcam_segmenter_init (omxcam_segmenter_t* segmenter){
+  memset (segmenter, 0, sizeof (omxcam_segmenter_t));
+  segmenter->duration = 6000;
+  segmenter->preallocate = 8388608;
+  segmenter->queue_size = 4194304;
+}
+
+int omxcam_segmenter_start (omxcam_segmenter_t* segmenter){
+  omxcam__trace ("starting segmenter");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (!segmenter->path){
+    omxcam__error ("invalid 'path' value");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  if (!segmenter->duration){
+    omxcam__error ("invalid 'duration' value");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  if (segmenter->queue_size <
+      OMXCAM_TS_PACKET_SIZE*OMXCAM_TS_CHUNK_PACKETS*2){
+    omxcam__error ("invalid 'queue_size' value");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  omxcam_ts_init (&segmenter->ts, omxcam__segmenter_on_ts);
+  segmenter->queue_head = 0;
+  segmenter->queue_tail = 0;
+  segmenter->stopping = 0;
+  segmenter->error = 0;
+  segmenter->dropped = 0;
+  segmenter->drop_position = 0;
+  segmenter->config_length = 0;
+  segmenter->config_open = 0;
+  segmenter->frame_open = 0;
+  segmenter->segment_open = 0;
+  segmenter->segment = 0;
+  segmenter->last_timestamp = -1;
+  segmenter->last_duration = 33333;
+  segmenter->fd = -1;
+  segmenter->durations = 0;
+  segmenter->segments = 0;
+  segmenter->segments_size = 0;
+  
+  segmenter->queue = malloc (segmenter->queue_size);
+  if (!segmenter->queue){
+    omxcam__error ("malloc");
+    omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+    return -1;
+  }
+  
+  if (pthread_mutex_init (&segmenter->mutex, 0)){
+    omxcam__error ("pthread_mutex_init");
+    free (segmenter->queue);
+    omxcam__set_last_error (OMXCAM_ERROR_SEGMENTER);
+    return -1;
+  }
+  
+  if (pthread_cond_init (&segmenter->cond, 0)){
+    omxcam__error ("pthread_cond_init");
+    pthread_mutex_destroy (&segmenter->mutex);
+    free (segmenter->queue);
+    omxcam__set_last_error (OMXCAM_ERROR_SEGMENTER);
+    return -1;
+  }
+  
+  if (pthread_create (&segmenter->thread, 0, omxcam__segmenter_thread,
+      segmenter)){
+    omxcam__error ("pthread_create");
+    pthread_cond_destroy (&segmenter->cond);
+    pthread_mutex_destroy (&segmenter->mutex);
+    free (segmenter->queue);
+    omxcam__set_last_error (OMXCAM_ERROR_SEGMENTER);
+    return -1;
+  }
+  
+  return 0;
+}
+
+int omxcam_segmenter_feed (
+    omxcam_segmenter_t* segmenter,
+    omxcam_buffer_t buffer){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  //The motion vectors are not part of the h264 stream
+  if (buffer.flags & OMXCAM_BUFFER_MOTION_VECTORS) return 0;
+  
+  int config = !!(buffer.flags & OMXCAM_BUFFER_CODEC_CONFIG);
+  
+  if (config && omxcam__segmenter_save_config (segmenter, &buffer)){
+    return -1;
+  }
+  segmenter->config_open = config;
+  
+  if (!config && !segmenter->frame_open){
+    //Beginning of a frame, the time is extrapolated if it's unknown
+    int64_t time = buffer.timestamp;
+    if (time == -1){
+      time = segmenter->last_timestamp == -1
+          ? 0
+          : segmenter->last_timestamp + segmenter->last_duration;
+    }else if (segmenter->last_timestamp != -1 &&
+        time > segmenter->last_timestamp){
+      segmenter->last_duration = time - segmenter->last_timestamp;
+    }
+    segmenter->last_timestamp = time;
+    segmenter->frame_open = 1;
+    
+    if (buffer.flags & OMXCAM_BUFFER_KEYFRAME){
+      //Half a frame of margin, the timestamps are not exact
+      int roll = segmenter->segment_open &&
+          (omxcam__segmenter_duration (segmenter,
+              time + segmenter->last_duration/2) >= segmenter->duration ||
+          (segmenter->max_size &&
+              segmenter->segment_size >= segmenter->max_size));
+      
+      if (roll){
+        omxcam__segmenter_push (segmenter, OMXCAM_SEGMENTER_CLOSE,
+            omxcam__segmenter_duration (segmenter, time), 0, 0, 0);
+        segmenter->segment_open = 0;
+        segmenter->segment++;
+      }
+      
+      if (!segmenter->segment_open){
+        omxcam__segmenter_push (segmenter, OMXCAM_SEGMENTER_OPEN,
+            segmenter->segment, 0, 0, 0);
+        segmenter->segment_open = 1;
+        segmenter->segment_start = time;
+        segmenter->segment_size = 0;
+        
+        //Without 'h264.inline_headers' only the first IDR frame has the
+        //parameter sets, the last ones received are repeated so that a
+        //client can begin with any segment
+        if (!segmenter->ts.config_length &&
+            omxcam__segmenter_parameter_sets (segmenter)){
+          return -1;
+        }
+      }
+    }
+  }
+  
+  //The first segment begins with an IDR frame, the parameter sets are kept by
+  //the muxer until the next frame
+  if (segmenter->segment_open || config){
+    if (omxcam_ts_feed (&segmenter->ts, buffer)) return -1;
+  }
+  
+  if (!config && (buffer.flags & OMXCAM_BUFFER_END_OF_FRAME)){
+    segmenter->frame_open = 0;
+  }
+  
+  if (omxcam__segmenter_failed (segmenter)){
+    omxcam__set_last_error (OMXCAM_ERROR_SEGMENTER);
+    return -1;
+  }
+  
+  return 0;
+}
+
+int omxcam_segmenter_stop (omxcam_segmenter_t* segmenter){
+  omxcam__trace ("stopping segmenter");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  //The incomplete last frame is flushed, the segment ends with a truncated
+  //frame. The disk can be waited now
+  if (segmenter->segment_open){
+    omxcam_ts_flush (&segmenter->ts);
+    omxcam__segmenter_push (segmenter, OMXCAM_SEGMENTER_CLOSE,
+        omxcam__segmenter_duration (segmenter,
+            segmenter->last_timestamp + segmenter->last_duration), 0, 0, 1);
+    segmenter->segment_open = 0;
+  }
+  
+  int error = 0;
+  
+  if (pthread_mutex_lock (&segmenter->mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    error = 1;
+  }else{
+    segmenter->stopping = 1;
+    pthread_cond_broadcast (&segmenter->cond);
+    if (pthread_mutex_unlock (&segmenter->mutex)){
+      omxcam__error ("pthread_mutex_unlock");
+      error = 1;
+    }
+  }
+  
+  if (pthread_join (segmenter->thread, 0)){
+    omxcam__error ("pthread_join");
+    error = 1;
+  }
+  
+  error |= segmenter->error;
+  
+  pthread_cond_destroy (&segmenter->cond);
+  pthread_mutex_destroy (&segmenter->mutex);
+  free (segmenter->queue);
+  free (segmenter->durations);
+  segmenter->queue = 0;
+  segmenter->durations = 0;
+  
+  if (error){
+    omxcam__set_last_error (OMXCAM_ERROR_SEGMENTER);
+    return -1;
+  }
+  
+  return 0;
+}
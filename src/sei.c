@@ -0,0 +1,125 @@
+#include "omxcam.h"
+#include "internal.h"
+
+#define OMXCAM_SEI_USER_DATA_UNREGISTERED 5
+#define OMXCAM_SEI_UUID_SIZE 16
+
+//Start code, NAL unit header and rbsp_trailing_bits. In the worst case the
+//emulation prevention adds one byte every two bytes
+#define OMXCAM_SEI_NAL_SIZE (OMXCAM_H264_SEI_SIZE*3/2 + 16)
+
+//sei_message()s of the next frame, added from any thread
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t messages[OMXCAM_H264_SEI_SIZE];
+static uint32_t messages_length;
+
+//Only used from the thread that fills the buffers
+static uint8_t nal[OMXCAM_SEI_NAL_SIZE];
+
+void omxcam__sei_reset (){
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return;
+  }
+  messages_length = 0;
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+  }
+}
+
+int omxcam__sei_add (uint8_t* uuid, uint8_t* data, uint32_t length){
+  uint32_t size = OMXCAM_SEI_UUID_SIZE + length;
+  //payloadType, payloadSize (0xFF until the last byte) and payload
+  uint32_t needed = 1 + size/255 + 1 + size;
+  int full;
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  full = messages_length + needed > sizeof (messages);
+  
+  if (!full){
+    uint8_t* p = messages + messages_length;
+    *p++ = OMXCAM_SEI_USER_DATA_UNREGISTERED;
+    uint32_t n = size;
+    while (n >= 255){
+      *p++ = 0xFF;
+      n -= 255;
+    }
+    *p++ = n;
+    memcpy (p, uuid, OMXCAM_SEI_UUID_SIZE);
+    p += OMXCAM_SEI_UUID_SIZE;
+    if (length) memcpy (p, data, length);
+    messages_length += needed;
+  }
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  if (full){
+    omxcam__error ("too many SEI messages for the next frame");
+    omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+    return -1;
+  }
+  
+  return 0;
+}
+
+int omxcam__sei_take (omxcam_buffer_t* frame, omxcam_buffer_t* sei){
+  //Critical section, called once per frame
+  uint8_t* p = nal;
+  uint32_t zeros = 0;
+  uint32_t i;
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return 0;
+  }
+  
+  if (messages_length){
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 1;
+    *p++ = OMXCAM_NAL_SEI;
+    
+    //The messages are escaped here and not when they are added because they
+    //can be concatenated, the emulation prevention depends on the previous
+    //bytes
+    for (i=0; i<messages_length; i++){
+      uint8_t byte = messages[i];
+      if (zeros >= 2 && byte <= 3){
+        *p++ = 3;
+        zeros = 0;
+      }
+      *p++ = byte;
+      zeros = byte ? 0 : zeros + 1;
+    }
+    
+    //rbsp_trailing_bits
+    *p++ = 0x80;
+    messages_length = 0;
+  }
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+  }
+  
+  if (p == nal) return 0;
+  
+  //The SEI NAL unit belongs to the frame, the muxers and the recorders need the
+  //keyframe flag in its first buffer
+  sei->data = nal;
+  sei->length = p - nal;
+  sei->flags = OMXCAM_BUFFER_END_OF_NAL |
+      (frame->flags & OMXCAM_BUFFER_KEYFRAME);
+  sei->timestamp = frame->timestamp;
+  
+  return 1;
+}
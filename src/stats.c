@@ -0,0 +1,104 @@
+#include "omxcam.h"
+#include "internal.h"
+
+//Read by the consumer, updated at the end of each frame
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static omxcam_frame_stats_t stats;
+static uint64_t sum;
+static double sum_squares;
+
+//Only used from the thread that fills the buffers
+static uint32_t frame_size;
+static int frame_keyframe;
+
+static uint32_t omxcam__frame_stats_sqrt (uint64_t value){
+  //Integer square root (Newton), libm is not linked
+  if (!value) return 0;
+  uint64_t x = value;
+  uint64_t y = (x + 1)/2;
+  while (y < x){
+    x = y;
+    y = (x + value/x)/2;
+  }
+  return (uint32_t)x;
+}
+
+void omxcam__frame_stats_start (){
+  frame_size = 0;
+  frame_keyframe = 0;
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return;
+  }
+  memset (&stats, 0, sizeof (omxcam_frame_stats_t));
+  sum = 0;
+  sum_squares = 0;
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+  }
+}
+
+void omxcam__frame_stats_update (omxcam_buffer_t* buffer){
+  if (buffer->flags & OMXCAM_BUFFER_CODEC_CONFIG) return;
+  
+  frame_size += buffer->length;
+  if (buffer->flags & OMXCAM_BUFFER_KEYFRAME) frame_keyframe = 1;
+  
+  if (!(buffer->flags & OMXCAM_BUFFER_END_OF_FRAME)) return;
+  
+  uint32_t size = frame_size;
+  int keyframe = frame_keyframe;
+  frame_size = 0;
+  frame_keyframe = 0;
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    return;
+  }
+  
+  if (!stats.frames || size < stats.min) stats.min = size;
+  if (size > stats.max) stats.max = size;
+  stats.last = size;
+  stats.frames++;
+  stats.keyframes += keyframe;
+  sum += size;
+  sum_squares += (double)size*size;
+  
+  double mean = (double)sum/stats.frames;
+  double variance = sum_squares/stats.frames - mean*mean;
+  stats.mean = mean;
+  stats.deviation = variance > 0
+      ? omxcam__frame_stats_sqrt ((uint64_t)variance)
+      : 0;
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+  }
+}
+
+int omxcam_video_get_frame_stats (omxcam_frame_stats_t* frame_stats){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (!omxcam__ctx.state.ready || !omxcam__ctx.h264){
+    omxcam__error ("h264 video is not running");
+    omxcam__set_last_error (OMXCAM_ERROR_CAMERA_UPDATE);
+    return -1;
+  }
+  
+  if (pthread_mutex_lock (&mutex)){
+    omxcam__error ("pthread_mutex_lock");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  *frame_stats = stats;
+  
+  if (pthread_mutex_unlock (&mutex)){
+    omxcam__error ("pthread_mutex_unlock");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
+    return -1;
+  }
+  
+  return 0;
+}
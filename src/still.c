@@ -1,6 +1,9 @@
 #include "omxcam.h"
 #include "internal.h"
 
+static omxcam__component_t* omxcam__still_fill_component;
+static int omxcam__still_end_of_image;
+
 static int omxcam__still_change_state (omxcam__state state, int use_encoder){
   if (omxcam__component_change_state (&omxcam__ctx.camera, state)){
     return -1;
@@ -53,27 +56,9 @@ int omxcam__still_validate (omxcam_still_settings_t* settings){
   return 0;
 }
 
-int omxcam_still_start (omxcam_still_settings_t* settings){
-  omxcam__trace ("starting still capture");
-  
-  omxcam__set_last_error (OMXCAM_ERROR_NONE);
-  
-  if (omxcam__ctx.state.running){
-    omxcam__error ("camera is already running");
-    omxcam__set_last_error (OMXCAM_ERROR_CAMERA_RUNNING);
-    return -1;
-  }
-  
-  if (omxcam__still_validate (settings)){
-    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
-    return -1;
-  }
-  
-  if (omxcam__init ()) return -1;
-  
+int omxcam__still_omx_init (omxcam_still_settings_t* settings){
   int use_encoder;
   OMX_COLOR_FORMATTYPE color_format;
-  omxcam__component_t* fill_component;
   OMX_ERRORTYPE error;
   
   OMX_U32 width_rounded = omxcam_round (settings->camera.width, 32);
@@ -90,31 +75,33 @@ int omxcam_still_start (omxcam_still_settings_t* settings){
       use_encoder = 0;
       color_format = OMX_COLOR_Format24bitRGB888;
       stride = stride*3;
-      fill_component = &omxcam__ctx.camera;
+      omxcam__still_fill_component = &omxcam__ctx.camera;
       break;
     case OMXCAM_FORMAT_RGBA8888:
       use_encoder = 0;
       color_format = OMX_COLOR_Format32bitABGR8888;
       stride = stride*4;
-      fill_component = &omxcam__ctx.camera;
+      omxcam__still_fill_component = &omxcam__ctx.camera;
       break;
     case OMXCAM_FORMAT_YUV420:
       use_encoder = 0;
       color_format = OMX_COLOR_FormatYUV420PackedPlanar;
-      fill_component = &omxcam__ctx.camera;
+      omxcam__still_fill_component = &omxcam__ctx.camera;
       break;
     case OMXCAM_FORMAT_JPEG:
       use_encoder = 1;
       color_format = OMX_COLOR_FormatYUV420PackedPlanar;
       width = settings->camera.width;
       height = settings->camera.height;
-      fill_component = &omxcam__ctx.image_encode;
+      omxcam__still_fill_component = &omxcam__ctx.image_encode;
       break;
     default:
       omxcam__set_last_error (OMXCAM_ERROR_FORMAT);
       return -1;
   }
   
+  omxcam__ctx.use_encoder = use_encoder;
+  
   omxcam__trace ("%dx%d", settings->camera.width, settings->camera.height);
   
   if (omxcam__component_init (&omxcam__ctx.camera)){
@@ -145,8 +132,8 @@ int omxcam_still_start (omxcam_still_settings_t* settings){
   sensor_st.sFrameSize.nPortIndex = OMX_ALL;
   if ((error = OMX_GetParameter (omxcam__ctx.camera.handle,
       OMX_IndexParamCommonSensorMode, &sensor_st))){
-    omxcam__error ("OMX_GetParameter - OMX_IndexParamCommonSensorMode: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_GetParameter - OMX_IndexParamCommonSensorMode", error);
     omxcam__set_last_error (OMXCAM_ERROR_STILL);
     return -1;
   }
@@ -155,8 +142,8 @@ int omxcam_still_start (omxcam_still_settings_t* settings){
   //they are configured with the port definition
   if ((error = OMX_SetParameter (omxcam__ctx.camera.handle,
       OMX_IndexParamCommonSensorMode, &sensor_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamCommonSensorMode: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetParameter - OMX_IndexParamCommonSensorMode", error);
     omxcam__set_last_error (OMXCAM_ERROR_STILL);
     return -1;
   }
@@ -169,8 +156,8 @@ int omxcam_still_start (omxcam_still_settings_t* settings){
   port_st.nPortIndex = 72;
   if ((error = OMX_GetParameter (omxcam__ctx.camera.handle,
       OMX_IndexParamPortDefinition, &port_st))){
-    omxcam__error ("OMX_GetParameter - OMX_IndexParamPortDefinition: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_GetParameter - OMX_IndexParamPortDefinition", error);
     omxcam__set_last_error (OMXCAM_ERROR_STILL);
     return -1;
   }
@@ -182,8 +169,8 @@ int omxcam_still_start (omxcam_still_settings_t* settings){
   port_st.format.image.nStride = stride;
   if ((error = OMX_SetParameter (omxcam__ctx.camera.handle,
       OMX_IndexParamPortDefinition, &port_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamPortDefinition: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetParameter - OMX_IndexParamPortDefinition", error);
     omxcam__set_last_error (error == OMX_ErrorBadParameter
         ? OMXCAM_ERROR_BAD_PARAMETER
         : OMXCAM_ERROR_STILL);
@@ -208,8 +195,8 @@ int omxcam_still_start (omxcam_still_settings_t* settings){
   port_st.format.video.nStride = 640;
   if ((error = OMX_SetParameter (omxcam__ctx.camera.handle,
       OMX_IndexParamPortDefinition, &port_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamPortDefinition: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetParameter - OMX_IndexParamPortDefinition", error);
     omxcam__set_last_error (OMXCAM_ERROR_STILL);
     return -1;
   }
@@ -228,8 +215,8 @@ int omxcam_still_start (omxcam_still_settings_t* settings){
     port_st.nPortIndex = 341;
     if ((error = OMX_GetParameter (omxcam__ctx.image_encode.handle,
         OMX_IndexParamPortDefinition, &port_st))){
-      omxcam__error ("OMX_GetParameter - OMX_IndexParamPortDefinition: %s",
-          omxcam__dump_OMX_ERRORTYPE (error));
+      omxcam__omx_error (&omxcam__ctx.image_encode,
+          "OMX_GetParameter - OMX_IndexParamPortDefinition", error);
       omxcam__set_last_error (OMXCAM_ERROR_STILL);
       return -1;
     }
@@ -240,14 +227,15 @@ int omxcam_still_start (omxcam_still_settings_t* settings){
     port_st.format.image.nStride = stride;
     if ((error = OMX_SetParameter (omxcam__ctx.image_encode.handle,
         OMX_IndexParamPortDefinition, &port_st))){
-      omxcam__error ("OMX_SetParameter - OMX_IndexParamPortDefinition: %s",
-          omxcam__dump_OMX_ERRORTYPE (error));
+      omxcam__omx_error (&omxcam__ctx.image_encode,
+          "OMX_SetParameter - OMX_IndexParamPortDefinition", error);
       omxcam__set_last_error (OMXCAM_ERROR_STILL);
       return -1;
     }
     
     //Configure JPEG settings
-    if (omxcam__jpeg_configure_omx (&settings->jpeg)){
+    if (omxcam__jpeg_configure_omx (&omxcam__ctx.image_encode,
+        &settings->jpeg)){
       omxcam__set_last_error (OMXCAM_ERROR_JPEG);
       return -1;
     }
@@ -258,7 +246,7 @@ int omxcam_still_start (omxcam_still_settings_t* settings){
     
     if ((error = OMX_SetupTunnel (omxcam__ctx.camera.handle, 72,
         omxcam__ctx.image_encode.handle, 340))){
-      omxcam__error ("OMX_SetupTunnel: %s", omxcam__dump_OMX_ERRORTYPE (error));
+      omxcam__omx_error (&omxcam__ctx.camera, "OMX_SetupTunnel", error);
       omxcam__set_last_error (OMXCAM_ERROR_STILL);
       return -1;
     }
@@ -270,7 +258,7 @@ int omxcam_still_start (omxcam_still_settings_t* settings){
   
   if ((error = OMX_SetupTunnel (omxcam__ctx.camera.handle, 70,
       omxcam__ctx.null_sink.handle, 240))){
-    omxcam__error ("OMX_SetupTunnel: %s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera, "OMX_SetupTunnel", error);
     omxcam__set_last_error (OMXCAM_ERROR_STILL);
     return -1;
   }
@@ -356,55 +344,11 @@ int omxcam_still_start (omxcam_still_settings_t* settings){
     return -1;
   }
   
-  //Start consuming the buffers
-  uint32_t end_events =
-      OMXCAM_EVENT_BUFFER_FLAG | OMXCAM_EVENT_FILL_BUFFER_DONE;
-  uint32_t current_events;
-  
-  while (1){
-    //Get the buffer data (a slice of the image)
-    if ((error = OMX_FillThisBuffer (fill_component->handle,
-        omxcam__ctx.output_buffer))){
-      omxcam__error ("OMX_FillThisBuffer: %s",
-          omxcam__dump_OMX_ERRORTYPE (error));
-      omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
-      return -1;
-    }
-    
-    //Wait until it's filled
-    if (omxcam__event_wait (fill_component, OMXCAM_EVENT_FILL_BUFFER_DONE,
-        &current_events, 0)){
-      omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
-      return -1;
-    }
-    
-    //Emit the buffer
-    if (omxcam__ctx.output_buffer->nFilledLen){
-      omxcam_buffer_t buffer;
-      buffer.data = omxcam__ctx.output_buffer->pBuffer;
-      buffer.length = omxcam__ctx.output_buffer->nFilledLen;
-      settings->on_data (buffer);
-    }
-    
-    //When it's the end of the stream, an OMX_EventBufferFlag is emitted in all
-    //the components in use. Then the FillBufferDone function is called in the
-    //last component in the component's chain
-    if (current_events == end_events){
-      //Clear the EOS flags
-      if (omxcam__event_wait (&omxcam__ctx.camera, OMXCAM_EVENT_BUFFER_FLAG,
-          0, 0)){
-        omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
-        return -1;
-      }
-      if (use_encoder &&
-          omxcam__event_wait (&omxcam__ctx.image_encode,
-              OMXCAM_EVENT_BUFFER_FLAG, 0, 0)){
-        omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
-        return -1;
-      }
-      break;
-    }
-  }
+  return 0;
+}
+
+int omxcam__still_omx_deinit (){
+  int use_encoder = omxcam__ctx.use_encoder;
   
   //Reset camera capture port
   if (omxcam__camera_capture_port_reset (72)){
@@ -495,6 +439,88 @@ int omxcam_still_start (omxcam_still_settings_t* settings){
     return -1;
   }
   
+  return 0;
+}
+
+int omxcam__still_read (omxcam_buffer_t* buffer, int* end_of_image){
+  uint32_t end_events =
+      OMXCAM_EVENT_BUFFER_FLAG | OMXCAM_EVENT_FILL_BUFFER_DONE;
+  uint32_t current_events;
+  OMX_ERRORTYPE error;
+  
+  //Get the buffer data (a slice of the image)
+  if ((error = OMX_FillThisBuffer (omxcam__still_fill_component->handle,
+      omxcam__ctx.output_buffer))){
+    omxcam__omx_error (omxcam__still_fill_component, "OMX_FillThisBuffer",
+        error);
+    omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
+    return -1;
+  }
+  
+  //Wait until it's filled
+  if (omxcam__event_wait (omxcam__still_fill_component,
+      OMXCAM_EVENT_FILL_BUFFER_DONE, &current_events, 0)){
+    omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
+    return -1;
+  }
+  
+  omxcam__buffer_wrap (buffer);
+  *end_of_image = 0;
+  
+  //When it's the end of the stream, an OMX_EventBufferFlag is emitted in all
+  //the components in use. Then the FillBufferDone function is called in the
+  //last component in the component's chain
+  if (current_events == end_events){
+    //Clear the EOS flags
+    if (omxcam__event_wait (&omxcam__ctx.camera, OMXCAM_EVENT_BUFFER_FLAG,
+        0, 0)){
+      omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
+      return -1;
+    }
+    if (omxcam__ctx.use_encoder &&
+        omxcam__event_wait (&omxcam__ctx.image_encode,
+            OMXCAM_EVENT_BUFFER_FLAG, 0, 0)){
+      omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
+      return -1;
+    }
+    *end_of_image = 1;
+  }
+  
+  return 0;
+}
+
+int omxcam_still_start (omxcam_still_settings_t* settings){
+  omxcam__trace ("starting still capture");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__ctx.state.running){
+    omxcam__error ("camera is already running");
+    omxcam__set_last_error (OMXCAM_ERROR_CAMERA_RUNNING);
+    return -1;
+  }
+  
+  if (omxcam__still_validate (settings)){
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  if (omxcam__init ()) return -1;
+  
+  if (omxcam__still_omx_init (settings)) return -1;
+  
+  //Start consuming the buffers
+  omxcam_buffer_t buffer;
+  int end_of_image = 0;
+  
+  while (!end_of_image){
+    if (omxcam__still_read (&buffer, &end_of_image)) return -1;
+    
+    //Emit the buffer
+    if (buffer.length) settings->on_data (buffer);
+  }
+  
+  if (omxcam__still_omx_deinit ()) return -1;
   if (omxcam__deinit ()) return -1;
   
   return 0;
@@ -505,7 +531,128 @@ int omxcam_still_stop (){
   
   omxcam__set_last_error (OMXCAM_ERROR_NONE);
   
+  return 0;
+}
+
+int omxcam_still_start_npt (omxcam_still_settings_t* settings){
+  omxcam__trace ("starting still capture (no pthread)");
   
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__ctx.state.running){
+    omxcam__error ("camera is already running");
+    omxcam__set_last_error (OMXCAM_ERROR_CAMERA_RUNNING);
+    return -1;
+  }
+  
+  if (omxcam__still_validate (settings)){
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  omxcam__ctx.no_pthread = 1;
+  omxcam__ctx.state.running = 1;
+  omxcam__ctx.video = 0;
+  omxcam__still_end_of_image = 0;
+  
+  if (omxcam__init ()) return omxcam__exit_npt (-1);
+  if (omxcam__still_omx_init (settings)) return omxcam__exit_npt (-1);
+  
+  omxcam__ctx.state.ready = 1;
   
   return 0;
-}
\ No newline at end of file
+}
+
+static int omxcam__still_check_npt (){
+  if (!omxcam__ctx.state.running){
+    omxcam__error ("camera is not running");
+    omxcam__set_last_error (OMXCAM_ERROR_CAMERA_NOT_RUNNING);
+    return -1;
+  }
+  
+  if (!omxcam__ctx.no_pthread){
+    omxcam__error ("still hasn't been started in 'no pthread' mode");
+    omxcam__set_last_error (OMXCAM_ERROR_NOT_NO_PTHREAD);
+    return -1;
+  }
+  
+  if (omxcam__ctx.video){
+    omxcam__error ("video has been started in 'no pthread' mode");
+    omxcam__set_last_error (OMXCAM_ERROR_STILL_ONLY);
+    return -1;
+  }
+  
+  return 0;
+}
+
+int omxcam_still_stop_npt (){
+  omxcam__trace ("stopping still capture (no pthread)");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  //Don't reset the state if the camera is running in video mode
+  if (omxcam__still_check_npt ()){
+    return omxcam__ctx.video ? -1 : omxcam__exit_npt (-1);
+  }
+  
+  if (omxcam__ctx.state.stopping){
+    omxcam__error ("camera is already being stopped");
+    omxcam__set_last_error (OMXCAM_ERROR_CAMERA_STOPPING);
+    return omxcam__exit_npt (-1);
+  }
+  
+  omxcam__ctx.state.stopping = 1;
+  
+  //The image doesn't need to be fully read, the remaining data is discarded
+  //when the components transition to Idle
+  if (omxcam__still_omx_deinit ()) return omxcam__exit_npt (-1);
+  if (omxcam__deinit ()) return omxcam__exit_npt (-1);
+  
+  return omxcam__exit_npt (0);
+}
+
+int omxcam_still_read_npt (
+    omxcam_buffer_t* buffer,
+    omxcam_bool* end_of_image){
+  omxcam__trace ("reading buffer (no pthread)");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__still_check_npt ()){
+    return omxcam__ctx.video ? -1 : omxcam__exit_npt (-1);
+  }
+  
+  //The camera is configured in one shot mode, there's no more data to fill
+  if (omxcam__still_end_of_image){
+    buffer->data = 0;
+    buffer->length = 0;
+    buffer->flags = 0;
+    buffer->timestamp = -1;
+    if (end_of_image) *end_of_image = OMXCAM_TRUE;
+    return 0;
+  }
+  
+  if (omxcam__still_read (buffer, &omxcam__still_end_of_image)){
+    omxcam__trace ("error while capturing (no pthread)");
+    
+    //The details of the failed OpenMAX IL call are cleared by stop()
+    omxcam_error_details_t details;
+    omxcam_last_error_details (&details);
+    
+    //Ignore the error
+    omxcam_still_stop_npt ();
+    
+    //Save the error after the still deinitialization in order to overwrite
+    //a possible error during this task
+    details.error = OMXCAM_ERROR_CAPTURE;
+    omxcam__set_last_error_details (&details);
+    
+    return -1;
+  }
+  
+  if (end_of_image){
+    *end_of_image = omxcam__still_end_of_image ? OMXCAM_TRUE : OMXCAM_FALSE;
+  }
+  
+  return 0;
+}
@@ -0,0 +1,306 @@
+#include "omxcam.h"
+#include "internal.h"
+
+#define OMXCAM_TS_PAT_PID 0x0000
+#define OMXCAM_TS_PMT_PID 0x1000
+#define OMXCAM_TS_VIDEO_PID 0x0100
+
+//Indexes of the continuity counters
+#define OMXCAM_TS_PAT 0
+#define OMXCAM_TS_PMT 1
+#define OMXCAM_TS_VIDEO 2
+
+//The PTS is ahead of the PCR to give time to the decoder to receive the frame,
+//700ms
+#define OMXCAM_TS_DELAY 63000
+
+//Duration of a frame when it cannot be calculated, 30fps
+#define OMXCAM_TS_DEFAULT_DURATION 3000
+
+//Adaptation field with the PCR: length, flags and PCR
+#define OMXCAM_TS_PCR_SIZE 8
+
+//PTS and PCR are 33-bit counters
+#define OMXCAM_TS_CLOCK_MASK 0x1FFFFFFFFLL
+
+//Access unit delimiter, mandatory in the h264 streams of a MPEG-TS
+static uint8_t aud[] = { 0, 0, 0, 1, 0x09, 0xF0 };
+
+static uint32_t omxcam__ts_crc32 (uint8_t* data, uint32_t length){
+  //CRC-32/MPEG-2, the tables are only written at each IDR frame
+  uint32_t crc = 0xFFFFFFFF;
+  uint32_t i;
+  int bit;
+  
+  for (i=0; i<length; i++){
+    crc ^= (uint32_t)data[i] << 24;
+    for (bit=0; bit<8; bit++){
+      crc = crc & 0x80000000 ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+    }
+  }
+  
+  return crc;
+}
+
+static uint8_t* omxcam__ts_packet (omxcam_ts_t* ts){
+  return ts->chunk + ts->packets*OMXCAM_TS_PACKET_SIZE;
+}
+
+static uint8_t omxcam__ts_continuity (omxcam_ts_t* ts, int counter){
+  uint8_t value = ts->continuity[counter];
+  ts->continuity[counter] = (value + 1) & 0x0F;
+  return value;
+}
+
+static void omxcam__ts_emit (omxcam_ts_t* ts){
+  if (!ts->packets) return;
+  
+  omxcam_buffer_t buffer;
+  buffer.data = ts->chunk;
+  buffer.length = ts->packets*OMXCAM_TS_PACKET_SIZE;
+  buffer.flags = 0;
+  buffer.timestamp = -1;
+  
+  ts->packets = 0;
+  
+  if (ts->on_data) ts->on_data (buffer);
+}
+
+static void omxcam__ts_next_packet (omxcam_ts_t* ts){
+  if (++ts->packets == OMXCAM_TS_CHUNK_PACKETS) omxcam__ts_emit (ts);
+}
+
+static void omxcam__ts_write_section (
+    omxcam_ts_t* ts,
+    uint16_t pid,
+    int counter,
+    uint8_t* section,
+    uint32_t length){
+  uint8_t* p = omxcam__ts_packet (ts);
+  
+  p[0] = 0x47;
+  p[1] = 0x40 | pid >> 8;
+  p[2] = pid;
+  p[3] = 0x10 | omxcam__ts_continuity (ts, counter);
+  //pointer_field
+  p[4] = 0;
+  memcpy (p + 5, section, length);
+  omxcam__put_u32 (p + 5 + length, omxcam__ts_crc32 (section, length));
+  memset (p + 9 + length, 0xFF, OMXCAM_TS_PACKET_SIZE - 9 - length);
+  
+  omxcam__ts_next_packet (ts);
+}
+
+static void omxcam__ts_write_tables (omxcam_ts_t* ts){
+  uint8_t section[32];
+  uint8_t* p;
+  
+  //PAT with a single program
+  p = section;
+  *p++ = 0x00;
+  p = omxcam__put_u16 (p, 0xB000 | 13);
+  //transport_stream_id, version 0, section 0 of 0
+  p = omxcam__put_u16 (p, 1);
+  *p++ = 0xC1;
+  *p++ = 0;
+  *p++ = 0;
+  p = omxcam__put_u16 (p, 1);
+  p = omxcam__put_u16 (p, 0xE000 | OMXCAM_TS_PMT_PID);
+  omxcam__ts_write_section (ts, OMXCAM_TS_PAT_PID, OMXCAM_TS_PAT, section,
+      p - section);
+  
+  //PMT with the h264 stream, which also carries the PCR
+  p = section;
+  *p++ = 0x02;
+  p = omxcam__put_u16 (p, 0xB000 | 18);
+  p = omxcam__put_u16 (p, 1);
+  *p++ = 0xC1;
+  *p++ = 0;
+  *p++ = 0;
+  p = omxcam__put_u16 (p, 0xE000 | OMXCAM_TS_VIDEO_PID);
+  p = omxcam__put_u16 (p, 0xF000);
+  *p++ = 0x1B;
+  p = omxcam__put_u16 (p, 0xE000 | OMXCAM_TS_VIDEO_PID);
+  p = omxcam__put_u16 (p, 0xF000);
+  omxcam__ts_write_section (ts, OMXCAM_TS_PMT_PID, OMXCAM_TS_PMT, section,
+      p - section);
+}
+
+static uint32_t omxcam__ts_header_size (omxcam_ts_t* ts){
+  return ts->packet_pcr == -1 ? 4 : 4 + OMXCAM_TS_PCR_SIZE;
+}
+
+static void omxcam__ts_end_packet (omxcam_ts_t* ts){
+  uint8_t* p = omxcam__ts_packet (ts);
+  uint32_t header = omxcam__ts_header_size (ts);
+  uint32_t stuffing = OMXCAM_TS_PACKET_SIZE - header - ts->payload_length;
+  
+  //The last packet of a frame is filled with the adaptation field
+  if (stuffing){
+    memmove (p + header + stuffing, p + header, ts->payload_length);
+  }
+  
+  p[0] = 0x47;
+  p[1] = (ts->packet_start ? 0x40 : 0) | OMXCAM_TS_VIDEO_PID >> 8;
+  p[2] = OMXCAM_TS_VIDEO_PID & 0xFF;
+  
+  uint32_t adaptation = header - 4 + stuffing;
+  p[3] = (adaptation ? 0x30 : 0x10) |
+      omxcam__ts_continuity (ts, OMXCAM_TS_VIDEO);
+  
+  if (adaptation){
+    p[4] = adaptation - 1;
+    
+    if (adaptation > 1){
+      p[5] = (ts->packet_random_access ? 0x40 : 0) |
+          (ts->packet_pcr != -1 ? 0x10 : 0);
+      uint8_t* field = p + 6;
+      
+      if (ts->packet_pcr != -1){
+        //base (33 bits), reserved (6 bits) and extension (9 bits)
+        field = omxcam__put_u32 (field, ts->packet_pcr >> 1);
+        *field++ = (ts->packet_pcr & 1) << 7 | 0x7E;
+        *field++ = 0;
+      }
+      
+      memset (field, 0xFF, p + header + stuffing - field);
+    }
+  }
+  
+  ts->packet_start = 0;
+  ts->packet_random_access = 0;
+  ts->packet_pcr = -1;
+  ts->payload_length = 0;
+  
+  omxcam__ts_next_packet (ts);
+}
+
+static void omxcam__ts_append (
+    omxcam_ts_t* ts,
+    uint8_t* data,
+    uint32_t length){
+  //Critical section, the data is copied only once, to the chunk
+  
+  while (length){
+    uint32_t header = omxcam__ts_header_size (ts);
+    uint32_t available = OMXCAM_TS_PACKET_SIZE - header - ts->payload_length;
+    uint32_t n = length < available ? length : available;
+    
+    memcpy (omxcam__ts_packet (ts) + header + ts->payload_length, data, n);
+    ts->payload_length += n;
+    data += n;
+    length -= n;
+    
+    if (n == available){
+      omxcam__ts_end_packet (ts);
+      
+      //The capture was stopped from 'on_data', the data has been freed
+      if (ts->stopped) return;
+    }
+  }
+}
+
+static void omxcam__ts_begin_frame (
+    omxcam_ts_t* ts,
+    omxcam_buffer_t* buffer){
+  //The time is extrapolated from the previous frame when it's unknown
+  int64_t time;
+  
+  if (buffer->timestamp == -1){
+    time = ts->last_time == -1 ? 0 : ts->last_time + ts->last_duration;
+  }else{
+    time = buffer->timestamp*9/100;
+    if (ts->last_time != -1 && time > ts->last_time){
+      ts->last_duration = time - ts->last_time;
+    }
+  }
+  ts->last_time = time;
+  
+  int keyframe = !!(buffer->flags & OMXCAM_BUFFER_KEYFRAME);
+  
+  //The decoders can join the stream at any IDR frame
+  if (!ts->tables_written || keyframe){
+    omxcam__ts_write_tables (ts);
+    ts->tables_written = 1;
+  }
+  
+  ts->packet_start = 1;
+  ts->packet_random_access = keyframe;
+  ts->packet_pcr = time & OMXCAM_TS_CLOCK_MASK;
+  
+  //PES header with an unbounded length and the PTS
+  uint64_t pts = (time + OMXCAM_TS_DELAY) & OMXCAM_TS_CLOCK_MASK;
+  uint8_t pes[] = {
+    0, 0, 1, 0xE0,
+    0, 0,
+    0x80, 0x80, 5,
+    0x21 | ((pts >> 29) & 0x0E),
+    pts >> 22,
+    (pts >> 14) | 1,
+    pts >> 7,
+    (pts << 1) | 1
+  };
+  
+  omxcam__ts_append (ts, pes, sizeof (pes));
+  omxcam__ts_append (ts, aud, sizeof (aud));
+  
+  //The parameter sets are sent with the first frame after them
+  omxcam__ts_append (ts, ts->config, ts->config_length);
+  ts->config_length = 0;
+  
+  ts->frame_open = 1;
+}
+
+static void omxcam__ts_end_frame (omxcam_ts_t* ts){
+  if (ts->payload_length) omxcam__ts_end_packet (ts);
+  ts->frame_open = 0;
+  
+  //Don't wait for a full chunk
+  omxcam__ts_emit (ts);
+}
+
+void omxcam_ts_init (
+    omxcam_ts_t* ts,
+    void (*on_data)(omxcam_buffer_t buffer)){
+  memset (ts, 0, sizeof (omxcam_ts_t));
+  ts->on_data = on_data;
+  ts->packet_pcr = -1;
+  ts->last_time = -1;
+  ts->last_duration = OMXCAM_TS_DEFAULT_DURATION;
+}
+
+int omxcam_ts_feed (omxcam_ts_t* ts, omxcam_buffer_t buffer){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  //The motion vectors are not part of the h264 stream
+  if (buffer.flags & OMXCAM_BUFFER_MOTION_VECTORS) return 0;
+  
+  if (buffer.flags & OMXCAM_BUFFER_CODEC_CONFIG){
+    if (ts->config_length + buffer.length > sizeof (ts->config)){
+      omxcam__error ("parameter sets too big");
+      omxcam__set_last_error (OMXCAM_ERROR_MEMORY);
+      return -1;
+    }
+    memcpy (ts->config + ts->config_length, buffer.data, buffer.length);
+    ts->config_length += buffer.length;
+    return 0;
+  }
+  
+  if (!ts->frame_open) omxcam__ts_begin_frame (ts, &buffer);
+  if (ts->stopped) return 0;
+  
+  omxcam__ts_append (ts, buffer.data, buffer.length);
+  if (ts->stopped) return 0;
+  
+  if (buffer.flags & OMXCAM_BUFFER_END_OF_FRAME) omxcam__ts_end_frame (ts);
+  
+  return 0;
+}
+
+int omxcam_ts_flush (omxcam_ts_t* ts){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (ts->frame_open) omxcam__ts_end_frame (ts);
+  
+  return 0;
+}
@@ -37,6 +37,25 @@ void omxcam_yuv_planes_slice (
   planes->length_v = planes->length_u;
 }
 
+uint8_t* omxcam__put_u16 (uint8_t* p, uint16_t value){
+  p[0] = value >> 8;
+  p[1] = value;
+  return p + 2;
+}
+
+uint8_t* omxcam__put_u32 (uint8_t* p, uint32_t value){
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+  return p + 4;
+}
+
+uint8_t* omxcam__put_u64 (uint8_t* p, uint64_t value){
+  p = omxcam__put_u32 (p, value >> 32);
+  return omxcam__put_u32 (p, value);
+}
+
 const char* omxcam__strbool (omxcam_bool value){
   return value ? "true" : "false";
 }
\ No newline at end of file
@@ -4,7 +4,10 @@
 typedef struct {
   void (*on_data)(omxcam_buffer_t buffer);
   void (*on_motion)(omxcam_buffer_t buffer);
+  void (*on_frame)(omxcam_frame_t frame);
   int inline_motion_vectors;
+  int mp4;
+  int ts;
   omxcam__component_t* fill_component;
 } omxcam__thread_arg_t;
 
@@ -13,11 +16,17 @@ static int running = 0;
 static int sleeping = 0;
 static int locked = 0;
 static int bg_error = 0;
+static omxcam_error_details_t bg_error_details;
 static pthread_t bg_thread;
 static pthread_mutex_t mutex;
 static pthread_mutex_t mutex_cond;
 static pthread_cond_t cond;
 static omxcam__thread_arg_t thread_arg;
+static omxcam_mp4_t mp4;
+static omxcam_ts_t ts;
+static omxcam_framer_t framer;
+static omxcam_frame_t npt_frame;
+static int npt_frame_ready;
 
 static int omxcam__video_change_state (omxcam__state state){
   if (omxcam__component_change_state (&omxcam__ctx.camera, state)){
@@ -96,6 +105,9 @@ static int omxcam__omx_init (omxcam_video_settings_t* settings){
       fill_component = &omxcam__ctx.camera;
       break;
     case OMXCAM_FORMAT_H264:
+    case OMXCAM_FORMAT_H264_MP4:
+    case OMXCAM_FORMAT_H264_TS:
+    case OMXCAM_FORMAT_MJPEG:
       omxcam__ctx.use_encoder = 1;
       color_format = OMX_COLOR_FormatYUV420PackedPlanar;
       width = settings->camera.width;
@@ -107,14 +119,49 @@ static int omxcam__omx_init (omxcam_video_settings_t* settings){
       return -1;
   }
   
+  omxcam__ctx.h264 = omxcam__ctx.use_encoder &&
+      settings->format != OMXCAM_FORMAT_MJPEG;
+  
   omxcam__trace ("%dx%d @%dfps", settings->camera.width,
       settings->camera.height, settings->camera.framerate);
   
   thread_arg.on_data = settings->on_data;
   thread_arg.on_motion = settings->on_motion;
   thread_arg.inline_motion_vectors = settings->h264.inline_motion_vectors &&
-      omxcam__ctx.use_encoder;
+      omxcam__ctx.h264;
   thread_arg.fill_component = fill_component;
+  thread_arg.on_frame = omxcam__ctx.h264 ? settings->on_frame : 0;
+  
+  //The memory is not released if the previous capture ended with an error
+  omxcam_framer_free (&framer);
+  omxcam_framer_init (&framer, thread_arg.inline_motion_vectors);
+  framer.on_frame = thread_arg.on_frame;
+  
+  thread_arg.mp4 = settings->format == OMXCAM_FORMAT_H264_MP4;
+  
+  if (thread_arg.mp4){
+    //The memory is not released if the previous capture ended with an error
+    omxcam_mp4_free (&mp4);
+    omxcam_mp4_init (&mp4, 0);
+  }
+  
+  thread_arg.ts = settings->format == OMXCAM_FORMAT_H264_TS;
+  if (thread_arg.ts) omxcam_ts_init (&ts, 0);
+  
+  omxcam__parameter_sets_reset ();
+  omxcam__sei_reset ();
+  
+  omxcam__ctx.measure_latency = settings->h264.measure_latency &&
+      omxcam__ctx.h264;
+  if (omxcam__ctx.measure_latency) omxcam__latency_start ();
+  if (omxcam__ctx.h264) omxcam__frame_stats_start ();
+  
+  omxcam__ctx.rate_control = settings->h264.rate_control.enabled &&
+      omxcam__ctx.h264;
+  if (omxcam__ctx.rate_control){
+    omxcam__rate_control_start (&settings->h264.rate_control,
+        settings->h264.bitrate);
+  }
   
   if (omxcam__component_init (&omxcam__ctx.camera)){
     omxcam__set_last_error (OMXCAM_ERROR_INIT_CAMERA);
@@ -143,8 +190,8 @@ static int omxcam__omx_init (omxcam_video_settings_t* settings){
   port_st.nPortIndex = 71;
   if ((error = OMX_GetParameter (omxcam__ctx.camera.handle,
       OMX_IndexParamPortDefinition, &port_st))){
-    omxcam__error ("OMX_GetParameter - OMX_IndexParamPortDefinition: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_GetParameter - OMX_IndexParamPortDefinition", error);
     omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
     return -1;
   }
@@ -157,8 +204,8 @@ static int omxcam__omx_init (omxcam_video_settings_t* settings){
   port_st.format.video.nStride = stride;
   if ((error = OMX_SetParameter (omxcam__ctx.camera.handle,
       OMX_IndexParamPortDefinition, &port_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamPortDefinition: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetParameter - OMX_IndexParamPortDefinition", error);
     omxcam__set_last_error (error == OMX_ErrorBadParameter
         ? OMXCAM_ERROR_BAD_PARAMETER
         : OMXCAM_ERROR_VIDEO);
@@ -170,8 +217,8 @@ static int omxcam__omx_init (omxcam_video_settings_t* settings){
   port_st.format.video.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
   if ((error = OMX_SetParameter (omxcam__ctx.camera.handle,
       OMX_IndexParamPortDefinition, &port_st))){
-    omxcam__error ("OMX_SetParameter - OMX_IndexParamPortDefinition: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetParameter - OMX_IndexParamPortDefinition", error);
     omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
     return -1;
   }
@@ -186,8 +233,8 @@ static int omxcam__omx_init (omxcam_video_settings_t* settings){
   framerate_st.xEncodeFramerate = port_st.format.video.xFramerate;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigVideoFramerate, &framerate_st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigVideoFramerate: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigVideoFramerate", error);
     omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
     return -1;
   }
@@ -196,8 +243,8 @@ static int omxcam__omx_init (omxcam_video_settings_t* settings){
   framerate_st.nPortIndex = 70;
   if ((error = OMX_SetConfig (omxcam__ctx.camera.handle,
       OMX_IndexConfigVideoFramerate, &framerate_st))){
-    omxcam__error ("OMX_SetConfig - OMX_IndexConfigVideoFramerate: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera,
+        "OMX_SetConfig - OMX_IndexConfigVideoFramerate", error);
     omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
     return -1;
   }
@@ -216,8 +263,8 @@ static int omxcam__omx_init (omxcam_video_settings_t* settings){
     port_st.nPortIndex = 201;
     if ((error = OMX_GetParameter (omxcam__ctx.video_encode.handle,
         OMX_IndexParamPortDefinition, &port_st))){
-      omxcam__error ("OMX_GetParameter - OMX_IndexParamPortDefinition: %s",
-          omxcam__dump_OMX_ERRORTYPE (error));
+      omxcam__omx_error (&omxcam__ctx.video_encode,
+          "OMX_GetParameter - OMX_IndexParamPortDefinition", error);
       omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
       return -1;
     }
@@ -227,21 +274,32 @@ static int omxcam__omx_init (omxcam_video_settings_t* settings){
     port_st.format.video.xFramerate = settings->camera.framerate << 16;
     port_st.format.video.nStride = stride;
     //Despite being configured later, these two fields need to be set now
-    port_st.format.video.nBitrate = settings->h264.qp.enabled
-        ? 0
-        : settings->h264.bitrate;
-    port_st.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
+    if (omxcam__ctx.h264){
+      port_st.format.video.nBitrate = settings->h264.qp.enabled
+          ? 0
+          : settings->h264.bitrate;
+      port_st.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
+    }else{
+      //The quality is fixed, each frame is a complete jpeg image
+      port_st.format.video.nBitrate = 0;
+      port_st.format.video.eCompressionFormat = OMX_VIDEO_CodingMJPEG;
+    }
     if ((error = OMX_SetParameter (omxcam__ctx.video_encode.handle,
         OMX_IndexParamPortDefinition, &port_st))){
-      omxcam__error ("OMX_SetParameter - OMX_IndexParamPortDefinition: %s",
-          omxcam__dump_OMX_ERRORTYPE (error));
+      omxcam__omx_error (&omxcam__ctx.video_encode,
+          "OMX_SetParameter - OMX_IndexParamPortDefinition", error);
       omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
       return -1;
     }
     
-    //Configure H264 settings
-    if (omxcam__h264_configure_omx (&settings->h264)){
-      omxcam__set_last_error (OMXCAM_ERROR_H264);
+    //Configure H264 or MJPEG settings
+    if (omxcam__ctx.h264){
+      if (omxcam__h264_configure_omx (&settings->h264)){
+        omxcam__set_last_error (OMXCAM_ERROR_H264);
+        return -1;
+      }
+    }else if (omxcam__mjpeg_configure_omx (&settings->mjpeg)){
+      omxcam__set_last_error (OMXCAM_ERROR_JPEG);
       return -1;
     }
     
@@ -251,7 +309,7 @@ static int omxcam__omx_init (omxcam_video_settings_t* settings){
     
     if ((error = OMX_SetupTunnel (omxcam__ctx.camera.handle, 71,
         omxcam__ctx.video_encode.handle, 200))){
-      omxcam__error ("OMX_SetupTunnel: %s", omxcam__dump_OMX_ERRORTYPE (error));
+      omxcam__omx_error (&omxcam__ctx.camera, "OMX_SetupTunnel", error);
       omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
       return -1;
     }
@@ -263,7 +321,7 @@ static int omxcam__omx_init (omxcam_video_settings_t* settings){
   
   if ((error = OMX_SetupTunnel (omxcam__ctx.camera.handle, 70,
       omxcam__ctx.null_sink.handle, 240))){
-    omxcam__error ("OMX_SetupTunnel: %s", omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (&omxcam__ctx.camera, "OMX_SetupTunnel", error);
     omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
     return -1;
   }
@@ -458,9 +516,10 @@ static int omxcam__omx_deinit (){
   return 0;
 }
 
-static int omxcam__thread_sleep (uint32_t ms){
-  omxcam__trace ("sleeping for %d ms", ms);
-  
+static int omxcam__thread_block_init (uint32_t ms){
+  //The synchronization variables and the blocking flags are initialized before
+  //the background thread is created and before 'on_ready' is called, so the
+  //video can be stopped from any thread before the main thread is blocked
   if (pthread_mutex_init (&mutex_cond, 0)){
     omxcam__error ("pthread_mutex_init");
     return -1;
@@ -468,9 +527,36 @@ static int omxcam__thread_sleep (uint32_t ms){
   
   if (pthread_cond_init (&cond, 0)){
     omxcam__error ("pthread_cond_init");
+    pthread_mutex_destroy (&mutex_cond);
     return -1;
   }
   
+  if (ms == OMXCAM_CAPTURE_FOREVER){
+    locked = 1;
+  }else{
+    sleeping = 1;
+  }
+  
+  return 0;
+}
+
+static void omxcam__thread_block_deinit (){
+  //The main thread was never blocked, the next video starts from a clean state
+  locked = 0;
+  sleeping = 0;
+  
+  if (pthread_mutex_destroy (&mutex_cond)){
+    omxcam__error ("pthread_mutex_destroy");
+  }
+  
+  if (pthread_cond_destroy (&cond)){
+    omxcam__error ("pthread_cond_destroy");
+  }
+}
+
+static int omxcam__thread_sleep (uint32_t ms){
+  omxcam__trace ("sleeping for %d ms", ms);
+  
   //Lock the main thread for a given time using a timed cond variable
   
   struct timespec time;
@@ -486,7 +572,6 @@ static int omxcam__thread_sleep (uint32_t ms){
     return -1;
   }
   
-  sleeping = 1;
   int error = 0;
   
   //Spurious wakeup guard
@@ -550,23 +635,11 @@ static int omxcam__thread_wake (){
 static int omxcam__thread_lock (){
   omxcam__trace ("locking main thread");
   
-  if (pthread_mutex_init (&mutex_cond, 0)){
-    omxcam__error ("pthread_mutex_init");
-    return -1;
-  }
-  
-  if (pthread_cond_init (&cond, 0)){
-    omxcam__error ("pthread_cond_init");
-    return -1;
-  }
-  
   if (pthread_mutex_lock (&mutex_cond)){
     omxcam__error ("pthread_mutex_lock");
     return -1;
   }
   
-  locked = 1;
-  
   //Spurious wakeup guard
   while (locked){
     if (pthread_cond_wait (&cond, &mutex_cond)){
@@ -622,12 +695,45 @@ static int omxcam__thread_unlock (){
 static void omxcam__thread_handle_error (){
   omxcam__trace ("error while capturing");
   bg_error = -1;
+  
+  //The details of the failed OpenMAX IL call are cleared by stop()
+  omxcam_error_details_t details;
+  omxcam_last_error_details (&details);
+  
   //Ignore the error
   omxcam_video_stop ();
   
   //Save the error after the video deinitialization in order to overwrite
-  //a possible error during this task
-  omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
+  //a possible error during this task. The error state is thread-local, so it
+  //is also saved for the thread that started the video
+  details.error = OMXCAM_ERROR_CAPTURE;
+  omxcam__set_last_error_details (&details);
+  bg_error_details = details;
+}
+
+static int omxcam__video_emit (
+    omxcam__thread_arg_t* arg,
+    void (*on_data)(omxcam_buffer_t),
+    omxcam_buffer_t buffer){
+  if (arg->on_frame && omxcam_framer_feed (&framer, buffer)) return -1;
+  
+  //The video was stopped from 'on_frame', the buffer is no longer valid
+  if (!running_safe) return 0;
+  
+  //The muxers need all the buffers, even if there's no callback
+  if (arg->mp4){
+    mp4.on_data = on_data;
+    return omxcam_mp4_feed (&mp4, buffer);
+  }
+  if (arg->ts){
+    ts.on_data = on_data;
+    return omxcam_ts_feed (&ts, buffer);
+  }
+  
+  //The buffers are filled even if there's no callback
+  if (on_data) on_data (buffer);
+  
+  return 0;
 }
 
 static void* omxcam__video_capture (void* thread_arg){
@@ -635,6 +741,7 @@ static void* omxcam__video_capture (void* thread_arg){
 
   omxcam__thread_arg_t* arg = (omxcam__thread_arg_t*)thread_arg;
   int stop = 0;
+  int frame_open = 0;
   OMX_ERRORTYPE error;
   void (*on_data)(omxcam_buffer_t);
   void (*on_motion)(omxcam_buffer_t);
@@ -664,8 +771,7 @@ static void* omxcam__video_capture (void* thread_arg){
     
     if ((error = OMX_FillThisBuffer (arg->fill_component->handle,
         omxcam__ctx.output_buffer))){
-      omxcam__error ("OMX_FillThisBuffer: %s",
-          omxcam__dump_OMX_ERRORTYPE (error));
+      omxcam__omx_error (arg->fill_component, "OMX_FillThisBuffer", error);
       omxcam__thread_handle_error ();
       return (void*)0;
     }
@@ -680,23 +786,71 @@ static void* omxcam__video_capture (void* thread_arg){
     //Check if it's a motion vector
     if (arg->inline_motion_vectors &&
         (omxcam__ctx.output_buffer->nFlags & OMX_BUFFERFLAG_CODECSIDEINFO)){
-      if (on_motion){
-        omxcam_buffer_t buffer;
-        buffer.data = omxcam__ctx.output_buffer->pBuffer;
-        buffer.length = omxcam__ctx.output_buffer->nFilledLen;
-        on_motion (buffer);
+      omxcam_buffer_t buffer;
+      omxcam__buffer_wrap (&buffer);
+      if (on_motion) on_motion (buffer);
+      if (!running_safe) break;
+      
+      //The frame is emitted when its motion vectors arrive
+      if (arg->on_frame && omxcam_framer_feed (&framer, buffer)){
+        omxcam__thread_handle_error ();
+        return (void*)0;
       }
       continue;
     }
     
-    //The buffers are filled even if there's no callback
-    if (!on_data) continue;
+    if (omxcam__ctx.rate_control){
+      omxcam__rate_control_update (omxcam__ctx.output_buffer->nFilledLen);
+    }
     
-    //Emit the buffer
     omxcam_buffer_t buffer;
-    buffer.data = omxcam__ctx.output_buffer->pBuffer;
-    buffer.length = omxcam__ctx.output_buffer->nFilledLen;
-    on_data (buffer);
+    omxcam__buffer_wrap (&buffer);
+    
+    if (omxcam__ctx.measure_latency) omxcam__latency_update (&buffer);
+    
+    if (omxcam__ctx.h264){
+      omxcam__parameter_sets_update (&buffer);
+      omxcam__frame_stats_update (&buffer);
+      
+      //The SEI NAL unit is emitted before the first buffer of the frame, the
+      //data of the frame is not copied
+      if (!frame_open && !(buffer.flags & OMXCAM_BUFFER_CODEC_CONFIG)){
+        omxcam_buffer_t sei;
+        if (omxcam__sei_take (&buffer, &sei) &&
+            omxcam__video_emit (arg, on_data, sei)){
+          omxcam__thread_handle_error ();
+          return (void*)0;
+        }
+        frame_open = 1;
+        
+        //The video was stopped from a callback, the output buffer has been
+        //freed
+        if (!running_safe) break;
+      }
+      if (buffer.flags & OMXCAM_BUFFER_END_OF_FRAME) frame_open = 0;
+    }
+    
+    //Emit the buffer
+    if (omxcam__video_emit (arg, on_data, buffer)){
+      omxcam__thread_handle_error ();
+      return (void*)0;
+    }
+  }
+  
+  if (arg->mp4){
+    //The last fragment
+    if (omxcam_mp4_flush (&mp4)){
+      omxcam__error ("cannot flush the mp4 muxer");
+    }
+    omxcam_mp4_free (&mp4);
+  }
+  
+  //The last frame
+  if (arg->ts) omxcam_ts_flush (&ts);
+  
+  if (arg->on_frame){
+    omxcam_framer_flush (&framer);
+    omxcam_framer_free (&framer);
   }
   
   omxcam__trace ("exit thread");
@@ -708,17 +862,20 @@ void omxcam_video_init (omxcam_video_settings_t* settings){
   omxcam__camera_init (&settings->camera, OMXCAM_VIDEO_MAX_WIDTH,
       OMXCAM_VIDEO_MAX_HEIGHT);
   omxcam__h264_init (&settings->h264);
+  omxcam__mjpeg_init (&settings->mjpeg);
   settings->format = OMXCAM_FORMAT_H264;
   settings->camera_id = 0;
   settings->on_ready = 0;
   settings->on_data = 0;
   settings->on_motion = 0;
   settings->on_stop = 0;
+  settings->on_frame = 0;
 }
 
 int omxcam__video_validate (omxcam_video_settings_t* settings){
   if (omxcam__camera_validate (&settings->camera, 1)) return -1;
   if (omxcam__h264_validate (&settings->h264)) return -1;
+  if (omxcam__mjpeg_validate (&settings->mjpeg)) return -1;
   return 0;
 }
 
@@ -763,8 +920,16 @@ int omxcam_video_start (
     return omxcam__exit (-1);
   }
   
+  if (omxcam__thread_block_init (ms)){
+    omxcam__set_last_error (ms == OMXCAM_CAPTURE_FOREVER
+        ? OMXCAM_ERROR_LOCK
+        : OMXCAM_ERROR_SLEEP);
+    return omxcam__exit (-1);
+  }
+  
   if (pthread_create (&bg_thread, 0, omxcam__video_capture, &thread_arg)){
     omxcam__error ("pthread_create");
+    omxcam__thread_block_deinit ();
     omxcam__set_last_error (OMXCAM_ERROR_VIDEO);
     return omxcam__exit (-1);
   }
@@ -803,6 +968,9 @@ int omxcam_video_start (
       return omxcam__exit (-1);
     }
     
+    //Report the error of the background thread to the current thread
+    omxcam__set_last_error_details (&bg_error_details);
+    
     return omxcam__exit (error);
   }
   
@@ -839,6 +1007,13 @@ int omxcam_video_stop (){
     return -1;
   }
   
+  //The camera can be busy with a still capture, e.g. a bracketing burst
+  if (!omxcam__ctx.video){
+    omxcam__error (omxcam_strerror (OMXCAM_ERROR_VIDEO_ONLY));
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO_ONLY);
+    return -1;
+  }
+  
   if (omxcam__ctx.state.stopping){
     omxcam__error ("camera is already being stopped");
     omxcam__set_last_error (OMXCAM_ERROR_CAMERA_STOPPING);
@@ -860,6 +1035,11 @@ int omxcam_video_stop (){
     //This var is used to prevent from calling mutex_lock() after
     //mutex_destroy()
     running_safe = 0;
+    
+    //The framer and the muxers stop reading the buffer that is being freed
+    framer.stopped = 1;
+    mp4.stopped = 1;
+    ts.stopped = 1;
   }else{
     //Main thread
     //This case also applies when the video is stopped from another random
@@ -1256,6 +1436,144 @@ int omxcam_video_update_frame_stabilisation (
   return 0;
 }
 
+static int omxcam__video_check_h264_update (){
+  if (omxcam__video_check_update ()) return -1;
+  
+  if (!omxcam__ctx.h264){
+    omxcam__error ("video is not being encoded with h264");
+    omxcam__set_last_error (OMXCAM_ERROR_FORMAT);
+    return -1;
+  }
+  
+  return 0;
+}
+
+int omxcam_video_update_h264_bitrate (uint32_t bitrate){
+  omxcam__trace ("updating 'h264.bitrate': %d", bitrate);
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__video_check_h264_update ()) return -1;
+  
+  if (!omxcam__h264_is_valid_bitrate (bitrate)){
+    omxcam__error ("invalid 'h264.bitrate' value");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  if (omxcam__h264_set_bitrate (bitrate)){
+    omxcam__set_last_error (OMXCAM_ERROR_H264);
+    return -1;
+  }
+  
+  return 0;
+}
+
+int omxcam_video_update_h264_idr_period (uint32_t idr_period){
+  omxcam__trace ("updating 'h264.idr_period': %d", idr_period);
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__video_check_h264_update ()) return -1;
+  
+  if (!omxcam__h264_is_valid_idr_period (idr_period)){
+    omxcam__error ("invalid 'h264.idr_period' value");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  if (omxcam__h264_set_idr_period (idr_period)){
+    omxcam__set_last_error (OMXCAM_ERROR_H264);
+    return -1;
+  }
+  
+  return 0;
+}
+
+int omxcam_video_request_h264_idr (){
+  omxcam__trace ("requesting h264 IDR frame");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__video_check_h264_update ()) return -1;
+  
+  if (omxcam__h264_request_idr ()){
+    omxcam__set_last_error (OMXCAM_ERROR_H264);
+    return -1;
+  }
+  
+  return 0;
+}
+
+int omxcam_video_get_h264_parameter_sets (uint8_t* data, uint32_t* length){
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (!data || !length){
+    omxcam__error ("invalid parameters");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  return omxcam__parameter_sets_get (data, length);
+}
+
+int omxcam_video_add_h264_consumer (void (*on_data)(omxcam_buffer_t buffer)){
+  omxcam__trace ("adding h264 consumer");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__video_check_h264_update ()) return -1;
+  
+  uint8_t data[OMXCAM_H264_PARAMETER_SETS_SIZE];
+  uint32_t length;
+  
+  if (omxcam__parameter_sets_get (data, &length)) return -1;
+  
+  //Without the parameter sets the consumer waits for the next IDR frame that
+  //includes them ('h264.inline_headers')
+  if (length && on_data){
+    omxcam_buffer_t buffer;
+    buffer.data = data;
+    buffer.length = length;
+    buffer.flags = OMXCAM_BUFFER_CODEC_CONFIG | OMXCAM_BUFFER_END_OF_NAL;
+    buffer.timestamp = -1;
+    on_data (buffer);
+  }
+  
+  if (omxcam__h264_request_idr ()){
+    omxcam__set_last_error (OMXCAM_ERROR_H264);
+    return -1;
+  }
+  
+  return 0;
+}
+
+int omxcam_video_add_h264_sei (
+    uint8_t* uuid,
+    uint8_t* data,
+    uint32_t length){
+  omxcam__trace ("adding h264 SEI message (%d bytes)", length);
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  if (omxcam__video_check_h264_update ()) return -1;
+  
+  //The buffers are returned to the caller one by one
+  if (omxcam__ctx.no_pthread){
+    omxcam__error ("SEI messages are not supported in 'no pthread' mode");
+    omxcam__set_last_error (OMXCAM_ERROR_NO_PTHREAD);
+    return -1;
+  }
+  
+  if (!uuid || (length && !data) || length > OMXCAM_H264_SEI_SIZE){
+    omxcam__error ("invalid SEI message");
+    omxcam__set_last_error (OMXCAM_ERROR_BAD_PARAMETER);
+    return -1;
+  }
+  
+  return omxcam__sei_add (uuid, data, length);
+}
+
 int omxcam_video_start_npt (omxcam_video_settings_t* settings){
   omxcam__trace ("starting video capture (no pthread)");
   
@@ -1272,6 +1590,14 @@ int omxcam_video_start_npt (omxcam_video_settings_t* settings){
     return -1;
   }
   
+  //The buffers can be muxed with omxcam_mp4_feed() and omxcam_ts_feed()
+  if (settings->format == OMXCAM_FORMAT_H264_MP4 ||
+      settings->format == OMXCAM_FORMAT_H264_TS){
+    omxcam__error ("muxed formats are not supported in 'no pthread' mode");
+    omxcam__set_last_error (OMXCAM_ERROR_FORMAT);
+    return -1;
+  }
+  
   omxcam__ctx.no_pthread = 1;
   omxcam__ctx.state.running = 1;
   omxcam__ctx.video = 1;
@@ -1280,7 +1606,7 @@ int omxcam_video_start_npt (omxcam_video_settings_t* settings){
   if (omxcam__omx_init (settings)) return omxcam__exit_npt (-1);
   
   omxcam__ctx.inline_motion_vectors = settings->h264.inline_motion_vectors &&
-      omxcam__ctx.use_encoder;
+      omxcam__ctx.h264;
   
   omxcam__ctx.state.ready = 1;
   
@@ -1304,6 +1630,12 @@ int omxcam_video_stop_npt (){
     return omxcam__exit_npt (-1);
   }
   
+  if (!omxcam__ctx.video){
+    omxcam__error ("still has been started in 'no pthread' mode");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO_ONLY);
+    return -1;
+  }
+  
   if (omxcam__ctx.state.stopping){
     omxcam__error ("camera is already being stopped");
     omxcam__set_last_error (OMXCAM_ERROR_CAMERA_STOPPING);
@@ -1312,6 +1644,8 @@ int omxcam_video_stop_npt (){
   
   omxcam__ctx.state.stopping = 1;
   
+  omxcam_framer_free (&framer);
+  
   if (omxcam__omx_deinit ()) return omxcam__exit_npt (-1);
   if (omxcam__deinit ()) return omxcam__exit_npt (-1);
   
@@ -1321,12 +1655,17 @@ int omxcam_video_stop_npt (){
 static void omxcam__handle_error_npt (){
   omxcam__trace ("error while capturing (no pthread)");
   
+  //The details of the failed OpenMAX IL call are cleared by stop()
+  omxcam_error_details_t details;
+  omxcam_last_error_details (&details);
+  
   //Ignore the error
   omxcam_video_stop_npt ();
   
   //Save the error after the video deinitialization in order to overwrite
   //a possible error during this task
-  omxcam__set_last_error (OMXCAM_ERROR_CAPTURE);
+  details.error = OMXCAM_ERROR_CAPTURE;
+  omxcam__set_last_error_details (&details);
 }
 
 int omxcam_video_read_npt (
@@ -1350,12 +1689,17 @@ int omxcam_video_read_npt (
     return omxcam__exit_npt (-1);
   }
   
+  if (!omxcam__ctx.video){
+    omxcam__error ("still has been started in 'no pthread' mode");
+    omxcam__set_last_error (OMXCAM_ERROR_VIDEO_ONLY);
+    return -1;
+  }
+  
   OMX_ERRORTYPE error;
 
   if ((error = OMX_FillThisBuffer (thread_arg.fill_component->handle,
       omxcam__ctx.output_buffer))){
-    omxcam__error ("OMX_FillThisBuffer: %s",
-        omxcam__dump_OMX_ERRORTYPE (error));
+    omxcam__omx_error (thread_arg.fill_component, "OMX_FillThisBuffer", error);
     omxcam__handle_error_npt ();
     return omxcam__exit_npt (-1);
   }
@@ -1377,8 +1721,52 @@ int omxcam_video_read_npt (
     }
   }
   
-  buffer->data = omxcam__ctx.output_buffer->pBuffer;
-  buffer->length = omxcam__ctx.output_buffer->nFilledLen;
+  omxcam__buffer_wrap (buffer);
+  
+  if (!(omxcam__ctx.inline_motion_vectors &&
+      (omxcam__ctx.output_buffer->nFlags & OMX_BUFFERFLAG_CODECSIDEINFO))){
+    if (omxcam__ctx.rate_control){
+      omxcam__rate_control_update (buffer->length);
+    }
+    if (omxcam__ctx.h264){
+      omxcam__parameter_sets_update (buffer);
+      omxcam__frame_stats_update (buffer);
+    }
+    if (omxcam__ctx.measure_latency) omxcam__latency_update (buffer);
+  }
+  
+  return 0;
+}
+
+static void omxcam__video_frame_npt (omxcam_frame_t frame){
+  npt_frame = frame;
+  npt_frame_ready = 1;
+}
+
+int omxcam_video_read_frame_npt (omxcam_frame_t* frame){
+  omxcam__trace ("reading frame (no pthread)");
+  
+  omxcam__set_last_error (OMXCAM_ERROR_NONE);
+  
+  //The state is checked by omxcam_video_read_npt()
+  if (omxcam__ctx.state.running && !omxcam__ctx.h264){
+    omxcam__error ("frames are only available with the h264 format");
+    omxcam__set_last_error (OMXCAM_ERROR_FORMAT);
+    return -1;
+  }
+  
+  omxcam_buffer_t buffer;
+  framer.on_frame = omxcam__video_frame_npt;
+  npt_frame_ready = 0;
+  
+  //The buffers are read until a frame is complete, the last one can be the
+  //motion vectors or the first buffer of the next frame
+  while (!npt_frame_ready){
+    if (omxcam_video_read_npt (&buffer, 0)) return -1;
+    if (omxcam_framer_feed (&framer, buffer)) return -1;
+  }
+  
+  *frame = npt_frame;
   
   return 0;
-}
\ No newline at end of file
+}